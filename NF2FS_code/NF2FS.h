@@ -121,6 +121,25 @@ typedef uint32_t NF2FS_hash_t;
 #define NF2FS_WL_MIGRATE_THRESHOLD (2 * NF2FS_RAM_REGION_NUM * 50)
 #endif
 
+/**
+ * The number of sectors copied in a step of region migration.
+ * Migration goes on step by step when allocating sectors, so
+ * a single operation only waits for a few sectors.
+ */
+#ifndef NF2FS_WL_STEP_SECTORS
+#define NF2FS_WL_STEP_SECTORS 1
+#endif
+
+/**
+ * Copying a sector costs about an erase, so a step is done by allocs that
+ * erase nothing. A step is forced after NF2FS_WL_STEP_DEFER allocs that
+ * erase, migration still ends if every alloc erases. An operation then
+ * waits for at most an erase and a sector copy more than without wl.
+ */
+#ifndef NF2FS_WL_STEP_DEFER
+#define NF2FS_WL_STEP_DEFER 4
+#endif
+
 /**
  * The max number of file we could open at a time in ram.
  */
@@ -150,6 +169,51 @@ typedef uint32_t NF2FS_hash_t;
 #define NF2FS_ENTRY_NAME_LEN 12
 #endif
 
+/**
+ * The number of bits in the name filter of an opened dir, should be a multiple of 32.
+ * A name not in the filter is not in the dir, so creating it does not read the dir.
+ * 0 compiles the filter out, then every name lookup reads the dir.
+ */
+#ifndef NF2FS_DIR_FILTER_BITS
+#define NF2FS_DIR_FILTER_BITS 512
+#endif
+
+/**
+ * The most names with the same hash that are compared through a name footer,
+ * the sector is parsed if there are more.
+ */
+#ifndef NF2FS_FOOTER_CANDIDATES
+#define NF2FS_FOOTER_CANDIDATES 4
+#endif
+
+/**
+ * The most file sizes and names kept by the cursor of readdir-plus while it waits for
+ * names or data in other sectors, a file not kept is looked up by another traversal.
+ * Data of the sector being listed is read again each time NF2FS_CURSOR_PENDS files wait.
+ */
+#ifndef NF2FS_CURSOR_SIZES
+#define NF2FS_CURSOR_SIZES 16
+#endif
+
+#ifndef NF2FS_CURSOR_PENDS
+#define NF2FS_CURSOR_PENDS 16
+#endif
+
+/**
+ * The bits marking files named in the sector being listed, it should be a multiple of 32.
+ */
+#ifndef NF2FS_CURSOR_BITS
+#define NF2FS_CURSOR_BITS 1024
+#endif
+
+/**
+ * The number of oldest sectors of a dir compacted by a dir gc step,
+ * so the time of a step does not depend on the size of dir.
+ */
+#ifndef NF2FS_DIR_GC_SECTORS
+#define NF2FS_DIR_GC_SECTORS 2
+#endif
+
 #ifndef NF2FS_DHEAD_WRITTEN_SET
 #define NF2FS_DHEAD_WRITTEN_SET 0xbfffffff
 #define NF2FS_DHEAD_DELETE_SET 0xfffe0fff
@@ -157,6 +221,16 @@ typedef uint32_t NF2FS_hash_t;
 #define NF2FS_SHEAD_USING_SET 0x8fffffff
 #endif
 
+// Bits of data head covered by the crc of a seal, type and flags may change after proged.
+#ifndef NF2FS_DHEAD_SEAL_MASK
+#define NF2FS_DHEAD_SEAL_MASK 0x3ffe0fff
+#endif
+
+// Cleared in the head of the oldest dir sector after older ones are compacted, its pre_sector is stale then.
+#ifndef NF2FS_SHEAD_CUT_SET
+#define NF2FS_SHEAD_CUT_SET 0xff7fffff
+#endif
+
 #ifndef NF2FS_FILE_SIZE_THRESHOLD
 #define NF2FS_FILE_SIZE_THRESHOLD 64
 #endif
@@ -170,6 +244,71 @@ typedef uint32_t NF2FS_hash_t;
 #define NF2FS_NORMAL_CACHE_SIZE 256
 #endif
 
+/**
+ * The default number of slots in the read cache pool, each slot buffers
+ * cache_size bytes of a sector. At most NF2FS_RCACHE_SLOT_NUM - 2 slots can
+ * be pinned for dir tail sectors, so it should not be smaller than 2.
+ */
+#ifndef NF2FS_RCACHE_SLOT_NUM
+#define NF2FS_RCACHE_SLOT_NUM 4
+#endif
+
+/**
+ * The number of write-combining prog caches parked beside the pcache.
+ * Dir tails written in turn keep their own buffer, so they get full-page progs.
+ */
+#ifndef NF2FS_PCACHE_POOL_NUM
+#define NF2FS_PCACHE_POOL_NUM 2
+#endif
+
+/**
+ * The max number of segments collected in one vectored read/prog request.
+ * A full batch is sent to the device before more segments are added.
+ */
+#ifndef NF2FS_IOV_MAX
+#define NF2FS_IOV_MAX 8
+#endif
+
+/**
+ * The number of pre-erased sectors NF2FS_fs_idle keeps ahead of the
+ * dir and big file allocation cursors.
+ */
+#ifndef NF2FS_PREERASE_POOL_NUM
+#define NF2FS_PREERASE_POOL_NUM 4
+#endif
+
+/**
+ * The longest free run of a region is unknown, the region should be read to know it.
+ * Runs recorded in commit message are at most 0xff, a larger one is also unknown.
+ */
+#ifndef NF2FS_REGION_RUN_UNKNOWN
+#define NF2FS_REGION_RUN_UNKNOWN 0xffff
+#define NF2FS_REGION_RUN_FLASH_MAX 0xff
+#endif
+
+/**
+ * When dir or big file regions are used up, regions of the other type are taken.
+ * The other type keeps at least NF2FS_REGION_KEEP_MIN regions.
+ */
+#ifndef NF2FS_REGION_KEEP_MIN
+#define NF2FS_REGION_KEEP_MIN 2
+#endif
+
+/**
+ * A big file is hot after NF2FS_HOT_REWRITES random writes since mount, its new
+ * sectors are taken from the hot big file region, so they are not mixed with cold data.
+ * A dir is hot after NF2FS_HOT_REWRITES records of its files are rewritten, its new
+ * tails are taken from the hot dir region, and dir gc moves live records to cold ones.
+ * Counts of the last NF2FS_HEAT_NUM rewritten files are kept, so they survive close.
+ */
+#ifndef NF2FS_HOT_REWRITES
+#define NF2FS_HOT_REWRITES 4
+#endif
+
+#ifndef NF2FS_HEAT_NUM
+#define NF2FS_HEAT_NUM 8
+#endif
+
 // Used for big file GC
 #ifndef NF2FS_FILE_INDEX_NUM
 #define NF2FS_FILE_INDEX_NUM 20
@@ -344,6 +483,23 @@ enum NF2FS_sector_type
 
     // Only a in-ram flag for reserve region.
     NF2FS_SECTOR_META= 0xa,
+
+    // Only a in-ram flag for the region of hot big files, its sectors are NF2FS_SECTOR_BFILE.
+    NF2FS_SECTOR_HOT_BFILE= 0xb,
+
+    // Only a in-ram flag for the region of hot dirs, its sectors are NF2FS_SECTOR_DIR.
+    NF2FS_SECTOR_HOT_DIR= 0xc,
+};
+
+/**
+ * Flags when opening a file, they are hints of how often the file is rewritten.
+ * Without them, the temperature comes from random writes of the file.
+ * High bits are used, so they can be passed with O_RDWR, O_CREAT and so on.
+ */
+enum NF2FS_open_flags
+{
+    NF2FS_O_HOT= 0x10000000,
+    NF2FS_O_COLD= 0x20000000,
 };
 
 /**
@@ -386,6 +542,15 @@ enum NF2FS_sector_type
  *      14)NF2FS_DATA_MOUNT_MESSAGE:Stored message like where in sector(id) map we are scaning now.
  *      15)NF2FS_DATA_MAGIC:        Tell us whether or not corrupt happens. When mount, the data behind
  *                                   turned to 0; When umount, write a new one.
+ *      16)NF2FS_DATA_SEAL:         In the front of a batch of records in dir sector, the crc of the
+ *                                   batch tells us whether it's writen without corrupt.
+ *      17)NF2FS_DATA_WL_REGIONS:   Candidate regions with less etimes for dir and big file, in wl sector.
+ *      18)NF2FS_DATA_WL_REMAP:     Where the migrated regions are in nor flash, in wl sector.
+ *      19)NF2FS_DATA_WL_PLAN:      Pairs of regions that are going to be migrated, in wl sector.
+ *      20)NF2FS_DATA_WL_MOVE:      How far the migration in plan goes, in wl sector.
+ *      21)NF2FS_DATA_REGION_ETIMES:Erase times of a range of physical regions, in superblock.
+ *      22)NF2FS_DATA_ID_LEASE:     Ids of a word of id map leased before they are named, in superblock.
+ *      23)NF2FS_DATA_NAME_FOOTER:  Hashes and offsets of names in a sealed dir sector, at the end of it.
  *
  *  5. Length(10 bits):    Length of data behind, 0x3ff is not used and sometimes means something.
  */
@@ -399,6 +564,8 @@ enum NF2FS_data_type
     NF2FS_DATA_SUPER_MESSAGE= 0X1e,
     NF2FS_DATA_COMMIT= 0X1d,
     NF2FS_DATA_MAGIC= 0X1c,
+    NF2FS_DATA_SEAL= 0X1b,
+    NF2FS_DATA_REGION_ETIMES= 0x1a,
 
     NF2FS_DATA_SECTOR_MAP= 0x19,
     NF2FS_DATA_ID_MAP= 0x18,
@@ -409,12 +576,23 @@ enum NF2FS_data_type
     // New DIR/FILE NAME is used to free id when crash occurs at a new creation.
     NF2FS_DATA_NDIR_NAME= 0x14,
     NF2FS_DATA_NFILE_NAME= 0x13,
+
+    // Records in wl sector.
+    NF2FS_DATA_WL_REGIONS= 0x12,
+    NF2FS_DATA_WL_REMAP= 0x11,
+    NF2FS_DATA_WL_PLAN= 0x10,
+    NF2FS_DATA_WL_MOVE= 0x0f,
+
     NF2FS_DATA_DIR_NAME= 0x0e,
+    NF2FS_DATA_NAME_FOOTER= 0x0d,
     NF2FS_DATA_FILE_NAME= 0x0c,
     NF2FS_DATA_BFILE_INDEX= 0x0b,
     NF2FS_DATA_SFILE_DATA= 0x0a,
     NF2FS_DATA_DIR_OSPACE= 0x09,
 
+    // Leased ids are given back at mount if they have no names after a crash.
+    NF2FS_DATA_ID_LEASE= 0x08,
+
     // NF2FS_DATA_DELETE can also be the end of readdir
     NF2FS_DATA_DELETE= 0x00, 
     NF2FS_DATA_REG= 0x02,
@@ -476,6 +654,18 @@ enum
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  */
 
+/**
+ * One segment of a vectored read/prog request, (sector, off, size) in flash
+ * and the ram buffer it is read to or proged from.
+ */
+typedef struct NF2FS_iovec
+{
+    NF2FS_size_t sector;
+    NF2FS_off_t off;
+    void* buffer;
+    NF2FS_size_t size;
+} NF2FS_iovec_t;
+
 /**
  * Basic configure message provided by user during mount.
  */
@@ -497,6 +687,27 @@ typedef struct NF2FS_config
     // Sync the state of the underlying block device.
     int (*sync)(const struct NF2FS_config* c);
 
+    // Optional vectored read, fills all cnt segments of iov in one request.
+    // When NULL, segments are read one by one through read.
+    int (*readv)(const struct NF2FS_config* c, const struct NF2FS_iovec* iov, NF2FS_size_t cnt);
+
+    // Optional vectored prog, programs all cnt segments of iov in one request
+    // and in order. When NULL, segments are proged one by one through prog.
+    int (*progv)(const struct NF2FS_config* c, const struct NF2FS_iovec* iov, NF2FS_size_t cnt);
+
+    // Optional asynchronous erase, starts erasing a sector and returns at once.
+    // Only used together with busy.
+    int (*erase_async)(const struct NF2FS_config* c, NF2FS_size_t sector);
+
+    // Optional asynchronous prog, starts programming and returns at once. The
+    // buffer is kept unchanged until busy reports the device idle. Only used
+    // together with busy.
+    int (*prog_async)(const struct NF2FS_config* c, NF2FS_size_t sector, NF2FS_off_t off, void* buffer, NF2FS_size_t size);
+
+    // Optional completion polling, returns 1 if an async erase/prog is still
+    // running, 0 if the device is idle.
+    int (*busy)(const struct NF2FS_config* c);
+
 #ifdef NF2FS_THREADSAFE
     // Lock the underlying sector device.
     int (*lock)(const struct NF2FS_config* c);
@@ -543,6 +754,28 @@ typedef struct NF2FS_config
     // in superblock and must be respected by other NF2FS drivers.
     NF2FS_size_t file_max;
 
+    // Optional format option. When true, records in dir sectors are proged once
+    // and each batch of them begins with a NF2FS_DATA_SEAL record carrying their
+    // crc, instead of a second prog to clear written flags. Stored in superblock
+    // and must be respected by other NF2FS drivers.
+    bool crc_seal;
+
+    // Optional format option. When true, names in dir sectors are proged forward
+    // from the sector head and other records backward from the sector end, so
+    // traversing names or data does not read the other. Stored in superblock and
+    // must be respected by other NF2FS drivers.
+    bool dual_end;
+
+    // Optional number of slots in the read cache pool. Every slot costs
+    // cache_size bytes of ram, and dir traversals running in turn use
+    // different slots. Defaults to NF2FS_RCACHE_SLOT_NUM when zero.
+    NF2FS_size_t rcache_slots;
+
+    // Optional base address of the nor flash in memory mapped (XIP) mode, data
+    // in (sector, off) lives at map_base + sector * sector_size + off.
+    // NF2FS_file_mmap is not supported when NULL.
+    const void* map_base;
+
     void* user_data;
 } NF2FS_config_t;
 
@@ -555,13 +788,20 @@ typedef struct NF2FS_config
 /**
  * The common head structure for all sectors belong to dir.
  *  1. head describes the basic message of sector.
- *  2. pre_sector links sectors if they belong to the same dir.
+ *  2. pre_sector links sectors if they belong to the same dir. It's not followed
+ *     once NF2FS_SHEAD_CUT_SET is proged to head, i.e. older sectors are compacted
+ *     by dir gc step.
+ *  3. next_sector is proged when a newer sector is linked to the dir, so dir gc
+ *     step finds the oldest sectors without traversing from the tail.
+ *  4. With dual_end, it's followed by where data begins in the sector, which is
+ *     proged when the sector is sealed.
  */
 typedef struct NF2FS_dir_sector_flash
 {
     NF2FS_head_t head;
     NF2FS_size_t pre_sector;
     NF2FS_size_t id;
+    NF2FS_size_t next_sector;
 } NF2FS_dir_sector_flash_t;
 
 /**
@@ -619,6 +859,8 @@ typedef struct NF2FS_supermessage_flash
     NF2FS_size_t name_max;
     NF2FS_size_t file_max; // the max file size
     NF2FS_size_t region_cnt;
+    NF2FS_size_t crc_seal;
+    NF2FS_size_t dual_end;
     uint8_t fs_name[5];
 } NF2FS_supermessage_flash_t;
 
@@ -645,6 +887,17 @@ typedef struct NF2FS_mapaddr_flash
     NF2FS_size_t erase_times[];
 } NF2FS_mapaddr_flash_t;
 
+/**
+ * Ids of the word beginning at begin that are used in id map before they are named.
+ * bits is 0 when the lease is given back, the last record in superblock is the valid one.
+ */
+typedef struct NF2FS_idlease_flash
+{
+    NF2FS_head_t head;
+    NF2FS_size_t begin;
+    uint32_t bits;
+} NF2FS_idlease_flash_t;
+
 /**
  * The position of wl message in nor flash.
  */
@@ -656,6 +909,56 @@ typedef struct NF2FS_wladdr_flash
     NF2FS_size_t erase_times;
 } NF2FS_wladdr_flash_t;
 
+/**
+ * Candidate regions with less etimes, they are used first when we change sector maps.
+ */
+typedef struct NF2FS_wl_regions_flash
+{
+    NF2FS_head_t head;
+    NF2FS_size_t dir_regions[NF2FS_RAM_REGION_NUM];
+    NF2FS_size_t bfile_regions[NF2FS_RAM_REGION_NUM];
+} NF2FS_wl_regions_flash_t;
+
+/**
+ * The physical region of regions, remap is pairs of (region, physical region).
+ * Later records in wl sector cover earlier ones.
+ */
+typedef struct NF2FS_wl_remap_flash
+{
+    NF2FS_head_t head;
+    NF2FS_size_t remap[];
+} NF2FS_wl_remap_flash_t;
+
+/**
+ * The migration plan, pairs is pairs of (region_1, region_2) that are swapped in order.
+ */
+typedef struct NF2FS_wl_plan_flash
+{
+    NF2FS_head_t head;
+    NF2FS_size_t pairs[];
+} NF2FS_wl_plan_flash_t;
+
+/**
+ * The cursor of migration, sectors before sector in the moving region are copied.
+ */
+typedef struct NF2FS_wl_move_flash
+{
+    NF2FS_head_t head;
+    NF2FS_size_t index;
+    NF2FS_size_t phase;
+    NF2FS_size_t sector;
+} NF2FS_wl_move_flash_t;
+
+/**
+ * Erase times of physical regions [begin, begin + n), n regions fit in a cache.
+ */
+typedef struct NF2FS_region_etimes_flash
+{
+    NF2FS_head_t head;
+    NF2FS_size_t begin;
+    NF2FS_size_t etimes[];
+} NF2FS_region_etimes_flash_t;
+
 /**
  * Every time we umount or commit(maybe have), we should write this.
  *
@@ -669,6 +972,9 @@ typedef struct NF2FS_wladdr_flash
  *     in-ram hash structure, so don't need to record the free off.
  *  3) But we don't want to traverse wl array and added message behind, so we
  *     should record free off.
+ *
+ * region_run records the longest free run of each region if it fits in a cache
+ * with the commit message, so we do not read maps to find space after mounting.
  */
 typedef struct NF2FS_commit_flash
 {
@@ -678,8 +984,32 @@ typedef struct NF2FS_commit_flash
     NF2FS_size_t next_dir_sector;
     NF2FS_size_t next_bfile_sector;
     NF2FS_size_t reserve_region;
+    uint8_t region_run[];
 } NF2FS_commit_flash_t;
 
+/**
+ * The seal of a batch of records in dir sector, it's in the front of the batch.
+ *  1. size is the size of the batch behind the seal.
+ *  2. crc is the crc32 of the batch, only NF2FS_DHEAD_SEAL_MASK bits of data heads are used.
+ */
+typedef struct NF2FS_seal_flash
+{
+    NF2FS_head_t head;
+    NF2FS_size_t size;
+    uint32_t crc;
+} NF2FS_seal_flash_t;
+
+/**
+ * An entry in the name footer of a sealed dir sector.
+ *  1. The footer is at the end of sector, entries are followed by a data head of NF2FS_DATA_NAME_FOOTER.
+ *  2. hash is got by NF2FS_name_hash, off is where the name record is in the sector.
+ */
+typedef struct NF2FS_footer_entry_flash
+{
+    uint16_t hash;
+    uint16_t off;
+} NF2FS_footer_entry_flash_t;
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * ------------------------------------------------------------    Cache structure    ------------------------------------------------------------
@@ -700,6 +1030,74 @@ typedef struct NF2FS_cache_ram
     uint8_t* buffer;
 } NF2FS_cache_ram_t;
 
+/**
+ * A slot in the read cache pool.
+ *  1. ref is the reference bit used by CLOCK replacement.
+ *  2. pin keeps the slot from being evicted, it's used for dir tail sectors.
+ *     A pinned slot is still evicted if all other slots are held.
+ *  3. holds is the number of traversals using the buffer, a held slot is never evicted.
+ */
+typedef struct NF2FS_rcache_slot_ram
+{
+    NF2FS_cache_ram_t cache;
+    bool ref;
+    bool pin;
+    NF2FS_size_t holds;
+} NF2FS_rcache_slot_ram_t;
+
+/**
+ * The N-way associative read cache pool.
+ * hand is the clock hand, pin_num is the number of pinned slots.
+ */
+typedef struct NF2FS_rcache_pool_ram
+{
+    NF2FS_size_t slot_num;
+    NF2FS_size_t pin_num;
+    NF2FS_size_t hand;
+    NF2FS_rcache_slot_ram_t* slots;
+} NF2FS_rcache_pool_ram_t;
+
+/**
+ * The pool of parked write-combining prog caches.
+ * pcache in NF2FS_t is the one being appended, the others wait here with
+ * their (sector, tail offset) until they are switched back, evicted or synced.
+ * victim is the next cache to be evicted when no cache is empty.
+ */
+typedef struct NF2FS_pcache_pool_ram
+{
+    NF2FS_size_t victim;
+    NF2FS_cache_ram_t* caches[NF2FS_PCACHE_POOL_NUM];
+} NF2FS_pcache_pool_ram_t;
+
+/**
+ * State of the device when async erase/prog are used.
+ *  1. busy means an async erase/prog is running in the device.
+ *  2. progs in queue[next, cnt) wait for the running one to finish, in order.
+ *  3. data of queued and running progs is copied to stage, so callers could
+ *     reuse their buffers at once. used is the size of stage in use.
+ */
+typedef struct NF2FS_dev_ram
+{
+    bool busy;
+    NF2FS_size_t next;
+    NF2FS_size_t cnt;
+    NF2FS_size_t used;
+    NF2FS_size_t stage_size;
+    uint8_t* stage;
+    NF2FS_iovec_t queue[NF2FS_IOV_MAX];
+} NF2FS_dev_ram_t;
+
+/**
+ * A batch of read or prog segments waiting to be sent to the device.
+ * Segments adjacent both in flash and in ram are merged into one.
+ */
+typedef struct NF2FS_iobatch_ram
+{
+    bool is_prog;
+    NF2FS_size_t cnt;
+    NF2FS_iovec_t iov[NF2FS_IOV_MAX];
+} NF2FS_iobatch_ram_t;
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * ----------------------------------------------------------    Map and wl structure    ---------------------------------------------------------
@@ -714,6 +1112,8 @@ typedef struct NF2FS_cache_ram
  *     to dir or big file.
  *  3) The three regions are all map structure, and for small size
  *     nor flash like 1MB, we may only use 8 bits of a uint32_t structure.
+ *  4) moved_region is only in ram, bit 1 means the region has changed its type
+ *     in the current scan, so it is not moved again until the next scan.
  */
 typedef struct NF2FS_region_map_ram
 {
@@ -728,6 +1128,8 @@ typedef struct NF2FS_region_map_ram
 
     NF2FS_off_t bfile_index;
     uint32_t* bfile_region;
+
+    uint32_t* moved_region;
 } NF2FS_region_map_ram_t;
 
 /**
@@ -779,6 +1181,18 @@ typedef struct NF2FS_wl_message
  * it increased.
  *
  * When changed_region_times >= 2 * NF2FS_RAM_REGION_NUM * scan_throld, data migration
+ *
+ * remap is the physical region of each region. Data of a region is migrated by copying
+ * it to the physical region of reserve region, then the two swap their physical regions.
+ * Region 0 is never migrated.
+ *
+ * Migration of a pair in plan has three phases, region_1 moves to reserve region, region_2
+ * moves to the old place of region_1, region_1 moves to the old place of region_2. If
+ * region_2 is reserve region, only the first phase is needed. Move_sector sectors of
+ * move_region have been copied to the physical region of reserve region, so they are
+ * read and writen there until the phase ends.
+ *
+ * step_defer is the number of allocs since the last step.
  */
 typedef struct NF2FS_wl_ram
 {
@@ -791,16 +1205,55 @@ typedef struct NF2FS_wl_ram
     NF2FS_size_t bfile_region_index;
     NF2FS_size_t dir_regions[NF2FS_RAM_REGION_NUM];
     NF2FS_size_t bfile_regions[NF2FS_RAM_REGION_NUM];
+    NF2FS_size_t* remap;
+
+    NF2FS_size_t* plan;
+    NF2FS_size_t plan_num;
+    NF2FS_size_t plan_index;
+    NF2FS_size_t move_phase;
+    NF2FS_size_t move_sector;
+    NF2FS_size_t move_region;
+    NF2FS_size_t step_defer;
 } NF2FS_wl_ram_t;
 
+/**
+ * The pool of pre-erased sectors in a map.
+ *
+ * Sectors in [index_or_changed of the map, cursor) of the region have been
+ * checked by NF2FS_fs_idle in the scan, the free ones among them form the pool.
+ */
+typedef struct NF2FS_preerase_ram
+{
+    NF2FS_size_t scan_times;
+    NF2FS_size_t region;
+    NF2FS_size_t cursor;
+} NF2FS_preerase_ram_t;
+
 /**
  * The management structure of nor flash.
+ *
+ * region_run is the longest run of free sectors in each region. Free maps only lose bits between
+ * two scans, so it never underestimates a region, and it's recalculated when maps are merged.
+ *
+ * region_etimes is the sum of erase times of sectors in each physical region, it's counted when
+ * a sector is erased and recorded in superblock. NF2FS_NULL means it's unknown and sector heads
+ * should be read to know it.
+ *
+ * hot_map buffers a second region of big file regions for hot files, and hot_dir_map
+ * buffers a second region of dir regions for new tails of hot dirs. A region is never
+ * buffered by two maps at the same time.
+ *
+ * old_unmerged tells whether sectors may have been turned old in erase map since it's merged
+ * into free maps, it's unknown after mounting.
  */
 typedef struct NF2FS_flash_manage_ram
 {
     NF2FS_size_t region_num;
     NF2FS_size_t region_size;
     NF2FS_size_t scan_times;
+    uint16_t* region_run;
+    NF2FS_size_t* region_etimes;
+    bool region_etimes_changed;
 
     NF2FS_size_t smap_begin;
     NF2FS_off_t smap_off; // The offset of in-NOR sector map, not erase map
@@ -811,13 +1264,25 @@ typedef struct NF2FS_flash_manage_ram
     NF2FS_map_ram_t* meta_map;
     NF2FS_map_ram_t* dir_map;
     NF2FS_map_ram_t* bfile_map;
+    NF2FS_map_ram_t* hot_map;
+    NF2FS_map_ram_t* hot_dir_map;
     NF2FS_map_ram_t* reserve_map;
     NF2FS_map_ram_t* erase_map;
+    bool old_unmerged;
     NF2FS_wl_ram_t* wl;
+
+    NF2FS_preerase_ram_t dir_pool;
+    NF2FS_preerase_ram_t bfile_pool;
+    NF2FS_preerase_ram_t emap_pool;
 } NF2FS_flash_manage_ram_t;
 
 /**
  * The bit map of id.
+ *
+ * Ids are leased a bitmap word at a time: a lease record is proged to superblock, then
+ * free ids of the word are set used in flash with one prog and handed out from lease.
+ * Unused leased ids go back through the remove map at unmount, or at the next mount
+ * if they have no names after a crash. Freed ids go to the remove map at once.
  */
 typedef struct NF2FS_idmap_ram
 {
@@ -827,6 +1292,9 @@ typedef struct NF2FS_idmap_ram
 
     NF2FS_size_t ids_in_buffer;
     NF2FS_map_ram_t* free_map;
+
+    NF2FS_size_t lease_begin; // the first id of the leased word, NF2FS_NULL if no lease record is open
+    uint32_t lease;           // leased ids not handed out
 } NF2FS_idmap_ram_t;
 
 /**
@@ -836,7 +1304,10 @@ typedef struct NF2FS_idmap_ram
  */
 
 /**
- * The structure of tree entry, size is 32 B
+ * The structure of tree entry, size is 36 B
+ *
+ *  1. old_space of a closed dir is kept for the reclaimer, it's NF2FS_NULL
+ *     until the dir is opened once.
  */
 typedef struct NF2FS_tree_entry_ram
 {
@@ -846,6 +1317,7 @@ typedef struct NF2FS_tree_entry_ram
     NF2FS_size_t name_sector; // sector that store dir name
     NF2FS_size_t name_off;
     NF2FS_size_t tail_sector; // sector that belongs to the dir
+    NF2FS_size_t old_space;   // old space of the dir when it's closed
     union data
     {
         NF2FS_hash_t hash;
@@ -857,6 +1329,7 @@ typedef struct NF2FS_tree_ram
 {
     NF2FS_size_t entry_num;
     NF2FS_tree_entry_ram_t* tree_array;
+    NF2FS_size_t* sectors; // sectors of the closed dir in each entry, NF2FS_NULL if not known
 } NF2FS_tree_ram_t;
 
 /**
@@ -895,6 +1368,16 @@ typedef struct NF2FS_bfile_index_flash
     NF2FS_bfile_index_ram_t index[];
 } NF2FS_bfile_index_flash_t;
 
+/**
+ * A piece of big file data that is continuous in memory mapped flash.
+ * It's returned by NF2FS_file_mmap.
+ */
+typedef struct NF2FS_mmap_extent
+{
+    const void* addr;
+    NF2FS_size_t size;
+} NF2FS_mmap_extent_t;
+
 /**
  * The basic data structure structure of small file.
  * It's stored in dir.
@@ -930,10 +1413,19 @@ typedef struct NF2FS_file_ram
     NF2FS_off_t off;
     NF2FS_size_t namelen;
 
+    int flags; // NF2FS_open_flags
+
     NF2FS_cache_ram_t file_cache;
     struct NF2FS_file_ram* next_file;
 } NF2FS_file_ram_t;
 
+// Random writes of a big file since mount, kept by file id.
+typedef struct NF2FS_heat_ram
+{
+    NF2FS_size_t id;
+    NF2FS_size_t rewrites;
+} NF2FS_heat_ram_t;
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * -------------------------------------------------------------    Dir structure    -------------------------------------------------------------
@@ -947,16 +1439,110 @@ typedef struct NF2FS_info
     char name[NF2FS_NAME_MAX + 1];
 } NF2FS_info_ram_t;
 
+// Status of a file or dir, size is 0 for dirs.
+typedef struct NF2FS_stat
+{
+    uint8_t type;
+    NF2FS_size_t id;
+    NF2FS_size_t size;
+} NF2FS_stat_ram_t;
+
+/**
+ * A dir entry got by readdir-plus, type is 0 at the end of dir.
+ * (sector, off) is where its name is, size is 0 for dirs.
+ * name is ended with '\0', and it's valid until the next entry is read.
+ */
+typedef struct NF2FS_dentry
+{
+    uint8_t type;
+    NF2FS_size_t id;
+    NF2FS_size_t size;
+    NF2FS_size_t sector;
+    NF2FS_off_t off;
+    NF2FS_size_t namelen;
+    char* name;
+} NF2FS_dentry_ram_t;
+
+// Called for each entry by NF2FS_dir_list, listing stops if it does not return 0.
+typedef int (*NF2FS_list_cb_t)(void* data, NF2FS_dentry_ram_t* dentry);
+
+// A file size kept by the cursor of readdir-plus, or a file waiting for its size.
+typedef struct NF2FS_cursor_slot_ram
+{
+    NF2FS_size_t id;
+    NF2FS_size_t size;
+    NF2FS_size_t sector; // where the name is, for waiting files
+    NF2FS_off_t off;
+} NF2FS_cursor_slot_ram_t;
+
+/**
+ * The cursor of readdir-plus, an opened dir has one while it's listed.
+ *
+ *  1. window reads ahead cache_size bytes of the sector being listed. Names of the
+ *     sector are walked first to mark their files in bits.
+ *
+ *  2. sizes are sizes of files whose data is met before their names. Data of marked
+ *     files is not kept, lost is set if one of them can not be kept or if a marked
+ *     record is not met by files of the sector.
+ *
+ *  3. pends are files whose data is not met yet. Data of the sector is walked when
+ *     they are full, they are returned when it's met or at the end of dir. With lost,
+ *     those not met in the sector are looked up after the walk.
+ *
+ *  4. name is the returned name, it's valid until the next entry.
+ */
+typedef struct NF2FS_dir_cursor_ram
+{
+    NF2FS_size_t sector;     // the sector being listed
+    NF2FS_size_t pre_sector; // the next sector to list
+    NF2FS_off_t off;         // the next name record
+    NF2FS_off_t name_end;
+    NF2FS_off_t data_begin;  // data records of the sector are in [data_begin, data_end)
+    NF2FS_off_t data_end;
+    NF2FS_off_t win_off;     // window has [win_off, win_off + win_size) of the sector
+    NF2FS_size_t win_size;
+    bool kept;               // data of the sector has been walked
+    bool fresh;              // files of the sector wait without a walk
+    bool lost;
+    NF2FS_size_t marked;     // marked records not met by waiting files in the first walk
+    NF2FS_size_t matched;    // marked records met by files of the sector later
+    uint32_t bits[NF2FS_CURSOR_BITS / 32];
+
+    NF2FS_size_t size_num;
+    NF2FS_cursor_slot_ram_t sizes[NF2FS_CURSOR_SIZES];
+    NF2FS_size_t pend_num;
+    NF2FS_cursor_slot_ram_t pends[NF2FS_CURSOR_PENDS];
+
+    char name[NF2FS_NAME_MAX + 1];
+    uint8_t window[];
+} NF2FS_dir_cursor_ram_t;
+
+/**
+ * The bloom filter of names in an opened dir.
+ */
+#if NF2FS_DIR_FILTER_BITS > 0
+typedef struct NF2FS_name_filter_ram
+{
+    bool valid;         // all names in the dir are in bits
+    NF2FS_size_t names; // names added to bits
+    NF2FS_size_t stale; // names deleted after added
+    uint32_t bits[NF2FS_DIR_FILTER_BITS / 32];
+} NF2FS_name_filter_ram_t;
+#else
+typedef struct NF2FS_name_filter_ram NF2FS_name_filter_ram_t;
+#endif
+
 /**
  * The in ram structure of directory.
  *
  *  1. old_space tell us how many space can we gc if gc happends for the dir.
  *     not the accurate value, but the least.
  *
- *  2. The name of file and data are seperated. To quickly find file in data,
+ *  2. The name of file and data are seperated with dual_end. To quickly find file in data,
  *     we store all names in the front of the sector belongs to the dir, and
  *     all data in the end of it.
- *     The forward and backward pointer tell us where we should tail to write.
+ *     tail_off and data_off tell us where names and data are proged, data records begin
+ *     at 4 bytes aligned offsets, so the first one can be found behind free space.
  *
  *  3. If a dir is very big, then we should use many sectors. All these sectors
  *     use a pointer at the end of each sector linked together.
@@ -970,6 +1556,21 @@ typedef struct NF2FS_info
  *
  *  5. Backward list stores all backward start message of former sectors belong
  *     to dir.
+ *
+ *  6. filter is built while traversing the dir, and trusted only when a traversal
+ *     has seen all names. Deleted names stay in it until it's rebuilt.
+ *
+ *  7. When the tail sector is sealed, a footer of its tail_names names is proged at
+ *     the end of it, so finding names there does not parse the whole sector.
+ *
+ *  8. stamp is the dir clock of the last prog that is not gc, the reclaimer prefers
+ *     dirs that have not been changed for a long time, closed dirs are the oldest.
+ *     busy is set while a new tail is linked into the dir and its father, the dir
+ *     and its sons are not reclaimed then.
+ *
+ *  9. oldest_sector is where dir gc step begins. It's kept in ospace records, so
+ *     the dir is traversed from its tail only if the record is stale or missing.
+ *     sectors is counted by the reclaimer once, then kept on sector alloc and free.
  */
 typedef struct NF2FS_dir_ram
 {
@@ -983,13 +1584,26 @@ typedef struct NF2FS_dir_ram
     NF2FS_size_t pos_sector; // used for dir read
     NF2FS_size_t pos_off;
     NF2FS_size_t pos_presector;
+    NF2FS_dir_cursor_ram_t* cursor; // used for readdir-plus
 
     NF2FS_size_t name_sector;
     NF2FS_size_t name_off;
     NF2FS_size_t namelen;
 
     NF2FS_size_t tail_sector;
+    NF2FS_size_t oldest_sector; // the other end of the dir, NF2FS_NULL if not known yet
+    NF2FS_size_t sectors;       // sectors in the dir, NF2FS_NULL if not known yet
     NF2FS_off_t tail_off;
+    NF2FS_size_t tail_names; // names in tail sector, space of their footer is reserved
+    NF2FS_off_t data_off;    // data begins here in tail sector, sector size without dual_end
+    NF2FS_off_t prog_off;    // where the last record is proged
+
+    NF2FS_size_t stamp;
+    bool busy;
+
+#if NF2FS_DIR_FILTER_BITS > 0
+    NF2FS_name_filter_ram_t filter;
+#endif
 
     struct NF2FS_dir_ram* next_dir;
 } NF2FS_dir_ram_t;
@@ -1004,11 +1618,12 @@ typedef struct NF2FS_dir_name_flash
     uint8_t name[];
 } NF2FS_dir_name_flash_t;
 
-// The old space that can be recycled for current dir.
+// The old space that can be recycled for current dir, and its oldest sector when it's proged.
 typedef struct NF2FS_dir_ospace_flash
 {
     NF2FS_head_t head;
     NF2FS_size_t old_space;
+    NF2FS_size_t oldest_sector;
 } NF2FS_dir_ospace_flash_t;
 
 /**
@@ -1023,8 +1638,13 @@ typedef struct NF2FS_dir_ospace_flash
  */
 typedef struct NF2FS
 {
+    // rcache is a scratch read cache for map updates and gc,
+    // lookups of dir and superblock data go through rcache_pool.
     NF2FS_cache_ram_t* rcache;
     NF2FS_cache_ram_t* pcache;
+    NF2FS_rcache_pool_ram_t* rcache_pool;
+    NF2FS_pcache_pool_ram_t* pcache_pool;
+    NF2FS_dev_ram_t* dev;
 
     NF2FS_superblock_ram_t* superblock;
     NF2FS_flash_manage_ram_t* manager;
@@ -1033,6 +1653,10 @@ typedef struct NF2FS
 
     NF2FS_file_ram_t* file_list;
     NF2FS_dir_ram_t* dir_list;
+    NF2FS_heat_ram_t heat[NF2FS_HEAT_NUM];
+
+    NF2FS_size_t dir_clock; // ticks with progs of dirs, ages of dirs come from it
+    bool in_gc;             // dir gc is running, sector allocs in it do not reclaim
 
     const struct NF2FS_config* cfg;
 } NF2FS_t;
@@ -1052,13 +1676,16 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg);
 // unmount NF2FS
 int NF2FS_unmount(NF2FS_t* NF2FS);
 
+// migrate wl regions, reclaim old space of dirs and pre-erase old sectors while idle, return the number of copied and erased sectors
+int NF2FS_fs_idle(NF2FS_t* NF2FS, NF2FS_size_t max_ops);
+
 /**
  * -------------------------------------------------------------------------------------------------------
  * -------------------------------------    File level operations    -------------------------------------
  * -------------------------------------------------------------------------------------------------------
  */
 
-// open a file
+// open a file, flags are NF2FS_open_flags
 int NF2FS_file_open(NF2FS_t* NF2FS, NF2FS_file_ram_t** file, char* path, int flags);
 
 // close a file
@@ -1073,12 +1700,31 @@ int NF2FS_file_write(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer, NF2FS
 // change the file position
 int NF2FS_file_seek(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_soff_t off, int whence);
 
+// change the size of a file, zeros are filled when it grows
+int NF2FS_file_truncate(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_size_t size);
+
 // delete a file
 int NF2FS_file_delete(NF2FS_t* NF2FS, NF2FS_file_ram_t* file);
 
 // flush file data to flash
 int NF2FS_file_sync(NF2FS_t* NF2FS, NF2FS_file_ram_t* file);
 
+// map data of a big file in [off, off + size) to pointers in memory mapped flash
+int NF2FS_file_mmap(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_off_t off, NF2FS_size_t size,
+                    NF2FS_mmap_extent_t* extents, NF2FS_size_t num);
+
+// get status of a file or dir by path, the file is not opened.
+int NF2FS_stat(NF2FS_t* NF2FS, char* path, NF2FS_stat_ram_t* stat);
+
+// get status of an opened file
+int NF2FS_file_stat(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_stat_ram_t* stat);
+
+// rename a file or dir, it may be moved to another dir.
+int NF2FS_rename(NF2FS_t* NF2FS, char* old_path, char* new_path);
+
+// delete a file by path without opening it, the file should not be opened.
+int NF2FS_unlink(NF2FS_t* NF2FS, char* path);
+
 /**
  * -------------------------------------------------------------------------------------------------------
  * -------------------------------------    Dir level operations    --------------------------------------
@@ -1097,6 +1743,13 @@ int NF2FS_dir_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
 // read an dir entry from dir.
 int NF2FS_dir_read(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_info_ram_t* info);
 
+// read an dir entry with its id, size and where its name is, the dir is read ahead by cache size.
+// The next read after the end lists the dir again.
+int NF2FS_dir_readplus(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_dentry_ram_t* dentry);
+
+// list all entries of dir with cb, names are not copied.
+int NF2FS_dir_list(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_list_cb_t cb, void* data);
+
 #ifdef __cplusplus
 }
 #endif
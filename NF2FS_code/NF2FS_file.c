@@ -40,10 +40,8 @@ int NF2FS_file_free(NF2FS_file_ram_t** list, NF2FS_file_ram_t* file)
         return NF2FS_ERR_NOFILEOPEN;
     } else {
         head_file->next_file = file->next_file;
-        NF2FS_ASSERT(head_file->next_file != file->next_file);
         NF2FS_free(file->file_cache.buffer);
         NF2FS_free(file);
-        *list= head_file;
         return NF2FS_ERR_OK;
     }
 }
@@ -74,6 +72,61 @@ int NF2FS_bfile_prog(NF2FS_t *NF2FS, NF2FS_size_t *sector, NF2FS_off_t *off,
     return err;
 }
 
+// The sector type to allocate for big file data, hot files have their own region.
+int NF2FS_bfile_sector_type(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
+{
+    if (file->flags & NF2FS_O_COLD)
+        return NF2FS_SECTOR_BFILE;
+    if ((file->flags & NF2FS_O_HOT) || NF2FS_file_heat(NF2FS, file->id) >= NF2FS_HOT_REWRITES)
+        return NF2FS_SECTOR_HOT_BFILE;
+    return NF2FS_SECTOR_BFILE;
+}
+
+// The sector type to allocate for a new tail of dir, dirs whose records are rewritten often have their own region.
+int NF2FS_dir_sector_type(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
+{
+    if (NF2FS_file_heat(NF2FS, dir->id) >= NF2FS_HOT_REWRITES)
+        return NF2FS_SECTOR_HOT_DIR;
+    return NF2FS_SECTOR_DIR;
+}
+
+// random writes of file id since mount, or rewritten records of files in dir id
+NF2FS_size_t NF2FS_file_heat(NF2FS_t* NF2FS, NF2FS_size_t id)
+{
+    for (int i= 0; i < NF2FS_HEAT_NUM; i++) {
+        if (NF2FS->heat[i].id == id)
+            return NF2FS->heat[i].rewrites;
+    }
+    return 0;
+}
+
+// count times rewrites of id, the coldest entry is replaced when the table is full
+void NF2FS_file_heat_add(NF2FS_t* NF2FS, NF2FS_size_t id, NF2FS_size_t times)
+{
+    int cold= 0;
+    for (int i= 0; i < NF2FS_HEAT_NUM; i++) {
+        if (NF2FS->heat[i].id == id) {
+            NF2FS->heat[i].rewrites+= times;
+            return;
+        }
+        if (NF2FS->heat[i].rewrites < NF2FS->heat[cold].rewrites)
+            cold= i;
+    }
+    NF2FS->heat[cold].id= id;
+    NF2FS->heat[cold].rewrites= times;
+}
+
+// forget the count of a deleted file id, the id could be reused
+void NF2FS_file_heat_drop(NF2FS_t* NF2FS, NF2FS_size_t id)
+{
+    for (int i= 0; i < NF2FS_HEAT_NUM; i++) {
+        if (NF2FS->heat[i].id == id) {
+            NF2FS->heat[i].id= NF2FS_NULL;
+            NF2FS->heat[i].rewrites= 0;
+        }
+    }
+}
+
 // find end sector of each index
 void NF2FS_end_sector_find(NF2FS_t *NF2FS, NF2FS_bfile_index_ram_t *index,
                                NF2FS_size_t num, NF2FS_size_t *end_sector)
@@ -111,7 +164,7 @@ int NF2FS_bfile_part_gc(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_size_t sta
     // Find new sequential space to do gc.
     NF2FS_size_t new_begin, new_sector;
     NF2FS_off_t new_off = sizeof(NF2FS_bfile_sector_flash_t);
-    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_SECTOR_BFILE, sector_num,
+    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_bfile_sector_type(NF2FS, file), sector_num,
                               NF2FS_NULL, file->id, file->father_id, &new_sector, NULL);
     if (err)
         return err;
@@ -163,7 +216,7 @@ int NF2FS_bfile_part_gc(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_size_t sta
     bfile_index->index[start].off = sizeof(NF2FS_bfile_sector_flash_t);
     bfile_index->index[start].size= len;
     NF2FS_size_t rest = index_num - end - 1;
-    memcpy(&bfile_index->index[start + 1], &bfile_index->index[end + 1], rest * sizeof(NF2FS_bfile_index_ram_t));
+    memmove(&bfile_index->index[start + 1], &bfile_index->index[end + 1], rest * sizeof(NF2FS_bfile_index_ram_t));
 
     // update the file cache message
     file->file_cache.size-= (end - start) * sizeof(NF2FS_bfile_index_ram_t);
@@ -182,7 +235,7 @@ int NF2FS_bfile_part_gc(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_size_t sta
 
     // update basic message
     file->file_cache.sector= father_dir->tail_sector;
-    file->file_cache.off= father_dir->tail_off - file->file_cache.size;
+    file->file_cache.off= father_dir->prog_off;
     file->file_cache.change_flag= false;
     return err;
 }
@@ -217,6 +270,7 @@ int NF2FS_file_lowopen(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t id,
     file->id = id;
     file->father_id= dir->id;
     file->file_pos= 0;
+    file->flags= 0;
 
     file->sector = sector;
     file->off = off;
@@ -230,11 +284,27 @@ int NF2FS_file_lowopen(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t id,
     }
     memset(file->file_cache.buffer, 0xff, NF2FS_FILE_CACHE_SIZE);
 
-    // Traverse dir to find data with id.
-    err = NF2FS_dtraverse_data(NF2FS, file);
+    // Traverse dir to find data with id, data is not behind the name with dual_end
+    err = NF2FS_dtraverse_data(NF2FS, dir, file, file->sector,
+                               NF2FS->cfg->dual_end ? 0 : file->off);
     if (err)
         goto cleanup;
-    NF2FS_ASSERT(file->file_cache.sector != NF2FS_NULL);
+
+    // data flushed after the dir changes its tail sector is newer than the name,
+    // and gc may move data before the name in the same sector
+    if (file->file_cache.sector == NF2FS_NULL &&
+        (dir->tail_sector != file->sector || !NF2FS->cfg->dual_end)) {
+        err = NF2FS_dtraverse_data(NF2FS, dir, file, dir->tail_sector, 0);
+        if (err)
+            goto cleanup;
+    }
+
+    // a file closed before any data is written has no data
+    if (file->file_cache.sector == NF2FS_NULL) {
+        file->file_size= 0;
+        file->file_cache.size= 0;
+        file->file_cache.change_flag= false;
+    }
 
     // Add file to list.
     file->next_file = NF2FS->file_list;
@@ -252,6 +322,60 @@ cleanup:
     return err;
 }
 
+// Find the data or index record of a closed file with file->id, the file cache is not used.
+// dir may be NULL if it's not opened, tail is the tail sector of dir then.
+int NF2FS_file_record_find(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t tail,
+                           NF2FS_file_ram_t *file, NF2FS_size_t sector, NF2FS_off_t off)
+{
+    int err = NF2FS_ERR_OK;
+    file->file_size= 0;
+    file->file_cache.buffer= NULL;
+
+    // the same traversals as opening the file
+    err = NF2FS_dtraverse_data(NF2FS, dir, file, sector,
+                               NF2FS->cfg->dual_end ? 0 : off);
+    if (err)
+        return err;
+
+    if (file->file_cache.sector == NF2FS_NULL &&
+        (tail != sector || !NF2FS->cfg->dual_end)) {
+        err = NF2FS_dtraverse_data(NF2FS, dir, file, tail, 0);
+        if (err)
+            return err;
+    }
+
+    // the file has no data yet
+    if (file->file_cache.sector == NF2FS_NULL)
+        file->file_size= 0;
+    return err;
+}
+
+// Get size of file with file id, the file is not opened.
+int NF2FS_file_size(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t tail, NF2FS_size_t id,
+                    NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t *size)
+{
+    int err = NF2FS_ERR_OK;
+
+    // data of an opened file may be not flushed
+    NF2FS_file_ram_t* file= NF2FS->file_list;
+    while (file != NULL) {
+        if (file->id == id) {
+            *size= file->file_size;
+            return err;
+        }
+        file= file->next_file;
+    }
+
+    // only the size is found without a file cache
+    NF2FS_file_ram_t temp_file;
+    temp_file.id= id;
+    err= NF2FS_file_record_find(NF2FS, dir, tail, &temp_file, sector, off);
+    if (err)
+        return err;
+    *size= temp_file.file_size;
+    return err;
+}
+
 // Flush data in file cache to corresponding dir.
 int NF2FS_file_flush(NF2FS_t *NF2FS, NF2FS_file_ram_t *file)
 {
@@ -270,6 +394,10 @@ int NF2FS_file_flush(NF2FS_t *NF2FS, NF2FS_file_ram_t *file)
     if (dir == NULL)
         return NF2FS_ERR_NODIROPEN;
 
+    // records rewritten again and again make the dir hot, a hot file makes it hot at once
+    if (file->file_cache.sector != NF2FS_NULL && !(file->flags & NF2FS_O_COLD))
+        NF2FS_file_heat_add(NF2FS, dir->id, (file->flags & NF2FS_O_HOT) ? NF2FS_HOT_REWRITES : 1);
+
     // Set type of old file index to delete.
     NF2FS_head_t old_head = *(NF2FS_head_t *)file->file_cache.buffer;
     err = NF2FS_data_delete(NF2FS, file->father_id, file->file_cache.sector,
@@ -277,6 +405,9 @@ int NF2FS_file_flush(NF2FS_t *NF2FS, NF2FS_file_ram_t *file)
     if (err)
         return err;
 
+    // dir gc may happen in prog, and it should not prog the file cache again
+    file->file_cache.sector= NF2FS_NULL;
+
     // Prog new file index to dir.
     // in file cache, size and index are always new, but position and head may be old.
     NF2FS_head_t *head = (NF2FS_head_t *)file->file_cache.buffer;
@@ -288,7 +419,7 @@ int NF2FS_file_flush(NF2FS_t *NF2FS, NF2FS_file_ram_t *file)
 
     // update message
     file->file_cache.sector = dir->tail_sector;
-    file->file_cache.off = dir->tail_off - file->file_cache.size;
+    file->file_cache.off = dir->prog_off;
     file->file_cache.change_flag= false;
     return err;
 }
@@ -323,6 +454,7 @@ int NF2FS_create_file(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_file_ram_t **f
     file->father_id = dir->id;
     file->file_size = 0;
     file->file_pos= 0;
+    file->flags= 0;
     
     file->file_cache.sector = NF2FS_NULL;
     file->file_cache.size= 0;
@@ -347,8 +479,11 @@ int NF2FS_create_file(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_file_ram_t **f
 
     // update file message
     file->sector = dir->tail_sector;
-    file->off = dir->tail_off - size;
+    file->off = dir->prog_off;
     file->namelen = namelen;
+#if NF2FS_DIR_FILTER_BITS > 0
+    NF2FS_filter_add(&dir->filter, NF2FS_name_hash(name, namelen));
+#endif
     *file_addr = file;
 
     file->next_file = NF2FS->file_list;
@@ -366,6 +501,81 @@ cleanup:
     return err;
 }
 
+// give an opened file a new name in new_father, only the name and the data record are moved
+int NF2FS_file_move(NF2FS_t *NF2FS, NF2FS_dir_ram_t *father, NF2FS_dir_ram_t *new_father,
+                    NF2FS_file_ram_t *file, char *name, NF2FS_size_t namelen)
+{
+    int err = NF2FS_ERR_OK;
+
+    // the data record is moved as it is in flash
+    err = NF2FS_file_flush(NF2FS, file);
+    if (err)
+        return err;
+
+    // records of the file are in both dirs for a while, the old father is not reclaimed then
+    bool busy = father->busy;
+    father->busy = true;
+
+    // prog the new name with the same id first, the old one is still valid if crash happens
+    NF2FS_size_t size = sizeof(NF2FS_file_name_flash_t) + namelen;
+    NF2FS_file_name_flash_t *flash_name = NF2FS_malloc(size);
+    if (flash_name == NULL) {
+        err = NF2FS_ERR_NOMEM;
+        goto cleanup;
+    }
+    flash_name->head = NF2FS_MKDHEAD(0, 1, file->id, NF2FS_DATA_NFILE_NAME, size);
+    memcpy(flash_name->name, name, namelen);
+    err = NF2FS_dir_prog(NF2FS, new_father, flash_name, size);
+    NF2FS_free(flash_name);
+    if (err)
+        goto cleanup;
+
+    // dir gc in the same dir has updated position of the old name
+    NF2FS_size_t old_sector = file->sector;
+    NF2FS_off_t old_off = file->off;
+    NF2FS_size_t old_namelen = file->namelen;
+    file->sector = new_father->tail_sector;
+    file->off = new_father->prog_off;
+    file->namelen = namelen;
+
+    if (father != new_father && file->file_cache.sector != NF2FS_NULL) {
+        // data of file is found in its father dir, so it's copied to the new one,
+        // gc of the new father updates the new name and data of the file
+        NF2FS_size_t data_sector = file->file_cache.sector;
+        NF2FS_off_t data_off = file->file_cache.off;
+        file->father_id = new_father->id;
+        file->file_cache.sector = NF2FS_NULL;
+
+        NF2FS_head_t *head = (NF2FS_head_t *)file->file_cache.buffer;
+        *head = NF2FS_MKDHEAD(0, 1, file->id, (file->file_size <= NF2FS_FILE_SIZE_THRESHOLD) ? NF2FS_DATA_SFILE_DATA :
+                             NF2FS_DATA_BFILE_INDEX, file->file_cache.size);
+        err = NF2FS_dir_prog(NF2FS, new_father, file->file_cache.buffer, file->file_cache.size);
+        if (err)
+            goto cleanup;
+        file->file_cache.sector = new_father->tail_sector;
+        file->file_cache.off = new_father->prog_off;
+
+        err = NF2FS_data_delete(NF2FS, father->id, data_sector, data_off, file->file_cache.size);
+        if (err)
+            goto cleanup;
+    }
+    file->father_id = new_father->id;
+
+    // delete the old name at last
+    err = NF2FS_data_delete(NF2FS, father->id, old_sector, old_off,
+                            sizeof(NF2FS_file_name_flash_t) + old_namelen);
+    if (err)
+        goto cleanup;
+#if NF2FS_DIR_FILTER_BITS > 0
+    father->filter.stale++;
+    NF2FS_filter_add(&new_father->filter, NF2FS_name_hash(name, namelen));
+#endif
+
+cleanup:
+    father->busy = busy;
+    return err;
+}
+
 // read data of small file
 int NF2FS_small_file_read(NF2FS_t *NF2FS, NF2FS_file_ram_t *file, void *buffer, NF2FS_size_t size)
 {
@@ -383,19 +593,22 @@ int NF2FS_index_read_once(NF2FS_t* NF2FS, NF2FS_size_t begin, NF2FS_off_t off, N
 {
     int err = NF2FS_ERR_OK;
 
-    // Change (begin, off) to valid (sector, off).
+    // Change (begin, off) to valid (sector, off), data in the next sector is
+    // behind its sector head.
     NF2FS_size_t sector = begin;
     while (off >= NF2FS->cfg->sector_size) {
         sector++;
-        off -= NF2FS->cfg->sector_size;
+        off -= NF2FS->cfg->sector_size - sizeof(NF2FS_bfile_sector_flash_t);
     }
 
-    // Read data to buffer directly
+    // Read data to buffer directly, sectors of the index are read in one request
+    NF2FS_iobatch_ram_t batch;
+    NF2FS_iobatch_init(&batch, false);
     uint8_t *data = (uint8_t *)buffer;
     while (len > 0) {
         // read data to buffer
         NF2FS_size_t size= NF2FS_min(NF2FS->cfg->sector_size - off, len);
-        err= NF2FS_direct_read(NF2FS, sector, off, size, data);
+        err= NF2FS_iobatch_add(NF2FS, &batch, sector, off, data, size);
         if (err)
             return err;
 
@@ -408,7 +621,7 @@ int NF2FS_index_read_once(NF2FS_t* NF2FS, NF2FS_size_t begin, NF2FS_off_t off, N
             sector++;
         }
     }
-    return err;
+    return NF2FS_iobatch_submit(NF2FS, &batch);
 }
 
 // read data of big file
@@ -454,6 +667,60 @@ int NF2FS_big_file_read(NF2FS_t *NF2FS, NF2FS_file_ram_t *file, void *buffer, NF
     return err;
 }
 
+// map data of big file in [off, off + size) to extents of memory mapped flash
+int NF2FS_big_file_mmap(NF2FS_t *NF2FS, NF2FS_file_ram_t *file, NF2FS_off_t off, NF2FS_size_t size,
+                        NF2FS_mmap_extent_t *extents, NF2FS_size_t num)
+{
+    const uint8_t *base = (const uint8_t *)NF2FS->cfg->map_base;
+    NF2FS_ASSERT(off + size <= file->file_size);
+
+    // Calculate the number of index the file has.
+    int index_num = (file->file_cache.size - sizeof(NF2FS_head_t)) /
+                    sizeof(NF2FS_bfile_index_ram_t);
+    NF2FS_bfile_index_flash_t *bfile = (NF2FS_bfile_index_flash_t *)file->file_cache.buffer;
+
+    NF2FS_size_t cnt = 0;
+    NF2FS_off_t pos = 0;
+    for (int i = 0; i < index_num && size > 0; i++) {
+        if (pos + bfile->index[i].size <= off) {
+            // skip what we do not need.
+            pos += bfile->index[i].size;
+            continue;
+        }
+
+        // jump to the first byte we need in the index
+        NF2FS_bfile_index_ram_t index = bfile->index[i];
+        NF2FS_index_jump(NF2FS, &index, off - pos);
+        pos += bfile->index[i].size;
+
+        // every sector of the index is an extent, sector heads break the data
+        NF2FS_size_t rest_size = NF2FS_min(index.size, size);
+        while (rest_size > 0) {
+            NF2FS_size_t len = NF2FS_min(NF2FS->cfg->sector_size - index.off, rest_size);
+            const uint8_t *addr = base + NF2FS_dev_sector(NF2FS, index.sector) * NF2FS->cfg->sector_size +
+                                  index.off;
+            if (cnt > 0 && (const uint8_t *)extents[cnt - 1].addr + extents[cnt - 1].size == addr) {
+                // continue with the last extent
+                extents[cnt - 1].size += len;
+            } else if (cnt == num) {
+                // no more extents to use
+                return cnt;
+            } else {
+                extents[cnt].addr = addr;
+                extents[cnt].size = len;
+                cnt++;
+            }
+
+            rest_size -= len;
+            size -= len;
+            off += len;
+            NF2FS_index_jump(NF2FS, &index, len);
+        }
+    }
+    NF2FS_ASSERT(size == 0);
+    return cnt;
+}
+
 // write data to small file
 int NF2FS_small_file_write(NF2FS_t *NF2FS, NF2FS_file_ram_t *file, const void *buffer, NF2FS_size_t size)
 {
@@ -480,7 +747,7 @@ int NF2FS_s2b_file_write(NF2FS_t *NF2FS, NF2FS_file_ram_t *file, const void *buf
     NF2FS_size_t off = sizeof(NF2FS_bfile_sector_flash_t);
     NF2FS_size_t num = NF2FS_alignup(file->file_pos + size, NF2FS->cfg->sector_size - off) /
                         (NF2FS->cfg->sector_size - off);
-    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_SECTOR_BFILE, num,
+    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_bfile_sector_type(NF2FS, file), num,
                               NF2FS_NULL, file->id, file->father_id, &sector, NULL);
     if (err)
         return err;
@@ -582,6 +849,10 @@ int NF2FS_big_file_append(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer,
 
         if (my_size == 0)
             return err;
+
+        // the last index ends at the end of the sector now
+        temp_index.sector++;
+        temp_index.off = sizeof(NF2FS_bfile_sector_flash_t);
     }
 
     // alloc sector that we need
@@ -589,26 +860,25 @@ int NF2FS_big_file_append(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer,
     NF2FS_size_t off = sizeof(NF2FS_bfile_sector_flash_t);
     NF2FS_size_t num = NF2FS_alignup(my_size, NF2FS->cfg->sector_size - off) /
                         (NF2FS->cfg->sector_size - off);
-    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_SECTOR_BFILE, num,
+    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_bfile_sector_type(NF2FS, file), num,
                               NF2FS_NULL, file->id, file->father_id, &sector, NULL);
     if (err)
         return err;
 
     // Prog data to flash.
     NF2FS_size_t begin = sector;
-    err = NF2FS_bfile_prog(NF2FS, &sector, &off, buffer, my_size);
+    err = NF2FS_bfile_prog(NF2FS, &sector, &off, data, my_size);
     if (err)
         return err;
 
-    NF2FS_ASSERT((temp_index.sector != begin) || (temp_index.sector == begin && temp_index.off == sizeof(NF2FS_bfile_sector_flash_t)));
-    if (temp_index.sector + 1 == begin) {
+    if (temp_index.sector == begin) {
         // If we can merge new index and the last old index.
         bfile_index[index_num - 1].size += my_size;
     } else {
         // add a new if they can not merge
         bfile_index[index_num].sector = begin;
         bfile_index[index_num].off = sizeof(NF2FS_bfile_sector_flash_t);
-        bfile_index[index_num].size = size;
+        bfile_index[index_num].size = my_size;
         file->file_cache.size += sizeof(NF2FS_bfile_index_ram_t);
     }
 
@@ -624,12 +894,15 @@ int NF2FS_big_file_rwrite(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer,
                          NF2FS_bfile_index_ram_t *bfile_index, NF2FS_size_t index_num){
     int err= NF2FS_ERR_OK;
 
+    // data rewritten again and again makes the file hot
+    NF2FS_file_heat_add(NF2FS, file->id, 1);
+
     // alloc sector that we need
     NF2FS_size_t sector = NF2FS_NULL;
     NF2FS_size_t off = sizeof(NF2FS_bfile_sector_flash_t);
     NF2FS_ssize_t num = NF2FS_alignup(size, NF2FS->cfg->sector_size - off) /
                         (NF2FS->cfg->sector_size - off);
-    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_SECTOR_BFILE, num,
+    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_bfile_sector_type(NF2FS, file), num,
                               NF2FS_NULL, file->id, file->father_id, &sector, NULL);
     if (err)
         return err;
@@ -723,8 +996,7 @@ int NF2FS_big_file_rwrite(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer,
             break;
     }
 
-    // record valid of the last coverd index to end_index
-    NF2FS_ASSERT(off + bfile_index[j].size != size);
+    // record valid of the last coverd index to end_index, it's empty if new data ends with index j
     memcpy(&end_index, &bfile_index[j], sizeof(NF2FS_bfile_index_ram_t));
     NF2FS_index_jump(NF2FS, &end_index, size - off);
     bfile_index[j].size = (size - off);
@@ -756,6 +1028,8 @@ int NF2FS_big_file_rwrite(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer,
     err = NF2FS_bfile_sector_old(NF2FS, &bfile_index[i], j - i + 1);
     if (err)
         return err;
+    if (end_index.size == 0)
+        end_index.sector = NF2FS_NULL;
 
     // Calculate number of new/changed index we should prog.
     NF2FS_size_t new_index_num = 1;
@@ -765,20 +1039,12 @@ int NF2FS_big_file_rwrite(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer,
         new_index_num++;
 
     if (j < index_num) {
-        // the number of valid indexes behind index j
+        // the number of valid indexes behind index j, they may move forward or backward
         num = index_num - j - 1;
-
-
-        // TODO, change
-        NF2FS_ssize_t temp_num= num - 1;
-        while (temp_num >= 0) {
-            memcpy(&bfile_index[i + new_index_num + temp_num], &bfile_index[j + 1 + temp_num], sizeof(NF2FS_bfile_index_ram_t));
-            temp_num--;
+        if (num > 0) {
+            memmove(&bfile_index[i + new_index_num], &bfile_index[j + 1],
+                    num * sizeof(NF2FS_bfile_index_ram_t));
         }
-        // if (num > 0) {
-        //     memcpy(&bfile_index[i + new_index_num], &bfile_index[j + 1],
-        //            num * sizeof(NF2FS_bfile_index_ram_t));
-        // }
     }
 
     // Write begin index.
@@ -844,3 +1110,171 @@ int NF2FS_big_file_write(NF2FS_t *NF2FS, NF2FS_file_ram_t *file, void *buffer, N
     }
     return err;
 }
+
+// whether sector has data of one of the indexes
+static bool NF2FS_index_has_sector(NF2FS_t *NF2FS, NF2FS_bfile_index_ram_t *index, NF2FS_size_t num,
+                                   NF2FS_size_t sector)
+{
+    for (int i = 0; i < num; i++) {
+        if (index[i].size == 0 || sector < index[i].sector)
+            continue;
+
+        // jump to the last byte of the index
+        NF2FS_bfile_index_ram_t last = index[i];
+        NF2FS_index_jump(NF2FS, &last, index[i].size - 1);
+        if (sector <= last.sector)
+            return true;
+    }
+    return false;
+}
+
+// copy data of tail to the beginning of a new sector
+static int NF2FS_bfile_tail_move(NF2FS_t *NF2FS, NF2FS_file_ram_t *file, NF2FS_bfile_index_ram_t *tail,
+                                 NF2FS_size_t *new_sector)
+{
+    int err = NF2FS_ERR_OK;
+    uint8_t *data = NF2FS_malloc(tail->size);
+    if (data == NULL)
+        return NF2FS_ERR_NOMEM;
+
+    err = NF2FS_direct_read(NF2FS, tail->sector, tail->off, tail->size, data);
+    if (err)
+        goto cleanup;
+
+    NF2FS_size_t sector = NF2FS_NULL;
+    NF2FS_off_t off = sizeof(NF2FS_bfile_sector_flash_t);
+    err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_bfile_sector_type(NF2FS, file), 1,
+                              NF2FS_NULL, file->id, file->father_id, &sector, NULL);
+    if (err)
+        goto cleanup;
+    *new_sector = sector;
+
+    err = NF2FS_bfile_prog(NF2FS, &sector, &off, data, tail->size);
+
+cleanup:
+    NF2FS_free(data);
+    return err;
+}
+
+// truncate a big file to size, it's changed to a small file if size is not larger than threshold
+int NF2FS_big_file_truncate(NF2FS_t *NF2FS, NF2FS_file_ram_t *file, NF2FS_size_t size)
+{
+    int err = NF2FS_ERR_OK;
+    NF2FS_ASSERT(size < file->file_size);
+
+    NF2FS_bfile_index_flash_t *bfile = (NF2FS_bfile_index_flash_t *)file->file_cache.buffer;
+    NF2FS_bfile_index_ram_t *index = bfile->index;
+    NF2FS_size_t num = (file->file_cache.size - sizeof(NF2FS_head_t)) / sizeof(NF2FS_bfile_index_ram_t);
+
+    if (size <= NF2FS_FILE_SIZE_THRESHOLD) {
+        // read data left before sectors are old
+        uint8_t data[NF2FS_FILE_SIZE_THRESHOLD];
+        NF2FS_size_t pos = file->file_pos;
+        file->file_pos = 0;
+        if (size > 0) {
+            err = NF2FS_big_file_read(NF2FS, file, data, size);
+            if (err)
+                return err;
+        }
+        file->file_pos = pos;
+
+        err = NF2FS_bfile_sector_old(NF2FS, index, num);
+        if (err)
+            return err;
+
+        // Delete old index, the new data is proged when flushing
+        err = NF2FS_data_delete(NF2FS, file->father_id, file->file_cache.sector,
+                                 file->file_cache.off, NF2FS_dhead_dsize(bfile->head));
+        if (err)
+            return err;
+        file->file_cache.sector = NF2FS_NULL;
+
+        NF2FS_sfile_data_flash_t *small_file = (NF2FS_sfile_data_flash_t *)file->file_cache.buffer;
+        small_file->head = NF2FS_MKDHEAD(0, 1, file->id, NF2FS_DATA_SFILE_DATA, size + sizeof(NF2FS_head_t));
+        memcpy(small_file->data, data, size);
+        file->file_size = size;
+        file->file_cache.size = size + sizeof(NF2FS_head_t);
+        file->file_cache.change_flag = true;
+        return err;
+    }
+
+    // Find the index where the file ends now.
+    NF2FS_off_t off = 0;
+    int i = 0;
+    for (i = 0; i < num; i++) {
+        if (off + index[i].size >= size)
+            break;
+        off += index[i].size;
+    }
+    NF2FS_ASSERT(i < num);
+
+    // indexes behind the end are dropped, the part of index i behind the end too
+    NF2FS_bfile_index_ram_t dropped[NF2FS_FILE_INDEX_MAX + 1];
+    NF2FS_size_t dropped_num = 0;
+    NF2FS_bfile_index_ram_t rest = index[i];
+    NF2FS_index_jump(NF2FS, &rest, size - off);
+    index[i].size = size - off;
+    if (rest.size > 0)
+        dropped[dropped_num++] = rest;
+    for (int j = i + 1; j < num; j++)
+        dropped[dropped_num++] = index[j];
+    NF2FS_size_t index_num = i + 1;
+
+    // Appends prog to free space behind the last index, so data in the middle of the last sector
+    // is moved to a new sector, and the old one is dropped.
+    if (rest.off != sizeof(NF2FS_bfile_sector_flash_t)) {
+        NF2FS_bfile_index_ram_t tail = {
+            .sector = rest.sector,
+            .off = (index[i].sector == rest.sector) ? index[i].off : sizeof(NF2FS_bfile_sector_flash_t),
+            .size = 0,
+        };
+        tail.size = rest.off - tail.off;
+
+        NF2FS_size_t sector = NF2FS_NULL;
+        err = NF2FS_bfile_tail_move(NF2FS, file, &tail, &sector);
+        if (err)
+            return err;
+
+        dropped[dropped_num++] = tail;
+        index[i].size -= tail.size;
+        if (index[i].size > 0)
+            i++;
+        index[i].sector = sector;
+        index[i].off = sizeof(NF2FS_bfile_sector_flash_t);
+        index[i].size = tail.size;
+        index_num = i + 1;
+    }
+
+    // sectors only have dropped data are old, the first and last ones may be shared with others
+    NF2FS_bfile_index_ram_t old[NF2FS_FILE_INDEX_MAX + 1];
+    NF2FS_size_t old_num = 0;
+    for (int j = 0; j < dropped_num; j++) {
+        NF2FS_bfile_index_ram_t run = dropped[j];
+        if (NF2FS_index_has_sector(NF2FS, index, index_num, run.sector) ||
+            NF2FS_index_has_sector(NF2FS, dropped, j, run.sector)) {
+            NF2FS_size_t len = NF2FS_min(NF2FS->cfg->sector_size - run.off, run.size);
+            NF2FS_index_jump(NF2FS, &run, len);
+        }
+        if (run.size == 0)
+            continue;
+
+        NF2FS_bfile_index_ram_t last = run;
+        NF2FS_index_jump(NF2FS, &last, run.size - 1);
+        if (NF2FS_index_has_sector(NF2FS, index, index_num, last.sector) ||
+            NF2FS_index_has_sector(NF2FS, dropped, j, last.sector)) {
+            run.size -= (last.sector == run.sector) ? run.size :
+                        last.off + 1 - sizeof(NF2FS_bfile_sector_flash_t);
+        }
+        if (run.size > 0)
+            old[old_num++] = run;
+    }
+    err = NF2FS_bfile_sector_old(NF2FS, old, old_num);
+    if (err)
+        return err;
+
+    file->file_size = size;
+    file->file_cache.size = index_num * sizeof(NF2FS_bfile_index_ram_t) + sizeof(NF2FS_head_t);
+    file->file_cache.change_flag = true;
+    NF2FS_ASSERT(file->file_cache.size <= NF2FS_FILE_CACHE_SIZE);
+    return err;
+}
@@ -11,6 +11,7 @@
 #include "NF2FS_rw.h"
 #include "NF2FS_head.h"
 #include "NF2FS_util.h"
+#include "NF2FS_bitmap.h"
 
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
@@ -26,6 +27,8 @@ void NF2FS_region_map_free(NF2FS_region_map_ram_t* region_map)
             NF2FS_free(region_map->dir_region);
         if (region_map->bfile_region)
             NF2FS_free(region_map->bfile_region);
+        if (region_map->moved_region)
+            NF2FS_free(region_map->moved_region);
         NF2FS_free(region_map);
     }
 }
@@ -44,6 +47,11 @@ int NF2FS_region_map_init(NF2FS_size_t region_num, NF2FS_region_map_ram_t** regi
         goto cleanup;
     }
 
+    region_map->change_flag= NF2FS_REGION_MAP_NOCHANGE;
+    region_map->dir_region= NULL;
+    region_map->bfile_region= NULL;
+    region_map->moved_region= NULL;
+
     // the size allocated for region map buffer
     size= NF2FS_alignup(region_num, sizeof(uint32_t) * 8) / 8;
 
@@ -61,7 +69,15 @@ int NF2FS_region_map_init(NF2FS_size_t region_num, NF2FS_region_map_ram_t** regi
         err = NF2FS_ERR_NOMEM;
         goto cleanup;
     }
-    memset(region_map->dir_region, 0xff, size);
+    memset(region_map->bfile_region, 0xff, size);
+
+    // No region has been moved
+    region_map->moved_region = NF2FS_malloc(size);
+    if (!region_map->moved_region) {
+        err = NF2FS_ERR_NOMEM;
+        goto cleanup;
+    }
+    memset(region_map->moved_region, 0, size);
 
     *region_map_addr = region_map;
     return err;
@@ -95,9 +111,9 @@ int NF2FS_region_type(NF2FS_region_map_ram_t *region_map, NF2FS_size_t region)
 
     int i = region / (sizeof(uint32_t) * 8);
     int j = region % (sizeof(uint32_t) * 8);
-    if ((region_map->dir_region[i] >> j) & 1U) {
+    if (!((region_map->dir_region[i] >> j) & 1U)) {
         return NF2FS_SECTOR_DIR;
-    } else if ((region_map->bfile_region[i] >> j) & 1U) {
+    } else if (!((region_map->bfile_region[i] >> j) & 1U)) {
         return NF2FS_SECTOR_BFILE;
     } else {
         NF2FS_ERROR("WRONG region type\n");
@@ -130,9 +146,9 @@ int NF2FS_region_map_flush(NF2FS_t* NF2FS, NF2FS_region_map_ram_t* region_map)
         return err;
     }
 
-    // Create in-flash region map structure.
+    // Create in-flash region map structure, bits turned to 1 need a new one.
     // should be freed after using.
-    NF2FS_size_t len = sizeof(NF2FS_region_map_flash_t) + map_len;
+    NF2FS_size_t len = sizeof(NF2FS_region_map_flash_t) + 2 * map_len;
     NF2FS_region_map_flash_t *flash_map = NF2FS_malloc(len);
     if (!flash_map) {
         err = NF2FS_ERR_NOMEM;
@@ -142,10 +158,18 @@ int NF2FS_region_map_flush(NF2FS_t* NF2FS, NF2FS_region_map_ram_t* region_map)
     // Assign data for in-flash region map.
     flash_map->head = NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_REGION_MAP, len);
     memcpy((uint8_t *)flash_map->map, (uint8_t *)region_map->dir_region, map_len);
+    memcpy((uint8_t *)flash_map->map + map_len, (uint8_t *)region_map->bfile_region, map_len);
 
     // Prog to NOR flash directly
     err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, flash_map, len);
-    
+    if (err)
+        goto cleanup;
+
+    // later changes are in-place in the new map
+    region_map->begin= NF2FS->superblock->sector;
+    region_map->off= NF2FS->superblock->free_off - len;
+    region_map->change_flag= NF2FS_REGION_MAP_NOCHANGE;
+
 cleanup:
     if (flash_map)
         NF2FS_free(flash_map);
@@ -157,9 +181,11 @@ uint32_t* NF2FS_region_map_get(NF2FS_flash_manage_ram_t* manager, int smap_type,
 {
     switch (smap_type) {
     case NF2FS_SECTOR_BFILE:
+    case NF2FS_SECTOR_HOT_BFILE:
         *region_index= &manager->region_map->bfile_index;
         return manager->region_map->bfile_region;
     case NF2FS_SECTOR_DIR:
+    case NF2FS_SECTOR_HOT_DIR:
         *region_index= &manager->region_map->dir_index;
         return manager->region_map->dir_region;
     case NF2FS_SECTOR_META:
@@ -170,6 +196,106 @@ uint32_t* NF2FS_region_map_get(NF2FS_flash_manage_ram_t* manager, int smap_type,
     return NULL;
 }
 
+// Record the change of region map, a new map is never turned back to an in-place change.
+void NF2FS_region_map_changed(NF2FS_region_map_ram_t* region_map, uint32_t change_flag)
+{
+    region_map->change_flag= NF2FS_max(region_map->change_flag, change_flag);
+}
+
+// remove a region from origin region type
+int NF2FS_remove_region(NF2FS_t* NF2FS, NF2FS_region_map_ram_t* region_map, int type, NF2FS_size_t region)
+{
+    NF2FS_off_t* region_index;
+    uint32_t* region_buffer= NF2FS_region_map_get(NF2FS->manager, type, &region_index);
+    if (region_buffer == NULL)
+        return NF2FS_ERR_INVAL;
+
+    // bit 1 means not owned, it can not be proged in place
+    NF2FS_bitmap_set(region_buffer, region, 1);
+    NF2FS_bitmap_set(region_map->moved_region, region, 1);
+    NF2FS_region_map_changed(region_map, NF2FS_REGION_MAP_NEW_MAP);
+    return NF2FS_ERR_OK;
+}
+
+// alloc a new region with num sequential free sectors to dir or file, when its regions are used up.
+// Regions not owned by any type come first, then free regions of the other type, at last the
+// other type's regions that are at least half free. Regions moved in the current scan are
+// not moved again, so regions do not flip between the two types.
+int NF2FS_region_alloc(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int type, NF2FS_size_t num,
+                       NF2FS_size_t* region)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_region_map_ram_t* region_map= manager->region_map;
+
+    // Get pointers of the type and the other type
+    bool dir_type= (type == NF2FS_SECTOR_DIR || type == NF2FS_SECTOR_HOT_DIR);
+    int other_type= dir_type ? NF2FS_SECTOR_BFILE : NF2FS_SECTOR_DIR;
+    NF2FS_off_t* region_index;
+    NF2FS_off_t* other_index;
+    uint32_t* region_buffer= NF2FS_region_map_get(manager, type, &region_index);
+    uint32_t* other_buffer= NF2FS_region_map_get(manager, other_type, &other_index);
+    NF2FS_map_ram_t* map= NF2FS_smap_get(manager, type);
+    if (region_buffer == NULL || other_buffer == NULL || map == NULL)
+        return NF2FS_ERR_INVAL;
+
+    // regions are read into map, go back to the old one if nothing is found
+    NF2FS_size_t old_region= map->region;
+    NF2FS_size_t other_cnt= manager->region_num -
+                           NF2FS_bitmap_count(other_buffer, 0, manager->region_num);
+    for (int pass= 0; pass < 3; pass++) {
+        for (NF2FS_size_t i= 0; i < manager->region_num; i++) {
+            // buffered regions and regions of the type are skipped
+            if (i == region_map->reserve || i == old_region || NF2FS_smap_buffered(manager, map, i) ||
+                !NF2FS_bitmap_test(region_buffer, i) ||
+                !NF2FS_region_run_fit(manager, i, num))
+                continue;
+
+            bool is_other= !NF2FS_bitmap_test(other_buffer, i);
+            if (pass == 0 && is_other)
+                continue;
+            if (pass > 0 && (!is_other || other_cnt <= NF2FS_REGION_KEEP_MIN ||
+                             NF2FS_bitmap_test(region_map->moved_region, i)))
+                continue;
+            if (pass == 1 && manager->region_run[i] != manager->region_size)
+                continue;
+
+            // check the in-flash map of the region
+            err= NF2FS_ram_map_change(NF2FS, i, manager->region_size, map,
+                                     manager->smap_begin, manager->smap_off);
+            if (err)
+                return err;
+            NF2FS_region_run_update(manager, map);
+            if ((pass == 1 && map->free_num != manager->region_size) ||
+                (pass == 2 && map->free_num < manager->region_size / 2) ||
+                manager->region_run[i] < num)
+                continue;
+
+            // move the region to the type
+            if (is_other) {
+                err= NF2FS_remove_region(NF2FS, region_map, other_type, i);
+                if (err)
+                    return err;
+            }
+            NF2FS_bitmap_clear(region_buffer, i, 1);
+            NF2FS_region_map_changed(region_map, NF2FS_REGION_MAP_IN_PLACE_CHANGE);
+            *region= i;
+            return err;
+        }
+    }
+
+    // There really has no more space.
+    if (old_region == NF2FS_NULL) {
+        map->region= NF2FS_NULL;
+        map->free_num= 0;
+    } else {
+        err= NF2FS_ram_map_change(NF2FS, old_region, manager->region_size, map,
+                                 manager->smap_begin, manager->smap_off);
+        if (err)
+            return err;
+    }
+    return NF2FS_ERR_NOSPC;
+}
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * ----------------------------------------------------------    Basic map operations    ---------------------------------------------------------
@@ -221,8 +347,8 @@ int NF2FS_map_flush(NF2FS_t *NF2FS, NF2FS_map_ram_t *map, NF2FS_size_t buffer_le
     }
 
     // Flush to NOR flash
-    // without the head structure, we use cfg->prog directly.
-    err = NF2FS->cfg->prog(NF2FS->cfg, sector, off, map->buffer, buffer_len);
+    // without the head structure, we use NF2FS_dev_prog directly.
+    err = NF2FS_dev_prog(NF2FS, sector, off, map->buffer, buffer_len);
     NF2FS_ASSERT(err <= 0);
     return err;
 }
@@ -255,25 +381,6 @@ int NF2FS_erase_map_flush(NF2FS_t* NF2FS, NF2FS_map_ram_t* emap, NF2FS_size_t ne
     return err;
 }
 
-// count the valid bits number (bit 1) in the buffer
-int NF2FS_valid_bits_cnt(uint32_t* buffer, uint32_t bits_in_buffer)
-{
-    uint32_t cnt= 0;
-    uint32_t i= 0;
-    uint32_t j= 0;
-    for (int loop= 0; loop < bits_in_buffer; loop++) {
-        if ((buffer[i] >> j) & 1U)
-            cnt++;
-
-        j++;
-        if (j == 32) {
-            i++;
-            j= 0;
-        }
-    }
-    return cnt;
-}
-
 // The in-ram map change function.
 int NF2FS_ram_map_change(NF2FS_t *NF2FS, NF2FS_size_t region, NF2FS_size_t bits_in_buffer,
                         NF2FS_map_ram_t *map, NF2FS_size_t map_begin, NF2FS_size_t map_off)
@@ -298,7 +405,7 @@ int NF2FS_ram_map_change(NF2FS_t *NF2FS, NF2FS_size_t region, NF2FS_size_t bits_
         return err;
 
     // count the valid bits in the map buffer
-    map->free_num = NF2FS_valid_bits_cnt(map->buffer, bits_in_buffer);
+    map->free_num = NF2FS_bitmap_count(map->buffer, 0, bits_in_buffer);
     return err;
 }
 
@@ -306,69 +413,24 @@ int NF2FS_ram_map_change(NF2FS_t *NF2FS, NF2FS_size_t region, NF2FS_size_t bits_
 int NF2FS_find_in_map(NF2FS_t *NF2FS, NF2FS_size_t bits_in_buffer, NF2FS_map_ram_t *map,
                      NF2FS_size_t num, NF2FS_size_t *begin)
 {
-    int cnt = 0;
+    NF2FS_size_t cnt = 0;
 
     // If there are no enough free sectors, current alloc is failed.
     NF2FS_ASSERT(map->free_num != NF2FS_NULL);
     if (map->free_num < num)
         return 0;
 
-    // There are 32 bits in NF2FS_size_t
-    int uint32_bits = 32;
-    int max = bits_in_buffer / uint32_bits;
-    int i = map->index_or_changed / uint32_bits;
-    int j = map->index_or_changed % uint32_bits;
-    for (; i < max;) {
-        for (; j < uint32_bits; j++) {
-            // Find num sequential sectors to use.
-            if ((map->buffer[i] >> j) & 1) {
-                cnt++;
-                if (cnt == num) {
-                    j++;
-                    break;
-                }
-            }
-            else
-                cnt = 0;
-        }
-
-        // find, return directly
-        if (cnt == num)
-            break;
-        
-        // find in the next loop
-        j = 0;
-        i++;
-    }
-
-    // There are two cases when we change bit map
-    // 1. In the same NF2FS_size_t, i.e map->buffer[i]
-    // 2. In map->buffer[i] and in map->buffer[i+1]
-    if (cnt == num) {
-        NF2FS_size_t origin = i * uint32_bits + j - num;
-        NF2FS_size_t temp = 0;
-
-        // If it's case 2, turn map->buffer[i] first.
-        // TODO, need to change in the future.
-        if (i > 0 && j < num) {
-            for (int k = 0; k < num - j; k++)
-                temp = (temp >> 1) | (1U << 31);
-            map->buffer[0] &= ~temp;
-            origin = uint32_bits * i;
-        }
-
-        // Turn others.
-        temp = 0;
-        for (int k = 0; k < i * uint32_bits + j - origin; k++) {
-            temp = (temp << 1) | 1U;
-        }
-        map->buffer[i] &= ~(temp << ((j < num) ? 0 : j - num));
+    // Find num sequential free bits after the index, runs may cross words.
+    NF2FS_size_t origin = NF2FS_bitmap_find(map->buffer, map->index_or_changed,
+                                           bits_in_buffer, num, &cnt);
+    if (origin != NF2FS_NULL) {
+        NF2FS_bitmap_clear(map->buffer, origin, num);
 
         // Change other things.
         map->free_num -= num;
-        map->index_or_changed = i * uint32_bits + j;
-        *begin = bits_in_buffer * map->region + map->index_or_changed - num;
-        return cnt;
+        map->index_or_changed = origin + num;
+        *begin = bits_in_buffer * map->region + origin;
+        return num;
     }
 
     // tell the max number of sequential sectors in buffer
@@ -379,6 +441,248 @@ int NF2FS_find_in_map(NF2FS_t *NF2FS, NF2FS_size_t bits_in_buffer, NF2FS_map_ram
     return cnt;
 }
 
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * -----------------------------------------------------------    Free run operations    ---------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Set free runs of all regions to run.
+void NF2FS_region_run_reset(NF2FS_flash_manage_ram_t* manager, uint16_t run)
+{
+    for (int i= 0; i < manager->region_num; i++)
+        manager->region_run[i]= run;
+}
+
+// Record the longest free run of the region buffered in sector map.
+void NF2FS_region_run_update(NF2FS_flash_manage_ram_t* manager, NF2FS_map_ram_t* map)
+{
+    if (map->region == NF2FS_NULL)
+        return;
+    manager->region_run[map->region]= NF2FS_bitmap_longest(map->buffer, 0, manager->region_size);
+}
+
+// Whether or not num sequential free sectors may be found in the region.
+bool NF2FS_region_run_fit(NF2FS_flash_manage_ram_t* manager, NF2FS_size_t region, NF2FS_size_t num)
+{
+    uint16_t run= manager->region_run[region];
+    return run == NF2FS_REGION_RUN_UNKNOWN || run >= num;
+}
+
+// Recalculate free runs with bits [bit, bit + bits) of the whole free map in data.
+// run is the length of free run ending at bit, and turns to the one ending at bit + bits.
+void NF2FS_region_run_scan(NF2FS_flash_manage_ram_t* manager, const uint32_t* data,
+                           NF2FS_size_t bit, NF2FS_size_t bits, NF2FS_size_t* run)
+{
+    NF2FS_size_t i= 0;
+    while (i < bits) {
+        NF2FS_size_t region= (bit + i) / manager->region_size;
+        if (region >= manager->region_num)
+            return;
+
+        // runs do not cross regions
+        if ((bit + i) % manager->region_size == 0) {
+            manager->region_run[region]= 0;
+            *run= 0;
+        }
+
+        NF2FS_size_t end= NF2FS_min(bits, (region + 1) * manager->region_size - bit);
+        while (i < end) {
+            NF2FS_size_t start= NF2FS_bitmap_next(data, i, end, true);
+            if (start != i)
+                *run= 0;
+            if (start == end)
+                break;
+
+            i= NF2FS_bitmap_next(data, start, end, false);
+            *run+= i - start;
+            manager->region_run[region]= NF2FS_max(manager->region_run[region], *run);
+        }
+        i= end;
+    }
+}
+
+// The length of commit message, free runs of regions are behind it if they fit in a cache.
+NF2FS_size_t NF2FS_commit_len(NF2FS_t* NF2FS)
+{
+    NF2FS_size_t len= sizeof(NF2FS_commit_flash_t) + NF2FS->manager->region_num;
+    if (len >= NF2FS->cfg->cache_size)
+        return sizeof(NF2FS_commit_flash_t);
+    return len;
+}
+
+// Record free runs of regions behind the commit message.
+void NF2FS_region_run_commit(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit)
+{
+    NF2FS_size_t num= NF2FS_dhead_dsize(commit->head) - sizeof(NF2FS_commit_flash_t);
+    for (int i= 0; i < num; i++)
+        commit->region_run[i]= NF2FS_min(NF2FS->manager->region_run[i], NF2FS_REGION_RUN_FLASH_MAX);
+}
+
+// Assign free runs of regions with commit message, runs not recorded are unknown.
+void NF2FS_region_run_assign(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit)
+{
+    NF2FS_size_t num= NF2FS_dhead_dsize(commit->head) - sizeof(NF2FS_commit_flash_t);
+    for (int i= 0; i < NF2FS->manager->region_num; i++) {
+        if (i < num && commit->region_run[i] != NF2FS_REGION_RUN_FLASH_MAX)
+            NF2FS->manager->region_run[i]= commit->region_run[i];
+        else
+            NF2FS->manager->region_run[i]= NF2FS_REGION_RUN_UNKNOWN;
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ----------------------------------------------------------    Erase times operations    -------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Set erase times of all regions to etimes, NF2FS_NULL means unknown.
+void NF2FS_region_etimes_reset(NF2FS_flash_manage_ram_t* manager, NF2FS_size_t etimes)
+{
+    for (int i= 0; i < manager->region_num; i++)
+        manager->region_etimes[i]= etimes;
+    manager->region_etimes_changed= false;
+}
+
+// Whether or not erase times of all regions are known.
+bool NF2FS_region_etimes_known(NF2FS_flash_manage_ram_t* manager)
+{
+    for (int i= 0; i < manager->region_num; i++) {
+        if (manager->region_etimes[i] == NF2FS_NULL)
+            return false;
+    }
+    return true;
+}
+
+// Count an erase of the physical sector.
+void NF2FS_region_etimes_add(NF2FS_t* NF2FS, NF2FS_size_t sector)
+{
+    NF2FS_flash_manage_ram_t* manager= NF2FS->manager;
+    if (!manager || !manager->region_etimes || !manager->region_size)
+        return;
+
+    NF2FS_size_t region= sector / manager->region_size;
+    if (region >= manager->region_num || manager->region_etimes[region] == NF2FS_NULL)
+        return;
+    manager->region_etimes[region]++;
+    manager->region_etimes_changed= true;
+}
+
+// Get erase times of all regions with sector heads, used when they are not recorded.
+int NF2FS_region_etimes_scan(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager)
+{
+    int err= NF2FS_ERR_OK;
+    const struct NF2FS_config* cfg= NF2FS->cfg;
+
+    // sectors are read in physical address, so the device should be idle
+    err= NF2FS_dev_wait(NF2FS);
+    if (err)
+        return err;
+
+    // map and wl sectors have no sector head, they are in region 0 that is never migrated
+    NF2FS_region_etimes_reset(manager, 0);
+    NF2FS_size_t smap_cnt= NF2FS_alignup(2 * cfg->sector_count / 8, cfg->sector_size) /
+                           cfg->sector_size;
+    NF2FS_size_t spe_sectors[smap_cnt + 2];
+    for (int i= 0; i < smap_cnt; i++) {
+        spe_sectors[i]= manager->smap_begin + i;
+        manager->region_etimes[0]+= manager->etimes[i];
+    }
+    spe_sectors[smap_cnt]= NF2FS->id_map->begin;
+    manager->region_etimes[0]+= NF2FS->id_map->etimes;
+    spe_sectors[smap_cnt + 1]= NF2FS_NULL;
+    if (manager->wl && manager->wl->begin != NF2FS_NULL) {
+        spe_sectors[smap_cnt + 1]= manager->wl->begin;
+        manager->region_etimes[0]+= manager->wl->etimes;
+    }
+
+    // other sectors record etimes in sector head
+    NF2FS_head_t head;
+    for (NF2FS_size_t i= 0; i < cfg->sector_count; i++) {
+        bool spe_flag= false;
+        if (i < manager->region_size) {
+            for (int j= 0; j < smap_cnt + 2; j++) {
+                if (spe_sectors[j] == i) {
+                    spe_flag= true;
+                    break;
+                }
+            }
+        }
+        if (spe_flag)
+            continue;
+
+        err= cfg->read(cfg, i, 0, &head, sizeof(NF2FS_head_t));
+        if (err)
+            return err;
+        if (head != NF2FS_NULL && !NF2FS_shead_check(head, NF2FS_NULL, NF2FS_NULL))
+            manager->region_etimes[i / manager->region_size]+= NF2FS_shead_etimes(head);
+    }
+
+    manager->region_etimes_changed= true;
+    return err;
+}
+
+// The length of the record with erase times of regions from begin, it's less than a cache.
+NF2FS_size_t NF2FS_region_etimes_len(NF2FS_t* NF2FS, NF2FS_size_t begin)
+{
+    NF2FS_size_t num= (NF2FS->cfg->cache_size - 1 - sizeof(NF2FS_region_etimes_flash_t)) /
+                      sizeof(NF2FS_size_t);
+    num= NF2FS_min(num, NF2FS->manager->region_num - begin);
+    return sizeof(NF2FS_region_etimes_flash_t) + num * sizeof(NF2FS_size_t);
+}
+
+// Fill the record with erase times of regions from begin, return the length of it.
+NF2FS_size_t NF2FS_region_etimes_record(NF2FS_t* NF2FS, NF2FS_region_etimes_flash_t* record,
+                                        NF2FS_size_t begin)
+{
+    NF2FS_flash_manage_ram_t* manager= NF2FS->manager;
+    NF2FS_size_t len= NF2FS_region_etimes_len(NF2FS, begin);
+    NF2FS_size_t num= (len - sizeof(NF2FS_region_etimes_flash_t)) / sizeof(NF2FS_size_t);
+    record->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_REGION_ETIMES, len);
+    record->begin= begin;
+    memcpy(record->etimes, &manager->region_etimes[begin], num * sizeof(NF2FS_size_t));
+    return len;
+}
+
+// Prog erase times of regions to superblock.
+int NF2FS_region_etimes_flush(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager)
+{
+    int err= NF2FS_ERR_OK;
+
+    // unknown etimes are got by reading sector heads, no need to record
+    if (!NF2FS_region_etimes_known(manager))
+        return err;
+
+    NF2FS_region_etimes_flash_t* record= NF2FS_malloc(NF2FS->cfg->cache_size);
+    if (!record)
+        return NF2FS_ERR_NOMEM;
+
+    NF2FS_size_t begin= 0;
+    while (begin < manager->region_num) {
+        NF2FS_size_t len= NF2FS_region_etimes_record(NF2FS, record, begin);
+        err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, record, len);
+        if (err)
+            goto cleanup;
+        begin+= (len - sizeof(NF2FS_region_etimes_flash_t)) / sizeof(NF2FS_size_t);
+    }
+    manager->region_etimes_changed= false;
+
+cleanup:
+    NF2FS_free(record);
+    return err;
+}
+
+// Assign erase times of regions with a record in superblock.
+void NF2FS_region_etimes_assign(NF2FS_t* NF2FS, NF2FS_region_etimes_flash_t* record)
+{
+    NF2FS_flash_manage_ram_t* manager= NF2FS->manager;
+    NF2FS_size_t num= (NF2FS_dhead_dsize(record->head) - sizeof(NF2FS_region_etimes_flash_t)) /
+                      sizeof(NF2FS_size_t);
+    for (int i= 0; i < num && record->begin + i < manager->region_num; i++)
+        manager->region_etimes[record->begin + i]= record->etimes[i];
+}
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * ----------------------------------------------------------    Sector map operations    --------------------------------------------------------
@@ -429,6 +733,18 @@ int NF2FS_smap_flush(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager)
                 manager->smap_off);
     if (err)
         return err;
+
+    // flush hot_map
+    err = NF2FS_map_flush(NF2FS, manager->hot_map, len, manager->smap_begin,
+                manager->smap_off);
+    if (err)
+        return err;
+
+    // flush hot_dir_map
+    err = NF2FS_map_flush(NF2FS, manager->hot_dir_map, len, manager->smap_begin,
+                manager->smap_off);
+    if (err)
+        return err;
     
     // flush reserve_map
     err = NF2FS_map_flush(NF2FS, manager->reserve_map, len, manager->smap_begin,
@@ -451,11 +767,40 @@ int NF2FS_smap_flush(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager)
     return err;
 }
 
+// Reload buffered sector maps after in-flash maps are merged, scan positions in them are kept.
+int NF2FS_smap_reload(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_map_ram_t* maps[6]= {manager->meta_map, manager->dir_map, manager->bfile_map,
+                               manager->hot_map, manager->hot_dir_map, manager->reserve_map};
+
+    for (int i= 0; i < 6; i++) {
+        if (maps[i]->region == NF2FS_NULL)
+            continue;
+
+        NF2FS_size_t index= maps[i]->index_or_changed;
+        err= NF2FS_ram_map_change(NF2FS, maps[i]->region, manager->region_size, maps[i],
+                                 manager->smap_begin, manager->smap_off);
+        if (err)
+            return err;
+        maps[i]->index_or_changed= index;
+        NF2FS_region_run_update(manager, maps[i]);
+    }
+
+    // marks in the erase map have been merged
+    memset(manager->erase_map->buffer, 0xff, manager->region_size / 8);
+    manager->erase_map->index_or_changed= 0;
+    manager->erase_map->free_num= 0;
+    manager->old_unmerged= false;
+    return err;
+}
+
 // Change in-flash sector map.
 int NF2FS_flash_smap_change(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager,
                        NF2FS_cache_ram_t *pcache, NF2FS_cache_ram_t *rcache)
 {
     int err= NF2FS_ERR_OK;
+    NF2FS_mapaddr_flash_t *addr = NULL;
 
     err = NF2FS_smap_flush(NF2FS, manager);
     if (err)
@@ -465,40 +810,24 @@ int NF2FS_flash_smap_change(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager,
     if (err)
         return err;
 
-    // find a new place for in-flash bitmap
+    // find a new place for in-flash bitmap, the free map and erase map are adjacent
     NF2FS_size_t old_sector = manager->smap_begin;
     NF2FS_size_t old_off = manager->smap_off;
     NF2FS_size_t need_space = 2 * NF2FS->cfg->sector_count / 8;
     NF2FS_size_t num = NF2FS_alignup(need_space, NF2FS->cfg->sector_size) /
                         NF2FS->cfg->sector_size;
-    if (old_off + need_space >= NF2FS->cfg->sector_size) {
+    NF2FS_size_t* new_etimes= NULL;
+    if (old_off + 2 * need_space > num * NF2FS->cfg->sector_size) {
         // We need to find new sector to store map message.
+        // sector_alloc erases them, and do not write sector heads because they store maps
         NF2FS_size_t new_begin = NF2FS_NULL;
+        new_etimes= NF2FS_malloc(num * sizeof(NF2FS_size_t));
+        if (!new_etimes)
+            return NF2FS_ERR_NOMEM;
         err = NF2FS_sector_alloc(NF2FS, manager, NF2FS_SECTOR_MAP, num, NF2FS_NULL,
-                                  NF2FS_NULL, NF2FS_NULL, &new_begin, NULL);
-        if (err)
-            return err;
-
-        // erase old sector map
-        err= NF2FS_map_sector_erase(NF2FS, manager->smap_begin, num, manager->etimes);
+                                  NF2FS_NULL, NF2FS_NULL, &new_begin, new_etimes);
         if (err)
-            return err;
-
-        // erase the newly allocated sectors.
-        // do not need to write a new sector head because they store maps
-        for (int i= 0; i < num; i++) {
-            NF2FS_size_t head;
-            bool if_erase= NF2FS_sector_erase(NF2FS, new_begin + num, &head);
-
-            // cal the erase times
-            if (head == NF2FS_NULL) {
-                manager->etimes[i]= 0;
-            } else if (if_erase) {
-                manager->etimes[i]= NF2FS_dhead_dsize(head) + 1;
-            } else {
-                manager->etimes[i]= NF2FS_dhead_dsize(head);
-            }
-        }
+            goto cleanup;
 
         // Update basic map message.
         manager->smap_begin= new_begin;
@@ -508,25 +837,30 @@ int NF2FS_flash_smap_change(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager,
         manager->smap_off+= need_space;
     }
 
-    // Read the free map and remove map to cache
+    // Read the free map and remove map to cache, positions are counted in bytes from sector 0
     need_space /= 2;
-    NF2FS_size_t new_sector= manager->smap_begin;
-    NF2FS_off_t off = manager->smap_off;
-    NF2FS_size_t old_sector2 = old_sector + num / 2;
-    NF2FS_off_t old_off2= (old_off + need_space >= NF2FS->cfg->sector_size) ? 0 : old_off + need_space;
+    NF2FS_size_t sector_size= NF2FS->cfg->sector_size;
+    NF2FS_size_t free_pos= old_sector * sector_size + old_off;
+    NF2FS_size_t erase_pos= free_pos + NF2FS_alignup(NF2FS->cfg->sector_count, 8) / 8;
+    NF2FS_size_t new_pos= manager->smap_begin * sector_size + manager->smap_off;
+    NF2FS_size_t map_bit= 0;
+    NF2FS_size_t run= 0;
     while (need_space > 0) {
-        NF2FS_size_t size= NF2FS_min(NF2FS->cfg->sector_size - off,
-                                   NF2FS_min(need_space, NF2FS->cfg->cache_size));
+        // one piece should not cross sectors
+        NF2FS_size_t size= NF2FS_min(need_space, NF2FS->cfg->cache_size);
+        size= NF2FS_min(size, sector_size - free_pos % sector_size);
+        size= NF2FS_min(size, sector_size - erase_pos % sector_size);
+        size= NF2FS_min(size, sector_size - new_pos % sector_size);
 
         // Read free map to pcache
-        err = NF2FS_read_to_cache(NF2FS, pcache, old_sector, old_off, size);
+        err = NF2FS_read_to_cache(NF2FS, pcache, free_pos / sector_size, free_pos % sector_size, size);
         if (err)
-            return err;
+            goto cleanup;
 
         // Read remove map to rcache
-        err = NF2FS_read_to_cache(NF2FS, rcache, old_sector2, old_off2, size);
+        err = NF2FS_read_to_cache(NF2FS, rcache, erase_pos / sector_size, erase_pos % sector_size, size);
         if (err)
-            return err;
+            goto cleanup;
 
         // Emerge into one free map.
         NF2FS_size_t *data1 = (NF2FS_size_t *)pcache->buffer;
@@ -538,32 +872,47 @@ int NF2FS_flash_smap_change(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager,
             data2++;
         }
 
-        // Program the new free map into flash, we use cfg->prog with the head structure
-        err = NF2FS->cfg->prog(NF2FS->cfg, new_sector, off, pcache->buffer, size);
+        // free sectors come back, recalculate free runs of regions
+        NF2FS_region_run_scan(manager, (uint32_t*)pcache->buffer, map_bit, size * 8, &run);
+        map_bit+= size * 8;
+
+        // Program the new free map into flash, we use NF2FS_dev_prog with the head structure
+        err = NF2FS_dev_prog(NF2FS, new_pos / sector_size, new_pos % sector_size, pcache->buffer, size);
         NF2FS_ASSERT(err <= 0);
-        if (err) {
-            return err;
-        }
+        if (err)
+            goto cleanup;
 
-        off += size;
-        old_off += size;
-        old_off2 += size;
-        if (old_off >= NF2FS->cfg->sector_size) {
-            off = 0;
-            old_off = 0;
-            old_off2 = 0;
-            new_sector++;
-            old_sector++;
-            old_sector2++;
-        }
+        free_pos += size;
+        erase_pos += size;
+        new_pos += size;
         need_space -= size;
     }
 
+    // the old map sectors can be erased after merged
+    if (new_etimes) {
+        err= NF2FS_map_sector_erase(NF2FS, old_sector, num, manager->etimes);
+        if (err)
+            goto cleanup;
+        memcpy(manager->etimes, new_etimes, num * sizeof(NF2FS_size_t));
+    }
+
+    // marks in erase map are merged, buffered free maps should have sectors freed
+    err= NF2FS_smap_reload(NF2FS, manager);
+    if (err)
+        goto cleanup;
+
+    // old map sectors are reused after the next merge
+    if (new_etimes) {
+        err= NF2FS_emap_set(NF2FS, manager, old_sector, num);
+        if (err)
+            goto cleanup;
+    }
+
     NF2FS_cache_one(NF2FS, pcache);
 
     // prog the new map_addr to superblock
     NF2FS_size_t len = sizeof(NF2FS_mapaddr_flash_t) + num * sizeof(NF2FS_size_t);
-    NF2FS_mapaddr_flash_t *addr = NF2FS_malloc(len);
+    addr = NF2FS_malloc(len);
     if (addr == NULL) {
         err = NF2FS_ERR_NOMEM;
         goto cleanup;
@@ -576,15 +925,27 @@ int NF2FS_flash_smap_change(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager,
     for (int i = 0; i < num; i++) {
         addr->erase_times[i] = manager->etimes[i];
     }
-    err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, &addr, len);
+    err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, addr, len);
+    if (err)
+        goto cleanup;
+
+    // erase times of regions are recorded once a scan, so crash loses at most a scan of them
+    err= NF2FS_region_etimes_flush(NF2FS, manager);
+    if (err)
+        goto cleanup;
 
     // we have scanned nor flash one time, increase it.
+    // regions moved in the last scan can be moved again.
     manager->scan_times++;
+    memset(manager->region_map->moved_region, 0,
+           NF2FS_alignup(manager->region_num, sizeof(uint32_t) * 8) / 8);
 
 cleanup:
     // we should finally free the allocated message.
     if (addr != NULL)
         NF2FS_free(addr);
+    if (new_etimes != NULL)
+        NF2FS_free(new_etimes);
     return err;
 }
 
@@ -594,8 +955,12 @@ NF2FS_map_ram_t* NF2FS_smap_get(NF2FS_flash_manage_ram_t* manager, int smap_type
     switch (smap_type) {
     case NF2FS_SECTOR_BFILE:
         return manager->bfile_map;
+    case NF2FS_SECTOR_HOT_BFILE:
+        return manager->hot_map;
     case NF2FS_SECTOR_DIR:
         return manager->dir_map;
+    case NF2FS_SECTOR_HOT_DIR:
+        return manager->hot_dir_map;
     case NF2FS_SECTOR_META:
         return manager->meta_map;
     case NF2FS_SECTOR_RESERVE:
@@ -607,16 +972,30 @@ NF2FS_map_ram_t* NF2FS_smap_get(NF2FS_flash_manage_ram_t* manager, int smap_type
     return NULL;
 }
 
-// Find next region of sector map to scan.
+// Whether or not the region is buffered by a sector map other than map.
+bool NF2FS_smap_buffered(NF2FS_flash_manage_ram_t* manager, NF2FS_map_ram_t* map, NF2FS_size_t region)
+{
+    NF2FS_map_ram_t* maps[6]= {manager->meta_map, manager->dir_map, manager->bfile_map,
+                               manager->hot_map, manager->hot_dir_map, manager->reserve_map};
+
+    for (int i= 0; i < 6; i++) {
+        if (maps[i] != map && maps[i]->region == region)
+            return true;
+    }
+    return false;
+}
+
+// Find next region of sector map to scan, the region may have num sequential free sectors.
 // not including the erase, meta, and reserve map.
-int NF2FS_sector_nextsmap(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int smap_type)
+int NF2FS_sector_nextsmap(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int smap_type,
+                          NF2FS_size_t num)
 {
     int err= NF2FS_ERR_OK;
 
     // these two map has fixed region
     NF2FS_map_ram_t* map= NF2FS_smap_get(manager, smap_type);
     if (smap_type == NF2FS_SECTOR_META || smap_type == NF2FS_SECTOR_RESERVE) {
-        map->free_num= NF2FS_valid_bits_cnt(map->buffer, manager->region_size);
+        map->free_num= NF2FS_bitmap_count(map->buffer, 0, manager->region_size);
         map->index_or_changed= 0;
         // if it's format, we alloc region 0 as meta region
         if (map->region == NF2FS_NULL) {
@@ -624,6 +1003,7 @@ int NF2FS_sector_nextsmap(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int
             map->region= manager->region_map->reserve;
             manager->region_map->reserve++;
         }
+        NF2FS_region_run_update(manager, map);
         return err;
     }
 
@@ -640,89 +1020,204 @@ int NF2FS_sector_nextsmap(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int
             return err;
     }
 
+    // After NF2FS_WL_START scans, candidate regions with less etimes are used first
+    if (manager->scan_times >= NF2FS_WL_START) {
+        bool found= false;
+        err= NF2FS_wl_nextsmap(NF2FS, manager, smap_type, num, &found);
+        if (err || found)
+            return err;
+    }
+
     // Change to the next region for dir, bfile map
     int uint32_bits= 32;
-    if (manager->scan_times < NF2FS_WL_START) {
-        // If we first scan NOR flash, reserve is used to indicate the next free region
-        if (manager->scan_times == 0 && manager->region_map->reserve != manager->region_num - 1) {
-            // use reserve region as the next free region
-            map->region= manager->region_map->reserve;
-            map->free_num= manager->region_size;
-            map->index_or_changed= 0;
-            memset(map->buffer, 0xff, manager->region_size / 8);
-
-            // update region map message
-            region_buffer[manager->region_map->reserve / uint32_bits]&=
-                ~(1U << (manager->region_map->reserve % uint32_bits));
-            *region_index= manager->region_map->reserve + 1;
-            manager->region_map->change_flag= NF2FS_REGION_MAP_IN_PLACE_CHANGE;
-            manager->region_map->reserve++;
-            return err;
-        }
+    // If we first scan NOR flash, reserve is used to indicate the next free region
+    if (manager->scan_times == 0 && manager->region_map->reserve != manager->region_num - 1) {
+        // use reserve region as the next free region
+        map->region= manager->region_map->reserve;
+        map->free_num= manager->region_size;
+        map->index_or_changed= 0;
+        memset(map->buffer, 0xff, manager->region_size / 8);
+        manager->region_run[map->region]= manager->region_size;
+
+        // update region map message
+        region_buffer[manager->region_map->reserve / uint32_bits]&=
+            ~(1U << (manager->region_map->reserve % uint32_bits));
+        *region_index= manager->region_map->reserve + 1;
+        NF2FS_region_map_changed(manager->region_map, NF2FS_REGION_MAP_IN_PLACE_CHANGE);
+        manager->region_map->reserve++;
+        return err;
+    }
 
-        // change buffered map in the normal scan without WL
-        NF2FS_size_t i = *region_index / uint32_bits;
-        NF2FS_size_t j = *region_index % uint32_bits;
-        while (true) {
-            // find all regions, but don's have another one.
-            if (*region_index == map->region) {
-                // TODO in the future
-                // steal from the other region map, or there really has no more space.
-                err = NF2FS_ERR_NOSPC;
+    // change buffered map in the normal scan
+    NF2FS_size_t scanned= 0;
+    while (true) {
+        // change the in-flash map if we scan flash once
+        if (*region_index >= manager->region_num && scanned < manager->region_num) {
+            *region_index= 0;
+            err= NF2FS_flash_smap_change(NF2FS, manager, NF2FS->pcache, NF2FS->rcache);
+            if (err) {
+                NF2FS_ERROR("NF2FS_flash_smap_change error\n");
                 return err;
             }
+        }
 
-            // Looped to find the next used region.
-            // In nor flash, bit 0 means used, bit 1 means not used.
-            if (~((region_buffer[i] >> j) & 1U)) {
-                err= NF2FS_ram_map_change(NF2FS, *region_index, manager->region_size, map,
-                                         manager->smap_begin, manager->smap_off);
-                *region_index = *region_index + 1;
+        // find all regions, but don's have another one, take one from others.
+        if (*region_index == map->region || scanned == manager->region_num) {
+            NF2FS_size_t region;
+            err= NF2FS_region_alloc(NF2FS, manager, smap_type, num, &region);
+            if (err)
                 return err;
-            }
+            *region_index= region + 1;
+            return err;
+        }
+        scanned++;
 
-            // Update basic message for next loop
-            *region_index = *region_index + 1;
-            j++;
-            if (j == uint32_bits) {
-                i++;
-                j = 0;
+        // Looped to find the next used region.
+        // In nor flash, bit 0 means used, bit 1 means not used.
+        // Regions without num sequential free sectors are skipped without reading maps.
+        NF2FS_size_t i = *region_index / uint32_bits;
+        NF2FS_size_t j = *region_index % uint32_bits;
+        if (!((region_buffer[i] >> j) & 1U) &&
+            !NF2FS_smap_buffered(manager, map, *region_index) &&
+            NF2FS_region_run_fit(manager, *region_index, num)) {
+            err= NF2FS_ram_map_change(NF2FS, *region_index, manager->region_size, map,
+                                     manager->smap_begin, manager->smap_off);
+            NF2FS_region_run_update(manager, map);
+            *region_index = *region_index + 1;
+            return err;
+        }
+
+        // Update basic message for next loop
+        *region_index = *region_index + 1;
+    }
+}
+
+// Allocate num sequential sectors that cross regions, num is larger than the region size.
+// The extent begins at the first sector of a region, regions it covers are fresh regions
+// in the first scan or free regions of the same type.
+int NF2FS_sectors_find_span(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager, NF2FS_size_t num,
+                            int smap_type, NF2FS_size_t *begin)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t len= manager->region_size / 8;
+    NF2FS_size_t cnt= NF2FS_alignup(num, manager->region_size) / manager->region_size;
+    NF2FS_iobatch_ram_t batch;
+    uint32_t* buffer= NULL;
+
+    NF2FS_map_ram_t* map= NF2FS_smap_get(manager, smap_type);
+    NF2FS_size_t* region_index;
+    uint32_t* region_buffer= NF2FS_region_map_get(manager, smap_type, &region_index);
+    if (!map || !region_buffer)
+        return NF2FS_ERR_INVAL;
+
+    // maps of covered regions are read, checked and proged together.
+    buffer= NF2FS_malloc(NF2FS_alignup(cnt * len, sizeof(uint32_t)));
+    if (!buffer)
+        return NF2FS_ERR_NOMEM;
+
+    // the buffered map is flushed, so in-flash maps are the newest.
+    err= NF2FS_map_flush(NF2FS, map, len, manager->smap_begin, manager->smap_off);
+    if (err)
+        goto cleanup;
+
+    NF2FS_size_t first= 0;
+    bool fresh= false;
+    while (true) {
+        // fresh regions are free, the last region is left for reserve.
+        fresh= (manager->scan_times == 0 && manager->region_map->reserve + cnt < manager->region_num);
+        if (fresh) {
+            first= manager->region_map->reserve;
+            memset(buffer, 0xff, cnt * len);
+            break;
+        }
+
+        // find cnt sequential regions of the type that are free, judged by free runs
+        NF2FS_size_t run= 0;
+        for (first= 1; first < manager->region_num; first++) {
+            NF2FS_size_t i= first / 32;
+            NF2FS_size_t j= first % 32;
+            if (((region_buffer[i] >> j) & 1U) || NF2FS_smap_buffered(manager, map, first) ||
+                manager->region_run[first] != manager->region_size) {
+                run= 0;
+                continue;
             }
 
-            // change the in-flash map if we scan flash once
-            if (*region_index == manager->region_num) {
-                i = 0;
-                j = 0;
-                *region_index= 0;
-                err= NF2FS_flash_smap_change(NF2FS, manager, NF2FS->pcache, NF2FS->rcache);
-                if (err) {
-                    NF2FS_ERROR("NF2FS_flash_smap_change error\n");
-                    return err;
-                }
+            run++;
+            if (run == cnt)
+                break;
+        }
+        if (run < cnt) {
+            err= NF2FS_ERR_NOSPC;
+            goto cleanup;
+        }
+        first= first + 1 - cnt;
+
+        // read maps of these regions
+        NF2FS_iobatch_init(&batch, false);
+        for (int k= 0; k < cnt; k++) {
+            NF2FS_size_t sector= manager->smap_begin;
+            NF2FS_off_t off= manager->smap_off + (first + k) * len;
+            while (off >= NF2FS->cfg->sector_size) {
+                sector++;
+                off-= NF2FS->cfg->sector_size;
             }
+
+            err= NF2FS_iobatch_add(NF2FS, &batch, sector, off, (uint8_t*)buffer + k * len, len);
+            if (err)
+                goto cleanup;
         }
-    } else if (manager->scan_times >= NF2FS_WL_START) {
-        // Change sector map with wl module.
-        NF2FS_size_t* index= (smap_type == NF2FS_SECTOR_DIR) ? &manager->wl->dir_region_index :
-                                                           &manager->wl->bfile_region_index;
-        if (manager->wl->changed_region_times == NF2FS_WL_MIGRATE_THRESHOLD) {
-            // TODO in the future
-            // now we should use LDB instead of GDB, and recalculate the wl_addr
-            NF2FS_ASSERT(-1 < 0);
+        err= NF2FS_iobatch_submit(NF2FS, &batch);
+        if (err)
+            goto cleanup;
+
+        // runs are upper bounds, correct them and try again if regions are not free.
+        if (NF2FS_bitmap_find(buffer, 0, num, num, NULL) == 0)
+            break;
+        for (int k= 0; k < cnt; k++) {
+            manager->region_run[first + k]= NF2FS_bitmap_longest(buffer, k * manager->region_size,
+                                                                 (k + 1) * manager->region_size);
         }
+    }
 
-        // TODO in the future
-        // we should flush buffered map as LDB into flash
-        NF2FS_ASSERT(-1 < 0);
+    // turn bits of the extent to 0, the last region becomes the buffered map
+    NF2FS_bitmap_clear(buffer, 0, num);
+    NF2FS_iobatch_init(&batch, true);
+    for (int k= 0; k < cnt - 1; k++) {
+        NF2FS_size_t sector= manager->smap_begin;
+        NF2FS_off_t off= manager->smap_off + (first + k) * len;
+        while (off >= NF2FS->cfg->sector_size) {
+            sector++;
+            off-= NF2FS->cfg->sector_size;
+        }
 
-        // update basic messages
-        *index= ((*index) + 1) % NF2FS_RAM_REGION_NUM;
-        manager->wl->changed_region_times++;
-        return err;
-    } else {
-        NF2FS_ERROR("ERROR in NF2FS_sector_nextsmap\n");
-        return NF2FS_ERR_INVAL;
+        err= NF2FS_iobatch_add(NF2FS, &batch, sector, off, (uint8_t*)buffer + k * len, len);
+        if (err)
+            goto cleanup;
+        manager->region_run[first + k]= 0;
     }
+    err= NF2FS_iobatch_submit(NF2FS, &batch);
+    if (err)
+        goto cleanup;
+
+    map->region= first + cnt - 1;
+    memcpy(map->buffer, (uint8_t*)buffer + (cnt - 1) * len, len);
+    map->index_or_changed= num - (cnt - 1) * manager->region_size;
+    map->free_num= NF2FS_bitmap_count(map->buffer, 0, manager->region_size);
+    NF2FS_region_run_update(manager, map);
+
+    // fresh regions now belong to the type
+    if (fresh) {
+        for (NF2FS_size_t k= first; k < first + cnt; k++)
+            region_buffer[k / 32]&= ~(1U << (k % 32));
+        NF2FS_region_map_changed(manager->region_map, NF2FS_REGION_MAP_IN_PLACE_CHANGE);
+        manager->region_map->reserve+= cnt;
+    }
+    *region_index= first + cnt;
+    *begin= first * manager->region_size;
+
+cleanup:
+    NF2FS_free(buffer);
+    return err;
 }
 
 // Allocate sequential sectors.
@@ -734,35 +1229,47 @@ int NF2FS_sectors_find(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager, NF2FS_
     if (!map)
         return NF2FS_ERR_INVAL;
 
+    // an extent larger than a region crosses regions
+    if (num > manager->region_size)
+        return NF2FS_sectors_find_span(NF2FS, manager, num, smap_type, begin);
+
     // get a region if current map does not have a region
     if (map->region == NF2FS_NULL) {
-        err= NF2FS_sector_nextsmap(NF2FS, manager, smap_type);
+        err= NF2FS_sector_nextsmap(NF2FS, manager, smap_type, num);
         if (err)
             return err;
     }
 
-    // the max num should less than the region size
-    NF2FS_ASSERT(num <= manager->region_size);
-
     NF2FS_size_t flag_region= map->region;
+    bool merged= false;
     while (true) {
-        // TODO in the future
-        // If we can not find the needed sequential sectors, we should perform GC or WL.
-        // LDB in WL is also not considered currently.
+        // If we can not find the needed sequential sectors, the caller reclaims old space of dirs.
+        // TODO in the future, LDB in WL is also not considered currently.
 
         // we have found all sectors we need
-        if (NF2FS_find_in_map(NF2FS, manager->region_size, map, num, begin) == num)
+        NF2FS_size_t cnt= NF2FS_find_in_map(NF2FS, manager->region_size, map, num, begin);
+        NF2FS_region_run_update(manager, map);
+        if (cnt == num)
             return err;
 
         // we should change the sector map if we can not find it in current buffer.
-        err = NF2FS_sector_nextsmap(NF2FS, manager, smap_type);
-        if (err)
+        err = NF2FS_sector_nextsmap(NF2FS, manager, smap_type, num);
+        if (err && err != NF2FS_ERR_NOSPC)
             return err;
 
-        // We have scanned all regions but not find
-        if (map->region == flag_region) {
-            NF2FS_ERROR("NO more space in flash\n");
-            return NF2FS_ERR_NOSPC;
+        // We have scanned all regions but not find,
+        // sectors turned old after the last merge are free again when the erase map is merged.
+        if (err || map->region == flag_region) {
+            if (merged || !manager->old_unmerged) {
+                NF2FS_ERROR("NO more space in flash\n");
+                return NF2FS_ERR_NOSPC;
+            }
+
+            err= NF2FS_flash_smap_change(NF2FS, manager, NF2FS->pcache, NF2FS->rcache);
+            if (err)
+                return err;
+            flag_region= map->region;
+            merged= true;
         }
     }
 }
@@ -792,20 +1299,49 @@ int NF2FS_sector_alloc(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager, int se
 
     int err = NF2FS_ERR_OK;
 
+    // migration of wl goes on with allocs of user sectors
+    bool dir_type= sector_type == NF2FS_SECTOR_DIR || sector_type == NF2FS_SECTOR_HOT_DIR;
+    bool user_type= dir_type || sector_type == NF2FS_SECTOR_BFILE ||
+                    sector_type == NF2FS_SECTOR_HOT_BFILE;
+
     // get sequential sectors.
     err= NF2FS_sectors_find(NF2FS, manager, num,
                            NF2FS_smap_type_transit(sector_type), begin);
+
+    // Reclaim any sector of old space in dirs a step at a time if flash is full, the owner is in use.
+    // Reclaimed sectors are in dir regions, so big files do not wait for it.
+    while (err == NF2FS_ERR_NOSPC && dir_type && !NF2FS->in_gc) {
+        NF2FS_size_t ops= 0;
+        err= NF2FS_dir_reclaim(NF2FS, id, father_id, NF2FS->cfg->sector_size,
+                               NF2FS_DIR_GC_SECTORS, &ops);
+        if (err)
+            return err;
+        if (ops == 0)
+            return NF2FS_ERR_NOSPC;
+
+        err= NF2FS_sectors_find(NF2FS, manager, num,
+                               NF2FS_smap_type_transit(sector_type), begin);
+    }
     if (err)
         return err;
 
+    // sectors of hot big files and hot dirs are normal sectors of their types
+    if (sector_type == NF2FS_SECTOR_HOT_BFILE)
+        sector_type= NF2FS_SECTOR_BFILE;
+    else if (sector_type == NF2FS_SECTOR_HOT_DIR)
+        sector_type= NF2FS_SECTOR_DIR;
+
     // Check sector heads and erase if needed.
     NF2FS_size_t sector= *begin;
     NF2FS_size_t cur_etimes= NF2FS_NULL;
     NF2FS_head_t head;
     bool if_erase;
+    NF2FS_size_t erased= 0;
     for (int i= 0; i < num; i++) {
         // erase the sector head if needed, get the old head
         if_erase= NF2FS_sector_erase(NF2FS, sector, &head);
+        if (if_erase && head != NF2FS_NULL)
+            erased++;
 
         // cal the erase times
         if (head == NF2FS_NULL) {
@@ -832,6 +1368,7 @@ int NF2FS_sector_alloc(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager, int se
                 .head= NF2FS_MKSHEAD(0, NF2FS_STATE_USING, sector_type, 0x3f, cur_etimes),
                 .pre_sector= pre_sector,
                 .id= id,
+                .next_sector= NF2FS_NULL,
             };
             err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_SHEAD, sector, 0,
                                   sizeof(NF2FS_dir_sector_flash_t), &dsector);
@@ -854,6 +1391,10 @@ int NF2FS_sector_alloc(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager, int se
 
         sector++;
     }
+
+    // a step of migration takes the place of an erase, nobody waits for a whole region
+    if (user_type)
+        err= NF2FS_wl_pace(NF2FS, manager, erased);
     return err;
 }
 
@@ -883,46 +1424,127 @@ int NF2FS_emap_set(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager,
 
     // If current erase map has valid data and it's not the region we
     // want to prog, we should flush it.
-    if ((begin / manager->region_size) != map->region &&
-        map->index_or_changed && flush_flag) {
-        err= NF2FS_erase_map_flush(NF2FS, manager->erase_map,
-                                  (begin / manager->region_size));
-        if (err)
-            return err;
+    if ((begin / manager->region_size) != map->region && flush_flag) {
+        if (map->index_or_changed) {
+            err= NF2FS_erase_map_flush(NF2FS, manager->erase_map,
+                                      (begin / manager->region_size));
+            if (err)
+                return err;
+        } else {
+            map->region= begin / manager->region_size;
+        }
     }
 
-    // Turn bits to 0.
-    int i = (begin % manager->region_size) / 32;
-    int j = (begin % manager->region_size) % 32;
-    for (int k = 0; k < num; k++) {
-        map->buffer[i] &= ~(1U << j);
-        map->index_or_changed = 1;
-
-        j++;
-        if (j == 32) {
-            // If j is up to 32.
-            i++;
-            j= 0;
-            if (i == manager->region_size / 32) {
-                if (flush_flag) {
-                    err= NF2FS_erase_map_flush(NF2FS, manager->erase_map,
-                                          map->region+1);
-                    if (err)
-                        return err;
-                } else {
-                    // If it is meta or reserve map,
-                    // then current sector should be the last.
-                    NF2FS_ASSERT(num - k == 1);
-                }
-
-                i = 0;
-                j = 0;
+    // Turn bits to 0 in erase map, the rest of sectors are in the next region.
+    // Sectors in meta and reserve map are free again directly.
+    NF2FS_size_t off = begin % manager->region_size;
+    while (num > 0) {
+        NF2FS_size_t len = NF2FS_min(num, manager->region_size - off);
+        if (flush_flag) {
+            NF2FS_bitmap_clear(map->buffer, off, len);
+            map->index_or_changed = 1;
+            manager->old_unmerged= true;
+        } else {
+            NF2FS_bitmap_set(map->buffer, off, len);
+            map->free_num= NF2FS_bitmap_count(map->buffer, 0, manager->region_size);
+        }
+        num -= len;
+        off += len;
+
+        if (off == manager->region_size) {
+            if (flush_flag) {
+                err= NF2FS_erase_map_flush(NF2FS, manager->erase_map,
+                                      map->region+1);
+                if (err)
+                    return err;
+            } else if (num > 0) {
+                // the rest of sectors are out of meta or reserve map, they use their own map
+                return NF2FS_emap_set(NF2FS, manager, NF2FS_alignup(begin + 1, manager->region_size), num);
             }
+            off = 0;
         }
     }
     return err;
 }
 
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ---------------------------------------------------------    Pre-erase operations    ---------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Walk the pool cursor over sectors whose bit in map is bit_val and pre-erase them,
+// stop when the pool has target sectors or the erase budget is used up.
+int NF2FS_preerase_map(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_map_ram_t* map,
+                       NF2FS_preerase_ram_t* pool, NF2FS_size_t begin, bool bit_val,
+                       NF2FS_size_t target, NF2FS_size_t* budget)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t num= 0;
+    bool if_erase= false;
+
+    // Only normal regions have sectors to pre-erase.
+    if (map->region == NF2FS_NULL || map->region == 0 ||
+        map->region == manager->region_map->reserve)
+        return err;
+
+    // The pool is rebuilt when the map turns to another region or scan.
+    if (pool->scan_times != manager->scan_times || pool->region != map->region ||
+        pool->cursor < begin) {
+        pool->scan_times= manager->scan_times;
+        pool->region= map->region;
+        pool->cursor= begin;
+    }
+
+    // Sectors checked before are still in the pool if they are not allocated.
+    num= NF2FS_bitmap_count(map->buffer, begin, pool->cursor);
+    if (!bit_val)
+        num= pool->cursor - begin - num;
+
+    while (num < target && *budget > 0) {
+        NF2FS_size_t i= NF2FS_bitmap_next(map->buffer, pool->cursor, manager->region_size, bit_val);
+        pool->cursor= i;
+        if (i == manager->region_size)
+            break;
+
+        err= NF2FS_sector_preerase(NF2FS, map->region * manager->region_size + i, &if_erase);
+        if (err)
+            return err;
+        if (if_erase)
+            (*budget)--;
+        num++;
+        pool->cursor++;
+    }
+    return err;
+}
+
+// Pre-erase old sectors ahead of dir and big file allocation, then the freed
+// sectors recorded in erase map. Return the number of erased sectors.
+int NF2FS_preerase(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t max_ops)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t budget= max_ops;
+
+    // Keep pools of free sectors behind the alloc index.
+    err= NF2FS_preerase_map(NF2FS, manager, manager->dir_map, &manager->dir_pool,
+                            manager->dir_map->index_or_changed, true, NF2FS_PREERASE_POOL_NUM, &budget);
+    if (err)
+        return err;
+
+    err= NF2FS_preerase_map(NF2FS, manager, manager->bfile_map, &manager->bfile_pool,
+                            manager->bfile_map->index_or_changed, true, NF2FS_PREERASE_POOL_NUM, &budget);
+    if (err)
+        return err;
+
+    // Sectors freed in this scan are reused after the next scan, erase them with the rest.
+    err= NF2FS_preerase_map(NF2FS, manager, manager->erase_map, &manager->emap_pool,
+                            0, false, NF2FS_NULL, &budget);
+    if (err)
+        return err;
+
+    return max_ops - budget;
+}
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * ------------------------------------------------------------    ID map operations    ----------------------------------------------------------
@@ -952,6 +1574,9 @@ int NF2FS_idmap_init(NF2FS_t* NF2FS, NF2FS_idmap_ram_t** map_addr)
     }
 
     // Allocate free id map.
+    idmap->ids_in_buffer= NF2FS_ID_MAX / NF2FS->cfg->region_cnt;
+    idmap->lease_begin= NF2FS_NULL;
+    idmap->lease= 0;
     err = NF2FS_map_init(NF2FS, &idmap->free_map, idmap->ids_in_buffer / 8);
     if (err) {
         err= NF2FS_ERR_NOMEM;
@@ -996,6 +1621,8 @@ int NF2FS_idmap_change(NF2FS_t *NF2FS, NF2FS_idmap_ram_t *id_map,
         return err;
 
     // find a new place for in-flash bitmap
+    NF2FS_size_t old_begin = id_map->begin;
+    NF2FS_size_t new_etimes = id_map->etimes;
     NF2FS_size_t old_sector = id_map->begin;
     NF2FS_size_t old_off = id_map->off;
     NF2FS_size_t need_space = 2 * NF2FS_ID_MAX / 8;
@@ -1004,31 +1631,13 @@ int NF2FS_idmap_change(NF2FS_t *NF2FS, NF2FS_idmap_ram_t *id_map,
     NF2FS_ASSERT(num == 1);
     if (old_off + need_space >= NF2FS->cfg->sector_size) {
         // We need to find new sector to store map message.
+        // sector_alloc erases it, and do not write sector head because it stores maps
         NF2FS_size_t new_begin = NF2FS_NULL;
         err = NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_SECTOR_MAP, num, NF2FS_NULL,
-                                  NF2FS_NULL, NF2FS_NULL, &new_begin, NULL);
-        if (err)
-            return err;
-
-        // erase old sector map, currently there is only one sector for id_map
-        err= NF2FS_map_sector_erase(NF2FS, id_map->begin, num, &id_map->etimes);
+                                  NF2FS_NULL, NF2FS_NULL, &new_begin, &new_etimes);
         if (err)
             return err;
 
-        // erase the newly allocated sectors.
-        // do not need to write a new sector head because they store maps
-        NF2FS_size_t head;
-        bool if_erase= NF2FS_sector_erase(NF2FS, new_begin, &head);
-
-        // cal the erase times
-        if (head == NF2FS_NULL) {
-            id_map->etimes= 0;
-        } else if (if_erase) {
-            id_map->etimes= NF2FS_dhead_dsize(head) + 1;
-        } else {
-            id_map->etimes= NF2FS_dhead_dsize(head);
-        }
-
         // Update basic map message.
         id_map->begin= new_begin;
         id_map->off= 0;
@@ -1067,8 +1676,8 @@ int NF2FS_idmap_change(NF2FS_t *NF2FS, NF2FS_idmap_ram_t *id_map,
             data2++;
         }
 
-        // Program the new free map into flash, we use cfg->prog with the head structure
-        err = NF2FS->cfg->prog(NF2FS->cfg, new_sector, off, pcache->buffer, size);
+        // Program the new free map into flash, we use NF2FS_dev_prog with the head structure
+        err = NF2FS_dev_prog(NF2FS, new_sector, off, pcache->buffer, size);
         NF2FS_ASSERT(err <= 0);
         if (err) {
             return err;
@@ -1090,6 +1699,14 @@ int NF2FS_idmap_change(NF2FS_t *NF2FS, NF2FS_idmap_ram_t *id_map,
 
     NF2FS_cache_one(NF2FS, pcache);
 
+    // erase old sector map after merging, currently there is only one sector for id_map
+    if (id_map->begin != old_begin) {
+        err= NF2FS_map_sector_erase(NF2FS, old_begin, num, &id_map->etimes);
+        if (err)
+            return err;
+        id_map->etimes= new_etimes;
+    }
+
     // prog the new map_addr to superblock
     NF2FS_size_t len = sizeof(NF2FS_mapaddr_flash_t) + num * sizeof(NF2FS_size_t);
     NF2FS_mapaddr_flash_t *addr = NF2FS_malloc(len);
@@ -1103,7 +1720,7 @@ int NF2FS_idmap_change(NF2FS_t *NF2FS, NF2FS_idmap_ram_t *id_map,
     addr->begin = id_map->begin;
     addr->off = id_map->off;
     addr->erase_times[0] = id_map->etimes;
-    err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, &addr, len);
+    err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, addr, len);
 
 cleanup:
     // we should finally free the allocated message.
@@ -1112,24 +1729,93 @@ cleanup:
     return err;
 }
 
-// prog the id to in-flash map directly
-int NF2FS_id_direct_prog(NF2FS_t* NF2FS, NF2FS_size_t id, NF2FS_size_t begin, NF2FS_size_t off)
+// prog bits of the word beginning at id first to used in the in-flash map directly
+int NF2FS_id_direct_prog(NF2FS_t* NF2FS, NF2FS_size_t first, uint32_t bits,
+                         NF2FS_size_t begin, NF2FS_size_t off)
 {
     int err= NF2FS_ERR_OK;
 
-    // Data to prog
-    char data= 0xff;
-    data= data & ~(1 << (id % 8));
+    // Data to prog, bits of other ids stay 1
+    uint32_t data= ~bits;
 
     // Address to prog
-    off= off + (id / 8);
+    off= off + (first / 8);
     while (off >= NF2FS->cfg->sector_size) {
         begin++;
         off-= NF2FS->cfg->sector_size;
     }
 
     // prog
-    err= NF2FS->cfg->prog(NF2FS->cfg, begin, off, &data, sizeof(char));
+    err= NF2FS_dev_prog(NF2FS, begin, off, &data, sizeof(uint32_t));
+    return err;
+}
+
+// read the word of the in-flash map beginning at id first
+int NF2FS_id_word_read(NF2FS_t* NF2FS, NF2FS_size_t first, NF2FS_size_t begin,
+                       NF2FS_size_t off, uint32_t* word)
+{
+    off= off + (first / 8);
+    while (off >= NF2FS->cfg->sector_size) {
+        begin++;
+        off-= NF2FS->cfg->sector_size;
+    }
+    return NF2FS_direct_read(NF2FS, begin, off, sizeof(uint32_t), word);
+}
+
+// prog a lease record of ids beginning at first to superblock
+int NF2FS_id_lease_record(NF2FS_t* NF2FS, NF2FS_size_t first, uint32_t bits)
+{
+    NF2FS_idlease_flash_t record= {
+        .head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_ID_LEASE, sizeof(NF2FS_idlease_flash_t)),
+        .begin= first,
+        .bits= bits,
+    };
+    return NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, &record, sizeof(NF2FS_idlease_flash_t));
+}
+
+// drop ids from the lease that are free or removed in flash
+int NF2FS_id_lease_check(NF2FS_t* NF2FS, NF2FS_idmap_ram_t* idmap)
+{
+    int err= NF2FS_ERR_OK;
+    uint32_t free_word;
+    uint32_t remove_word;
+
+    err= NF2FS_id_word_read(NF2FS, idmap->lease_begin, idmap->begin, idmap->off, &free_word);
+    if (err)
+        return err;
+
+    err= NF2FS_id_word_read(NF2FS, idmap->lease_begin, idmap->begin,
+                            idmap->off + (NF2FS_ID_MAX / 8), &remove_word);
+    if (err)
+        return err;
+
+    // used ids are 0 in free map, removed ids are 0 in remove map
+    idmap->lease&= ~free_word & remove_word;
+    return err;
+}
+
+// Give back leased ids to the remove map and close the lease record.
+int NF2FS_idmap_sync(NF2FS_t* NF2FS, NF2FS_idmap_ram_t* idmap)
+{
+    int err= NF2FS_ERR_OK;
+
+    if (idmap->lease_begin == NF2FS_NULL)
+        return err;
+
+    // leased ids are used in flash but nobody has them, remove them
+    if (idmap->lease) {
+        err= NF2FS_id_direct_prog(NF2FS, idmap->lease_begin, idmap->lease, idmap->begin,
+                                 idmap->off + (NF2FS_ID_MAX / 8));
+        if (err)
+            return err;
+        idmap->lease= 0;
+    }
+
+    // nothing is leased now, mount has no ids to check
+    err= NF2FS_id_lease_record(NF2FS, idmap->lease_begin, 0);
+    if (err)
+        return err;
+    idmap->lease_begin= NF2FS_NULL;
     return err;
 }
 
@@ -1138,23 +1824,50 @@ int NF2FS_id_alloc(NF2FS_t *NF2FS, NF2FS_size_t *id)
 {
     int err = NF2FS_ERR_OK;
 
-    NF2FS_map_ram_t *idmap = NF2FS->id_map->free_map;
+    // hand out leased ids first, they are used in flash already
+    NF2FS_idmap_ram_t* id_map= NF2FS->id_map;
+    if (id_map->lease) {
+        *id= id_map->lease_begin + NF2FS_ctz(id_map->lease);
+        id_map->lease&= id_map->lease - 1;
+        return err;
+    }
+
+    NF2FS_map_ram_t *idmap = id_map->free_map;
     NF2FS_size_t flag_region= idmap->region;
     while (true) {
         // we can find id in current region
         if (idmap->free_num > 0) {
-            err = NF2FS_find_in_map(NF2FS, NF2FS->id_map->ids_in_buffer,
+            err = NF2FS_find_in_map(NF2FS, id_map->ids_in_buffer,
                                      idmap, 1, id);
             if (err < 0)
                 return err;
 
-            // prog id into flash directly
-            err= NF2FS_id_direct_prog(NF2FS, *id, NF2FS->id_map->begin, NF2FS->id_map->off);
-            if (err)
-                return err;
+            if (*id != NF2FS_NULL) {
+                // lease other free ids in the same word of buffer
+                NF2FS_size_t bit= *id - idmap->region * id_map->ids_in_buffer;
+                uint32_t bits= idmap->buffer[bit / 32];
+                if (id_map->ids_in_buffer < 32)
+                    bits&= (1U << id_map->ids_in_buffer) - 1;
+                NF2FS_size_t first= *id - bit % 32;
+                uint32_t used= bits | (1U << (bit % 32));
+
+                // record the lease first, ids used without names are given back at mount
+                // format has no superblock yet, the lease is progged with the new one
+                if (bits) {
+                    if (NF2FS->superblock->sector != NF2FS_NULL) {
+                        err= NF2FS_id_lease_record(NF2FS, first, used);
+                        if (err)
+                            return err;
+                    }
+                    id_map->lease_begin= first;
+                }
+                idmap->buffer[bit / 32]&= ~bits;
+                idmap->free_num-= NF2FS_popc(bits);
+                id_map->lease= bits;
 
-            if (*id != NF2FS_NULL)
-                return NF2FS_ERR_OK;
+                // prog all of them into flash with one prog
+                return NF2FS_id_direct_prog(NF2FS, first, used, id_map->begin, id_map->off);
+            }
         }
 
         // if we have scanned the whole bitmap without useful id, failed
@@ -1164,7 +1877,7 @@ int NF2FS_id_alloc(NF2FS_t *NF2FS, NF2FS_size_t *id)
 
         // get a new id map when we scan to the end
         if (new == NF2FS->cfg->region_cnt) {
-            err = NF2FS_idmap_change(NF2FS, NF2FS->id_map,
+            err = NF2FS_idmap_change(NF2FS, id_map,
                                       NF2FS->pcache, NF2FS->rcache);
             if (err)
                 return err;
@@ -1172,8 +1885,8 @@ int NF2FS_id_alloc(NF2FS_t *NF2FS, NF2FS_size_t *id)
         }
 
         // fail to find, turn to the next region
-        err= NF2FS_ram_map_change(NF2FS, new, NF2FS->id_map->ids_in_buffer,
-                                 idmap, NF2FS->id_map->begin, NF2FS->id_map->off);
+        err= NF2FS_ram_map_change(NF2FS, new, id_map->ids_in_buffer,
+                                 idmap, id_map->begin, id_map->off);
         if (err)
             return err;
     }
@@ -1184,8 +1897,8 @@ int NF2FS_id_free(NF2FS_t *NF2FS, NF2FS_idmap_ram_t *idmap, NF2FS_size_t id)
 {
     int err = NF2FS_ERR_OK;
 
-    // prog the free message to the remove id map directly.
-    err= NF2FS_id_direct_prog(NF2FS, id, idmap->begin,
+    // prog the free message to the remove id map directly, a crash does not lose it.
+    err= NF2FS_id_direct_prog(NF2FS, id - id % 32, 1U << (id % 32), idmap->begin,
                              idmap->off + (NF2FS_ID_MAX / 8));
     return err;
 }
@@ -1204,10 +1917,303 @@ int NF2FS_wl_init(NF2FS_t* NF2FS, NF2FS_wl_ram_t** wl_addr)
     if (!wl)
         return NF2FS_ERR_NOMEM;
     memset(wl, 0xff, sizeof(NF2FS_wl_ram_t)); 
+    wl->off= 0;
+    wl->changed_region_times= 0;
+    wl->dir_region_index= 0;
+    wl->bfile_region_index= 0;
+
+    // regions are in their own physical regions before migration
+    wl->remap= NF2FS_malloc(NF2FS->cfg->region_cnt * sizeof(NF2FS_size_t));
+    if (!wl->remap) {
+        NF2FS_free(wl);
+        return NF2FS_ERR_NOMEM;
+    }
+    for (int i= 0; i < NF2FS->cfg->region_cnt; i++)
+        wl->remap[i]= i;
+
+    // there is no plan of migration
+    wl->plan= NF2FS_malloc((NF2FS->cfg->region_cnt + 2) * sizeof(NF2FS_size_t));
+    if (!wl->plan) {
+        NF2FS_free(wl->remap);
+        NF2FS_free(wl);
+        return NF2FS_ERR_NOMEM;
+    }
+    wl->plan_num= 0;
+    wl->plan_index= 0;
+    wl->move_phase= 0;
+    wl->move_sector= 0;
+    wl->move_region= NF2FS_NULL;
+    wl->step_defer= 0;
     *wl_addr= wl;
     return NF2FS_ERR_OK;
 }
 
+// free the wl module
+void NF2FS_wl_free(NF2FS_wl_ram_t* wl)
+{
+    if (wl) {
+        if (wl->remap)
+            NF2FS_free(wl->remap);
+        if (wl->plan)
+            NF2FS_free(wl->plan);
+        NF2FS_free(wl);
+    }
+}
+
+// Update the region that is moving in the current phase of plan.
+static void NF2FS_wl_move_update(NF2FS_flash_manage_ram_t* manager)
+{
+    NF2FS_wl_ram_t* wl= manager->wl;
+    if (wl->plan_index >= wl->plan_num) {
+        wl->move_region= NF2FS_NULL;
+        return;
+    }
+
+    // region_2 moves in the second phase, region_1 moves in others
+    NF2FS_size_t* pair= &wl->plan[2 * wl->plan_index];
+    wl->move_region= (wl->move_phase == 1) ? pair[1] : pair[0];
+}
+
+// The moving region has swapped with reserve region, turn to the next phase.
+static void NF2FS_wl_move_next(NF2FS_flash_manage_ram_t* manager)
+{
+    NF2FS_wl_ram_t* wl= manager->wl;
+    NF2FS_size_t* pair= &wl->plan[2 * wl->plan_index];
+
+    wl->move_sector= 0;
+    wl->move_phase++;
+    if (wl->move_phase == 3 || pair[1] == manager->region_map->reserve) {
+        wl->plan_index++;
+        wl->move_phase= 0;
+    }
+    NF2FS_wl_move_update(manager);
+}
+
+// Change to a new wl sector, the newest wl message is proged to it first.
+int NF2FS_wl_sector_change(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_wl_ram_t* wl= manager->wl;
+    NF2FS_size_t old_sector= wl->begin;
+    NF2FS_size_t old_etimes= wl->etimes;
+    NF2FS_wl_remap_flash_t* remap= NULL;
+
+    // allocate a new sector for wl message
+    NF2FS_size_t new_sector= NF2FS_NULL;
+    NF2FS_size_t etimes= NF2FS_NULL;
+    err= NF2FS_sector_alloc(NF2FS, manager, NF2FS_SECTOR_WL, NF2FS_WL_SECTOR_NUM,
+                           NF2FS_NULL, NF2FS_NULL, NF2FS_NULL, &new_sector, &etimes);
+    if (err)
+        return err;
+
+    // record physical regions of migrated regions
+    NF2FS_size_t cnt= 0;
+    for (int i= 0; i < manager->region_num; i++) {
+        if (wl->remap[i] != i)
+            cnt++;
+    }
+    NF2FS_size_t len= sizeof(NF2FS_wl_remap_flash_t) + 2 * cnt * sizeof(NF2FS_size_t);
+    NF2FS_size_t plan_len= sizeof(NF2FS_wl_plan_flash_t) + 2 * wl->plan_num * sizeof(NF2FS_size_t);
+    NF2FS_ASSERT(len + sizeof(NF2FS_wl_regions_flash_t) + plan_len + sizeof(NF2FS_wl_move_flash_t) <=
+                 NF2FS->cfg->sector_size);
+    NF2FS_off_t off= 0;
+    if (cnt > 0) {
+        remap= NF2FS_malloc(NF2FS_max(len, plan_len));
+        if (!remap)
+            return NF2FS_ERR_NOMEM;
+
+        remap->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_REMAP, len);
+        cnt= 0;
+        for (int i= 0; i < manager->region_num; i++) {
+            if (wl->remap[i] != i) {
+                remap->remap[cnt++]= i;
+                remap->remap[cnt++]= wl->remap[i];
+            }
+        }
+        err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_DHEAD, new_sector, off, len, remap);
+        if (err)
+            goto cleanup;
+        off+= len;
+    }
+
+    // record candidate regions
+    NF2FS_wl_regions_flash_t regions;
+    regions.head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_REGIONS, sizeof(NF2FS_wl_regions_flash_t));
+    memcpy(regions.dir_regions, wl->dir_regions, sizeof(wl->dir_regions));
+    memcpy(regions.bfile_regions, wl->bfile_regions, sizeof(wl->bfile_regions));
+    err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_DHEAD, new_sector, off,
+                          sizeof(NF2FS_wl_regions_flash_t), &regions);
+    if (err)
+        goto cleanup;
+    off+= sizeof(NF2FS_wl_regions_flash_t);
+
+    // record the unfinished plan and how far it goes
+    if (wl->move_region != NF2FS_NULL) {
+        if (!remap) {
+            remap= NF2FS_malloc(plan_len);
+            if (!remap)
+                return NF2FS_ERR_NOMEM;
+        }
+
+        NF2FS_wl_plan_flash_t* plan= (NF2FS_wl_plan_flash_t*)remap;
+        plan->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_PLAN, plan_len);
+        memcpy(plan->pairs, wl->plan, 2 * wl->plan_num * sizeof(NF2FS_size_t));
+        err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_DHEAD, new_sector, off, plan_len, plan);
+        if (err)
+            goto cleanup;
+        off+= plan_len;
+
+        NF2FS_wl_move_flash_t move;
+        move.head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_MOVE, sizeof(NF2FS_wl_move_flash_t));
+        move.index= wl->plan_index;
+        move.phase= wl->move_phase;
+        move.sector= wl->move_sector;
+        err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_DHEAD, new_sector, off,
+                              sizeof(NF2FS_wl_move_flash_t), &move);
+        if (err)
+            goto cleanup;
+        off+= sizeof(NF2FS_wl_move_flash_t);
+    }
+
+    // update in-ram data first, superblock may be changed when proging in it
+    wl->begin= new_sector;
+    wl->off= off;
+    wl->etimes= etimes;
+
+    // Add address of wl sectors to superblock.
+    NF2FS_wladdr_flash_t wladdr;
+    wladdr.head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_ADDR, sizeof(NF2FS_wladdr_flash_t));
+    wladdr.begin= new_sector;
+    wladdr.off= off;
+    wladdr.erase_times= etimes;
+    err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, &wladdr, sizeof(NF2FS_wladdr_flash_t));
+    if (err)
+        goto cleanup;
+
+    // the old wl sector can be used again
+    if (old_sector != NF2FS_NULL) {
+        err= NF2FS_map_sector_erase(NF2FS, old_sector, 1, &old_etimes);
+        if (err)
+            goto cleanup;
+        err= NF2FS_emap_set(NF2FS, manager, old_sector, 1);
+    }
+
+cleanup:
+    if (remap)
+        NF2FS_free(remap);
+    return err;
+}
+
+// Append a record to wl sector, change to a new wl sector if it's full.
+int NF2FS_wl_prog(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, void* buffer, NF2FS_size_t len)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_wl_ram_t* wl= manager->wl;
+
+    if (wl->begin == NF2FS_NULL || wl->off + len > NF2FS->cfg->sector_size) {
+        err= NF2FS_wl_sector_change(NF2FS, manager);
+        if (err)
+            return err;
+    }
+
+    err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_DHEAD, wl->begin, wl->off, len, buffer);
+    if (err)
+        return err;
+    wl->off+= len;
+    return err;
+}
+
+// Load candidate regions and physical regions from wl sector when mounting.
+int NF2FS_wl_load(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_wl_ram_t* wl= manager->wl;
+    if (wl->begin == NF2FS_NULL)
+        return err;
+
+    // pairs of remap records are read in pieces
+    NF2FS_size_t piece= NF2FS_aligndown(NF2FS->cfg->cache_size, 2 * sizeof(NF2FS_size_t));
+    NF2FS_size_t* buffer= NF2FS_malloc(piece);
+    if (!buffer)
+        return NF2FS_ERR_NOMEM;
+
+    NF2FS_off_t off= 0;
+    NF2FS_head_t head;
+    while (off + sizeof(NF2FS_head_t) <= NF2FS->cfg->sector_size) {
+        err= NF2FS_direct_read(NF2FS, wl->begin, off, sizeof(NF2FS_head_t), &head);
+        if (err)
+            goto cleanup;
+
+        // the free space begins, or the head is broken
+        NF2FS_size_t len= NF2FS_dhead_dsize(head);
+        if (head == NF2FS_NULL || len < sizeof(NF2FS_head_t) || off + len > NF2FS->cfg->sector_size)
+            break;
+
+        // records are skipped if they are not entirely writen
+        if (NF2FS_dhead_check(head, NF2FS_ID_SUPER, (int)NF2FS_NULL)) {
+            off+= len;
+            continue;
+        }
+
+        if (NF2FS_dhead_type(head) == NF2FS_DATA_WL_REGIONS) {
+            NF2FS_wl_regions_flash_t regions;
+            err= NF2FS_direct_read(NF2FS, wl->begin, off, sizeof(NF2FS_wl_regions_flash_t), &regions);
+            if (err)
+                goto cleanup;
+            memcpy(wl->dir_regions, regions.dir_regions, sizeof(wl->dir_regions));
+            memcpy(wl->bfile_regions, regions.bfile_regions, sizeof(wl->bfile_regions));
+        } else if (NF2FS_dhead_type(head) == NF2FS_DATA_WL_MOVE) {
+            NF2FS_wl_move_flash_t move;
+            err= NF2FS_direct_read(NF2FS, wl->begin, off, sizeof(NF2FS_wl_move_flash_t), &move);
+            if (err)
+                goto cleanup;
+            wl->plan_index= move.index;
+            wl->move_phase= move.phase;
+            wl->move_sector= move.sector;
+            NF2FS_wl_move_update(manager);
+        } else if (NF2FS_dhead_type(head) == NF2FS_DATA_WL_PLAN) {
+            // a new plan begins from the first pair
+            NF2FS_size_t size= NF2FS_min(len - sizeof(NF2FS_head_t),
+                                         (NF2FS->cfg->region_cnt + 2) * sizeof(NF2FS_size_t));
+            for (NF2FS_off_t pos= 0; pos < size; pos+= piece) {
+                err= NF2FS_direct_read(NF2FS, wl->begin, off + sizeof(NF2FS_head_t) + pos,
+                                      NF2FS_min(piece, size - pos), (uint8_t*)wl->plan + pos);
+                if (err)
+                    goto cleanup;
+            }
+            wl->plan_num= size / (2 * sizeof(NF2FS_size_t));
+            wl->plan_index= 0;
+            wl->move_phase= 0;
+            wl->move_sector= 0;
+            NF2FS_wl_move_update(manager);
+        } else if (NF2FS_dhead_type(head) == NF2FS_DATA_WL_REMAP) {
+            NF2FS_off_t pos= off + sizeof(NF2FS_head_t);
+            while (pos < off + len) {
+                NF2FS_size_t size= NF2FS_min(piece, off + len - pos);
+                err= NF2FS_direct_read(NF2FS, wl->begin, pos, size, buffer);
+                if (err)
+                    goto cleanup;
+
+                for (int i= 0; i + 1 < size / sizeof(NF2FS_size_t); i+= 2) {
+                    if (buffer[i] < manager->region_num && buffer[i + 1] < manager->region_num)
+                        wl->remap[buffer[i]]= buffer[i + 1];
+                }
+                pos+= size;
+            }
+
+            // the record is writen when the moving region swaps with reserve region
+            if (wl->move_region != NF2FS_NULL && wl->move_sector == manager->region_size)
+                NF2FS_wl_move_next(manager);
+        }
+        off+= len;
+    }
+    wl->off= off;
+
+cleanup:
+    NF2FS_free(buffer);
+    return err;
+}
+
 // Swap wl message, used for heap sort funtion.
 void NF2FS_wl_swap(NF2FS_t *NF2FS, NF2FS_wl_message_t *a, NF2FS_wl_message_t *b)
 {
@@ -1279,54 +2285,68 @@ int NF2FS_wl_heaps_sort(NF2FS_t *NF2FS, NF2FS_size_t num, NF2FS_wl_message_t *he
     return err;
 }
 
-// we should record wl, and map sectors' etimes without sector head.
-void NF2FS_wl_map_etimes(NF2FS_t* NF2FS, NF2FS_size_t smap_num, NF2FS_wl_message_t *wlarr)
-{
-    // the wl, sector map, and id map are all in meta region
-    for (int i= 0; i < smap_num; i++) {
-        wlarr[0].etimes+= NF2FS->manager->etimes[i];
-    }
-
-    wlarr[0].etimes+= NF2FS->id_map->etimes;
-    if (NF2FS->manager->wl)
-        wlarr[0].etimes+= NF2FS->manager->wl->etimes;
-}
-
-// The global region migration module
+// The global region migration module, it makes the plan and regions are migrated by NF2FS_wl_step.
 int NF2FS_global_region_migration(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager,
                                    NF2FS_wl_message_t *wlarr)
 {
     int err = NF2FS_ERR_OK;
+    NF2FS_wl_ram_t* wl= manager->wl;
+    NF2FS_size_t reserve= manager->region_map->reserve;
+    NF2FS_size_t num= 0;
 
-    // migrate low etimes regions and high etimes regions
     // reserve the most high etimes regions to exchange the reserve region
+    // region 0 and reserve region are not migrated with others
+    int top= manager->region_num - 1;
+    NF2FS_size_t reserve_etimes= 0;
+    for (int i= 0; i < manager->region_num; i++) {
+        if (wlarr[i].region == reserve)
+            reserve_etimes= wlarr[i].etimes;
+    }
+    while (top >= 0 && (wlarr[top].region == 0 || wlarr[top].region == reserve))
+        top--;
+
+    // migrate low etimes regions and high etimes regions
     int begin = 0;
-    int end= manager->region_num - 2;
-    while (begin < end) {
-        if (wlarr[begin].region == manager->reserve_map->region)
+    int end= top - 1;
+    while (true) {
+        while (begin < end && (wlarr[begin].region == 0 || wlarr[begin].region == reserve))
             begin++;
-
-        if (wlarr[end].region == manager->reserve_map->region)
+        while (begin < end && (wlarr[end].region == 0 || wlarr[end].region == reserve))
             end--;
-        
-        err = NF2FS_region_migration(NF2FS, wlarr[begin].region, wlarr[end].region);
-        if (err)
-            return err;
+
+        // pairs inside have closer etimes, it's not worth migrating them
+        if (begin >= end || wlarr[end].etimes - wlarr[begin].etimes < manager->region_size)
+            break;
+
+        wl->plan[num++]= wlarr[begin].region;
+        wl->plan[num++]= wlarr[end].region;
         begin++;
         end--;
     }
 
     // change the reserve region, old data in reserve region should not be migrated
-    err= NF2FS_region_migration(NF2FS, wlarr[manager->region_num - 1].region,
-                          manager->reserve_map->region);
-    if (err)
+    if (top >= 0 && wlarr[top].etimes >= reserve_etimes + manager->region_size) {
+        wl->plan[num++]= wlarr[top].region;
+        wl->plan[num++]= reserve;
+    }
+
+    wl->plan_num= num / 2;
+    wl->plan_index= 0;
+    wl->move_phase= 0;
+    wl->move_sector= 0;
+    NF2FS_wl_move_update(manager);
+    if (num == 0)
         return err;
 
-    // reset the reserve region
-    manager->reserve_map->region= wlarr[manager->region_num - 1].region;
-    manager->reserve_map->free_num= manager->region_size;
-    manager->reserve_map->index_or_changed= 0;
-    memset(manager->reserve_map->buffer, 0xff, manager->region_size);
+    // record the plan, migration goes on from it after remounting
+    NF2FS_size_t len= sizeof(NF2FS_wl_plan_flash_t) + num * sizeof(NF2FS_size_t);
+    NF2FS_wl_plan_flash_t* plan= NF2FS_malloc(len);
+    if (!plan)
+        return NF2FS_ERR_NOMEM;
+    plan->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_PLAN, len);
+    memcpy(plan->pairs, wl->plan, num * sizeof(NF2FS_size_t));
+    err= NF2FS_wl_prog(NF2FS, manager, plan, len);
+    NF2FS_free(plan);
     return err;
 }
 
@@ -1334,74 +2354,32 @@ int NF2FS_global_region_migration(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *mana
 int NF2FS_wl_region_sort(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager)
 {
     int err= NF2FS_ERR_OK;
-    NF2FS_size_t prog_size= sizeof(NF2FS_size_t) * manager->region_num;
-    NF2FS_size_t* arr_flash;
-    NF2FS_wladdr_flash_t wladdr;
-    int cur_index;
+    NF2FS_size_t* phys= NULL;
+    NF2FS_wl_regions_flash_t regions;
 
     // allocate a heap for sort
     NF2FS_wl_message_t* wlarr_heap= NF2FS_malloc(manager->region_num * sizeof(NF2FS_wl_message_t));
     if (!wlarr_heap)
         return NF2FS_ERR_NOMEM;
 
-    // init the heap
-    for (int i= 0; i < manager->region_num; i++) {
-        wlarr_heap[i].region= i;
-        wlarr_heap[i].etimes= 0;
+    // if we do not have wl module now, we should create one
+    if (!manager->wl) {
+        err= NF2FS_wl_init(NF2FS, &manager->wl);
+        if (err)
+            goto cleanup;
     }
 
-    // record the special sectors without sector head
-    NF2FS_size_t smap_cnt= NF2FS_alignup(2 * NF2FS->cfg->sector_count / 8, NF2FS->cfg->sector_size) /
-                     NF2FS->cfg->sector_size + 2;
-    NF2FS_wl_map_etimes(NF2FS, smap_cnt, wlarr_heap);
-
-    // mark these special sectors
-    NF2FS_size_t spe_sectors[smap_cnt + 2];
-    for (int i= 0; i < smap_cnt; i++)
-        spe_sectors[i]= manager->smap_begin + i;
-
-    spe_sectors[smap_cnt]= NF2FS->id_map->begin;
-    if (manager->wl) {
-        spe_sectors[smap_cnt+1]= manager->wl->begin;
-    }else {
-        spe_sectors[smap_cnt+1]= NF2FS_NULL;
+    // etimes of regions are counted when erasing, sector heads are read if they are not recorded
+    if (!NF2FS_region_etimes_known(manager)) {
+        err= NF2FS_region_etimes_scan(NF2FS, manager);
+        if (err)
+            goto cleanup;
     }
 
-    // record other normal sectors
-    NF2FS_size_t region = 0;
-    NF2FS_size_t cnt= 0;
-    NF2FS_head_t head;
-    bool spe_flag= false;
-    for (int i= 0; i < NF2FS->cfg->sector_count; i++) {
-        // judge if it's map, wl sector without sector head
-        spe_flag= false;
-        if (region == 0) {
-            for (int j= 0; j < smap_cnt + 2; j++) {
-                if (spe_sectors[j] == i) {
-                    spe_flag= true;
-                    break;
-                }
-            }
-        }
-
-        // if it's normal sector, read and record etimes
-        if (~spe_flag) {
-            err= NF2FS_direct_read(NF2FS, i, 0, sizeof(NF2FS_head_t), &head);
-            if (err)
-                goto cleanup;
-
-            err= NF2FS_shead_check(head, NF2FS_STATE_FREE, NF2FS_SECTOR_NOTSURE);
-            if (err)
-                goto cleanup;
-            wlarr_heap[region].etimes += (head == NF2FS_NULL) ? 0 : NF2FS_shead_etimes(head);
-        }
-
-        // prepare for the next loop
-        cnt++;
-        if (cnt == manager->region_size) {
-            cnt = 0;
-            region++;
-        }
+    // init the heap, etimes are of the physical region
+    for (int i= 0; i < manager->region_num; i++) {
+        wlarr_heap[i].region= i;
+        wlarr_heap[i].etimes= manager->region_etimes[manager->wl->remap[i]];
     }
 
     // sort regions with etimes
@@ -1409,92 +2387,202 @@ int NF2FS_wl_region_sort(NF2FS_t *NF2FS, NF2FS_flash_manage_ram_t *manager)
     if (err)
         goto cleanup;
 
-    // if we do not have wl module now, we should create one
-    if (!manager->wl) {
-        err= NF2FS_wl_init(NF2FS, &manager->wl);
-        if (err)
-            goto cleanup;
+    // physical regions in the order of etimes, they are not changed by migration
+    phys= NF2FS_malloc(3 * manager->region_num * sizeof(NF2FS_size_t));
+    if (!phys) {
+        err= NF2FS_ERR_NOMEM;
+        goto cleanup;
     }
+    for (int i= 0; i < manager->region_num; i++)
+        phys[i]= manager->wl->remap[wlarr_heap[i].region];
 
-    // do migration
+    // plan migration
     err = NF2FS_global_region_migration(NF2FS, manager, wlarr_heap);
     if (err)
         goto cleanup;
 
-    // prepare for the new flash and ram wl module
-    if (manager->wl->begin == NF2FS_NULL ||
-        manager->wl->off + prog_size > NF2FS->cfg->sector_size) {
-        // allocate a new sector for wl array
-        NF2FS_size_t new_sector= NF2FS_NULL;
-        NF2FS_size_t etimes= NF2FS_NULL;
-        err = NF2FS_sector_alloc(NF2FS, manager, NF2FS_SECTOR_WL, NF2FS_WL_SECTOR_NUM,
-                                NF2FS_NULL, NF2FS_NULL, NF2FS_NULL, &new_sector, &etimes);
-        if (err)
-            goto cleanup;
+    // physical regions of regions when the plan is done
+    NF2FS_wl_ram_t* wl= manager->wl;
+    NF2FS_size_t reserve= manager->region_map->reserve;
+    NF2FS_size_t* remap= phys + manager->region_num;
+    NF2FS_size_t temp;
+    memcpy(remap, wl->remap, manager->region_num * sizeof(NF2FS_size_t));
+    for (int i= 0; i < wl->plan_num; i++) {
+        NF2FS_size_t moves[3]= {wl->plan[2 * i], wl->plan[2 * i + 1], wl->plan[2 * i]};
+        for (int j= 0; j < 3; j++) {
+            temp= remap[moves[j]];
+            remap[moves[j]]= remap[reserve];
+            remap[reserve]= temp;
+            if (moves[1] == reserve)
+                break;
+        }
+    }
 
-        // record the address of the array
-        wladdr.head = NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_ADDR, sizeof(NF2FS_wladdr_flash_t));
-        wladdr.begin= new_sector;
-        wladdr.off= 0;
-        wladdr.erase_times= etimes;
+    // regions that will be in physical regions with less etimes become candidates
+    NF2FS_size_t* owner= phys + 2 * manager->region_num;
+    for (int i= 0; i < manager->region_num; i++)
+        owner[remap[i]]= i;
 
-        // Add address of wl sectors to superblock.
-        err = NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, &wladdr, sizeof(NF2FS_wladdr_flash_t));
-        if (err)
-            return err;
-
-        // update in-ram data
-        manager->wl->begin= new_sector;
-        manager->wl->off= 0;
-        manager->wl->etimes= etimes;
+    NF2FS_size_t dir_cnt= 0;
+    NF2FS_size_t bfile_cnt= 0;
+    memset(regions.dir_regions, 0xff, sizeof(regions.dir_regions));
+    memset(regions.bfile_regions, 0xff, sizeof(regions.bfile_regions));
+    for (int i= 0; i < manager->region_num; i++) {
+        NF2FS_size_t region= owner[phys[i]];
+        if (!NF2FS_bitmap_test(manager->region_map->dir_region, region) &&
+            dir_cnt < NF2FS_RAM_REGION_NUM) {
+            regions.dir_regions[dir_cnt++]= region;
+        } else if (!NF2FS_bitmap_test(manager->region_map->bfile_region, region) &&
+                   bfile_cnt < NF2FS_RAM_REGION_NUM) {
+            regions.bfile_regions[bfile_cnt++]= region;
+        }
     }
+
+    // record the candidates in wl sector
+    regions.head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_REGIONS, sizeof(NF2FS_wl_regions_flash_t));
+    err= NF2FS_wl_prog(NF2FS, manager, &regions, sizeof(NF2FS_wl_regions_flash_t));
+    if (err)
+        goto cleanup;
+
+    // update the ram wl module
+    memcpy(manager->wl->dir_regions, regions.dir_regions, sizeof(regions.dir_regions));
+    memcpy(manager->wl->bfile_regions, regions.bfile_regions, sizeof(regions.bfile_regions));
     manager->wl->changed_region_times= 0;
     manager->wl->bfile_region_index= 0;
     manager->wl->dir_region_index= 0;
 
-    // update the flash wl module
-    arr_flash= (NF2FS_size_t*)wlarr_heap;
-    for (int i= 0; i < manager->region_num; i++) {
-        arr_flash[i]= wlarr_heap[i].region;
+cleanup:
+    if (phys)
+        NF2FS_free(phys);
+    if (wlarr_heap)
+        NF2FS_free(wlarr_heap);
+    return err;
+}
+
+// Change the sector map to a candidate region, found is false if no candidate fits.
+int NF2FS_wl_nextsmap(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int smap_type,
+                      NF2FS_size_t num, bool* found)
+{
+    int err= NF2FS_ERR_OK;
+    *found= false;
+
+    // regions are sorted and migrated again after a number of changes, and the last plan is done
+    if (!manager->wl || (manager->wl->changed_region_times >= NF2FS_WL_MIGRATE_THRESHOLD &&
+                         manager->wl->move_region == NF2FS_NULL)) {
+        err= NF2FS_wl_region_sort(NF2FS, manager);
+        if (err)
+            return err;
     }
-    err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_DATA, manager->wl->begin, manager->wl->off,
-                          prog_size, arr_flash);
-    if (err)
-        goto cleanup;
-    manager->wl->off+= prog_size;
 
-    // update the ram wl module, i.e. to be accessed big file regions
-    cur_index= 0;
-    for (int i= 0; i < manager->region_num; i++) {
-        if (NF2FS_region_type(manager->region_map, wlarr_heap[i].region) ==
-            NF2FS_SECTOR_BFILE) {
-            manager->wl->dir_regions[cur_index]= wlarr_heap[i].region;
-            cur_index++;
-        }
+    NF2FS_wl_ram_t* wl= manager->wl;
+    bool dir_type= (smap_type == NF2FS_SECTOR_DIR || smap_type == NF2FS_SECTOR_HOT_DIR);
+    NF2FS_size_t* index= dir_type ? &wl->dir_region_index : &wl->bfile_region_index;
+    NF2FS_size_t* regions= dir_type ? wl->dir_regions : wl->bfile_regions;
+    NF2FS_size_t* region_index;
+    uint32_t* region_buffer= NF2FS_region_map_get(manager, smap_type, &region_index);
+    NF2FS_map_ram_t* map= NF2FS_smap_get(manager, smap_type);
+    if (region_buffer == NULL || map == NULL)
+        return NF2FS_ERR_INVAL;
 
-        if (cur_index == NF2FS_RAM_REGION_NUM)
-            break;
+    // rotate through candidates, they may have been taken by the other type
+    NF2FS_size_t old_region= map->region;
+    for (int i= 0; i < NF2FS_RAM_REGION_NUM; i++) {
+        NF2FS_size_t region= regions[*index];
+        *index= ((*index) + 1) % NF2FS_RAM_REGION_NUM;
+        if (region >= manager->region_num || region == old_region ||
+            NF2FS_smap_buffered(manager, map, region) ||
+            NF2FS_bitmap_test(region_buffer, region) ||
+            !NF2FS_region_run_fit(manager, region, num))
+            continue;
+
+        err= NF2FS_ram_map_change(NF2FS, region, manager->region_size, map,
+                                 manager->smap_begin, manager->smap_off);
+        if (err)
+            return err;
+        NF2FS_region_run_update(manager, map);
+        if (manager->region_run[region] < num)
+            continue;
+
+        wl->changed_region_times++;
+        *found= true;
+        return err;
     }
 
-    // update the ram wl module, i.e. to be accessed dir regions
-    cur_index= 0;
-    for (int i= 0; i < manager->region_num; i++) {
-        if (NF2FS_region_type(manager->region_map, wlarr_heap[i].region) ==
-            NF2FS_SECTOR_DIR) {
-            manager->wl->bfile_regions[cur_index]= wlarr_heap[i].region;
-            cur_index++;
+    // go back to the old region, the normal scan goes on from it
+    if (map->region != old_region && old_region != NF2FS_NULL)
+        err= NF2FS_ram_map_change(NF2FS, old_region, manager->region_size, map,
+                                 manager->smap_begin, manager->smap_off);
+    return err;
+}
+
+// Migrate regions in plan, at most max_sectors sectors are copied, moved is the number copied.
+int NF2FS_wl_step(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t max_sectors,
+                  NF2FS_size_t* moved)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_wl_ram_t* wl= manager->wl;
+    *moved= 0;
+    if (!wl || wl->move_region == NF2FS_NULL || max_sectors == 0)
+        return err;
+
+    uint8_t* buffer= NF2FS_malloc(NF2FS->cfg->cache_size);
+    if (!buffer)
+        return NF2FS_ERR_NOMEM;
+
+    while (wl->move_region != NF2FS_NULL) {
+        // all sectors are copied, the phase ends
+        if (wl->move_sector == manager->region_size) {
+            err= NF2FS_region_swap(NF2FS, wl->move_region);
+            if (err)
+                goto cleanup;
+            NF2FS_wl_move_next(manager);
+            continue;
         }
 
-        if (cur_index == NF2FS_RAM_REGION_NUM)
+        if (*moved == max_sectors)
             break;
+
+        NF2FS_size_t num= NF2FS_min(max_sectors - *moved, manager->region_size - wl->move_sector);
+        err= NF2FS_region_copy(NF2FS, wl->move_region, wl->move_sector, num, buffer);
+        if (err)
+            goto cleanup;
+
+        // copied sectors are read and writen in reserve region from now on
+        wl->move_sector+= num;
+        *moved+= num;
+        NF2FS_wl_move_flash_t move;
+        move.head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_MOVE, sizeof(NF2FS_wl_move_flash_t));
+        move.index= wl->plan_index;
+        move.phase= wl->move_phase;
+        move.sector= wl->move_sector;
+        err= NF2FS_wl_prog(NF2FS, manager, &move, sizeof(NF2FS_wl_move_flash_t));
+        if (err)
+            goto cleanup;
     }
 
 cleanup:
-    if (wlarr_heap)
-        NF2FS_free(wlarr_heap);
+    NF2FS_free(buffer);
     return err;
 }
 
+// Do a step of migration after an alloc, erased is the number of sectors the alloc erased.
+int NF2FS_wl_pace(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t erased)
+{
+    NF2FS_wl_ram_t* wl= manager->wl;
+    if (!wl || wl->move_region == NF2FS_NULL)
+        return NF2FS_ERR_OK;
+
+    // two allocs in a row do not both step, they may be in the same operation.
+    // A forced step does not wait behind several erases.
+    wl->step_defer++;
+    if (wl->step_defer < 2 || (erased > 0 && wl->step_defer <= NF2FS_WL_STEP_DEFER) || erased > 1)
+        return NF2FS_ERR_OK;
+
+    NF2FS_size_t moved;
+    wl->step_defer= 0;
+    return NF2FS_wl_step(NF2FS, manager, NF2FS_WL_STEP_SECTORS, &moved);
+}
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * -----------------------------------------------------------    Manager operations    ----------------------------------------------------------
@@ -1508,12 +2596,19 @@ void NF2FS_manager_free(NF2FS_flash_manage_ram_t* manager)
         NF2FS_region_map_free(manager->region_map);
         if (manager->etimes)
             NF2FS_free(manager->etimes);
-        if (manager->wl)
-            NF2FS_free(manager->wl);
+        if (manager->region_run)
+            NF2FS_free(manager->region_run);
+        if (manager->region_etimes)
+            NF2FS_free(manager->region_etimes);
+        NF2FS_wl_free(manager->wl);
         if (manager->dir_map)
             NF2FS_free(manager->dir_map);
         if (manager->bfile_map)
             NF2FS_free(manager->bfile_map);
+        if (manager->hot_map)
+            NF2FS_free(manager->hot_map);
+        if (manager->hot_dir_map)
+            NF2FS_free(manager->hot_dir_map);
         if (manager->meta_map)
             NF2FS_free(manager->meta_map);
         if (manager->reserve_map)
@@ -1542,6 +2637,37 @@ int NF2FS_manager_init(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t** manager_addr)
     manager->region_num= NF2FS->cfg->region_cnt;
     manager->region_size= NF2FS->cfg->sector_count / NF2FS->cfg->region_cnt;
     manager->wl= NULL;
+    manager->dir_pool.region= NF2FS_NULL;
+    manager->bfile_pool.region= NF2FS_NULL;
+    manager->emap_pool.region= NF2FS_NULL;
+    manager->etimes= NULL;
+    manager->region_etimes= NULL;
+    manager->dir_map= NULL;
+    manager->bfile_map= NULL;
+    manager->hot_map= NULL;
+    manager->hot_dir_map= NULL;
+    manager->meta_map= NULL;
+    manager->reserve_map= NULL;
+    manager->erase_map= NULL;
+    manager->old_unmerged= true;
+    manager->region_map= NULL;
+
+    // init free runs of regions, they are unknown until maps are read
+    NF2FS_ASSERT(manager->region_size < NF2FS_REGION_RUN_UNKNOWN);
+    manager->region_run= NF2FS_malloc(manager->region_num * sizeof(uint16_t));
+    if (!manager->region_run) {
+        err = NF2FS_ERR_NOMEM;
+        goto cleanup;
+    }
+    NF2FS_region_run_reset(manager, NF2FS_REGION_RUN_UNKNOWN);
+
+    // init erase times of regions, they are unknown until superblock is read
+    manager->region_etimes= NF2FS_malloc(manager->region_num * sizeof(NF2FS_size_t));
+    if (!manager->region_etimes) {
+        err = NF2FS_ERR_NOMEM;
+        goto cleanup;
+    }
+    NF2FS_region_etimes_reset(manager, NF2FS_NULL);
 
     // init etimes
     num= NF2FS_alignup(2 * NF2FS->cfg->sector_count / 8, NF2FS->cfg->sector_size) /
@@ -1562,6 +2688,16 @@ int NF2FS_manager_init(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t** manager_addr)
     if (err) 
         goto cleanup;
 
+    // init hot_map
+    err= NF2FS_map_init(NF2FS, &manager->hot_map, smap_len);
+    if (err)
+        goto cleanup;
+
+    // init hot_dir_map
+    err= NF2FS_map_init(NF2FS, &manager->hot_dir_map, smap_len);
+    if (err)
+        goto cleanup;
+
     // init meta_map
     err= NF2FS_map_init(NF2FS, &manager->meta_map, smap_len);
     if (err) 
@@ -1605,6 +2741,9 @@ int NF2FS_init_with_commit(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit, NF2FS_c
     // update scan times
     NF2FS->manager->scan_times= commit->scan_times;
 
+    // update free runs of regions, buffered maps below have the newest ones
+    NF2FS_region_run_assign(NF2FS, commit);
+
     // update dir map and region map
     temp_region= commit->next_dir_sector / NF2FS->manager->region_size;
     NF2FS->manager->region_map->dir_index= temp_region + 1;
@@ -1612,6 +2751,7 @@ int NF2FS_init_with_commit(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit, NF2FS_c
                              NF2FS->manager->dir_map, NF2FS->manager->smap_begin, NF2FS->manager->smap_off);
     if (err)
         return err;
+    NF2FS_region_run_update(NF2FS->manager, NF2FS->manager->dir_map);
 
     // update big file map and region map
     if (commit->next_bfile_sector != NF2FS_NULL * NF2FS->manager->region_size) {
@@ -1621,6 +2761,7 @@ int NF2FS_init_with_commit(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit, NF2FS_c
                                 NF2FS->manager->bfile_map, NF2FS->manager->smap_begin, NF2FS->manager->smap_off);
         if (err)
             return err;
+        NF2FS_region_run_update(NF2FS->manager, NF2FS->manager->bfile_map);
     }
 
     // update meta map
@@ -1628,6 +2769,7 @@ int NF2FS_init_with_commit(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit, NF2FS_c
                              NF2FS->manager->meta_map, NF2FS->manager->smap_begin, NF2FS->manager->smap_off);
     if (err)
         return err;
+    NF2FS_region_run_update(NF2FS->manager, NF2FS->manager->meta_map);
 
     // update reserve map
     NF2FS->manager->region_map->reserve= commit->reserve_region;
@@ -1635,47 +2777,14 @@ int NF2FS_init_with_commit(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit, NF2FS_c
                              NF2FS->manager->reserve_map, NF2FS->manager->smap_begin, NF2FS->manager->smap_off);
     if (err)
         return err;
+    NF2FS_region_run_update(NF2FS->manager, NF2FS->manager->reserve_map);
 
     // if wl hasn't been build, return directly
     if (!NF2FS->manager->wl)
         return err;
 
-    // update wl message
-    NF2FS_size_t dir_index= 0;
-    NF2FS_size_t bfile_index= 0;
-    NF2FS_size_t total_size= sizeof(NF2FS_size_t) * NF2FS->cfg->region_cnt;
-    while (total_size > 0) {
-        // read wl message to cache
-        NF2FS_size_t read_size= NF2FS_min(total_size, NF2FS->cfg->cache_size);
-        err= NF2FS_direct_read(NF2FS, NF2FS->manager->wl->begin, NF2FS->manager->wl->off - total_size,
-                              read_size, cache->buffer);
-        if (err)
-            return err;
-        total_size-= read_size;
-
-        // add regions with less etimes to wl module
-        NF2FS_size_t max_loop= NF2FS->cfg->cache_size / sizeof(NF2FS_size_t);
-        NF2FS_size_t* cur_region= (NF2FS_size_t *)cache->buffer;
-        for (int i= 0; i < max_loop; i++) {
-            int region_type= NF2FS_region_type(NF2FS->manager->region_map, cur_region[i]);
-            if (region_type == NF2FS_SECTOR_BFILE) {
-                NF2FS->manager->wl->bfile_regions[bfile_index]= cur_region[i];
-                bfile_index++;
-            } else if (region_type == NF2FS_SECTOR_DIR) {
-                NF2FS->manager->wl->dir_regions[dir_index]= cur_region[i];
-                dir_index++;
-            }
-
-            // add finished, return
-            if (bfile_index == NF2FS_RAM_REGION_NUM && dir_index == NF2FS_RAM_REGION_NUM) {
-                NF2FS_cache_one(NF2FS, cache);
-                return err;
-            }
-        }
-    }
-
-    // add finished, return
-    NF2FS_cache_one(NF2FS, cache);
+    // update wl message, physical regions should be known before reading other regions
+    err= NF2FS_wl_load(NF2FS, NF2FS->manager);
     return err;
 }
 
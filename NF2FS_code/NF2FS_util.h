@@ -65,6 +65,33 @@ static inline uint32_t NF2FS_alignup(uint32_t a, uint32_t alignment)
     return NF2FS_aligndown(a + alignment - 1, alignment);
 }
 
+// Count the number of trailing binary zeros in a, a should not be 0
+static inline uint32_t NF2FS_ctz(uint32_t a)
+{
+#if !defined(NF2FS_NO_INTRINSICS) && defined(__GNUC__)
+    return __builtin_ctz(a);
+#else
+    uint32_t n= 0;
+    while (!(a & 1U)) {
+        a>>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Count the number of binary ones in a
+static inline uint32_t NF2FS_popc(uint32_t a)
+{
+#if !defined(NF2FS_NO_INTRINSICS) && (defined(__GNUC__) || defined(__CC_ARM))
+    return __builtin_popcount(a);
+#else
+    a= a - ((a >> 1) & 0x55555555);
+    a= (a & 0x33333333) + ((a >> 2) & 0x33333333);
+    return (((a + (a >> 4)) & 0xf0f0f0f) * 0x1010101) >> 24;
+#endif
+}
+
 // Allocate memory, only used if buffers are not provided to NF2FS
 static inline void* NF2FS_malloc(size_t size)
 {
@@ -34,6 +34,8 @@ void NF2FS_deinit(NF2FS_t *NF2FS)
     if (NF2FS->ram_tree) {
         if (NF2FS->ram_tree->tree_array)
             NF2FS_free(NF2FS->ram_tree->tree_array);
+        if (NF2FS->ram_tree->sectors)
+            NF2FS_free(NF2FS->ram_tree->sectors);
         NF2FS_free(NF2FS->ram_tree);
     }
 
@@ -58,6 +60,7 @@ void NF2FS_deinit(NF2FS_t *NF2FS)
     while (dir != NULL) {
         cur_dir= dir;
         dir= dir->next_dir;
+        NF2FS_dcursor_free(cur_dir);
         NF2FS_free(cur_dir);
     }
 
@@ -68,12 +71,24 @@ void NF2FS_deinit(NF2FS_t *NF2FS)
         NF2FS_free(NF2FS->rcache);
     }
 
+    // Free read cache pool.
+    NF2FS_rcache_pool_free(NF2FS->rcache_pool);
+    NF2FS->rcache_pool= NULL;
+
+    // Free parked prog caches.
+    NF2FS_pcache_pool_free(NF2FS->pcache_pool);
+    NF2FS->pcache_pool= NULL;
+
     // Free prog cache.
     if (NF2FS->pcache) {
         if (NF2FS->pcache->buffer)
             NF2FS_free(NF2FS->pcache->buffer);
         NF2FS_free(NF2FS->pcache);
     }
+
+    // Free device state.
+    NF2FS_dev_free(NF2FS->dev);
+    NF2FS->dev= NULL;
 }
 
 // Init ram structures when mount/format
@@ -101,16 +116,31 @@ int NF2FS_init(NF2FS_t *NF2FS, const struct NF2FS_config *cfg)
     NF2FS_ASSERT(NF2FS->cfg->name_max <= NF2FS_NAME_MAX);
     NF2FS_ASSERT(NF2FS->cfg->file_max <= NF2FS_FILE_MAX_SIZE);
 
+    // init device state
+    err = NF2FS_dev_init(NF2FS, &NF2FS->dev);
+    if (err)
+        goto cleanup;
+
     // init prog cache
     err = NF2FS_cache_init(NF2FS, &NF2FS->pcache, NF2FS->cfg->cache_size);
     if (err)
         goto cleanup;
 
+    // init parked prog caches
+    err = NF2FS_pcache_pool_init(NF2FS, &NF2FS->pcache_pool);
+    if (err)
+        goto cleanup;
+
     // Initialize read cache.
     err = NF2FS_cache_init(NF2FS, &NF2FS->rcache, NF2FS->cfg->cache_size);
     if (err)
         goto cleanup;
 
+    // Initialize read cache pool.
+    err = NF2FS_rcache_pool_init(NF2FS, &NF2FS->rcache_pool);
+    if (err)
+        goto cleanup;
+
     // Initialize superblock message.
     err = NF2FS_super_init(NF2FS, &NF2FS->superblock);
     if (err)
@@ -134,6 +164,12 @@ int NF2FS_init(NF2FS_t *NF2FS, const struct NF2FS_config *cfg)
     // init file list and dir list.
     NF2FS->file_list= NULL;
     NF2FS->dir_list= NULL;
+    NF2FS->dir_clock= 0;
+    NF2FS->in_gc= false;
+    for (int i= 0; i < NF2FS_HEAT_NUM; i++) {
+        NF2FS->heat[i].id= NF2FS_NULL;
+        NF2FS->heat[i].rewrites= 0;
+    }
     return err;
 
 cleanup:
@@ -216,6 +252,8 @@ int NF2FS_format(NF2FS_t *NF2FS, const struct NF2FS_config *cfg, bool init_flag)
     NF2FS->manager->region_num= NF2FS->cfg->region_cnt;
     NF2FS->manager->region_size= NF2FS->cfg->sector_count / NF2FS->cfg->region_cnt;
     NF2FS->manager->scan_times= 0;
+    NF2FS_region_run_reset(NF2FS->manager, NF2FS->manager->region_size);
+    NF2FS_region_etimes_reset(NF2FS->manager, 0);
 
     // currently assign sector 2 to sector map
     NF2FS->manager->smap_begin= 2;
@@ -228,10 +266,10 @@ int NF2FS_format(NF2FS_t *NF2FS, const struct NF2FS_config *cfg, bool init_flag)
     NF2FS->manager->region_map->reserve= 0;
 
     // malloc region for meta region and dir region
-    err= NF2FS_sector_nextsmap(NF2FS, NF2FS->manager, NF2FS_SECTOR_META);
+    err= NF2FS_sector_nextsmap(NF2FS, NF2FS->manager, NF2FS_SECTOR_META, 1);
     if (err)
         goto cleanup;
-    err= NF2FS_sector_nextsmap(NF2FS, NF2FS->manager, NF2FS_SECTOR_DIR);
+    err= NF2FS_sector_nextsmap(NF2FS, NF2FS->manager, NF2FS_SECTOR_DIR, 1);
     if (err)
         goto cleanup;
 
@@ -262,8 +300,17 @@ int NF2FS_format(NF2FS_t *NF2FS, const struct NF2FS_config *cfg, bool init_flag)
     NF2FS->dir_list->old_sector= NF2FS_NULL;
     NF2FS->dir_list->name_sector= NF2FS_NULL;
     NF2FS->dir_list->pos_sector= NF2FS_NULL;
+    NF2FS->dir_list->cursor= NULL;
     NF2FS->dir_list->tail_sector= NF2FS->ram_tree->tree_array[0].tail_sector;
-    NF2FS->dir_list->tail_off= sizeof(NF2FS_dir_sector_flash_t);
+    NF2FS->dir_list->oldest_sector= NF2FS->dir_list->tail_sector;
+    NF2FS->dir_list->sectors= 1;
+    NF2FS->dir_list->stamp= 0;
+    NF2FS->dir_list->busy= false;
+    NF2FS_dir_tail_init(NF2FS, NF2FS->dir_list);
+#if NF2FS_DIR_FILTER_BITS > 0
+    NF2FS_filter_reset(&NF2FS->dir_list->filter, true);
+#endif
+    NF2FS->dir_list->next_dir = NULL;
 
     // init the id map
     NF2FS->id_map->begin= 3;
@@ -301,6 +348,7 @@ cleanup:
 int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
 {
     int err = NF2FS_ERR_OK;
+    NF2FS_cache_ram_t* rcache= NULL;
     
     // Init ram structures
     err = NF2FS_init(NF2FS, cfg);
@@ -321,15 +369,17 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
     }
 
     // Read data in superblock.
+    NF2FS_size_t root_tail= NF2FS_NULL;
+    NF2FS_off_t root_off= NF2FS_NULL;
     while (true) {
-        // Read to rcache
+        // Read to a slot of read cache pool
         NF2FS_size_t size = NF2FS_min(NF2FS->cfg->cache_size,
                           NF2FS->cfg->sector_size - NF2FS->superblock->free_off);
-        err= NF2FS_read_to_cache(NF2FS, NF2FS->rcache, NF2FS->superblock->sector,
-                                NF2FS->superblock->free_off, size);
+        err= NF2FS_rcache_fetch_hold(NF2FS, &rcache, NF2FS->superblock->sector,
+                                    NF2FS->superblock->free_off, size, false);
         if (err)
             goto cleanup;
-        uint8_t *data = NF2FS->rcache->buffer;
+        uint8_t *data = rcache->buffer + NF2FS->superblock->free_off - rcache->off;
 
         while (true) {
             NF2FS_head_t head = *(NF2FS_head_t *)data;
@@ -340,7 +390,7 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
             if (err)
                 goto cleanup;
 
-            if (NF2FS->superblock->free_off + NF2FS_dhead_dsize(head) > NF2FS->rcache->off + size) {
+            if (NF2FS->superblock->free_off + NF2FS_dhead_dsize(head) > rcache->off + rcache->size) {
                 if (head == NF2FS_NULL) {
                     // TODO in the future
                     // something may wrong during superblock gc.
@@ -354,7 +404,7 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
             // Check the data head type.
             switch (NF2FS_dhead_type(head)) {
                 case NF2FS_DATA_SUPER_MESSAGE: {
-                // check if NF2FS message is true, size is 36B
+                // check if NF2FS message is true, size is 40B
                 NF2FS_supermessage_flash_t *message = (NF2FS_supermessage_flash_t *)data;
                 if (!memcpy(message->fs_name, &NF2FS_FS_NAME, strlen(NF2FS_FS_NAME)) ||
                     NF2FS_VERSION != message->version ||
@@ -362,7 +412,9 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
                     NF2FS->cfg->sector_count != message->sector_count ||
                     NF2FS->cfg->name_max != message->name_max ||
                     NF2FS->cfg->file_max != message->file_max ||
-                    NF2FS->cfg->region_cnt != message->region_cnt) {
+                    NF2FS->cfg->region_cnt != message->region_cnt ||
+                    NF2FS->cfg->crc_seal != message->crc_seal ||
+                    NF2FS->cfg->dual_end != message->dual_end) {
                     err = NF2FS_ERR_WRONGCFG;
                     goto cleanup;
                 }
@@ -390,15 +442,31 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
             }
 
             case NF2FS_DATA_WL_ADDR: {
-                // update WL message
-                err= NF2FS_wl_init(NF2FS, &NF2FS->manager->wl);
-                if (err)
-                    return err;
+                // update WL message, records in wl sector are loaded with commit message
+                if (!NF2FS->manager->wl) {
+                    err= NF2FS_wl_init(NF2FS, &NF2FS->manager->wl);
+                    if (err)
+                        goto cleanup;
+                }
                 NF2FS_wladdr_flash_t *wladdr = (NF2FS_wladdr_flash_t *)data;
                 NF2FS->manager->wl->begin= wladdr->begin;
                 NF2FS->manager->wl->off= wladdr->off;
                 NF2FS->manager->wl->etimes= wladdr->erase_times;
-                // TODO in the future, should update other wl message
+                break;
+            }
+
+            case NF2FS_DATA_ID_LEASE: {
+                // the last lease record is open if crash happens before ids are given back
+                NF2FS_idlease_flash_t* record= (NF2FS_idlease_flash_t*)data;
+                NF2FS->id_map->lease_begin= record->bits ? record->begin : NF2FS_NULL;
+                NF2FS->id_map->lease= record->bits;
+                break;
+            }
+
+            case NF2FS_DATA_REGION_ETIMES: {
+                // erase times of a range of regions, the last record of them is the newest
+                NF2FS_region_etimes_flash_t* record= (NF2FS_region_etimes_flash_t*)data;
+                NF2FS_region_etimes_assign(NF2FS, record);
                 break;
             }
 
@@ -412,12 +480,9 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
                 if (err)
                     goto cleanup;
 
-                // add open root dir to dir list
-                NF2FS_dir_ram_t *root_dir= NULL;
-                err= NF2FS_dir_lowopen(NF2FS, name->tail, NF2FS_ID_ROOT, NF2FS_ID_SUPER, NF2FS->superblock->sector,
-                                      NF2FS->superblock->free_off, &root_dir, NF2FS->pcache);
-                if (err)
-                    goto cleanup;
+                // root dir is opened after wl message is loaded, its sectors may be migrated
+                root_tail= name->tail;
+                root_off= NF2FS->superblock->free_off;
                 break;
             }
 
@@ -436,11 +501,35 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
                 if (err)
                     goto cleanup;
 
+                // add open root dir to dir list
+                NF2FS_dir_ram_t *root_dir= NULL;
+                err= NF2FS_dir_lowopen(NF2FS, root_tail, NF2FS_ID_ROOT, NF2FS_ID_SUPER, NF2FS->superblock->sector,
+                                      root_off, &root_dir, NF2FS->pcache);
+                if (err)
+                    goto cleanup;
+
                 // set the commit message to delete, if do not have it, corrupt happens
                 NF2FS_head_validate(NF2FS, NF2FS->superblock->sector,
                                    NF2FS->superblock->free_off, NF2FS_DHEAD_DELETE_SET);
 
                 NF2FS->superblock->free_off+= len;
+
+                // give back leased ids without names, they are not handed out before crash
+                if (NF2FS->id_map->lease_begin != NF2FS_NULL) {
+                    err= NF2FS_id_lease_check(NF2FS, NF2FS->id_map);
+                    if (err)
+                        goto cleanup;
+
+                    err= NF2FS_dtraverse_ids(NF2FS, root_dir->tail_sector, NF2FS->id_map->lease_begin,
+                                            &NF2FS->id_map->lease);
+                    if (err)
+                        goto cleanup;
+
+                    err= NF2FS_idmap_sync(NF2FS, NF2FS->id_map);
+                    if (err)
+                        goto cleanup;
+                }
+                NF2FS_rcache_release(NF2FS, rcache);
                 return err;
             }
 
@@ -463,12 +552,13 @@ int NF2FS_mount(NF2FS_t* NF2FS, const struct NF2FS_config* cfg)
             data += len;
 
             // the next data head is not entire, read again
-            if (NF2FS->superblock->free_off - NF2FS->rcache->off + sizeof(NF2FS_head_t) >= NF2FS->cfg->cache_size)
+            if (NF2FS->superblock->free_off + sizeof(NF2FS_head_t) >= rcache->off + rcache->size)
                 break;
         }
     }
 
 cleanup:
+    NF2FS_rcache_release(NF2FS, rcache);
     NF2FS_deinit(NF2FS);
     return err;
 }
@@ -494,6 +584,7 @@ int NF2FS_unmount(NF2FS_t *NF2FS)
         NF2FS_dir_ospace_flash_t old_space= {
             .head= NF2FS_MKDHEAD(0, 1, dir->id, NF2FS_DATA_DIR_OSPACE, sizeof(NF2FS_dir_ospace_flash_t)),
             .old_space= dir->old_space,
+            .oldest_sector= dir->oldest_sector,
         };
 
         err= NF2FS_dir_prog(NF2FS, dir, &old_space, sizeof(NF2FS_dir_ospace_flash_t));
@@ -502,22 +593,38 @@ int NF2FS_unmount(NF2FS_t *NF2FS)
         dir = dir->next_dir;
     }
 
+    // Give back leased ids to the remove id map.
+    err = NF2FS_idmap_sync(NF2FS, NF2FS->id_map);
+    if (err)
+        return err;
+
     // Flush region map to flash.
     err = NF2FS_region_map_flush(NF2FS, NF2FS->manager->region_map);
     if (err)
         return err;
 
-    // Prog new commit message.
-    NF2FS_commit_flash_t commit= {
-        .head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_COMMIT, sizeof(NF2FS_commit_flash_t)),
-        .next_id= NF2FS->id_map->free_map->region * NF2FS->id_map->ids_in_buffer + NF2FS->id_map->free_map->index_or_changed,
-        .scan_times= NF2FS->manager->scan_times,
-        .next_dir_sector= NF2FS->manager->dir_map->region * NF2FS->manager->region_size + NF2FS->manager->dir_map->index_or_changed,
-        .next_bfile_sector= NF2FS->manager->bfile_map->region * NF2FS->manager->region_size + NF2FS->manager->bfile_map->index_or_changed,
-        .reserve_region= NF2FS->manager->region_map->reserve,
-    };
+    // Record erase times of regions if they change.
+    if (NF2FS->manager->region_etimes_changed) {
+        err= NF2FS_region_etimes_flush(NF2FS, NF2FS->manager);
+        if (err)
+            return err;
+    }
 
-    err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, &commit, sizeof(NF2FS_commit_flash_t));
+    // Prog new commit message, free runs of regions are behind it.
+    NF2FS_size_t len= NF2FS_commit_len(NF2FS);
+    NF2FS_commit_flash_t* commit= NF2FS_malloc(len);
+    if (!commit)
+        return NF2FS_ERR_NOMEM;
+    commit->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_COMMIT, len);
+    commit->next_id= NF2FS->id_map->free_map->region * NF2FS->id_map->ids_in_buffer + NF2FS->id_map->free_map->index_or_changed;
+    commit->scan_times= NF2FS->manager->scan_times;
+    commit->next_dir_sector= NF2FS->manager->dir_map->region * NF2FS->manager->region_size + NF2FS->manager->dir_map->index_or_changed;
+    commit->next_bfile_sector= NF2FS->manager->bfile_map->region * NF2FS->manager->region_size + NF2FS->manager->bfile_map->index_or_changed;
+    commit->reserve_region= NF2FS->manager->region_map->reserve;
+    NF2FS_region_run_commit(NF2FS, commit);
+
+    err= NF2FS_prog_in_superblock(NF2FS, NF2FS->superblock, commit, len);
+    NF2FS_free(commit);
     if (err)
         return err;
 
@@ -526,8 +633,13 @@ int NF2FS_unmount(NF2FS_t *NF2FS)
     if (err)
         return err;
 
-    // Flush data in pcache to flash.
-    err = NF2FS_cache_flush(NF2FS, NF2FS->pcache);
+    // Flush data in pcache and parked prog caches to flash.
+    err = NF2FS_pcache_flush_all(NF2FS);
+    if (err)
+        return err;
+
+    // Wait for async progs to finish.
+    err = NF2FS_dev_wait(NF2FS);
     if (err)
         return err;
 
@@ -536,13 +648,42 @@ int NF2FS_unmount(NF2FS_t *NF2FS)
     return err;
 }
 
+// do background work when the caller is idle, erase at most max_ops sectors
+int NF2FS_fs_idle(NF2FS_t* NF2FS, NF2FS_size_t max_ops)
+{
+    int err = NF2FS_ERR_OK;
+
+    // Let queued async progs move on first.
+    err = NF2FS_dev_poll(NF2FS);
+    if (err)
+        return err;
+
+    // Move on the wl migration, copying a sector takes an op.
+    NF2FS_size_t moved= 0;
+    err = NF2FS_wl_step(NF2FS, NF2FS->manager, max_ops, &moved);
+    if (err)
+        return err;
+
+    // Reclaim dirs with much old space like dir progs do, compacting a sector takes an op.
+    err = NF2FS_dir_reclaim(NF2FS, NF2FS_NULL, NF2FS_NULL, NF2FS->cfg->sector_size * 3,
+                            max_ops, &moved);
+    if (err)
+        return err;
+
+    // Pre-erase old sectors so later allocs need not erase.
+    err = NF2FS_preerase(NF2FS, NF2FS->manager, max_ops - moved);
+    if (err < 0)
+        return err;
+    return err + moved;
+}
+
 /**
  * -------------------------------------------------------------------------------------------------------
  * -------------------------------------    File level operations    -------------------------------------
  * -------------------------------------------------------------------------------------------------------
  */
 
-// open a file
+// open a file, flags are NF2FS_open_flags
 int NF2FS_file_open(NF2FS_t* NF2FS, NF2FS_file_ram_t** file, char* path, int flags)
 {
     int err = NF2FS_ERR_OK;
@@ -578,8 +719,8 @@ int NF2FS_file_open(NF2FS_t* NF2FS, NF2FS_file_ram_t** file, char* path, int fla
 
     // Traverse dir to find whether or not the file is already in dir.
     NF2FS_tree_entry_ram_t temp_entry;
-    err= NF2FS_dtraverse_name(NF2FS, father_dir->tail_sector, name, strlen(name),
-                             NF2FS_DATA_REG, &temp_entry);
+    err= NF2FS_dir_name_find(NF2FS, father_dir, name, strlen(name),
+                            NF2FS_DATA_REG, &temp_entry);
     if (err)
         return err;
 
@@ -595,6 +736,9 @@ int NF2FS_file_open(NF2FS_t* NF2FS, NF2FS_file_ram_t** file, char* path, int fla
         if (err)
             return err;
     }
+
+    // hints of temperature for big file data
+    (*file)->flags= flags;
     return err;
 }
 
@@ -692,15 +836,61 @@ int NF2FS_file_seek(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_soff_t off, in
     return NF2FS_ERR_OK;
 }
 
+// change the size of a file, zeros are filled when it grows
+int NF2FS_file_truncate(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_size_t size)
+{
+    int err= NF2FS_ERR_OK;
+    if (size > NF2FS->cfg->file_max)
+        return NF2FS_ERR_FBIG;
+
+    if (size > file->file_size) {
+        // write zeros at the end of file
+        NF2FS_size_t pos= file->file_pos;
+        NF2FS_size_t len= NF2FS_min(size - file->file_size, NF2FS->cfg->sector_size);
+        uint8_t* zeros= NF2FS_malloc(len);
+        if (zeros == NULL)
+            return NF2FS_ERR_NOMEM;
+        memset(zeros, 0, len);
+
+        file->file_pos= file->file_size;
+        while (file->file_size < size) {
+            err= NF2FS_file_write(NF2FS, file, zeros, NF2FS_min(size - file->file_size, len));
+            if (err)
+                break;
+        }
+        file->file_pos= pos;
+        NF2FS_free(zeros);
+        return err;
+    } else if (size < file->file_size) {
+        if (file->file_size <= NF2FS_FILE_SIZE_THRESHOLD) {
+            // small file data is in cache, it's proged when flushing
+            file->file_size= size;
+            file->file_cache.size= size + sizeof(NF2FS_head_t);
+            file->file_cache.change_flag= true;
+        } else {
+            // whole sectors behind the end are old, data left is not rewritten
+            err= NF2FS_big_file_truncate(NF2FS, file, size);
+            if (err)
+                return err;
+        }
+    }
+
+    if (file->file_pos > size)
+        file->file_pos= size;
+    return err;
+}
+
 // delete a file
 int NF2FS_file_delete(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
 {
     int err= NF2FS_ERR_OK;
 
-    // delete sectors belong to big file
-    NF2FS_head_t head= *(NF2FS_head_t*)file->file_cache.buffer;
-    NF2FS_ASSERT(head != NF2FS_NULL);
-    if (NF2FS_dhead_type(head) == NF2FS_DATA_BFILE_INDEX) {
+    // delete sectors belong to big file, a new file may have nothing in cache
+    NF2FS_head_t head= NF2FS_NULL;
+    if (file->file_cache.size > 0)
+        head= *(NF2FS_head_t*)file->file_cache.buffer;
+    NF2FS_ASSERT(head != NF2FS_NULL || file->file_cache.sector == NF2FS_NULL);
+    if (head != NF2FS_NULL && NF2FS_dhead_type(head) == NF2FS_DATA_BFILE_INDEX) {
         // Because head in buffer may be old, we use size in file cache.
         NF2FS_bfile_index_flash_t *index = (NF2FS_bfile_index_flash_t *)file->file_cache.buffer;
         NF2FS_size_t num = (file->file_cache.size - sizeof(NF2FS_head_t)) / sizeof(NF2FS_bfile_index_ram_t);
@@ -721,7 +911,17 @@ int NF2FS_file_delete(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
     if (err)
         return err;
 
+#if NF2FS_DIR_FILTER_BITS > 0
+    // the name stays in the name filter of father dir
+    NF2FS_dir_ram_t* father_dir= NULL;
+    err= NF2FS_open_dir_find(NF2FS, file->father_id, &father_dir);
+    if (err)
+        return err;
+    father_dir->filter.stale++;
+#endif
+
     // Free id that the file belongs to.
+    NF2FS_file_heat_drop(NF2FS, file->id);
     err = NF2FS_id_free(NF2FS, NF2FS->id_map, file->id);
     if (err)
         return err;
@@ -734,7 +934,346 @@ int NF2FS_file_delete(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
 // flush file data to flash
 int NF2FS_file_sync(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
 {
-    return NF2FS_file_flush(NF2FS, file);
+    int err= NF2FS_file_flush(NF2FS, file);
+    if (err)
+        return err;
+
+    // data of the file may still wait in prog caches
+    err= NF2FS_pcache_flush_all(NF2FS);
+    if (err)
+        return err;
+
+    // and async progs may still be running
+    return NF2FS_dev_wait(NF2FS);
+}
+
+/**
+ * Map data of a big file in [off, off + size) to pointers in memory mapped flash.
+ *
+ * Return the number of extents filled. If all num extents are used, the rest
+ * should be mapped again from off + mapped size. Pointers are valid until the
+ * file is written, gc or deleted, or until regions are migrated by wl.
+ */
+int NF2FS_file_mmap(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_off_t off, NF2FS_size_t size,
+                    NF2FS_mmap_extent_t* extents, NF2FS_size_t num)
+{
+    if (NF2FS->cfg->map_base == NULL || num == 0)
+        return NF2FS_ERR_INVAL;
+
+    if (off + size > file->file_size)
+        return NF2FS_ERR_INVAL;
+
+    // data of small file is stored with the file index in dir
+    if (file->file_size <= NF2FS_FILE_SIZE_THRESHOLD)
+        return NF2FS_ERR_INVAL;
+
+    // mapped flash could not be read while it's busy
+    int err= NF2FS_dev_wait(NF2FS);
+    if (err)
+        return err;
+
+    return NF2FS_big_file_mmap(NF2FS, file, off, size, extents, num);
+}
+
+// get status of a file or dir by path, no file is opened
+int NF2FS_stat(NF2FS_t* NF2FS, char* path, NF2FS_stat_ram_t* stat)
+{
+    int err = NF2FS_ERR_OK;
+
+    // find the father dir
+    NF2FS_tree_entry_ram_t *entry = NULL;
+    err= NF2FS_father_dir_find(NF2FS, path, &entry);
+    if (err)
+        return err;
+    NF2FS_ASSERT(entry->tail_sector != NF2FS_NULL);
+
+    // Find The true name in path, the father itself is asked if there is no name
+    char *name = NF2FS_name_in_path(path);
+    if (*name == '/')
+        name++;
+    NF2FS_size_t namelen= strlen(name);
+    stat->type= NF2FS_DATA_DIR;
+    stat->size= 0;
+    if (namelen == 0) {
+        stat->id= entry->id;
+        return err;
+    }
+
+    // dirs may be found in ram-tree
+    NF2FS_size_t tree_index= NF2FS_NULL;
+    if (!NF2FS_tree_entry_name_find(NF2FS, name, namelen, entry->id, &tree_index)) {
+        stat->id= NF2FS->ram_tree->tree_array[tree_index].id;
+        return err;
+    }
+
+    // the father dir is not opened for stat, but its name filter is used if it's opened
+    NF2FS_dir_ram_t* father_dir= NF2FS->dir_list;
+    while (father_dir != NULL && father_dir->id != entry->id)
+        father_dir= father_dir->next_dir;
+
+    NF2FS_tree_entry_ram_t temp_entry;
+    if (father_dir != NULL)
+        err= NF2FS_dir_name_find(NF2FS, father_dir, name, namelen, NF2FS_DATA_REG, &temp_entry);
+    else
+        err= NF2FS_dtraverse_name(NF2FS, entry->tail_sector, name, namelen, NF2FS_DATA_REG,
+                                  &temp_entry, NULL);
+    if (err)
+        return err;
+
+    if (temp_entry.id != NF2FS_NULL) {
+        // only the record head and index of file data are read
+        stat->type= NF2FS_DATA_REG;
+        stat->id= temp_entry.id;
+        return NF2FS_file_size(NF2FS, father_dir, entry->tail_sector, temp_entry.id,
+                               temp_entry.name_sector, temp_entry.name_off, &stat->size);
+    }
+
+    // the dir is not in ram-tree
+    if (father_dir != NULL)
+        err= NF2FS_dir_name_find(NF2FS, father_dir, name, namelen, NF2FS_DATA_DIR, &temp_entry);
+    else
+        err= NF2FS_dtraverse_name(NF2FS, entry->tail_sector, name, namelen, NF2FS_DATA_DIR,
+                                  &temp_entry, NULL);
+    if (err)
+        return err;
+    if (temp_entry.id == NF2FS_NULL)
+        return NF2FS_ERR_NOENT;
+    stat->id= temp_entry.id;
+    return err;
+}
+
+// get status of an opened file
+int NF2FS_file_stat(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_stat_ram_t* stat)
+{
+    stat->type= NF2FS_DATA_REG;
+    stat->id= file->id;
+    stat->size= file->file_size;
+    return NF2FS_ERR_OK;
+}
+
+// find the last name in path and open its father dir, id of entry is NF2FS_NULL if it's not found
+static int NF2FS_path_entry_find(NF2FS_t* NF2FS, char* path, NF2FS_dir_ram_t** father_addr,
+                                 NF2FS_tree_entry_ram_t* entry, int* type)
+{
+    int err = NF2FS_ERR_OK;
+
+    NF2FS_tree_entry_ram_t *father_entry = NULL;
+    err= NF2FS_father_dir_find(NF2FS, path, &father_entry);
+    if (err)
+        return err;
+    NF2FS_ASSERT(father_entry->tail_sector != NF2FS_NULL);
+
+    err= NF2FS_dir_lowopen(NF2FS, father_entry->tail_sector, father_entry->id, father_entry->father_id,
+                          father_entry->name_sector, father_entry->name_off, father_addr, NF2FS->rcache);
+    if (err)
+        return err;
+
+    // root dir has no name to be changed
+    char *name = NF2FS_name_in_path(path);
+    if (*name == '/')
+        name++;
+    NF2FS_size_t namelen= strlen(name);
+    if (namelen == 0)
+        return NF2FS_ERR_INVAL;
+
+    // dirs may be found in ram-tree
+    NF2FS_size_t tree_index= NF2FS_NULL;
+    if (!NF2FS_tree_entry_name_find(NF2FS, name, namelen, (*father_addr)->id, &tree_index)) {
+        memcpy(entry, &NF2FS->ram_tree->tree_array[tree_index], sizeof(NF2FS_tree_entry_ram_t));
+        *type= NF2FS_DATA_DIR;
+        return err;
+    }
+
+    err= NF2FS_dir_name_find(NF2FS, *father_addr, name, namelen, NF2FS_DATA_REG, entry);
+    if (err || entry->id != NF2FS_NULL) {
+        *type= NF2FS_DATA_REG;
+        return err;
+    }
+
+    *type= NF2FS_DATA_DIR;
+    return NF2FS_dir_name_find(NF2FS, *father_addr, name, namelen, NF2FS_DATA_DIR, entry);
+}
+
+/**
+ * Rename a file or dir, it's moved to another dir if the father dir in new_path is different.
+ *
+ * Only a new name record with the same id is programmed, and data or index record of a file
+ * if it's moved to another dir. An existing file at new_path is replaced if it's not opened,
+ * an existing dir is never replaced.
+ */
+int NF2FS_rename(NF2FS_t* NF2FS, char* old_path, char* new_path)
+{
+    int err = NF2FS_ERR_OK;
+
+    NF2FS_file_ram_t* file= NULL;
+    NF2FS_file_ram_t* target= NULL;
+    bool file_opened= false;
+
+    // find the old name
+    NF2FS_dir_ram_t* father= NULL;
+    NF2FS_tree_entry_ram_t entry;
+    int type= NF2FS_DATA_REG;
+    err= NF2FS_path_entry_find(NF2FS, old_path, &father, &entry, &type);
+    if (err)
+        return err;
+    if (entry.id == NF2FS_NULL)
+        return NF2FS_ERR_NOENT;
+
+    // find the new name
+    NF2FS_dir_ram_t* new_father= NULL;
+    NF2FS_tree_entry_ram_t new_entry;
+    int new_type= NF2FS_DATA_REG;
+    err= NF2FS_path_entry_find(NF2FS, new_path, &new_father, &new_entry, &new_type);
+    if (err)
+        return err;
+    if (new_entry.id == entry.id)
+        return err;
+    if (new_entry.id != NF2FS_NULL && (type == NF2FS_DATA_DIR || new_type == NF2FS_DATA_DIR))
+        return NF2FS_ERR_EXIST;
+
+    char *name = NF2FS_name_in_path(new_path);
+    if (*name == '/')
+        name++;
+    NF2FS_size_t namelen= strlen(name);
+
+    if (type == NF2FS_DATA_DIR) {
+        // a dir can not be moved into itself or its sons
+        NF2FS_size_t id= new_father->id;
+        while (id != NF2FS_ID_ROOT) {
+            if (id == entry.id)
+                return NF2FS_ERR_INVAL;
+
+            NF2FS_size_t tree_index= NF2FS_NULL;
+            err= NF2FS_tree_entry_id_find(NF2FS->ram_tree, id, &tree_index);
+            if (err)
+                return err;
+            id= NF2FS->ram_tree->tree_array[tree_index].father_id;
+        }
+
+        // the dir keeps opened like father dirs of opened files
+        NF2FS_dir_ram_t* dir= NULL;
+        err= NF2FS_dir_lowopen(NF2FS, entry.tail_sector, entry.id, father->id,
+                              entry.name_sector, entry.name_off, &dir, NF2FS->rcache);
+        if (err)
+            return err;
+        return NF2FS_dir_move(NF2FS, father, new_father, dir, name, namelen);
+    }
+
+    // the replaced file should not be used by others
+    if (new_entry.id != NF2FS_NULL) {
+        for (target= NF2FS->file_list; target != NULL; target= target->next_file) {
+            if (target->id == new_entry.id)
+                return NF2FS_ERR_INVAL;
+        }
+        err= NF2FS_file_lowopen(NF2FS, new_father, new_entry.id, new_entry.name_sector,
+                               new_entry.name_off, namelen, &target);
+        if (err)
+            goto cleanup;
+    }
+
+    // files opened in rename are closed at last, so gc could update them
+    for (file= NF2FS->file_list; file != NULL; file= file->next_file) {
+        if (file->id == entry.id) {
+            file_opened= true;
+            break;
+        }
+    }
+    if (!file_opened) {
+        char *old_name = NF2FS_name_in_path(old_path);
+        if (*old_name == '/')
+            old_name++;
+        err= NF2FS_file_lowopen(NF2FS, father, entry.id, entry.name_sector, entry.name_off,
+                               strlen(old_name), &file);
+        if (err)
+            goto cleanup;
+    }
+
+    err= NF2FS_file_move(NF2FS, father, new_father, file, name, namelen);
+    if (err)
+        goto cleanup;
+
+    // delete the replaced file after the new name is valid
+    if (target != NULL) {
+        err= NF2FS_file_delete(NF2FS, target);
+        if (err)
+            goto cleanup;
+        target= NULL;
+    }
+
+cleanup:
+    if (target != NULL)
+        NF2FS_file_free(&NF2FS->file_list, target);
+    if (file != NULL && !file_opened)
+        NF2FS_file_free(&NF2FS->file_list, file);
+    return err;
+}
+
+/**
+ * Delete a file by path without opening it.
+ *
+ * The name and the data or index record are found without a file cache, and sectors of a big
+ * file are set old with its index on flash. An opened file should be deleted with its handle.
+ */
+int NF2FS_unlink(NF2FS_t* NF2FS, char* path)
+{
+    int err = NF2FS_ERR_OK;
+
+    // find the name
+    NF2FS_dir_ram_t* father= NULL;
+    NF2FS_tree_entry_ram_t entry;
+    int type= NF2FS_DATA_REG;
+    err= NF2FS_path_entry_find(NF2FS, path, &father, &entry, &type);
+    if (err)
+        return err;
+    if (entry.id == NF2FS_NULL)
+        return NF2FS_ERR_NOENT;
+    if (type == NF2FS_DATA_DIR)
+        return NF2FS_ERR_ISDIR;
+
+    NF2FS_file_ram_t* file= NF2FS->file_list;
+    while (file != NULL) {
+        if (file->id == entry.id)
+            return NF2FS_ERR_INVAL;
+        file= file->next_file;
+    }
+
+    // find the data or index record behind the name
+    NF2FS_file_ram_t temp_file;
+    temp_file.id= entry.id;
+    err= NF2FS_file_record_find(NF2FS, father, father->tail_sector, &temp_file,
+                                entry.name_sector, entry.name_off);
+    if (err)
+        return err;
+
+    if (temp_file.file_cache.sector != NF2FS_NULL) {
+        // big file is not smaller than threshold after flushing
+        if (temp_file.file_size > NF2FS_FILE_SIZE_THRESHOLD) {
+            err= NF2FS_bfile_record_old(NF2FS, temp_file.file_cache.sector, temp_file.file_cache.off,
+                                       temp_file.file_cache.size);
+            if (err)
+                return err;
+        }
+
+        err= NF2FS_data_delete(NF2FS, father->id, temp_file.file_cache.sector,
+                              temp_file.file_cache.off, temp_file.file_cache.size);
+        if (err)
+            return err;
+    }
+
+    // delete the name, it stays in the name filter
+    char *name = NF2FS_name_in_path(path);
+    if (*name == '/')
+        name++;
+    err= NF2FS_data_delete(NF2FS, father->id, entry.name_sector, entry.name_off,
+                          strlen(name) + sizeof(NF2FS_file_name_flash_t));
+    if (err)
+        return err;
+#if NF2FS_DIR_FILTER_BITS > 0
+    father->filter.stale++;
+#endif
+
+    NF2FS_file_heat_drop(NF2FS, entry.id);
+    return NF2FS_id_free(NF2FS, NF2FS->id_map, entry.id);
 }
 
 /**
@@ -782,8 +1321,8 @@ int NF2FS_dir_open(NF2FS_t* NF2FS, NF2FS_dir_ram_t** dir, char* path)
     err= NF2FS_tree_entry_name_find(NF2FS, name, strlen(name), father_dir->id, &tree_index);
     if (err) {
         // find opened dir in flash
-        err= NF2FS_dtraverse_name(NF2FS, father_dir->tail_sector, name, strlen(name),
-                                NF2FS_DATA_REG, &temp_entry);
+        err= NF2FS_dir_name_find(NF2FS, father_dir, name, strlen(name),
+                                NF2FS_DATA_DIR, &temp_entry);
         if (err)
             return err;
     }
@@ -828,13 +1367,22 @@ int NF2FS_dir_close(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
     NF2FS_dir_ospace_flash_t old_space= {
         .head= NF2FS_MKDHEAD(0, 1, dir->id, NF2FS_DATA_DIR_OSPACE, sizeof(NF2FS_dir_ospace_flash_t)),
         .old_space= dir->old_space,
+        .oldest_sector= dir->oldest_sector,
     };
     err= NF2FS_dir_prog(NF2FS, dir, &old_space, sizeof(NF2FS_dir_ospace_flash_t));
     if (err)
         return err;
 
+    // the reclaimer finds old space and sectors of the closed dir in tree
+    err= NF2FS_tree_entry_ospace(NF2FS->ram_tree, dir->id, dir->old_space);
+    if (err)
+        return err;
+    err= NF2FS_tree_entry_sectors(NF2FS->ram_tree, dir->id, dir->sectors);
+    if (err)
+        return err;
+
     // flush cache data to flash
-    err = NF2FS_cache_flush(NF2FS, NF2FS->pcache);
+    err = NF2FS_pcache_flush_all(NF2FS);
     if (err)
         return err;
 
@@ -854,6 +1402,7 @@ int NF2FS_dir_close(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
     }
 
     // free dir's memory
+    NF2FS_dcursor_free(dir);
     NF2FS_free(dir);
     return err;
 }
@@ -884,6 +1433,9 @@ int NF2FS_dir_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                              sizeof(NF2FS_dir_name_flash_t) + dir->namelen);
     if (err)
         return err;
+#if NF2FS_DIR_FILTER_BITS > 0
+    father_dir->filter.stale++;
+#endif
 
     // Delete the tree entry
     err= NF2FS_tree_entry_remove(NF2FS->ram_tree, dir->id);
@@ -891,12 +1443,13 @@ int NF2FS_dir_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
         return err;
 
     // Free id that belongs to dir.
+    NF2FS_file_heat_drop(NF2FS, dir->id);
     err = NF2FS_id_free(NF2FS, NF2FS->id_map, dir->id);
     if (err)
         return err;
 
     // Free in-ram dir structure.
-    err = NF2FS_dir_free(NF2FS->dir_list, dir);
+    err = NF2FS_dir_free(NF2FS, dir);
     return err;
 }
 
@@ -916,21 +1469,23 @@ int NF2FS_dir_read(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_info_ram_t* info)
     uint8_t *data = NULL;
     NF2FS_size_t head;
     NF2FS_size_t len = sizeof(NF2FS_head_t);
+    NF2FS_cache_ram_t* rcache= NULL;
     while (true) {
-        if (~((NF2FS->rcache->sector == dir->pos_sector) &&
-              (NF2FS->rcache->off + NF2FS->rcache->size >= dir->pos_off + len) &&
-              (NF2FS->rcache->off <= dir->pos_off))) {
+        if (!((rcache != NULL) && (rcache->sector == dir->pos_sector) &&
+              (rcache->off + rcache->size >= dir->pos_off + len) &&
+              (rcache->off <= dir->pos_off))) {
             
-            // read other data to cache
-            err = NF2FS_read_to_cache(NF2FS, NF2FS->rcache, dir->pos_sector, dir->pos_off,
-                                       NF2FS_min(NF2FS->cfg->cache_size, NF2FS->cfg->sector_size - dir->pos_off));
+            // read other data to cache, the tail sector of dir is pinned
+            err = NF2FS_rcache_fetch(NF2FS, &rcache, dir->pos_sector, dir->pos_off,
+                                     NF2FS_min(NF2FS->cfg->cache_size, NF2FS->cfg->sector_size - dir->pos_off),
+                                     dir->pos_sector == dir->tail_sector);
             if (err)
                 return err;
 
-            data = NF2FS->rcache->buffer;
+            data = rcache->buffer + dir->pos_off - rcache->off;
         } else {
             // get the next head position
-            data = NF2FS->rcache->buffer + dir->pos_off - NF2FS->rcache->off;
+            data = rcache->buffer + dir->pos_off - rcache->off;
         }
 
         if (dir->pos_off == 0) {
@@ -941,9 +1496,9 @@ int NF2FS_dir_read(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_info_ram_t* info)
                 return err;
 
             NF2FS_dir_sector_flash_t *dir_sector = (NF2FS_dir_sector_flash_t *)data;
-            dir->pos_presector = dir_sector->pre_sector;
-            data += sizeof(NF2FS_dir_sector_flash_t);
-            dir->pos_off += sizeof(NF2FS_dir_sector_flash_t);
+            dir->pos_presector = NF2FS_dir_pre(dir_sector);
+            data += NF2FS_dir_begin(NF2FS);
+            dir->pos_off += NF2FS_dir_begin(NF2FS);
             len = sizeof(NF2FS_head_t);
         }
 
@@ -958,7 +1513,7 @@ int NF2FS_dir_read(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_info_ram_t* info)
             }
 
             len = NF2FS_dhead_dsize(head);
-            if (dir->pos_off + len > NF2FS->rcache->off + NF2FS->rcache->size) {
+            if (dir->pos_off + len > rcache->off + rcache->size) {
                 if (head == NF2FS_NULL && dir->pos_presector != NF2FS_NULL) {
                     // time to traverse next sector
                     dir->pos_sector = dir->pos_presector;
@@ -999,6 +1554,7 @@ int NF2FS_dir_read(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_info_ram_t* info)
             case NF2FS_DATA_BFILE_INDEX:
             case NF2FS_DATA_SFILE_DATA:
             case NF2FS_DATA_DIR_OSPACE:    
+            case NF2FS_DATA_SEAL:
                 break;
 
             case NF2FS_DATA_FREE:
@@ -1023,9 +1579,39 @@ int NF2FS_dir_read(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_info_ram_t* info)
                 dir->pos_off += len;
                 data += len;
                 len= sizeof(NF2FS_head_t);
-                if (dir->pos_off + sizeof(NF2FS_head_t) < NF2FS->rcache->off + NF2FS->rcache->size)
+
+                // the next head should be entirely in cache, or the cache is read again
+                if (dir->pos_off + sizeof(NF2FS_head_t) > rcache->off + rcache->size)
                     break;
             }
         }
     }
 }
+
+// read an dir entry with its id, size and where its name is, the dir is read ahead by cache size.
+// The next read after the end lists the dir again.
+int NF2FS_dir_readplus(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_dentry_ram_t* dentry)
+{
+    return NF2FS_dcursor_next(NF2FS, dir, dentry);
+}
+
+// list all entries of dir with cb, names are not copied.
+int NF2FS_dir_list(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_list_cb_t cb, void* data)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_dentry_ram_t dentry;
+
+    // listing always begins at the tail of dir
+    NF2FS_dcursor_free(dir);
+    while (true) {
+        err= NF2FS_dcursor_next(NF2FS, dir, &dentry);
+        if (err || dentry.type == 0)
+            break;
+
+        err= cb(data, &dentry);
+        if (err)
+            break;
+    }
+    NF2FS_dcursor_free(dir);
+    return err;
+}
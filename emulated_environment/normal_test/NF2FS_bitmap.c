@@ -0,0 +1,202 @@
+/**
+ * The word-level bitmap operations of NF2FS
+ */
+
+#include "NF2FS_bitmap.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "NF2FS.h"
+#include "NF2FS_util.h"
+
+#if !defined(NF2FS_NO_INTRINSICS) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NF2FS_BITMAP_NEON
+#elif !defined(NF2FS_NO_INTRINSICS) && defined(__SSE2__)
+#include <emmintrin.h>
+#define NF2FS_BITMAP_SSE2
+#if defined(__SSSE3__) && !defined(__POPCNT__)
+#include <tmmintrin.h>
+#define NF2FS_BITMAP_SSSE3
+#endif
+#endif
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ------------------------------------------------------------    Bitmap operations    ----------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Mask of bits [low, high) in a word, 0 <= low < high <= 32.
+static inline uint32_t NF2FS_bitmap_mask(NF2FS_size_t low, NF2FS_size_t high)
+{
+    uint32_t mask= (high == 32) ? 0xffffffff : ((1U << high) - 1);
+    return mask & ~((1U << low) - 1);
+}
+
+// Count the number of bits 1 in whole words.
+static NF2FS_size_t NF2FS_bitmap_popc_words(const uint32_t* map, NF2FS_size_t words)
+{
+    NF2FS_size_t cnt= 0;
+    NF2FS_size_t i= 0;
+
+#if defined(NF2FS_BITMAP_NEON)
+    // count bits in each byte, then widen and add them up
+    uint32x4_t acc= vdupq_n_u32(0);
+    for (; i + 4 <= words; i+= 4) {
+        uint8x16_t bytes= vcntq_u8(vreinterpretq_u8_u32(vld1q_u32(map + i)));
+        acc= vaddq_u32(acc, vpaddlq_u16(vpaddlq_u8(bytes)));
+    }
+    cnt= vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+         vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#elif defined(NF2FS_BITMAP_SSSE3)
+    // look up bits in each nibble, then sum bytes with sad
+    const __m128i table= _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i low= _mm_set1_epi8(0x0f);
+    __m128i acc= _mm_setzero_si128();
+    for (; i + 4 <= words; i+= 4) {
+        __m128i data= _mm_loadu_si128((const __m128i*)(map + i));
+        __m128i bytes= _mm_add_epi8(_mm_shuffle_epi8(table, _mm_and_si128(data, low)),
+                                    _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(data, 4), low)));
+        acc= _mm_add_epi64(acc, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+    }
+    cnt= _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+#endif
+
+    for (; i < words; i++)
+        cnt+= NF2FS_popc(map[i]);
+    return cnt;
+}
+
+// Return the value of bit i in map.
+bool NF2FS_bitmap_test(const uint32_t* map, NF2FS_size_t i)
+{
+    return (map[i / 32] >> (i % 32)) & 1U;
+}
+
+// Count the number of bits 1 in [begin, end) of map.
+NF2FS_size_t NF2FS_bitmap_count(const uint32_t* map, NF2FS_size_t begin, NF2FS_size_t end)
+{
+    if (begin >= end)
+        return 0;
+
+    NF2FS_size_t first= begin / 32;
+    NF2FS_size_t last= (end - 1) / 32;
+    if (first == last)
+        return NF2FS_popc(map[first] & NF2FS_bitmap_mask(begin % 32, (end - 1) % 32 + 1));
+
+    // the head and tail word may be partial
+    NF2FS_size_t cnt= NF2FS_popc(map[first] & NF2FS_bitmap_mask(begin % 32, 32));
+    cnt+= NF2FS_bitmap_popc_words(map + first + 1, last - first - 1);
+    cnt+= NF2FS_popc(map[last] & NF2FS_bitmap_mask(0, (end - 1) % 32 + 1));
+    return cnt;
+}
+
+// Return the first bit in [begin, end) whose value is bit_val, or end if there is none.
+NF2FS_size_t NF2FS_bitmap_next(const uint32_t* map, NF2FS_size_t begin, NF2FS_size_t end, bool bit_val)
+{
+    NF2FS_size_t i= begin;
+    while (i < end) {
+        uint32_t word= bit_val ? map[i / 32] : ~map[i / 32];
+        word>>= i % 32;
+        if (word)
+            return NF2FS_min(i + NF2FS_ctz(word), end);
+
+        // no such bit in the rest of the word
+        i= NF2FS_aligndown(i, 32) + 32;
+    }
+    return end;
+}
+
+// Find num sequential bits 1 in [begin, end), return the first bit of them or NF2FS_NULL.
+// If not found and tail is not NULL, tail is the length of the run of bits 1 that ends at end.
+NF2FS_size_t NF2FS_bitmap_find(const uint32_t* map, NF2FS_size_t begin, NF2FS_size_t end,
+                               NF2FS_size_t num, NF2FS_size_t* tail)
+{
+    NF2FS_size_t run= 0;
+    NF2FS_size_t i= begin;
+    while (i < end) {
+        // the run begins at the next bit 1 and stops at the next bit 0
+        NF2FS_size_t start= NF2FS_bitmap_next(map, i, end, true);
+        if (start == end)
+            break;
+
+        i= NF2FS_bitmap_next(map, start, NF2FS_min(start + num, end), false);
+        if (i - start >= num)
+            return start;
+
+        if (i == end) {
+            run= i - start;
+            break;
+        }
+    }
+
+    if (tail)
+        *tail= run;
+    return NF2FS_NULL;
+}
+
+// Return the length of the longest run of bits 1 in [begin, end).
+NF2FS_size_t NF2FS_bitmap_longest(const uint32_t* map, NF2FS_size_t begin, NF2FS_size_t end)
+{
+    NF2FS_size_t longest= 0;
+    NF2FS_size_t i= begin;
+    while (i < end) {
+        NF2FS_size_t start= NF2FS_bitmap_next(map, i, end, true);
+        if (start == end)
+            break;
+
+        i= NF2FS_bitmap_next(map, start, end, false);
+        longest= NF2FS_max(longest, i - start);
+    }
+    return longest;
+}
+
+// Set num bits from begin to bit_val.
+static void NF2FS_bitmap_fill(uint32_t* map, NF2FS_size_t begin, NF2FS_size_t num, bool bit_val)
+{
+    while (num > 0) {
+        NF2FS_size_t off= begin % 32;
+        NF2FS_size_t len= NF2FS_min(num, 32 - off);
+        uint32_t mask= NF2FS_bitmap_mask(off, off + len);
+        if (bit_val)
+            map[begin / 32]|= mask;
+        else
+            map[begin / 32]&= ~mask;
+
+        begin+= len;
+        num-= len;
+    }
+}
+
+// Set num bits from begin to 1.
+void NF2FS_bitmap_set(uint32_t* map, NF2FS_size_t begin, NF2FS_size_t num)
+{
+    NF2FS_bitmap_fill(map, begin, num, true);
+}
+
+// Turn num bits from begin to 0.
+void NF2FS_bitmap_clear(uint32_t* map, NF2FS_size_t begin, NF2FS_size_t num)
+{
+    NF2FS_bitmap_fill(map, begin, num, false);
+}
+
+// Merge two maps with words uint32_t, i.e dst |= ~src.
+void NF2FS_bitmap_merge(uint32_t* dst, const uint32_t* src, NF2FS_size_t words)
+{
+    NF2FS_size_t i= 0;
+
+#if defined(NF2FS_BITMAP_NEON)
+    for (; i + 4 <= words; i+= 4)
+        vst1q_u32(dst + i, vornq_u32(vld1q_u32(dst + i), vld1q_u32(src + i)));
+#elif defined(NF2FS_BITMAP_SSE2)
+    const __m128i ones= _mm_set1_epi32(-1);
+    for (; i + 4 <= words; i+= 4) {
+        __m128i data= _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i mask= _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), ones);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(data, mask));
+    }
+#endif
+
+    for (; i < words; i++)
+        dst[i]|= ~src[i];
+}
@@ -0,0 +1,55 @@
+/**
+ * The word-level bitmap operations of NF2FS
+ */
+
+#ifndef NF2FS_BITMAP_H
+#define NF2FS_BITMAP_H
+
+#include "NF2FS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ------------------------------------------------------------    Bitmap operations    ----------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+/**
+ * Bitmaps are arrays of uint32_t, bit i is bit (i % 32) of word (i / 32).
+ * In sector and id maps, bit 1 means free and bit 0 means used.
+ */
+
+// Return the value of bit i in map.
+bool NF2FS_bitmap_test(const uint32_t* map, NF2FS_size_t i);
+
+// Count the number of bits 1 in [begin, end) of map.
+NF2FS_size_t NF2FS_bitmap_count(const uint32_t* map, NF2FS_size_t begin, NF2FS_size_t end);
+
+// Return the first bit in [begin, end) whose value is bit_val, or end if there is none.
+NF2FS_size_t NF2FS_bitmap_next(const uint32_t* map, NF2FS_size_t begin, NF2FS_size_t end, bool bit_val);
+
+// Find num sequential bits 1 in [begin, end), return the first bit of them or NF2FS_NULL.
+// If not found and tail is not NULL, tail is the length of the run of bits 1 that ends at end.
+NF2FS_size_t NF2FS_bitmap_find(const uint32_t* map, NF2FS_size_t begin, NF2FS_size_t end,
+                               NF2FS_size_t num, NF2FS_size_t* tail);
+
+// Return the length of the longest run of bits 1 in [begin, end).
+NF2FS_size_t NF2FS_bitmap_longest(const uint32_t* map, NF2FS_size_t begin, NF2FS_size_t end);
+
+// Set num bits from begin to 1.
+void NF2FS_bitmap_set(uint32_t* map, NF2FS_size_t begin, NF2FS_size_t num);
+
+// Turn num bits from begin to 0.
+void NF2FS_bitmap_clear(uint32_t* map, NF2FS_size_t begin, NF2FS_size_t num);
+
+// Merge two maps with words uint32_t, i.e dst |= ~src.
+void NF2FS_bitmap_merge(uint32_t* dst, const uint32_t* src, NF2FS_size_t words);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
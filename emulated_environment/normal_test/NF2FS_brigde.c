@@ -59,16 +59,90 @@ int W25Qxx_eraseNF2FS(const struct NF2FS_config *c, NF2FS_size_t sector)
     return NF2FS_ERR_OK;
 }
 
+int W25Qxx_readvNF2FS(const struct NF2FS_config *c, const struct NF2FS_iovec *iov,
+                      NF2FS_size_t cnt)
+{
+    W25QXX_seg_t segs[NF2FS_IOV_MAX];
+    if (cnt > NF2FS_IOV_MAX) {
+        return NF2FS_ERR_INVAL;
+    }
+
+    for (int i = 0; i < cnt; i++) {
+        if (iov[i].sector >= W25Q256_NUM_GRAN) {
+            return NF2FS_ERR_IO;
+        }
+        segs[i].buffer = iov[i].buffer;
+        segs[i].address = iov[i].sector * W25Q256_ERASE_GRAN + iov[i].off;
+        segs[i].size = iov[i].size;
+    }
+
+    W25QXX_Read_Chain(segs, cnt);
+    return NF2FS_ERR_OK;
+}
+
+int W25Qxx_progvNF2FS(const struct NF2FS_config *c, const struct NF2FS_iovec *iov,
+                      NF2FS_size_t cnt)
+{
+    W25QXX_seg_t segs[NF2FS_IOV_MAX];
+    if (cnt > NF2FS_IOV_MAX) {
+        return NF2FS_ERR_INVAL;
+    }
+
+    for (int i = 0; i < cnt; i++) {
+        if (iov[i].sector >= W25Q256_NUM_GRAN) {
+            return NF2FS_ERR_IO;
+        }
+        segs[i].buffer = iov[i].buffer;
+        segs[i].address = iov[i].sector * W25Q256_ERASE_GRAN + iov[i].off;
+        segs[i].size = iov[i].size;
+    }
+
+    W25QXX_Write_Chain(segs, cnt);
+    return NF2FS_ERR_OK;
+}
+
+int W25Qxx_erase_asyncNF2FS(const struct NF2FS_config *c, NF2FS_size_t sector)
+{
+    if (sector >= W25Q256_NUM_GRAN) {
+        return NF2FS_ERR_IO;
+    }
+
+    W25QXX_Erase_Sector_Async(sector);
+    return NF2FS_ERR_OK;
+}
+
+int W25Qxx_write_asyncNF2FS(const struct NF2FS_config *c, NF2FS_size_t sector,
+                            NF2FS_off_t off, void *buffer, NF2FS_size_t size)
+{
+    if (sector >= W25Q256_NUM_GRAN) {
+        return NF2FS_ERR_IO;
+    }
+
+    W25QXX_Write_Async(buffer, sector * W25Q256_ERASE_GRAN + off, size);
+    return NF2FS_ERR_OK;
+}
+
+int W25Qxx_busyNF2FS(const struct NF2FS_config *c)
+{
+    return W25QXX_Busy();
+}
+
 int W25Qxx_syncNF2FS(const struct NF2FS_config *c)
 {
     return NF2FS_ERR_OK;
 }
 
-const struct NF2FS_config NF2FS_cfg = {
+// map_base is set to the simulated flash when mounting
+struct NF2FS_config NF2FS_cfg = {
     .read = W25Qxx_readNF2FS,
     .prog = W25Qxx_writeNF2FS,
     .erase = W25Qxx_eraseNF2FS,
     .sync = W25Qxx_syncNF2FS,
+    .readv = W25Qxx_readvNF2FS,
+    .progv = W25Qxx_progvNF2FS,
+    .erase_async = W25Qxx_erase_asyncNF2FS,
+    .prog_async = W25Qxx_write_asyncNF2FS,
+    .busy = W25Qxx_busyNF2FS,
 
     .read_size = 1,
     .prog_size = 1,
@@ -81,12 +155,16 @@ const struct NF2FS_config NF2FS_cfg = {
     // .region_cnt = 64,
     .name_max = 255,
     .file_max = NF2FS_FILE_MAX_SIZE,
+    .crc_seal = true,
+    .dual_end = false,
 };
 
 int NF2FS_mount_wrp()
 {
     int err = -1;
 
+    extern char *sflash;
+    NF2FS_cfg.map_base = sflash;
     err = NF2FS_mount(&NF2FS, &NF2FS_cfg);
     if (err) {
         printf("mount fail is %d\r\n", err);
@@ -238,6 +316,125 @@ int NF2FS_readdir_wrp(int fd, struct nfvfs_dentry *buf)
     return err;
 }
 
+int NF2FS_stat_wrp(const char *path, void *buf)
+{
+    struct nfvfs_stat *st = (struct nfvfs_stat *)buf;
+    NF2FS_stat_ram_t my_stat;
+
+    int err = NF2FS_stat(&NF2FS, (char *)path, &my_stat);
+    if (err < 0) {
+        return err;
+    }
+
+    st->type = (my_stat.type == NF2FS_DATA_DIR) ? (int)NFVFS_TYPE_DIR : (int)NFVFS_TYPE_REG;
+    st->size = my_stat.size;
+    return err;
+}
+
+int NF2FS_rename_wrp(const char *oldpath, const char *newpath)
+{
+    return NF2FS_rename(&NF2FS, (char *)oldpath, (char *)newpath);
+}
+
+int NF2FS_unlink_wrp(const char *path)
+{
+    int err = NF2FS_unlink(&NF2FS, (char *)path);
+    if (err < 0) {
+        printf("unlink error is %d\r\n", err);
+    }
+    return err;
+}
+
+int NF2FS_fstat_wrp(int fd, void *buf)
+{
+    struct nfvfs_fentry *entry = ftable_get_entry(fd);
+    struct nfvfs_stat *st = (struct nfvfs_stat *)buf;
+    NF2FS_stat_ram_t my_stat;
+
+    if (entry == NULL) {
+        return -1;
+    }
+
+    if (S_IFREG(entry->mode)) {
+        NF2FS_file_stat(&NF2FS, (NF2FS_file_ram_t *)entry->f, &my_stat);
+        st->type = (int)NFVFS_TYPE_REG;
+        st->size = my_stat.size;
+    } else {
+        st->type = (int)NFVFS_TYPE_DIR;
+        st->size = 0;
+    }
+    return NF2FS_ERR_OK;
+}
+
+int NF2FS_truncate_wrp(const char *path, int length)
+{
+    NF2FS_file_ram_t *file;
+    NF2FS_stat_ram_t my_stat;
+
+    // do not create the file if it's not there
+    int err = NF2FS_stat(&NF2FS, (char *)path, &my_stat);
+    if (err < 0) {
+        return err;
+    }
+    if (my_stat.type != NF2FS_DATA_REG) {
+        return -1;
+    }
+
+    err = NF2FS_file_open(&NF2FS, &file, (char *)path, 0);
+    if (err < 0) {
+        return err;
+    }
+
+    err = NF2FS_file_truncate(&NF2FS, file, length);
+    if (err < 0) {
+        printf("file truncate error is %d\r\n", err);
+        NF2FS_file_close(&NF2FS, file);
+        return err;
+    }
+    return NF2FS_file_close(&NF2FS, file);
+}
+
+int NF2FS_ftruncate_wrp(int fd, int length)
+{
+    struct nfvfs_fentry *entry = ftable_get_entry(fd);
+    if (entry == NULL || !S_IFREG(entry->mode)) {
+        return -1;
+    }
+
+    int err = NF2FS_file_truncate(&NF2FS, (NF2FS_file_ram_t *)entry->f, length);
+    if (err < 0) {
+        printf("file truncate error is %d\r\n", err);
+    }
+    return err;
+}
+
+struct NF2FS_list_action {
+    int (*action)(const char *name, void *data);
+    void *data;
+};
+
+static int NF2FS_list_cb(void *data, NF2FS_dentry_ram_t *dentry)
+{
+    struct NF2FS_list_action *list = (struct NF2FS_list_action *)data;
+    return list->action(dentry->name, list->data);
+}
+
+int NF2FS_list_wrp(int fd, int (*action)(const char *name, void *data), void *data)
+{
+    struct nfvfs_fentry *entry = ftable_get_entry(fd);
+    struct NF2FS_list_action list = {
+        .action = action,
+        .data = data,
+    };
+
+    int err = NF2FS_dir_list(&NF2FS, (NF2FS_dir_ram_t *)entry->f, NF2FS_list_cb, &list);
+    if (err < 0) {
+        printf("list dir error type is %d\r\n", err);
+        return -1;
+    }
+    return err;
+}
+
 int NF2FS_delete_wrp(int fd, char *path, int mode)
 {
     int err = NF2FS_ERR_OK;
@@ -285,6 +482,36 @@ int NF2FS_sync_wrp(int fd)
     return 0;
 }
 
+// addr is where to store the pointer, return the size of data mapped continuously
+int NF2FS_mmap_wrp(void *addr, int len, int prot, int flags, int fd, int offset)
+{
+    struct nfvfs_fentry *entry = ftable_get_entry(fd);
+    NF2FS_mmap_extent_t extent;
+
+    if (entry == NULL || !S_IFREG(entry->mode)) {
+        return -1;
+    }
+
+    int err = NF2FS_file_mmap(&NF2FS, (NF2FS_file_ram_t *)entry->f, offset, len, &extent, 1);
+    if (err < 0) {
+        printf("file mmap error is %d\r\n", err);
+        return err;
+    }
+
+    *(const void **)addr = extent.addr;
+    return extent.size;
+}
+
+// size is the max number of sectors to pre-erase
+int NF2FS_gc_wrp(int size)
+{
+    int err = NF2FS_fs_idle(&NF2FS, size);
+    if (err < 0) {
+        printf("fs idle error is %d\r\n", err);
+    }
+    return err;
+}
+
 struct nfvfs_operations NF2FS_ops = {
     .mount = NF2FS_mount_wrp,
     .unmount = NF2FS_unmount_wrp,
@@ -295,7 +522,16 @@ struct nfvfs_operations NF2FS_ops = {
     .write = NF2FS_write_wrp,
     .lseek = NF2FS_lseek_wrp,
     .readdir = NF2FS_readdir_wrp,
+    .list = NF2FS_list_wrp,
+    .stat = NF2FS_stat_wrp,
+    .fstat = NF2FS_fstat_wrp,
+    .truncate = NF2FS_truncate_wrp,
+    .ftruncate = NF2FS_ftruncate_wrp,
+    .unlink = NF2FS_unlink_wrp,
+    .rename = NF2FS_rename_wrp,
     .remove = NF2FS_delete_wrp,
     .fsync = NF2FS_fsync_wrp,
     .sync = NF2FS_sync_wrp,
+    .mmap = NF2FS_mmap_wrp,
+    .gc = NF2FS_gc_wrp,
 };
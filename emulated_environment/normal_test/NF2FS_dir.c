@@ -13,17 +13,20 @@
 #include "NF2FS_rw.h"
 #include "NF2FS_tree.h"
 #include "NF2FS_manage.h"
+#include "NF2FS_file.h"
 #include "NF2FS_util.h"
 
 // // NEXT
 // #include "FreeRTOS.h"
 
 // Free specific dir in dir list.
-int NF2FS_dir_free(NF2FS_dir_ram_t *list, NF2FS_dir_ram_t *dir)
+int NF2FS_dir_free(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir)
 {
     // If dir is at the begin of list.
+    NF2FS_dir_ram_t *list = NF2FS->dir_list;
     if (list->id == dir->id) {
-        list = dir->next_dir;
+        NF2FS->dir_list = dir->next_dir;
+        NF2FS_dcursor_free(dir);
         NF2FS_free(dir);
         return NF2FS_ERR_OK;
     }
@@ -40,14 +43,407 @@ int NF2FS_dir_free(NF2FS_dir_ram_t *list, NF2FS_dir_ram_t *dir)
         return NF2FS_ERR_NODIROPEN;
     else {
         list->next_dir = dir->next_dir;
+        NF2FS_dcursor_free(dir);
         NF2FS_free(dir);
         return NF2FS_ERR_OK;
     }
 }
 
-// Find the needed name address in the dir.
+// The 16 bits hash of name, it's kept in name footers and used by the name filter.
+uint16_t NF2FS_name_hash(char* name, NF2FS_size_t namelen)
+{
+    NF2FS_hash_t hash= NF2FS_hash((uint8_t*)name, namelen);
+    hash^= hash >> 16;
+    hash*= 0x85ebca6b;
+    hash^= hash >> 13;
+    hash*= 0xc2b2ae35;
+    hash^= hash >> 16;
+    return (uint16_t)hash;
+}
+
+#if NF2FS_DIR_FILTER_BITS > 0
+// Spread the name hash, probes of the name filter are got by double hashing.
+static NF2FS_hash_t NF2FS_filter_hash(uint16_t name_hash)
+{
+    NF2FS_hash_t hash= name_hash * 0x9e3779b1;
+    hash^= hash >> 15;
+    hash*= 0x85ebca6b;
+    hash^= hash >> 13;
+    return hash;
+}
+
+// Reset the name filter, it's valid for a dir without names.
+void NF2FS_filter_reset(NF2FS_name_filter_ram_t* filter, bool valid)
+{
+    memset(filter->bits, 0, sizeof(filter->bits));
+    filter->valid= valid;
+    filter->names= 0;
+    filter->stale= 0;
+}
+
+// Add a name to the name filter by its name hash.
+void NF2FS_filter_add(NF2FS_name_filter_ram_t* filter, uint16_t name_hash)
+{
+    NF2FS_hash_t hash= NF2FS_filter_hash(name_hash);
+    NF2FS_hash_t step= ((hash >> 16) | (hash << 16)) | 1;
+
+    // 3 probes for each name
+    for (int i= 0; i < 3; i++) {
+        NF2FS_size_t bit= (hash + i * step) % NF2FS_DIR_FILTER_BITS;
+        filter->bits[bit / 32]|= 1U << (bit % 32);
+    }
+    filter->names++;
+}
+
+// Whether or not the name with the name hash may be in the name filter.
+bool NF2FS_filter_test(NF2FS_name_filter_ram_t* filter, uint16_t name_hash)
+{
+    NF2FS_hash_t hash= NF2FS_filter_hash(name_hash);
+    NF2FS_hash_t step= ((hash >> 16) | (hash << 16)) | 1;
+
+    for (int i= 0; i < 3; i++) {
+        NF2FS_size_t bit= (hash + i * step) % NF2FS_DIR_FILTER_BITS;
+        if (!(filter->bits[bit / 32] & (1U << (bit % 32))))
+            return false;
+    }
+    return true;
+}
+#endif
+
+// Get the name in a dir record, false if it's not a name record.
+static bool NF2FS_record_name(uint8_t* data, char** name, NF2FS_size_t* namelen)
+{
+    NF2FS_head_t head= *(NF2FS_head_t*)data;
+    switch (NF2FS_dhead_type(head)) {
+    case NF2FS_DATA_NDIR_NAME:
+    case NF2FS_DATA_DIR_NAME:
+        *name= (char*)((NF2FS_dir_name_flash_t*)data)->name;
+        *namelen= NF2FS_dhead_dsize(head) - sizeof(NF2FS_dir_name_flash_t);
+        return true;
+
+    case NF2FS_DATA_NFILE_NAME:
+    case NF2FS_DATA_FILE_NAME:
+        *name= (char*)((NF2FS_file_name_flash_t*)data)->name;
+        *namelen= NF2FS_dhead_dsize(head) - sizeof(NF2FS_file_name_flash_t);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Compare the name record at (sector, off) with name, entry->id is NF2FS_NULL if not matched.
+static int NF2FS_name_match(NF2FS_t* NF2FS, uint8_t* data, NF2FS_size_t dir_id, NF2FS_size_t sector,
+                            NF2FS_off_t off, char* name, NF2FS_size_t namelen, int file_type,
+                            NF2FS_tree_entry_ram_t* entry)
+{
+    NF2FS_head_t head= *(NF2FS_head_t*)data;
+    char* rname= NULL;
+    NF2FS_size_t rlen= 0;
+
+    // a longer name with the same prefix is not matched
+    entry->id= NF2FS_NULL;
+    if (!NF2FS_record_name(data, &rname, &rlen) || rlen != namelen || memcmp(name, rname, namelen))
+        return NF2FS_ERR_OK;
+
+    bool is_dir= NF2FS_dhead_type(head) == NF2FS_DATA_DIR_NAME ||
+                 NF2FS_dhead_type(head) == NF2FS_DATA_NDIR_NAME;
+    if (is_dir != (file_type == NF2FS_DATA_DIR))
+        return NF2FS_ERR_OK;
+
+    entry->id= NF2FS_dhead_id(head);
+    entry->father_id= dir_id;
+    entry->name_sector= sector;
+    entry->name_off= off;
+
+    // entry is not used for file, only stored necessary message
+    if (!is_dir)
+        return NF2FS_ERR_OK;
+
+    entry->tail_sector= ((NF2FS_dir_name_flash_t*)data)->tail;
+    if (namelen <= NF2FS_ENTRY_NAME_LEN) {
+        memcpy(entry->data.name, name, namelen);
+    } else {
+        // name is too long, use hash
+        entry->data.hash= NF2FS_hash((uint8_t*)name, namelen);
+    }
+
+    // add dir to tree
+    return NF2FS_tree_entry_add(NF2FS->ram_tree, entry->father_id, entry->id, entry->name_sector,
+                                entry->name_off, entry->tail_sector, name, namelen);
+}
+
+// The size of name footer with names, 0 if they can not be in one footer.
+static NF2FS_size_t NF2FS_footer_len(NF2FS_size_t names)
+{
+    NF2FS_size_t len= names * sizeof(NF2FS_footer_entry_flash_t) + sizeof(NF2FS_head_t);
+    return (len >= 0xfff) ? 0 : len;
+}
+
+// Prog the name footer at the end of a sealed dir sector, data of the dir ends at end.
+// It's not proged if there are more than names names, or no space is left for it.
+static int NF2FS_footer_prog(NF2FS_t* NF2FS, NF2FS_size_t dir_id, NF2FS_size_t sector,
+                             NF2FS_off_t end, NF2FS_size_t names)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t len= NF2FS_footer_len(names);
+    if (len == 0 || end + sizeof(NF2FS_head_t) + len > NF2FS->cfg->sector_size)
+        return err;
+
+    // read caches may be in use by the caller, so read the sector to our own buffer
+    uint8_t* buffer= NF2FS_malloc(NF2FS->cfg->cache_size);
+    NF2FS_footer_entry_flash_t* footer= NF2FS_malloc(len);
+    if (!buffer || !footer) {
+        err= NF2FS_ERR_NOMEM;
+        goto cleanup;
+    }
+
+    // the last records may be still in prog caches, and they are not synced with the footer
+    if (NF2FS->pcache->sector == sector) {
+        err= NF2FS_cache_flush(NF2FS, NF2FS->pcache);
+        if (err)
+            goto cleanup;
+        NF2FS_cache_one(NF2FS, NF2FS->pcache);
+    }
+    err= NF2FS_pcache_flush_range(NF2FS, sector, 0, NF2FS->cfg->sector_size);
+    if (err)
+        goto cleanup;
+
+    NF2FS_size_t num= 0;
+    NF2FS_off_t off= sizeof(NF2FS_dir_sector_flash_t);
+    while (off + sizeof(NF2FS_head_t) <= end) {
+        NF2FS_size_t size= NF2FS_min(NF2FS->cfg->cache_size, end - off);
+        err= NF2FS_direct_read(NF2FS, sector, off, size, buffer);
+        if (err)
+            goto cleanup;
+
+        NF2FS_off_t pos= 0;
+        while (pos + sizeof(NF2FS_head_t) <= size) {
+            NF2FS_head_t head= *(NF2FS_head_t*)(buffer + pos);
+            NF2FS_size_t dsize= NF2FS_dhead_dsize(head);
+            if (head == NF2FS_NULL || dsize == 0)
+                goto cleanup;
+
+            char* name= NULL;
+            NF2FS_size_t namelen= 0;
+            if (NF2FS_record_name(buffer + pos, &name, &namelen)) {
+                // the name is not entire, read again
+                if (pos + dsize > size)
+                    break;
+
+                if (num == names)
+                    goto cleanup;
+                footer[num].hash= NF2FS_name_hash(name, namelen);
+                footer[num].off= off + pos;
+                num++;
+            }
+            pos+= dsize;
+        }
+
+        // a name record is longer than cache
+        if (pos == 0)
+            goto cleanup;
+        off+= pos;
+    }
+
+    // the footer head is behind entries, and they are proged in one request
+    len= NF2FS_footer_len(num);
+    *(NF2FS_head_t*)&footer[num]= NF2FS_MKDHEAD(0, 0, dir_id, NF2FS_DATA_NAME_FOOTER, len);
+    err= NF2FS_dev_prog(NF2FS, sector, NF2FS->cfg->sector_size - len, footer, len);
+    if (err)
+        goto cleanup;
+
+    // entries are not records, read caches are dropped rather than synced
+    NF2FS_rcache_invalidate(NF2FS, sector);
+
+cleanup:
+    NF2FS_free(buffer);
+    NF2FS_free(footer);
+    return err;
+}
+
+// Find the name with the name footer of a sealed dir sector, names in footer are added to filter.
+// has_footer is false if the sector has no footer, then it should be parsed.
+static int NF2FS_footer_name_find(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_size_t dir_id, char* name,
+                                  NF2FS_size_t namelen, int file_type, NF2FS_tree_entry_ram_t* entry,
+                                  NF2FS_name_filter_ram_t* filter, bool* has_footer)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t sector_size= NF2FS->cfg->sector_size;
+    NF2FS_cache_ram_t* rcache= NULL;
+
+    *has_footer= false;
+    entry->id= NF2FS_NULL;
+
+    // the footer head is the last data head of sector
+    NF2FS_off_t off= sector_size - NF2FS_min(NF2FS->cfg->cache_size, sector_size);
+    err= NF2FS_rcache_fetch(NF2FS, &rcache, sector, off, sector_size - off, false);
+    if (err)
+        return err;
+    NF2FS_head_t head= *(NF2FS_head_t*)(rcache->buffer + sector_size - rcache->off - sizeof(NF2FS_head_t));
+    if (head == NF2FS_NULL || NF2FS_dhead_check(head, dir_id, NF2FS_DATA_NAME_FOOTER))
+        return err;
+
+    NF2FS_size_t len= NF2FS_dhead_dsize(head);
+    if (len < sizeof(NF2FS_head_t) || len > sector_size - sizeof(NF2FS_dir_sector_flash_t) ||
+        len % sizeof(NF2FS_footer_entry_flash_t))
+        return err;
+
+    // entries are read backward a cache at a time, matched hashes are compared later
+    uint16_t hash= NF2FS_name_hash(name, namelen);
+    NF2FS_off_t cands[NF2FS_FOOTER_CANDIDATES];
+    NF2FS_size_t cand_num= 0;
+    NF2FS_off_t begin= sector_size - len;
+    NF2FS_off_t pos= sector_size - sizeof(NF2FS_head_t);
+    while (pos > begin) {
+        if (pos <= off) {
+            off= pos - NF2FS_min(NF2FS->cfg->cache_size, pos - begin);
+            err= NF2FS_rcache_fetch(NF2FS, &rcache, sector, off, pos - off, false);
+            if (err)
+                return err;
+        }
+
+        pos-= sizeof(NF2FS_footer_entry_flash_t);
+        NF2FS_footer_entry_flash_t* fentry= (NF2FS_footer_entry_flash_t*)(rcache->buffer + pos - rcache->off);
+#if NF2FS_DIR_FILTER_BITS > 0
+        if (filter != NULL)
+            NF2FS_filter_add(filter, fentry->hash);
+#endif
+        if (fentry->hash != hash)
+            continue;
+
+        // too many candidates, parse the sector instead
+        if (cand_num == NF2FS_FOOTER_CANDIDATES)
+            return err;
+        cands[cand_num++]= fentry->off;
+    }
+
+    *has_footer= true;
+    for (NF2FS_size_t i= 0; i < cand_num; i++) {
+        if (cands[i] < sizeof(NF2FS_dir_sector_flash_t) || cands[i] + sizeof(NF2FS_head_t) > begin)
+            return NF2FS_ERR_WRONGCAL;
+
+        err= NF2FS_rcache_fetch(NF2FS, &rcache, sector, cands[i],
+                                NF2FS_min(NF2FS->cfg->cache_size, begin - cands[i]), false);
+        if (err)
+            return err;
+
+        // the name may be deleted after footer is proged
+        uint8_t* data= rcache->buffer + cands[i] - rcache->off;
+        head= *(NF2FS_head_t*)data;
+        if (NF2FS_dhead_check(head, NF2FS_NULL, (int)NF2FS_NULL) ||
+            cands[i] + NF2FS_dhead_dsize(head) > rcache->off + rcache->size)
+            continue;
+        err= NF2FS_name_match(NF2FS, data, dir_id, sector, cands[i], name, namelen,
+                              file_type, entry);
+        if (err || entry->id != NF2FS_NULL)
+            return err;
+    }
+    return err;
+}
+
+// Where records of a dir sector begin, the data offset is behind sector head with dual_end.
+NF2FS_off_t NF2FS_dir_begin(NF2FS_t* NF2FS)
+{
+    NF2FS_off_t begin= sizeof(NF2FS_dir_sector_flash_t);
+    if (NF2FS->cfg->dual_end)
+        begin+= sizeof(NF2FS_off_t);
+    return begin;
+}
+
+// The older sector of a dir sector, NF2FS_NULL if older ones are compacted.
+NF2FS_size_t NF2FS_dir_pre(NF2FS_dir_sector_flash_t* shead)
+{
+    if ((shead->head | NF2FS_SHEAD_CUT_SET) == NF2FS_SHEAD_CUT_SET)
+        return NF2FS_NULL;
+    return shead->pre_sector;
+}
+
+// Link the newer sector of a dir sector, next_sector is the last word of sector head.
+int NF2FS_dir_link_next(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_size_t next)
+{
+    return NF2FS_head_validate(NF2FS, sector, sizeof(NF2FS_dir_sector_flash_t) - sizeof(NF2FS_size_t),
+                               next);
+}
+
+// Init the tail message of dir when it gets a new tail sector.
+void NF2FS_dir_tail_init(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
+{
+    dir->tail_off= NF2FS_dir_begin(NF2FS);
+    dir->tail_names= 0;
+    dir->data_off= NF2FS->cfg->sector_size;
+}
+
+// Whether or not the record is proged backward from the sector end.
+static bool NF2FS_dir_is_data(NF2FS_t* NF2FS, NF2FS_head_t head)
+{
+    if (!NF2FS->cfg->dual_end)
+        return false;
+
+    switch (NF2FS_dhead_type(head)) {
+    case NF2FS_DATA_SFILE_DATA:
+    case NF2FS_DATA_BFILE_INDEX:
+    case NF2FS_DATA_DIR_OSPACE:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Find where data begins in a dir sector with dual_end, names in it end at name_end.
+// word is the data offset proged when the sector is sealed, data_off is NF2FS_NULL if
+// names should be parsed first to find it.
+static int NF2FS_dir_data_find(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t sector,
+                               NF2FS_off_t word, NF2FS_off_t name_end, NF2FS_off_t* data_off)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t sector_size= NF2FS->cfg->sector_size;
+
+    if (dir != NULL && sector == dir->tail_sector && dir->data_off != NF2FS_NULL) {
+        // the tail sector is not sealed, but we know where its data begins
+        *data_off= dir->data_off;
+        return err;
+    } else if (word != NF2FS_NULL) {
+        *data_off= word;
+        return err;
+    } else if (name_end == NF2FS_NULL) {
+        *data_off= NF2FS_NULL;
+        return err;
+    }
+
+    // read caches may be in use by the caller, so read the sector to our own buffer
+    uint32_t* buffer= NF2FS_malloc(NF2FS->cfg->cache_size);
+    if (!buffer)
+        return NF2FS_ERR_NOMEM;
+
+    // data begins at the first aligned word behind free space
+    *data_off= sector_size;
+    NF2FS_off_t off= NF2FS_alignup(name_end, sizeof(uint32_t));
+    while (off < sector_size) {
+        NF2FS_size_t size= NF2FS_min(NF2FS->cfg->cache_size, sector_size - off);
+        err= NF2FS_direct_read(NF2FS, sector, off, size, buffer);
+        if (err)
+            goto cleanup;
+
+        for (NF2FS_size_t i= 0; i < size / sizeof(uint32_t); i++) {
+            if (buffer[i] != NF2FS_NULL) {
+                *data_off= off + i * sizeof(uint32_t);
+                goto cleanup;
+            }
+        }
+        off+= size;
+    }
+
+cleanup:
+    NF2FS_free(buffer);
+    return err;
+}
+
+// Find the needed name address in the dir, names passed by are added to filter if it's not NULL.
 int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name,
-                        NF2FS_size_t namelen, int file_type, NF2FS_tree_entry_ram_t* entry)
+                        NF2FS_size_t namelen, int file_type, NF2FS_tree_entry_ram_t* entry,
+                        NF2FS_name_filter_ram_t* filter)
 {
     int err= NF2FS_ERR_OK;
     
@@ -55,25 +451,55 @@ int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name,
     NF2FS_size_t current_sector= begin_sector;
     NF2FS_size_t dir_id= NF2FS_NULL;
     NF2FS_size_t off = 0;
+    NF2FS_cache_ram_t* rcache= NULL;
     while (true) {
-        // Read data of dir to cache first.
+        // sealed sectors may have name footers, then they are not parsed
+        if (off == 0 && current_sector != begin_sector && !NF2FS->cfg->dual_end) {
+            bool has_footer= false;
+            err= NF2FS_footer_name_find(NF2FS, current_sector, dir_id, name, namelen, file_type,
+                                        entry, filter, &has_footer);
+            if (err || entry->id != NF2FS_NULL)
+                goto cleanup;
+
+            if (has_footer) {
+                // only the sector head is needed to find the next sector
+                err= NF2FS_rcache_fetch_hold(NF2FS, &rcache, current_sector, 0,
+                                        sizeof(NF2FS_dir_sector_flash_t), false);
+                if (err)
+                    goto cleanup;
+                NF2FS_dir_sector_flash_t *shead = (NF2FS_dir_sector_flash_t *)rcache->buffer;
+                err = NF2FS_shead_check(shead->head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
+                if (err)
+                    goto cleanup;
+
+                if (NF2FS_dir_pre(shead) == NF2FS_NULL) {
+                    entry->id= NF2FS_NULL;
+                    goto cleanup;
+                }
+                current_sector= NF2FS_dir_pre(shead);
+                continue;
+            }
+        }
+
+        // Read data of dir to cache first, the tail sector is pinned
         NF2FS_size_t size = NF2FS_min(NF2FS->cfg->cache_size,
                                     NF2FS->cfg->sector_size - off);
-        err = NF2FS_read_to_cache(NF2FS, NF2FS->rcache, current_sector, off, size);
+        err = NF2FS_rcache_fetch_hold(NF2FS, &rcache, current_sector, off, size,
+                                 current_sector == begin_sector);
         if (err)
-            return err;
-        uint8_t *data = NF2FS->rcache->buffer;
+            goto cleanup;
+        uint8_t *data = rcache->buffer + off - rcache->off;
 
         // record the next sector of the dir
         if (off == 0) {
             NF2FS_dir_sector_flash_t *shead = (NF2FS_dir_sector_flash_t *)data;
             err = NF2FS_shead_check(shead->head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
             if (err)
-                return err;
-            next_sector= shead->pre_sector;
+                goto cleanup;
+            next_sector= NF2FS_dir_pre(shead);
             dir_id= shead->id;
-            data += sizeof(NF2FS_dir_sector_flash_t);
-            off += sizeof(NF2FS_dir_sector_flash_t);
+            data += NF2FS_dir_begin(NF2FS);
+            off += NF2FS_dir_begin(NF2FS);
         }
 
         NF2FS_head_t head;
@@ -83,9 +509,9 @@ int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name,
             // Check if the head is valid.
             err = NF2FS_dhead_check(head, NF2FS_NULL, (int)NF2FS_NULL);
             if (err)
-                return err;
+                goto cleanup;
 
-            if (off + NF2FS_dhead_dsize(head) > NF2FS->rcache->off + size) {
+            if (off + NF2FS_dhead_dsize(head) > rcache->off + rcache->size) {
                 if (head == NF2FS_NULL && next_sector != NF2FS_NULL) {
                     // no more data in the sector, read the next
                     current_sector = next_sector;
@@ -94,10 +520,11 @@ int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name,
                 } else if (head == NF2FS_NULL) {
                     // not have next sector, finished and can not find
                     entry->id= NF2FS_NULL;
-                    return err;
-                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX) {
+                    goto cleanup;
+                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX &&
+                           NF2FS_dhead_type(head) != NF2FS_DATA_DELETE) {
                     // We have read whole data in cache.
-                    // but big file data is special
+                    // but big file data is special, and deleted data is only skipped
                     break;
                 }
             }
@@ -107,45 +534,23 @@ int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name,
             switch (NF2FS_dhead_type(head)) {
             case NF2FS_DATA_NDIR_NAME:
             case NF2FS_DATA_DIR_NAME:
-                len = NF2FS_dhead_dsize(head);
-                if (file_type == NF2FS_DATA_DIR) {
-                    // compare name and judge if matched
-                    NF2FS_dir_name_flash_t *fname = (NF2FS_dir_name_flash_t *)data;
-                    if (!memcmp(name, fname->name, namelen)) {
-                        entry->id= NF2FS_dhead_id(head);
-                        entry->father_id= dir_id;
-                        entry->name_sector= current_sector;
-                        entry->name_off= off;
-                        entry->tail_sector= fname->tail;
-                        if (namelen <= NF2FS_ENTRY_NAME_LEN) {
-                            memcpy(entry->data.name, name, namelen);
-                        } else {
-                            // name is too long, use hash
-                            entry->data.hash= NF2FS_hash((uint8_t*)name, namelen);
-                        }
-
-                        // add dir to tree
-                        err= NF2FS_tree_entry_add(NF2FS->ram_tree, entry->father_id, entry->id, entry->name_sector,
-                                                 entry->name_off, entry->tail_sector, name, namelen);
-                        return err;
-                    }
-                }
-                break;
-
             case NF2FS_DATA_NFILE_NAME:
             case NF2FS_DATA_FILE_NAME:
                 len = NF2FS_dhead_dsize(head);
-                if (file_type == NF2FS_DATA_REG) {
-                    NF2FS_file_name_flash_t *fname = (NF2FS_file_name_flash_t *)data;
-                    if (!memcmp(name, fname->name, namelen)) {
-                        // entry is not used for file, only stored necessary message
-                        entry->id= NF2FS_dhead_id(head);
-                        entry->father_id= dir_id;
-                        entry->name_sector= current_sector;
-                        entry->name_off= off;
-                        return err;
-                    }
+#if NF2FS_DIR_FILTER_BITS > 0
+                if (filter != NULL) {
+                    char* rname= NULL;
+                    NF2FS_size_t rlen= 0;
+                    NF2FS_record_name(data, &rname, &rlen);
+                    NF2FS_filter_add(filter, NF2FS_name_hash(rname, rlen));
                 }
+#endif
+
+                // compare name and judge if matched
+                err= NF2FS_name_match(NF2FS, data, dir_id, current_sector, off, name, namelen,
+                                      file_type, entry);
+                if (err || entry->id != NF2FS_NULL)
+                    goto cleanup;
                 break;
 
             case NF2FS_DATA_FREE:
@@ -155,7 +560,8 @@ int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name,
                 } else {
                     // something has been wrong
                     NF2FS_ERROR("WRONG in NF2FS_dtraverse_name\n");
-                    return NF2FS_ERR_WRONGCAL;
+                    err= NF2FS_ERR_WRONGCAL;
+                    goto cleanup;
                 }
                 len = 0;
                 break;
@@ -164,12 +570,14 @@ int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name,
             case NF2FS_DATA_BFILE_INDEX:
             case NF2FS_DATA_SFILE_DATA:
             case NF2FS_DATA_DIR_OSPACE:
+            case NF2FS_DATA_SEAL:
                 len = NF2FS_dhead_dsize(head);
                 break;
 
             default:
                 NF2FS_ERROR("WRONG in NF2FS_dtraverse_name\n");
-                return NF2FS_ERR_WRONGCAL;
+                err= NF2FS_ERR_WRONGCAL;
+                goto cleanup;
             }
 
             // update basic message
@@ -185,49 +593,157 @@ int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name,
             } else if (if_change && next_sector == NF2FS_NULL) {
                 // fail to find the name
                 entry->id= NF2FS_NULL;
-                return err;
+                goto cleanup;
             }
 
             // the next data head is not entire, read again
-            if (off - NF2FS->rcache->off + sizeof(NF2FS_head_t) >= NF2FS->cfg->cache_size)
+            if (off + sizeof(NF2FS_head_t) >= rcache->off + rcache->size)
                 break;
         }
     }
+
+cleanup:
+    NF2FS_rcache_release(NF2FS, rcache);
+    return err;
+}
+
+// Find the name in an opened dir, it's not traversed if the name filter tells the name is not there.
+int NF2FS_dir_name_find(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, char* name, NF2FS_size_t namelen,
+                        int file_type, NF2FS_tree_entry_ram_t* entry)
+{
+    int err= NF2FS_ERR_OK;
+#if NF2FS_DIR_FILTER_BITS > 0
+    NF2FS_name_filter_ram_t* filter= &dir->filter;
+
+    // not in the filter, so not in the dir
+    if (filter->valid && !NF2FS_filter_test(filter, NF2FS_name_hash(name, namelen))) {
+        entry->id= NF2FS_NULL;
+        return err;
+    }
+
+    // rebuild the filter while traversing if it's not trusted or too many names are deleted
+    bool rebuild= !filter->valid || filter->stale * 4 > filter->names;
+    if (rebuild)
+        NF2FS_filter_reset(filter, false);
+
+    err= NF2FS_dtraverse_name(NF2FS, dir->tail_sector, name, namelen, file_type, entry,
+                             rebuild ? filter : NULL);
+    if (err)
+        return err;
+
+    // all names are seen only if the name is not found
+    if (rebuild && entry->id == NF2FS_NULL)
+        filter->valid= true;
+#else
+    err= NF2FS_dtraverse_name(NF2FS, dir->tail_sector, name, namelen, file_type, entry, NULL);
+#endif
+    return err;
+}
+
+// The size of file in its sfile data or bfile index.
+static NF2FS_size_t NF2FS_record_size(uint8_t* data)
+{
+    NF2FS_head_t head= *(NF2FS_head_t*)data;
+    NF2FS_size_t len= NF2FS_dhead_dsize(head);
+    if (NF2FS_dhead_type(head) == NF2FS_DATA_SFILE_DATA)
+        return len - sizeof(NF2FS_head_t);
+
+    NF2FS_size_t size= 0;
+    NF2FS_size_t loop= (len - sizeof(NF2FS_head_t)) / sizeof(NF2FS_bfile_index_ram_t);
+    NF2FS_bfile_index_ram_t* index= ((NF2FS_bfile_index_flash_t*)data)->index;
+    for (NF2FS_size_t i= 0; i < loop; i++)
+        size+= index[i].size;
+    return size;
 }
 
-// find file's data or index in the dir
-int NF2FS_dtraverse_data(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
+// The size of file in its sfile data or bfile index on flash, the index is read in pieces.
+static int NF2FS_record_size_read(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off,
+                                  NF2FS_head_t head, NF2FS_size_t* size)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t len= NF2FS_dhead_dsize(head);
+
+    *size= 0;
+    if (NF2FS_dhead_type(head) == NF2FS_DATA_SFILE_DATA) {
+        *size= len - sizeof(NF2FS_head_t);
+        return err;
+    }
+
+    NF2FS_bfile_index_ram_t index[8];
+    NF2FS_size_t loop= (len - sizeof(NF2FS_head_t)) / sizeof(NF2FS_bfile_index_ram_t);
+    off+= sizeof(NF2FS_head_t);
+    while (loop > 0) {
+        NF2FS_size_t num= NF2FS_min(loop, sizeof(index) / sizeof(index[0]));
+        err= NF2FS_direct_read(NF2FS, sector, off, num * sizeof(NF2FS_bfile_index_ram_t), index);
+        if (err)
+            return err;
+        for (NF2FS_size_t i= 0; i < num; i++)
+            *size+= index[i].size;
+        off+= num * sizeof(NF2FS_bfile_index_ram_t);
+        loop-= num;
+    }
+    return err;
+}
+
+// find file's data or index in the dir, traverse from (begin_sector, begin_off) to older sectors
+// with dual_end, begin_off is 0 and only data of sectors is traversed.
+// only the size is found if the file has no cache buffer.
+int NF2FS_dtraverse_data(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_file_ram_t* file,
+                         NF2FS_size_t begin_sector, NF2FS_off_t begin_off)
 {
     int err= NF2FS_ERR_OK;
 
     NF2FS_size_t next_sector = NF2FS_NULL;
-    NF2FS_size_t current_sector= file->sector;
-    NF2FS_size_t off= file->off;
+    NF2FS_size_t current_sector= begin_sector;
+    NF2FS_size_t off= begin_off;
+    bool in_data= false;
 
-    // if the cache is used for traversing name in the past, we can reuse it.
-    if (NF2FS->rcache->sector == file->sector &&
-        NF2FS->rcache->off <= file->off &&
-        NF2FS->rcache->off + NF2FS->rcache->size > file->off)
-        off= NF2FS->rcache->off;
+    // a slot used for traversing name in the past is hit by fetch as it is
+    NF2FS_cache_ram_t* rcache= NULL;
 
     while (true) {
-        // Read data of file to cache first.
+        // data of the sector ends at the end of it
+        if (in_data && off >= NF2FS->cfg->sector_size) {
+            if (next_sector == NF2FS_NULL) {
+                file->file_cache.sector= NF2FS_NULL;
+                goto cleanup;
+            }
+            current_sector= next_sector;
+            off= 0;
+            in_data= false;
+        }
+
+        // Read data of file to cache first, only sector head is needed with dual_end
         NF2FS_size_t size = NF2FS_min(NF2FS->cfg->cache_size,
                                     NF2FS->cfg->sector_size - off);
-        err = NF2FS_read_to_cache(NF2FS, NF2FS->rcache, current_sector, off, size);
+        if (off == 0 && NF2FS->cfg->dual_end)
+            size= NF2FS_dir_begin(NF2FS);
+        err = NF2FS_rcache_fetch_hold(NF2FS, &rcache, current_sector, off, size, false);
         if (err)
-            return err;
-        uint8_t *data = NF2FS->rcache->buffer;
+            goto cleanup;
+        uint8_t *data = rcache->buffer + off - rcache->off;
 
         // record the next sector of the file
         if (off == 0) {
             NF2FS_dir_sector_flash_t *shead = (NF2FS_dir_sector_flash_t *)data;
             err = NF2FS_shead_check(shead->head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
             if (err)
-                return err;
-            next_sector= shead->pre_sector;
+                goto cleanup;
+            next_sector= NF2FS_dir_pre(shead);
             data += sizeof(NF2FS_dir_sector_flash_t);
             off += sizeof(NF2FS_dir_sector_flash_t);
+
+            // names are skipped if we know where data begins
+            if (NF2FS->cfg->dual_end) {
+                err= NF2FS_dir_data_find(NF2FS, dir, current_sector, *(NF2FS_off_t*)data,
+                                         NF2FS_NULL, &off);
+                if (err)
+                    goto cleanup;
+                in_data= (off != NF2FS_NULL);
+                if (!in_data)
+                    off= NF2FS_dir_begin(NF2FS);
+                continue;
+            }
         }
 
         NF2FS_head_t head;
@@ -238,10 +754,19 @@ int NF2FS_dtraverse_data(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
             err = NF2FS_dhead_check(head, NF2FS_NULL, (int)NF2FS_NULL);
             if (err) {
                 NF2FS_ERROR("head wrong in NF2FS_dtraverse_data\r\n");
-                return err;
+                goto cleanup;
+            }
+
+            // names end at a free head, then data of the sector is traversed
+            if (head == NF2FS_NULL && NF2FS->cfg->dual_end && !in_data) {
+                err= NF2FS_dir_data_find(NF2FS, dir, current_sector, NF2FS_NULL, off, &off);
+                if (err)
+                    goto cleanup;
+                in_data= true;
+                break;
             }
 
-            if (off + NF2FS_dhead_dsize(head) > NF2FS->rcache->off + size) {
+            if (off + NF2FS_dhead_dsize(head) > rcache->off + rcache->size) {
                 if (head == NF2FS_NULL && next_sector != NF2FS_NULL) {
                     // no more data in the sector, read the next
                     current_sector = next_sector;
@@ -250,10 +775,11 @@ int NF2FS_dtraverse_data(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
                 } else if (head == NF2FS_NULL) {
                     // not have next sector, finished and can not find
                     file->file_cache.sector= NF2FS_NULL;
-                    return err;
-                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX) {
+                    goto cleanup;
+                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX &&
+                           NF2FS_dhead_type(head) != NF2FS_DATA_DELETE) {
                     // We have read whole data in cache.
-                    // but big file data is special
+                    // but big file data is special, and deleted data is only skipped
                     break;
                 }
             }
@@ -267,78 +793,648 @@ int NF2FS_dtraverse_data(NF2FS_t* NF2FS, NF2FS_file_ram_t* file)
             case NF2FS_DATA_FILE_NAME:
             case NF2FS_DATA_DELETE:
             case NF2FS_DATA_DIR_OSPACE:
+            case NF2FS_DATA_SEAL:
                 len = NF2FS_dhead_dsize(head);    
                 break;
 
-            case NF2FS_DATA_FREE:
-                if (head == NF2FS_NULL) {
-                    // no more data, change to the next sector
-                    if_change= true;
-                } else {
-                    // something has been wrong
-                    NF2FS_ERROR("WRONG in NF2FS_dtraverse_data\n");
-                    return NF2FS_ERR_WRONGCAL;
+            case NF2FS_DATA_FREE:
+                if (head == NF2FS_NULL) {
+                    // no more data, change to the next sector
+                    if_change= true;
+                } else {
+                    // something has been wrong
+                    NF2FS_ERROR("WRONG in NF2FS_dtraverse_data\n");
+                    err= NF2FS_ERR_WRONGCAL;
+                    goto cleanup;
+                }
+                len = 0;
+                break;
+
+            case NF2FS_DATA_BFILE_INDEX:
+            case NF2FS_DATA_SFILE_DATA:
+                len = NF2FS_dhead_dsize(head);
+                if (NF2FS_dhead_id(head) == file->id) {
+                    if (!file->file_cache.buffer && off + len <= rcache->off + rcache->size) {
+                        // only the size is wanted without a file cache
+                        file->file_size= NF2FS_record_size(data);
+                    } else if (!file->file_cache.buffer) {
+                        NF2FS_size_t file_size= 0;
+                        err= NF2FS_record_size_read(NF2FS, current_sector, off, head, &file_size);
+                        if (err)
+                            goto cleanup;
+                        file->file_size= file_size;
+                    } else {
+                        if (off + len <= rcache->off + rcache->size) {
+                            // index is in cache
+                            memcpy(file->file_cache.buffer, data, len);
+                        } else {
+                            // index is not entirely in cache, read directly
+                            err= NF2FS_direct_read(NF2FS, current_sector, off, len, file->file_cache.buffer);
+                            if (err) {
+                                goto cleanup;
+                            }
+                        }
+                        file->file_size= NF2FS_record_size(file->file_cache.buffer);
+                    }
+                    file->file_cache.sector= current_sector;
+                    file->file_cache.off= off;
+                    file->file_cache.change_flag= 0;
+                    file->file_cache.size= len;
+                    goto cleanup;
+                }
+                break;
+
+            default:
+                NF2FS_ERROR("WRONG in NF2FS_dtraverse_data\n");
+                err= NF2FS_ERR_WRONGCAL;
+                goto cleanup;
+            }
+
+            // update basic message, data records are aligned
+            if (in_data)
+                len= NF2FS_alignup(len, sizeof(uint32_t));
+            off += len;
+            data += len;
+            if (in_data && off >= NF2FS->cfg->sector_size)
+                break;
+
+            if (if_change && next_sector != NF2FS_NULL) {
+                // Traverse the next sector.
+                if_change = false;
+                current_sector = next_sector;
+                off = 0;
+                break;
+            } else if (if_change && next_sector == NF2FS_NULL) {
+                // fail to find the name
+                file->file_cache.sector= NF2FS_NULL;
+                goto cleanup;
+            }
+
+            // the next data head is not entire, read again
+            if (off + sizeof(NF2FS_head_t) >= rcache->off + rcache->size)
+                break;
+        }
+    }
+
+cleanup:
+    NF2FS_rcache_release(NF2FS, rcache);
+    return err;
+}
+
+// Make [off, off + len) of the sector being listed be in window, it's read ahead from off if not.
+static int NF2FS_cursor_fetch(NF2FS_t* NF2FS, NF2FS_dir_cursor_ram_t* cursor, NF2FS_off_t off,
+                              NF2FS_size_t len, uint8_t** data)
+{
+    int err= NF2FS_ERR_OK;
+
+    if (off < cursor->win_off || off + len > cursor->win_off + cursor->win_size) {
+        NF2FS_size_t size= NF2FS_min(NF2FS->cfg->cache_size, NF2FS->cfg->sector_size - off);
+        if (len > size)
+            return NF2FS_ERR_WRONGCAL;
+
+        // the last records in prog caches are flushed by direct read
+        err= NF2FS_direct_read(NF2FS, cursor->sector, off, size, cursor->window);
+        if (err)
+            return err;
+        cursor->win_off= off;
+        cursor->win_size= size;
+    }
+    *data= cursor->window + off - cursor->win_off;
+    return err;
+}
+
+// Read and check the head at off of the sector being listed, a free head ends records.
+static int NF2FS_cursor_head(NF2FS_t* NF2FS, NF2FS_dir_cursor_ram_t* cursor, NF2FS_off_t off,
+                             NF2FS_off_t end, NF2FS_head_t* head)
+{
+    uint8_t* data= NULL;
+    int err= NF2FS_cursor_fetch(NF2FS, cursor, off, sizeof(NF2FS_head_t), &data);
+    if (err)
+        return err;
+
+    *head= *(NF2FS_head_t*)data;
+    if (*head == NF2FS_NULL)
+        return err;
+    err= NF2FS_dhead_check(*head, NF2FS_NULL, (int)NF2FS_NULL);
+    if (err)
+        return err;
+    if (NF2FS_dhead_dsize(*head) == 0 || off + NF2FS_dhead_dsize(*head) > end)
+        return NF2FS_ERR_WRONGCAL;
+    return err;
+}
+
+// The size of file in the data record at off of the sector being listed.
+static int NF2FS_cursor_record_size(NF2FS_t* NF2FS, NF2FS_dir_cursor_ram_t* cursor, NF2FS_off_t off,
+                                    NF2FS_head_t head, NF2FS_size_t* size)
+{
+    // a big index is read in pieces
+    if (NF2FS_dhead_dsize(head) > NF2FS->cfg->cache_size)
+        return NF2FS_record_size_read(NF2FS, cursor->sector, off, head, size);
+
+    uint8_t* data= NULL;
+    int err= NF2FS_cursor_fetch(NF2FS, cursor, off, NF2FS_dhead_dsize(head), &data);
+    if (err)
+        return err;
+    *size= NF2FS_record_size(data);
+    return err;
+}
+
+// Copy the name at off of sector to the cursor, names of the sector being listed are in window.
+static int NF2FS_cursor_name(NF2FS_t* NF2FS, NF2FS_dir_cursor_ram_t* cursor, NF2FS_size_t sector,
+                             NF2FS_off_t off, NF2FS_size_t namelen)
+{
+    int err= NF2FS_ERR_OK;
+
+    if (namelen > NF2FS_NAME_MAX)
+        return NF2FS_ERR_WRONGCAL;
+    if (sector == cursor->sector && namelen <= NF2FS->cfg->cache_size) {
+        uint8_t* data= NULL;
+        err= NF2FS_cursor_fetch(NF2FS, cursor, off, namelen, &data);
+        if (err)
+            return err;
+        memcpy(cursor->name, data, namelen);
+    } else {
+        err= NF2FS_direct_read(NF2FS, sector, off, namelen, cursor->name);
+        if (err)
+            return err;
+    }
+    cursor->name[namelen]= '\0';
+    return err;
+}
+
+// The opened file with id, NULL if it's not opened.
+static NF2FS_file_ram_t* NF2FS_cursor_opened(NF2FS_t* NF2FS, NF2FS_size_t id)
+{
+    NF2FS_file_ram_t* file= NF2FS->file_list;
+    while (file != NULL && file->id != id)
+        file= file->next_file;
+    return file;
+}
+
+// Whether the file may be named in the sector being listed.
+static bool NF2FS_cursor_marked(NF2FS_dir_cursor_ram_t* cursor, NF2FS_size_t id)
+{
+    NF2FS_size_t bit= id % NF2FS_CURSOR_BITS;
+    return (cursor->bits[bit / 32] >> (bit % 32)) & 1U;
+}
+
+// Keep the size of file whose data is met before its name.
+static void NF2FS_cursor_keep(NF2FS_dir_cursor_ram_t* cursor, NF2FS_size_t id, NF2FS_size_t size)
+{
+    if (cursor->size_num == NF2FS_CURSOR_SIZES) {
+        cursor->lost= true;
+        return;
+    }
+    cursor->sizes[cursor->size_num].id= id;
+    cursor->sizes[cursor->size_num].size= size;
+    cursor->size_num++;
+}
+
+// A data record of the sector is met, it's given to a waiting file, or kept if the file is
+// not named in the sector. Sizes are kept only in the first walk of the sector.
+static int NF2FS_cursor_met(NF2FS_t* NF2FS, NF2FS_dir_cursor_ram_t* cursor, NF2FS_off_t off,
+                            NF2FS_head_t head)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t id= NF2FS_dhead_id(head);
+
+    NF2FS_cursor_slot_ram_t* slot= NULL;
+    for (NF2FS_size_t i= 0; i < cursor->pend_num; i++) {
+        if (cursor->pends[i].id == id) {
+            slot= &cursor->pends[i];
+            break;
+        }
+    }
+
+    // a marked record not met by its file sets lost at the end of sector
+    if (slot == NULL && (cursor->kept || NF2FS_cursor_marked(cursor, id))) {
+        if (!cursor->kept)
+            cursor->marked++;
+        return err;
+    }
+
+    NF2FS_size_t size= 0;
+    err= NF2FS_cursor_record_size(NF2FS, cursor, off, head, &size);
+    if (err)
+        return err;
+    if (slot == NULL) {
+        NF2FS_cursor_keep(cursor, id, size);
+    } else {
+        slot->size= size;
+        if (cursor->kept)
+            cursor->matched++;
+    }
+    return err;
+}
+
+// Walk data of the sector being listed, the size of file id is found. If id is NF2FS_NULL,
+// waiting files get their sizes instead.
+static int NF2FS_cursor_walk(NF2FS_t* NF2FS, NF2FS_dir_cursor_ram_t* cursor, NF2FS_size_t id,
+                             NF2FS_size_t* size)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_off_t off= cursor->data_begin;
+
+    if (id != NF2FS_NULL)
+        *size= NF2FS_NULL;
+    while (off + sizeof(NF2FS_head_t) <= cursor->data_end) {
+        NF2FS_head_t head;
+        err= NF2FS_cursor_head(NF2FS, cursor, off, cursor->data_end, &head);
+        if (err)
+            return err;
+        if (head == NF2FS_NULL)
+            break;
+
+        if (NF2FS_dhead_type(head) == NF2FS_DATA_SFILE_DATA ||
+            NF2FS_dhead_type(head) == NF2FS_DATA_BFILE_INDEX) {
+            if (id == NF2FS_NULL)
+                err= NF2FS_cursor_met(NF2FS, cursor, off, head);
+            else if (NF2FS_dhead_id(head) == id)
+                return NF2FS_cursor_record_size(NF2FS, cursor, off, head, size);
+            if (err)
+                return err;
+        }
+
+        // data records are aligned with dual_end
+        NF2FS_size_t len= NF2FS_dhead_dsize(head);
+        off+= NF2FS->cfg->dual_end ? NF2FS_alignup(len, sizeof(uint32_t)) : len;
+    }
+
+    if (id == NF2FS_NULL) {
+        cursor->kept= true;
+        cursor->fresh= false;
+    }
+    return err;
+}
+
+// Begin to list the dir sector, files named in it are marked in bits.
+static int NF2FS_cursor_load(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t sector)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_dir_cursor_ram_t* cursor= dir->cursor;
+    NF2FS_size_t sector_size= NF2FS->cfg->sector_size;
+
+    cursor->sector= sector;
+    cursor->win_size= 0;
+    uint8_t* data= NULL;
+    err= NF2FS_cursor_fetch(NF2FS, cursor, 0, NF2FS_dir_begin(NF2FS), &data);
+    if (err)
+        return err;
+
+    NF2FS_dir_sector_flash_t* shead= (NF2FS_dir_sector_flash_t*)data;
+    err= NF2FS_shead_check(shead->head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
+    if (err)
+        return err;
+    cursor->pre_sector= NF2FS_dir_pre(shead);
+    NF2FS_off_t data_off= NF2FS->cfg->dual_end ?
+                          *(NF2FS_off_t*)(data + sizeof(NF2FS_dir_sector_flash_t)) : NF2FS_NULL;
+
+    cursor->kept= false;
+    cursor->fresh= false;
+    cursor->marked= 0;
+    cursor->matched= 0;
+    memset(cursor->bits, 0, sizeof(cursor->bits));
+
+    // names end at a free head, data is mixed with them without dual_end
+    NF2FS_off_t off= NF2FS_dir_begin(NF2FS);
+    cursor->off= off;
+    while (off + sizeof(NF2FS_head_t) <= sector_size) {
+        NF2FS_head_t head;
+        err= NF2FS_cursor_head(NF2FS, cursor, off, sector_size, &head);
+        if (err)
+            return err;
+        if (head == NF2FS_NULL)
+            break;
+
+        // data of an opened file is kept as others, its size is in ram
+        NF2FS_size_t id= NF2FS_dhead_id(head);
+        if ((NF2FS_dhead_type(head) == NF2FS_DATA_NFILE_NAME ||
+             NF2FS_dhead_type(head) == NF2FS_DATA_FILE_NAME) && !NF2FS_cursor_opened(NF2FS, id))
+            cursor->bits[(id % NF2FS_CURSOR_BITS) / 32]|= 1U << (id % NF2FS_CURSOR_BITS % 32);
+        off+= NF2FS_dhead_dsize(head);
+    }
+    cursor->name_end= off;
+    cursor->data_begin= cursor->off;
+    cursor->data_end= off;
+    if (NF2FS->cfg->dual_end) {
+        err= NF2FS_dir_data_find(NF2FS, dir, sector, data_off, off, &cursor->data_begin);
+        if (err)
+            return err;
+        cursor->data_end= sector_size;
+    }
+    return err;
+}
+
+// Find the size of file by traversing the dir again, it's used when the cursor can not keep it.
+static int NF2FS_cursor_lookup(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t id,
+                               NF2FS_size_t* size)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_file_ram_t file;
+
+    // only the size is wanted, so no file cache is needed
+    file.id= id;
+    file.file_size= 0;
+    file.file_cache.buffer= NULL;
+    err= NF2FS_dtraverse_data(NF2FS, dir, &file, dir->tail_sector, 0);
+    *size= (file.file_cache.sector == NF2FS_NULL) ? 0 : file.file_size;
+    return err;
+}
+
+// Walk data of the sector for waiting files, those not met are looked up if sizes are lost.
+static int NF2FS_cursor_batch(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_dir_cursor_ram_t* cursor= dir->cursor;
+
+    err= NF2FS_cursor_walk(NF2FS, cursor, NF2FS_NULL, NULL);
+    if (err || !cursor->lost)
+        return err;
+
+    for (NF2FS_size_t i= 0; i < cursor->pend_num; i++) {
+        if (cursor->pends[i].size != NF2FS_NULL)
+            continue;
+        err= NF2FS_cursor_lookup(NF2FS, dir, cursor->pends[i].id, &cursor->pends[i].size);
+        if (err)
+            return err;
+    }
+    return err;
+}
+
+// Find the size of file with data met before its name, NF2FS_NULL if it's not met.
+static void NF2FS_cursor_size(NF2FS_t* NF2FS, NF2FS_dir_cursor_ram_t* cursor, NF2FS_size_t id,
+                              NF2FS_size_t* size)
+{
+    *size= NF2FS_NULL;
+    for (NF2FS_size_t i= 0; i < cursor->size_num; i++) {
+        if (cursor->sizes[i].id == id) {
+            *size= cursor->sizes[i].size;
+            cursor->sizes[i]= cursor->sizes[--cursor->size_num];
+            break;
+        }
+    }
+
+    // data of an opened file may be not flushed
+    NF2FS_file_ram_t* file= NF2FS_cursor_opened(NF2FS, id);
+    if (file != NULL)
+        *size= file->file_size;
+}
+
+// Return the i-th waiting file, its name is read again.
+static int NF2FS_cursor_pend(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t i,
+                             NF2FS_dentry_ram_t* dentry)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_dir_cursor_ram_t* cursor= dir->cursor;
+    NF2FS_cursor_slot_ram_t* slot= &cursor->pends[i];
+
+    NF2FS_head_t head;
+    uint8_t* data= (uint8_t*)&head;
+    if (slot->sector == cursor->sector)
+        err= NF2FS_cursor_fetch(NF2FS, cursor, slot->off, sizeof(NF2FS_head_t), &data);
+    else
+        err= NF2FS_direct_read(NF2FS, slot->sector, slot->off, sizeof(NF2FS_head_t), &head);
+    if (err)
+        return err;
+    head= *(NF2FS_head_t*)data;
+    err= NF2FS_dhead_check(head, slot->id, (int)NF2FS_NULL);
+    if (err)
+        return err;
+    NF2FS_size_t namelen= NF2FS_dhead_dsize(head) - sizeof(NF2FS_file_name_flash_t);
+    err= NF2FS_cursor_name(NF2FS, cursor, slot->sector,
+                           slot->off + sizeof(NF2FS_file_name_flash_t), namelen);
+    if (err)
+        return err;
+
+    dentry->type= NF2FS_DATA_REG;
+    dentry->id= slot->id;
+    dentry->size= slot->size;
+    dentry->sector= slot->sector;
+    dentry->off= slot->off;
+    dentry->name= cursor->name;
+    dentry->namelen= namelen;
+
+    // waiting files are returned in order, so their names are read ahead together
+    cursor->pend_num--;
+    memmove(slot, slot + 1, (cursor->pend_num - i) * sizeof(NF2FS_cursor_slot_ram_t));
+    return err;
+}
+
+// Get the next entry of dir with the cursor of readdir-plus, the cursor is freed at the end.
+int NF2FS_dcursor_next(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_dentry_ram_t* dentry)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_dir_cursor_ram_t* cursor= dir->cursor;
+
+    // a new cursor begins at the tail sector
+    if (cursor == NULL) {
+        cursor= NF2FS_malloc(sizeof(NF2FS_dir_cursor_ram_t) + NF2FS->cfg->cache_size);
+        if (!cursor)
+            return NF2FS_ERR_NOMEM;
+        cursor->sector= NF2FS_NULL;
+        cursor->pre_sector= dir->tail_sector;
+        cursor->off= 0;
+        cursor->name_end= 0;
+        cursor->win_off= 0;
+        cursor->win_size= 0;
+        cursor->kept= true;
+        cursor->fresh= false;
+        cursor->lost= false;
+        cursor->marked= 0;
+        cursor->matched= 0;
+        cursor->size_num= 0;
+        cursor->pend_num= 0;
+        dir->cursor= cursor;
+    }
+
+    memset(dentry, 0, sizeof(NF2FS_dentry_ram_t));
+    while (true) {
+        // waiting files whose data is met are returned first
+        for (NF2FS_size_t i= 0; i < cursor->pend_num; i++) {
+            if (cursor->pends[i].size != NF2FS_NULL)
+                return NF2FS_cursor_pend(NF2FS, dir, i, dentry);
+        }
+
+        if (cursor->off < cursor->name_end) {
+            NF2FS_off_t off= cursor->off;
+            uint8_t* data= NULL;
+            err= NF2FS_cursor_fetch(NF2FS, cursor, off, sizeof(NF2FS_head_t), &data);
+            if (err)
+                return err;
+            NF2FS_head_t head= *(NF2FS_head_t*)data;
+
+            char* name= NULL;
+            NF2FS_size_t namelen= 0;
+            if (!NF2FS_record_name(data, &name, &namelen)) {
+                cursor->off+= NF2FS_dhead_dsize(head);
+                continue;
+            }
+            NF2FS_off_t name_off= off + ((uint8_t*)name - data);
+
+            int type= NF2FS_DATA_DIR;
+            NF2FS_size_t id= NF2FS_dhead_id(head);
+            NF2FS_size_t size= 0;
+            if (NF2FS_dhead_type(head) == NF2FS_DATA_NFILE_NAME ||
+                NF2FS_dhead_type(head) == NF2FS_DATA_FILE_NAME) {
+                type= NF2FS_DATA_REG;
+                NF2FS_cursor_size(NF2FS, cursor, id, &size);
+
+                // data of the sector is walked for waiting files, then the name is met again
+                if (size == NF2FS_NULL && cursor->pend_num == NF2FS_CURSOR_PENDS &&
+                    (cursor->fresh || !cursor->kept)) {
+                    err= NF2FS_cursor_batch(NF2FS, dir);
+                    if (err)
+                        return err;
+                    continue;
                 }
-                len = 0;
-                break;
 
-            case NF2FS_DATA_BFILE_INDEX:
-            case NF2FS_DATA_SFILE_DATA:
-                len = NF2FS_dhead_dsize(head);
-                if (NF2FS_dhead_id(head) == file->id) {
-                    if (off + len <= NF2FS->rcache->off + size) {
-                        // index is in cache
-                        memcpy(file->file_cache.buffer, data, len);
+                // data is in the sector or older ones, or the file is empty
+                if (size == NF2FS_NULL && cursor->pend_num < NF2FS_CURSOR_PENDS) {
+                    NF2FS_cursor_slot_ram_t* slot= &cursor->pends[cursor->pend_num++];
+                    slot->id= id;
+                    slot->size= NF2FS_NULL;
+                    slot->sector= cursor->sector;
+                    slot->off= off;
+                    cursor->fresh= true;
+                    cursor->off+= NF2FS_dhead_dsize(head);
+                    continue;
+                } else if (size == NF2FS_NULL) {
+                    err= NF2FS_cursor_walk(NF2FS, cursor, id, &size);
+                    if (err)
+                        return err;
+                    if (size != NF2FS_NULL) {
+                        cursor->matched++;
                     } else {
-                        // index is not entirely in cache, read directly
-                        err= NF2FS_direct_read(NF2FS, current_sector, off, len, file->file_cache.buffer);
-                        if (err) {
+                        err= NF2FS_cursor_lookup(NF2FS, dir, id, &size);
+                        if (err)
                             return err;
-                        }
-                    }
-                    file->file_cache.sector= current_sector;
-                    file->file_cache.off= off;
-                    file->file_cache.change_flag= 0;
-                    file->file_cache.size= len;
-                    if (NF2FS_dhead_type(head) == NF2FS_DATA_SFILE_DATA) {
-                        file->file_size= len - sizeof(NF2FS_head_t);
-                    } else {
-                        file->file_size= 0;
-                        NF2FS_size_t loop= (len - sizeof(NF2FS_head_t)) / sizeof(NF2FS_bfile_index_ram_t);
-                        NF2FS_bfile_index_ram_t* index= (NF2FS_bfile_index_ram_t*)(file->file_cache.buffer + sizeof(NF2FS_head_t));
-                        for (int i= 0; i < loop; i++)
-                            file->file_size+= index[i].size;
                     }
-                    return err;
                 }
-                break;
-
-            default:
-                NF2FS_ERROR("WRONG in NF2FS_dtraverse_data\n");
-                return NF2FS_ERR_WRONGCAL;
             }
 
-            // update basic message
-            off += len;
-            data += len;
+            cursor->off+= NF2FS_dhead_dsize(head);
+            err= NF2FS_cursor_name(NF2FS, cursor, cursor->sector, name_off, namelen);
+            if (err)
+                return err;
+            dentry->type= type;
+            dentry->id= id;
+            dentry->size= size;
+            dentry->sector= cursor->sector;
+            dentry->off= off;
+            dentry->name= cursor->name;
+            dentry->namelen= namelen;
+            return err;
+        }
 
-            if (if_change && next_sector != NF2FS_NULL) {
-                // Traverse the next sector.
-                if_change = false;
-                current_sector = next_sector;
-                off = 0;
-                break;
-            } else if (if_change && next_sector == NF2FS_NULL) {
-                // fail to find the name
-                file->file_cache.sector= NF2FS_NULL;
+        // files named at the end of sector wait for its data
+        if (!cursor->kept || cursor->fresh) {
+            err= NF2FS_cursor_batch(NF2FS, dir);
+            if (err)
+                return err;
+            continue;
+        }
+
+        // a marked record that is not met by files of the sector may belong to older names
+        if (cursor->matched < cursor->marked)
+            cursor->lost= true;
+
+        if (cursor->pre_sector != NF2FS_NULL) {
+            err= NF2FS_cursor_load(NF2FS, dir, cursor->pre_sector);
+            if (err)
                 return err;
+            continue;
+        }
+
+        // files still waiting are empty, unless their sizes are not kept
+        if (cursor->pend_num > 0) {
+            if (cursor->lost) {
+                err= NF2FS_cursor_lookup(NF2FS, dir, cursor->pends[0].id, &cursor->pends[0].size);
+                if (err)
+                    return err;
+            } else {
+                cursor->pends[0].size= 0;
             }
+            return NF2FS_cursor_pend(NF2FS, dir, 0, dentry);
+        }
 
-            // the next data head is not entire, read again
-            if (off - NF2FS->rcache->off + sizeof(NF2FS_head_t) >= NF2FS->cfg->cache_size)
+        // the end of dir, the next read lists it again
+        NF2FS_dcursor_free(dir);
+        return err;
+    }
+}
+
+// Free the cursor of readdir-plus.
+void NF2FS_dcursor_free(NF2FS_dir_ram_t* dir)
+{
+    if (dir->cursor != NULL) {
+        NF2FS_free(dir->cursor);
+        dir->cursor= NULL;
+    }
+}
+
+// clear bits of ids beginning at first that are named in the dir or its sub dirs, tail is the dir tail
+int NF2FS_dtraverse_ids(NF2FS_t* NF2FS, NF2FS_size_t tail, NF2FS_size_t first, uint32_t* bits)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t sector_size= NF2FS->cfg->sector_size;
+
+    // read caches may be in use by sub dirs, so read sectors to our own buffer
+    uint8_t* buffer= NF2FS_malloc(sector_size);
+    if (!buffer)
+        return NF2FS_ERR_NOMEM;
+
+    NF2FS_size_t sector= tail;
+    while (sector != NF2FS_NULL && *bits) {
+        err= NF2FS_direct_read(NF2FS, sector, 0, sector_size, buffer);
+        if (err)
+            goto cleanup;
+
+        NF2FS_dir_sector_flash_t* shead= (NF2FS_dir_sector_flash_t*)buffer;
+        err= NF2FS_shead_check(shead->head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
+        if (err)
+            goto cleanup;
+
+        // names are in the front of sector, they end at a free head
+        NF2FS_off_t off= NF2FS_dir_begin(NF2FS);
+        while (off + sizeof(NF2FS_head_t) <= sector_size && *bits) {
+            NF2FS_head_t head= *(NF2FS_head_t*)(buffer + off);
+            if (head == NF2FS_NULL)
                 break;
+            err= NF2FS_dhead_check(head, NF2FS_NULL, (int)NF2FS_NULL);
+            if (err)
+                goto cleanup;
+
+            NF2FS_size_t len= NF2FS_dhead_dsize(head);
+            if (len == 0 || off + len > sector_size) {
+                err= NF2FS_ERR_WRONGCAL;
+                goto cleanup;
+            }
+
+            char* name= NULL;
+            NF2FS_size_t namelen= 0;
+            NF2FS_size_t id= NF2FS_dhead_id(head);
+            if (NF2FS_record_name(buffer + off, &name, &namelen)) {
+                if (id >= first && id < first + 32)
+                    *bits&= ~(1U << (id - first));
+
+                // sub dirs have their own names
+                bool is_dir= NF2FS_dhead_type(head) == NF2FS_DATA_DIR_NAME ||
+                             NF2FS_dhead_type(head) == NF2FS_DATA_NDIR_NAME;
+                if (is_dir && id != shead->id) {
+                    err= NF2FS_dtraverse_ids(NF2FS, ((NF2FS_dir_name_flash_t*)(buffer + off))->tail,
+                                             first, bits);
+                    if (err)
+                        goto cleanup;
+                }
+            }
+            off+= len;
         }
+        sector= NF2FS_dir_pre(shead);
     }
+
+cleanup:
+    NF2FS_free(buffer);
+    return err;
 }
 
 // delete all big files in current dir
@@ -349,24 +1445,38 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
     NF2FS_size_t next_sector = NF2FS_NULL;
     NF2FS_size_t current_sector= dir->tail_sector;
     NF2FS_size_t off= 0;
+    NF2FS_cache_ram_t* rcache= NULL;
+    NF2FS_off_t data_word= NF2FS_NULL;
+    bool in_data= false;
     while (true) {
+        // data of the sector ends at the end of it
+        if (in_data && off >= NF2FS->cfg->sector_size) {
+            if (next_sector == NF2FS_NULL)
+                goto cleanup;
+            current_sector= next_sector;
+            off= 0;
+            in_data= false;
+        }
+
         // Read data of file to cache first.
         NF2FS_size_t size = NF2FS_min(NF2FS->cfg->cache_size,
                                     NF2FS->cfg->sector_size - off);
-        err = NF2FS_read_to_cache(NF2FS, NF2FS->rcache, current_sector, off, size);
+        err = NF2FS_rcache_fetch_hold(NF2FS, &rcache, current_sector, off, size, false);
         if (err)
-            return err;
-        uint8_t *data = NF2FS->rcache->buffer;
+            goto cleanup;
+        uint8_t *data = rcache->buffer + off - rcache->off;
 
         // record the next sector of the file
         if (off == 0) {
             NF2FS_dir_sector_flash_t *shead = (NF2FS_dir_sector_flash_t *)data;
             err = NF2FS_shead_check(shead->head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
             if (err)
-                return err;
-            next_sector= shead->pre_sector;
-            data += sizeof(NF2FS_dir_sector_flash_t);
-            off += sizeof(NF2FS_dir_sector_flash_t);
+                goto cleanup;
+            next_sector= NF2FS_dir_pre(shead);
+            if (NF2FS->cfg->dual_end)
+                data_word= *(NF2FS_off_t*)(data + sizeof(NF2FS_dir_sector_flash_t));
+            data += NF2FS_dir_begin(NF2FS);
+            off += NF2FS_dir_begin(NF2FS);
         }
 
         NF2FS_head_t head;
@@ -376,9 +1486,18 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
             // Check if the head is valid.
             err = NF2FS_dhead_check(head, NF2FS_NULL, (int)NF2FS_NULL);
             if (err)
-                return err;
+                goto cleanup;
+
+            // names end at a free head, then data of the sector is traversed
+            if (head == NF2FS_NULL && NF2FS->cfg->dual_end && !in_data) {
+                err= NF2FS_dir_data_find(NF2FS, dir, current_sector, data_word, off, &off);
+                if (err)
+                    goto cleanup;
+                in_data= true;
+                break;
+            }
 
-            if (off + NF2FS_dhead_dsize(head) > NF2FS->rcache->off + size) {
+            if (off + NF2FS_dhead_dsize(head) > rcache->off + rcache->size) {
                 if (head == NF2FS_NULL && next_sector != NF2FS_NULL) {
                     // no more data in the sector, read the next
                     current_sector = next_sector;
@@ -386,10 +1505,11 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                     break;
                 } else if (head == NF2FS_NULL) {
                     // not have next sector, finished and can not find
-                    return err;
-                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX) {
+                    goto cleanup;
+                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX &&
+                           NF2FS_dhead_type(head) != NF2FS_DATA_DELETE) {
                     // We have read whole data in cache.
-                    // but big file data is special
+                    // but big file data is special, and deleted data is only skipped
                     break;
                 }
             }
@@ -403,6 +1523,7 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
             case NF2FS_DATA_FILE_NAME:
             case NF2FS_DATA_DELETE:
             case NF2FS_DATA_DIR_OSPACE:
+            case NF2FS_DATA_SEAL:
             case NF2FS_DATA_SFILE_DATA:
                 len = NF2FS_dhead_dsize(head);    
                 break;
@@ -414,7 +1535,8 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                 } else {
                     // something has been wrong
                     NF2FS_ERROR("WRONG in NF2FS_dtraverse_bfile_delete\n");
-                    return NF2FS_ERR_WRONGCAL;
+                    err= NF2FS_ERR_WRONGCAL;
+                    goto cleanup;
                 }
                 len = 0;
                 break;
@@ -425,14 +1547,15 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                 NF2FS_size_t index_num= (len - sizeof(NF2FS_head_t)) / sizeof(NF2FS_bfile_index_ram_t);
                 NF2FS_bfile_index_flash_t* bfile_index= (NF2FS_bfile_index_flash_t*)data;
 
-                if (off + len <= NF2FS->rcache->off + size) {
+                if (off + len <= rcache->off + rcache->size) {
                     // if index is entirely in cache
                     err = NF2FS_bfile_sector_old(NF2FS, bfile_index->index, index_num);
                     if (err)
-                        return err;
+                        goto cleanup;
                 } else {
                     // If is not entirely in cache, we should use other approaches.
-                    // in the next loop, rcache must reread, so we can change rcache now
+                    // the scratch rcache is used to read part of indexes
+                    NF2FS_cache_drop(NF2FS, NF2FS->rcache);
                     NF2FS_size_t index_sector= current_sector;
                     NF2FS_size_t index_off= off + sizeof(NF2FS_head_t);
                     while (index_num > 0) {
@@ -441,13 +1564,13 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                                                         index_num * sizeof(NF2FS_bfile_index_ram_t));
                         err= NF2FS_direct_read(NF2FS, index_sector, index_off, read_size, NF2FS->rcache->buffer);
                         if (err)
-                            return err;
+                            goto cleanup;
 
                         // set relative indexes to old
                         err= NF2FS_bfile_sector_old(NF2FS, (NF2FS_bfile_index_ram_t*)NF2FS->rcache->buffer,
                                                    read_size / sizeof(NF2FS_bfile_index_ram_t));
                         if (err)
-                            return err;
+                            goto cleanup;
 
                         // update basic message
                         index_num-= read_size / sizeof(NF2FS_bfile_index_ram_t);
@@ -460,12 +1583,17 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
 
             default:
                 NF2FS_ERROR("WRONG in NF2FS_dtraverse_bfile_delete\n");
-                return NF2FS_ERR_WRONGCAL;
+                err= NF2FS_ERR_WRONGCAL;
+                goto cleanup;
             }
 
-            // update basic message
+            // update basic message, data records are aligned
+            if (in_data)
+                len= NF2FS_alignup(len, sizeof(uint32_t));
             off += len;
             data += len;
+            if (in_data && off >= NF2FS->cfg->sector_size)
+                break;
 
             if (if_change && next_sector != NF2FS_NULL) {
                 // Traverse the next sector.
@@ -475,57 +1603,113 @@ int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                 break;
             } else if (if_change && next_sector == NF2FS_NULL) {
                 // finishing
-                return err;
+                goto cleanup;
             }
 
             // the next data head is not entire, read again
-            if (off - NF2FS->rcache->off + sizeof(NF2FS_head_t) >= NF2FS->cfg->cache_size)
+            if (off + sizeof(NF2FS_head_t) >= rcache->off + rcache->size)
                 break;
         }
     }
+
+cleanup:
+    NF2FS_rcache_release(NF2FS, rcache);
+    return err;
+}
+
+// A name record is moved to (sector, off) by gc, update where opened files, dirs and tree find it.
+static int NF2FS_gc_name_moved(NF2FS_t* NF2FS, NF2FS_head_t head, NF2FS_size_t sector, NF2FS_off_t off)
+{
+    NF2FS_size_t id= NF2FS_dhead_id(head);
+    if (NF2FS_dhead_type(head) == NF2FS_DATA_FILE_NAME ||
+        NF2FS_dhead_type(head) == NF2FS_DATA_NFILE_NAME) {
+        NF2FS_file_ram_t* file= NF2FS->file_list;
+        while (file != NULL) {
+            if (file->id == id) {
+                file->sector= sector;
+                file->off= off;
+            }
+            file= file->next_file;
+        }
+        return NF2FS_ERR_OK;
+    }
+
+    NF2FS_dir_ram_t* dir= NF2FS->dir_list;
+    while (dir != NULL) {
+        if (dir->id == id) {
+            dir->name_sector= sector;
+            dir->name_off= off;
+        }
+        dir= dir->next_dir;
+    }
+    return NF2FS_tree_entry_update(NF2FS->ram_tree, id, sector, off, NF2FS_NULL);
 }
 
-// GC while traversing the dir
-int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
+// GC while traversing the dir from begin_sector to its oldest sector, moved is the size of
+// records moved to tail. A new tail sector is used if begin_sector is the tail.
+int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t begin_sector,
+                       NF2FS_size_t* moved)
 {
     int err= NF2FS_ERR_OK;
 
-    NF2FS_size_t old_sector = dir->tail_sector;
+    NF2FS_size_t old_sector = begin_sector;
     NF2FS_off_t old_off= 0;
     NF2FS_size_t next= NF2FS_NULL;
-
-    // New dir sector message.
-    err= NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_SECTOR_DIR, 1, NF2FS_NULL,
-                           dir->id, NF2FS_NULL, &dir->tail_sector, NULL);
-    if (err)
-        return err;
-    dir->tail_off= sizeof(NF2FS_dir_sector_flash_t);
+    NF2FS_cache_ram_t* rcache= NULL;
+    NF2FS_off_t data_word= NF2FS_NULL;
+    bool in_data= false;
+
+    *moved= 0;
+    if (begin_sector == dir->tail_sector) {
+        // the old tail is no longer the tail of dir
+        NF2FS_rcache_unpin(NF2FS, old_sector);
+
+        // New dir sector message, live records moved by gc are cold.
+        err= NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_SECTOR_DIR, 1, NF2FS_NULL,
+                               dir->id, NF2FS_NULL, &dir->tail_sector, NULL);
+        if (err)
+            goto cleanup;
+        dir->oldest_sector= dir->tail_sector;
+        dir->sectors= 1;
+        NF2FS_dir_tail_init(NF2FS, dir);
+    }
 
     // flush data in pcache
     err= NF2FS_cache_flush(NF2FS, NF2FS->pcache);
     if (err)
-        return err;
+        goto cleanup;
     NF2FS_cache_one(NF2FS, NF2FS->pcache);
 
     dir->old_space= 0;
     while (true) {
+        // data of the sector ends at the end of it
+        if (in_data && old_off >= NF2FS->cfg->sector_size) {
+            if (next == NF2FS_NULL)
+                goto cleanup;
+            old_sector= next;
+            old_off= 0;
+            in_data= false;
+        }
+
         // Read data of old sector to cache first.
         NF2FS_size_t size = NF2FS_min(NF2FS->cfg->cache_size, NF2FS->cfg->sector_size - old_off);
-        err = NF2FS_read_to_cache(NF2FS, NF2FS->rcache, old_sector, old_off, size);
+        err = NF2FS_rcache_fetch_hold(NF2FS, &rcache, old_sector, old_off, size, false);
         if (err)
-            return err;
-        uint8_t *data = (uint8_t*)NF2FS->rcache->buffer;
+            goto cleanup;
+        uint8_t *data = rcache->buffer + old_off - rcache->off;
 
         // record the next sector to be traversed
         if (old_off == 0) {
             NF2FS_dir_sector_flash_t *shead = (NF2FS_dir_sector_flash_t *)data;
             err = NF2FS_shead_check(shead->head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
             if (err)
-                return err;
+                goto cleanup;
 
-            next = shead->pre_sector;
-            data += sizeof(NF2FS_dir_sector_flash_t);
-            old_off += sizeof(NF2FS_dir_sector_flash_t);
+            next = NF2FS_dir_pre(shead);
+            if (NF2FS->cfg->dual_end)
+                data_word= *(NF2FS_off_t*)(data + sizeof(NF2FS_dir_sector_flash_t));
+            data += NF2FS_dir_begin(NF2FS);
+            old_off += NF2FS_dir_begin(NF2FS);
         }
 
         NF2FS_head_t head;
@@ -535,9 +1719,18 @@ int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
             // Check if the head is valid.
             err = NF2FS_dhead_check(head, NF2FS_NULL, (int)NF2FS_NULL);
             if (err)
-                return err;
+                goto cleanup;
+
+            // names end at a free head, then data of the sector is traversed
+            if (head == NF2FS_NULL && NF2FS->cfg->dual_end && !in_data) {
+                err= NF2FS_dir_data_find(NF2FS, dir, old_sector, data_word, old_off, &old_off);
+                if (err)
+                    goto cleanup;
+                in_data= true;
+                break;
+            }
 
-            if (old_off + NF2FS_dhead_dsize(head) > NF2FS->rcache->off + size) {
+            if (old_off + NF2FS_dhead_dsize(head) > rcache->off + rcache->size) {
                 if (head == NF2FS_NULL && next != NF2FS_NULL) {
                     // no more data in the sector, read the next
                     old_sector = next;
@@ -545,10 +1738,11 @@ int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                     break;
                 } else if (head == NF2FS_NULL) {
                     // not have next sector, finished and can not find
-                    return err;
-                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX) {
+                    goto cleanup;
+                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX &&
+                           NF2FS_dhead_type(head) != NF2FS_DATA_DELETE) {
                     // We have read whole data in cache.
-                    // but big file data is special
+                    // but big file data is special, and deleted data is only skipped
                     break;
                 }
             }
@@ -559,6 +1753,7 @@ int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
             {
             case NF2FS_DATA_DELETE:
             case NF2FS_DATA_DIR_OSPACE:
+            case NF2FS_DATA_SEAL:
                 // Ignore delete data.
                 len = NF2FS_dhead_dsize(head);
                 break;
@@ -566,38 +1761,26 @@ int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
             case NF2FS_DATA_BFILE_INDEX:
                 // Move to new sector.
                 len= NF2FS_dhead_dsize(head);
-                if (old_off + len <= NF2FS->pcache->off + size) {
-                    // data is entirely in pcache, prog directly.
+                if (old_off + len <= rcache->off + rcache->size) {
+                    // data is entirely in cache, prog directly.
                     err = NF2FS_dir_prog(NF2FS, dir, data, len);
                     if (err)
-                        return err;
+                        goto cleanup;
                 } else {
-                    // If is not entirely in cache, we should use other approaches.
-                    // in the next loop, pcache must reread, so we can change pcache now
-                    NF2FS_size_t temp_len= len;
-                    NF2FS_size_t temp_off= old_off;
-                    NF2FS_size_t data_type= NF2FS_DIRECT_PROG_DHEAD;
-                    while (temp_len > 0) {
-                        // read part index to pcache
-                        NF2FS_size_t read_size= NF2FS_min(NF2FS->cfg->cache_size, temp_len);
-                        err= NF2FS_direct_read(NF2FS, old_sector, temp_off, read_size, NF2FS->pcache->buffer);
-                        if (err)
-                            return err;
-
-                        // set relative indexes to old
-                        err= NF2FS_direct_prog(NF2FS, data_type, old_sector, temp_off,
-                                              read_size, NF2FS->pcache->buffer);
-                        if (err)
-                            return err;
-                        // means that other data do not need to change the written flag
-                        data_type= NF2FS_DIRECT_PROG_DATA; 
-
-                        // update basic message
-                        temp_len-= read_size;
-                        temp_off+= read_size;
-                        NF2FS_ASSERT(temp_off <= NF2FS->cfg->sector_size);
+                    // the index crosses the end of cache, it's read entirely to be moved
+                    uint8_t* index= NF2FS_malloc(len);
+                    if (index == NULL) {
+                        err= NF2FS_ERR_NOMEM;
+                        goto cleanup;
                     }
+                    err= NF2FS_direct_read(NF2FS, old_sector, old_off, len, index);
+                    if (!err)
+                        err= NF2FS_dir_prog(NF2FS, dir, index, len);
+                    NF2FS_free(index);
+                    if (err)
+                        goto cleanup;
                 }
+                *moved+= len;
                 break;
 
             case NF2FS_DATA_NDIR_NAME:
@@ -609,7 +1792,8 @@ int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                 len= NF2FS_dhead_dsize(head);
                 err = NF2FS_dir_prog(NF2FS, dir, data, len);
                 if (err)
-                    return err;
+                    goto cleanup;
+                *moved+= len;
 
                 // For son dir, we should update their tree entry message.
                 if (NF2FS_dhead_type(head) == NF2FS_DATA_DIR_NAME ||
@@ -617,7 +1801,14 @@ int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                     err= NF2FS_tree_entry_update(NF2FS->ram_tree, dir->id, dir->name_sector,
                                                 dir->name_off, dir->tail_sector);
                     if (err)
-                        return err;
+                        goto cleanup;
+                }
+
+                // opened files and dirs should find their names at the new place
+                if (NF2FS_dhead_type(head) != NF2FS_DATA_SFILE_DATA) {
+                    err= NF2FS_gc_name_moved(NF2FS, head, dir->tail_sector, dir->prog_off);
+                    if (err)
+                        goto cleanup;
                 }
                 break;
 
@@ -626,17 +1817,23 @@ int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                     // no more data, change to the next sector
                     if_change= true;
                 } else {
-                    return NF2FS_ERR_WRONGCAL;
+                    err= NF2FS_ERR_WRONGCAL;
+                    goto cleanup;
                 }
 
             default:
                 NF2FS_ERROR("WRONG in NF2FS_dtraverse_bfile_delete\n");
-                return NF2FS_ERR_WRONGCAL;
+                err= NF2FS_ERR_WRONGCAL;
+                goto cleanup;
             }
 
-            // update basic message
+            // update basic message, data records are aligned
+            if (in_data)
+                len= NF2FS_alignup(len, sizeof(uint32_t));
             old_off += len;
             data += len;
+            if (in_data && old_off >= NF2FS->cfg->sector_size)
+                break;
 
             if (if_change && next != NF2FS_NULL) {
                 // Traverse the next sector.
@@ -646,15 +1843,19 @@ int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
                 break;
             } else if (if_change && next == NF2FS_NULL) {
                 // finished
-                return err;
+                goto cleanup;
             }
 
             // the next data head is not entire, read again
-            if (old_off - NF2FS->rcache->off + sizeof(NF2FS_head_t) >= NF2FS->cfg->cache_size) {
+            if (old_off + sizeof(NF2FS_head_t) >= rcache->off + rcache->size) {
                 break;
             }
         }
     }
+
+cleanup:
+    NF2FS_rcache_release(NF2FS, rcache);
+    return err;
 }
 
 // cal the old space in dir
@@ -668,11 +1869,35 @@ int NF2FS_dtraverse_ospace(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t se
     NF2FS_size_t next= NF2FS_NULL;
     bool if_ospace= false;
     NF2FS_size_t accu_ospace= 0;
+    NF2FS_off_t data_word= NF2FS_NULL;
+    NF2FS_size_t free_len= 0;
+    bool in_data= false;
 
-    // init basic message
+    // init basic message, data offset of tail sector is found while traversing
     dir->tail_sector= sector;
+    dir->tail_names= 0;
+    dir->data_off= NF2FS_NULL;
     dir->old_space= 0;
+    dir->oldest_sector= NF2FS_NULL;
     while (true) {
+        // data of the sector ends at the end of it, free space between names and data is old
+        if (in_data && old_off >= NF2FS->cfg->sector_size) {
+            in_data= false;
+            accu_ospace= accu_ospace + dir->old_space + free_len;
+            if (if_ospace) {
+                dir->old_space= accu_ospace;
+                return err;
+            } else if (next == NF2FS_NULL) {
+                dir->old_sector= NF2FS_NULL;
+                dir->old_off= NF2FS_NULL;
+                dir->old_space= accu_ospace;
+                return err;
+            }
+            dir->old_space= 0;
+            old_sector= next;
+            old_off= 0;
+        }
+
         // Read data of old sector to cache first.
         NF2FS_size_t size = NF2FS_min(NF2FS->cfg->cache_size, NF2FS->cfg->sector_size - old_off);
 
@@ -688,9 +1913,11 @@ int NF2FS_dtraverse_ospace(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t se
             if (err)
                 return err;
 
-            next = shead->pre_sector;
-            data += sizeof(NF2FS_dir_sector_flash_t);
-            old_off += sizeof(NF2FS_dir_sector_flash_t);
+            next = NF2FS_dir_pre(shead);
+            if (NF2FS->cfg->dual_end)
+                data_word= *(NF2FS_off_t*)(data + sizeof(NF2FS_dir_sector_flash_t));
+            data += NF2FS_dir_begin(NF2FS);
+            old_off += NF2FS_dir_begin(NF2FS);
         }
 
         NF2FS_head_t head;
@@ -702,7 +1929,27 @@ int NF2FS_dtraverse_ospace(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t se
             if (err)
                 return err;
 
+            // names end at a free head, then data of the sector is traversed
+            if (head == NF2FS_NULL && NF2FS->cfg->dual_end && !in_data) {
+                NF2FS_off_t data_off= NF2FS_NULL;
+                err= NF2FS_dir_data_find(NF2FS, dir, old_sector, data_word, old_off, &data_off);
+                if (err)
+                    return err;
+                if (old_sector == dir->tail_sector) {
+                    dir->tail_off= old_off;
+                    dir->data_off= data_off;
+                }
+                free_len= data_off - old_off;
+                old_off= data_off;
+                in_data= true;
+                break;
+            }
+
             if (old_off + NF2FS_dhead_dsize(head) > cache->off + size) {
+                // data of the dir ends at the first free head of the tail sector
+                if (head == NF2FS_NULL && old_sector == dir->tail_sector)
+                    dir->tail_off= old_off;
+
                 if (head == NF2FS_NULL && next != NF2FS_NULL) {
                     // no more data in the sector, read the next
                     old_sector = next;
@@ -710,11 +1957,11 @@ int NF2FS_dtraverse_ospace(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t se
                     break;
                 } else if (head == NF2FS_NULL) {
                     // not have next sector, finished and can not find
-                    dir->tail_off= old_off;
                     return err;
-                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX) {
+                } else if (NF2FS_dhead_type(head) != NF2FS_DATA_BFILE_INDEX &&
+                           NF2FS_dhead_type(head) != NF2FS_DATA_DELETE) {
                     // We have read whole data in cache.
-                    // but big file data is special
+                    // but big file data is special, and deleted data is only skipped
                     break;
                 }
             }
@@ -724,17 +1971,22 @@ int NF2FS_dtraverse_ospace(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t se
             switch (NF2FS_dhead_type(head))
             {
             case NF2FS_DATA_DELETE:
-                // add to old space
+                // add to old space, older data than ospace is in it with dual_end
                 len= NF2FS_dhead_dsize(head);
-                dir->old_space+= len;
+                if (!(if_ospace && in_data))
+                    dir->old_space+= len;
                 break;
 
             case NF2FS_DATA_DIR_OSPACE: {
                 // get what we want, return if we find the tail_off.
+                // with dual_end, the first one in data is the newest in sector
                 len= NF2FS_dhead_dsize(head);
+                if (if_ospace && in_data)
+                    break;
                 if_ospace= true;
                 NF2FS_dir_ospace_flash_t *flash_old= (NF2FS_dir_ospace_flash_t *)data;
                 dir->old_space= flash_old->old_space + accu_ospace;
+                dir->oldest_sector= flash_old->oldest_sector;
                 dir->old_sector= old_sector;
                 dir->old_off= old_off;
                 break;
@@ -744,8 +1996,15 @@ int NF2FS_dtraverse_ospace(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t se
             case NF2FS_DATA_NFILE_NAME:
             case NF2FS_DATA_DIR_NAME:
             case NF2FS_DATA_FILE_NAME:
+                // names in tail sector are in its footer when it's sealed
+                len = NF2FS_dhead_dsize(head);
+                if (old_sector == dir->tail_sector)
+                    dir->tail_names++;
+                break;
+
             case NF2FS_DATA_BFILE_INDEX:
             case NF2FS_DATA_SFILE_DATA:
+            case NF2FS_DATA_SEAL:
                 // Move to new sector.
                 len = NF2FS_dhead_dsize(head);
                 break;
@@ -775,9 +2034,13 @@ int NF2FS_dtraverse_ospace(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t se
                 return NF2FS_ERR_WRONGCAL;
             }
 
-            // update basic message
+            // update basic message, data records are aligned
+            if (in_data)
+                len= NF2FS_alignup(len, sizeof(uint32_t));
             old_off += len;
             data += len;
+            if (in_data && old_off >= NF2FS->cfg->sector_size)
+                break;
 
             if (if_change && next != NF2FS_NULL) {
                 // Traverse the next sector.
@@ -800,21 +2063,78 @@ int NF2FS_dtraverse_ospace(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir, NF2FS_size_t se
     }
 }
 
+// Whether or not there is no enough space for a record in the tail sector of dir.
+static bool NF2FS_dir_no_space(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t len,
+                               NF2FS_size_t names)
+{
+    // leave space for the seal of a new batch
+    NF2FS_size_t need= len;
+    if (NF2FS->cfg->crc_seal)
+        need+= sizeof(NF2FS_seal_flash_t);
+
+    // a free head is left between names and aligned data
+    if (NF2FS->cfg->dual_end)
+        return dir->tail_off + need + sizeof(NF2FS_head_t) + sizeof(uint32_t) - 1 > dir->data_off;
+
+    // and for the name footer of the sector, a free head is left before it
+    need+= NF2FS_footer_len(dir->tail_names + names) + sizeof(NF2FS_head_t);
+    return dir->tail_off + need >= NF2FS->cfg->sector_size;
+}
+
+// Seal the tail sector of dir and link a new one to it.
+static int NF2FS_dir_new_tail(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t old_tail= dir->tail_sector;
+    NF2FS_rcache_unpin(NF2FS, old_tail);
+    err= NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_dir_sector_type(NF2FS, dir), 1,
+                               old_tail, dir->id, NF2FS_NULL, &dir->tail_sector, NULL);
+    if (err)
+        return err;
+    err= NF2FS_dir_link_next(NF2FS, old_tail, dir->tail_sector);
+    if (err)
+        return err;
+    if (dir->sectors != NF2FS_NULL)
+        dir->sectors++;
+
+    if (NF2FS->cfg->dual_end) {
+        // the old tail is sealed, its data can be found without parsing names
+        err= NF2FS_head_validate(NF2FS, old_tail, sizeof(NF2FS_dir_sector_flash_t),
+                                 dir->data_off);
+    } else {
+        // the old tail is sealed, names in it are summarized by the footer
+        err= NF2FS_footer_prog(NF2FS, dir->id, old_tail, dir->tail_off, dir->tail_names);
+    }
+    if (err)
+        return err;
+    NF2FS_dir_tail_init(NF2FS, dir);
+
+    // update the in-flash tail message
+    return NF2FS_dir_update(NF2FS, dir);
+}
+
 // prog node to the dir
 int NF2FS_dir_prog(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, void* buffer, NF2FS_size_t len)
 {
     int err = NF2FS_ERR_OK;
     NF2FS_ASSERT(len < NF2FS->cfg->sector_size);
 
+    char* name= NULL;
+    NF2FS_size_t namelen= 0;
+    NF2FS_size_t names= NF2FS_record_name((uint8_t*)buffer, &name, &namelen) ? 1 : 0;
+
     // get a new sector if there is no enough space
-    if (dir->tail_off + len >= NF2FS->cfg->sector_size) {
-        // GC if there is enough space
+    if (NF2FS_dir_no_space(NF2FS, dir, len, names)) {
+        // GC the oldest sectors if there is enough space, later progs go on with it
         NF2FS_ASSERT(dir->old_space != NF2FS_NULL);
         if (dir->old_space >= NF2FS->cfg->sector_size * 3) {
             // // NEXT
             // uint32_t start = (uint32_t)xTaskGetTickCount();
 
-            err = NF2FS_dir_gc(NF2FS, dir);
+            bool in_gc= NF2FS->in_gc;
+            NF2FS->in_gc= true;
+            err = NF2FS_dir_gc_step(NF2FS, dir);
+            NF2FS->in_gc= in_gc;
             if (err)
                 return err;
 
@@ -824,22 +2144,37 @@ int NF2FS_dir_prog(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, void* buffer, NF2FS_siz
         }
 
         // alloc a new sector if there still no enough space
-        if (dir->tail_off + len >= NF2FS->cfg->sector_size) {
-            err= NF2FS_sector_alloc(NF2FS, NF2FS->manager, NF2FS_SECTOR_DIR, 1,
-                                       dir->tail_sector, dir->id, NF2FS_NULL, &dir->tail_sector, NULL);
-            if (err)
-                return err;
-            dir->tail_off= sizeof(NF2FS_dir_sector_flash_t);
-
-            // update the in-flash tail message
-            err= NF2FS_dir_update(NF2FS, dir);
+        if (NF2FS_dir_no_space(NF2FS, dir, len, names)) {
+            dir->busy= true;
+            err= NF2FS_dir_new_tail(NF2FS, dir);
+            dir->busy= false;
             if (err)
                 return err;
         }
     }
 
-    // directly prog if data is larger than normal cache size
-    if (len >= NF2FS->cfg->cache_size) {
+    // progs of gc do not make the dir younger
+    if (!NF2FS->in_gc)
+        dir->stamp= NF2FS->dir_clock++;
+
+    if (NF2FS_dir_is_data(NF2FS, *(NF2FS_head_t*)buffer)) {
+        // data is proged backward, the written flag tells whether it's writen
+        dir->data_off= NF2FS_aligndown(dir->data_off - len, sizeof(uint32_t));
+        dir->prog_off= dir->data_off;
+        return NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_DHEAD, dir->tail_sector,
+                                 dir->data_off, len, buffer);
+    }
+
+    if (NF2FS->cfg->crc_seal) {
+        // records are proged once, the seal of batch tells whether they are writen
+        NF2FS_size_t seal_len= 0;
+        err= NF2FS_seal_prog(NF2FS, dir->id, dir->tail_sector, dir->tail_off,
+                             buffer, len, &seal_len);
+        if (err)
+            return err;
+        dir->tail_off+= seal_len;
+    } else if (len >= NF2FS->cfg->cache_size) {
+        // directly prog if data is larger than normal cache size
         // flush the pcache data
         err= NF2FS_cache_flush(NF2FS, NF2FS->pcache);
         if (err)
@@ -857,7 +2192,9 @@ int NF2FS_dir_prog(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, void* buffer, NF2FS_siz
         if (err)
             return err;   
     }
+    dir->prog_off= dir->tail_off;
     dir->tail_off+= len;
+    dir->tail_names+= names;
     NF2FS_ASSERT(dir->tail_off <= NF2FS->cfg->sector_size);
     return err;
 }
@@ -886,7 +2223,7 @@ int NF2FS_dir_old(NF2FS_t *NF2FS, NF2FS_size_t tail)
         err = NF2FS_emap_set(NF2FS, NF2FS->manager, tail, 1);
         if (err)
             return err;
-        tail = dsector_head.pre_sector;
+        tail = NF2FS_dir_pre(&dsector_head);
     }
     return err;
 }
@@ -927,7 +2264,7 @@ int NF2FS_dir_update(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir)
 
         // update ram messages, namelen of root dir is 0
         dir->name_sector = NF2FS->superblock->sector;
-        dir->name_off= NF2FS->superblock->free_off - len;
+        dir->name_off= NF2FS->superblock->free_off - sizeof(NF2FS_dir_name_flash_t);
         dir->namelen= 0;
         NF2FS->ram_tree->tree_array[entry_index].name_sector= dir->name_sector;
         NF2FS->ram_tree->tree_array[entry_index].name_off= dir->name_off;
@@ -953,7 +2290,13 @@ int NF2FS_dir_update(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir)
     if (dir_name == NULL)
         return NF2FS_ERR_NOMEM;
 
-    // read origin name to flash and prog a new one
+    // read origin name to flash and prog a new one, it may be still in the prog cache
+    if (NF2FS->pcache->sector == dir->name_sector) {
+        err= NF2FS_cache_flush(NF2FS, NF2FS->pcache);
+        if (err)
+            goto cleanup;
+        NF2FS_cache_one(NF2FS, NF2FS->pcache);
+    }
     err= NF2FS_direct_read(NF2FS, dir->name_sector, dir->name_off, len, dir_name);
     if (err)
         goto cleanup;
@@ -975,7 +2318,7 @@ int NF2FS_dir_update(NF2FS_t *NF2FS, NF2FS_dir_ram_t *dir)
 
     // Update address, the size of namelen is unchanged
     dir->name_sector = father_dir->tail_sector;
-    dir->name_off= father_dir->tail_off - len;
+    dir->name_off= father_dir->prog_off;
 
     NF2FS->ram_tree->tree_array[entry_index].name_sector= dir->name_sector;
     NF2FS->ram_tree->tree_array[entry_index].name_off= dir->name_off;
@@ -986,6 +2329,55 @@ cleanup:
     return err;
 }
 
+// give an opened dir a new name in new_father, its sectors are not touched
+int NF2FS_dir_move(NF2FS_t* NF2FS, NF2FS_dir_ram_t* father, NF2FS_dir_ram_t* new_father,
+                   NF2FS_dir_ram_t* dir, char* name, NF2FS_size_t namelen)
+{
+    int err= NF2FS_ERR_OK;
+
+    // prog the new name with the same id and tail first, the old one is still valid if crash happens
+    NF2FS_size_t len= sizeof(NF2FS_dir_name_flash_t) + namelen;
+    NF2FS_dir_name_flash_t* dir_name= NF2FS_malloc(len);
+    if (dir_name == NULL)
+        return NF2FS_ERR_NOMEM;
+    dir_name->head= NF2FS_MKDHEAD(0, 1, dir->id, NF2FS_DATA_NDIR_NAME, len);
+    dir_name->tail= dir->tail_sector;
+    memcpy(dir_name->name, name, namelen);
+    err= NF2FS_dir_prog(NF2FS, new_father, dir_name, len);
+    NF2FS_free(dir_name);
+    if (err)
+        return err;
+
+    // dir gc in the same dir has updated position of the old name
+    NF2FS_size_t old_sector= dir->name_sector;
+    NF2FS_off_t old_off= dir->name_off;
+    NF2FS_size_t old_namelen= dir->namelen;
+    dir->father_id= new_father->id;
+    dir->name_sector= new_father->tail_sector;
+    dir->name_off= new_father->prog_off;
+    dir->namelen= namelen;
+
+    // name in tree entry is changed, so the entry is added again
+    err= NF2FS_tree_entry_remove(NF2FS->ram_tree, dir->id);
+    if (err)
+        return err;
+    err= NF2FS_tree_entry_add(NF2FS->ram_tree, new_father->id, dir->id, dir->name_sector,
+                             dir->name_off, dir->tail_sector, name, namelen);
+    if (err)
+        return err;
+
+    // delete the old name at last
+    err= NF2FS_data_delete(NF2FS, father->id, old_sector, old_off,
+                          sizeof(NF2FS_dir_name_flash_t) + old_namelen);
+    if (err)
+        return err;
+#if NF2FS_DIR_FILTER_BITS > 0
+    father->filter.stale++;
+    NF2FS_filter_add(&new_father->filter, NF2FS_name_hash(name, namelen));
+#endif
+    return err;
+}
+
 // open dir
 int NF2FS_dir_lowopen(NF2FS_t* NF2FS, NF2FS_size_t tail, NF2FS_size_t id, NF2FS_size_t father_id,
                      NF2FS_size_t name_sector, NF2FS_size_t name_off, NF2FS_dir_ram_t **dir_addr,
@@ -1027,12 +2419,38 @@ int NF2FS_dir_lowopen(NF2FS_t* NF2FS, NF2FS_size_t tail, NF2FS_size_t id, NF2FS_
     dir->pos_sector = NF2FS_NULL;
     dir->pos_off = NF2FS_NULL;
     dir->pos_presector = NF2FS_NULL;
+    dir->cursor= NULL;
+
+#if NF2FS_DIR_FILTER_BITS > 0
+    // names are added to filter at the first traversal
+    NF2FS_filter_reset(&dir->filter, false);
+#endif
 
     // cal old space in the dir
     err = NF2FS_dtraverse_ospace(NF2FS, dir, tail, cache);
     if (err)
         goto cleanup;
 
+    // the reclaimer finds old space of the dir in tree after it's closed
+    err= NF2FS_tree_entry_ospace(NF2FS->ram_tree, id, dir->old_space);
+    if (err)
+        goto cleanup;
+
+    // sectors of the dir are kept in tree after it's counted once
+    NF2FS_size_t index= NF2FS_NULL;
+    dir->sectors= NF2FS_NULL;
+    if (!NF2FS_tree_entry_id_find(NF2FS->ram_tree, id, &index))
+        dir->sectors= NF2FS->ram_tree->sectors[index];
+
+    // a closed dir is as old as the mount
+    dir->stamp= 0;
+    dir->busy= false;
+
+    // batches in the tail sector should be sealed without corrupt
+    err = NF2FS_seal_check(NF2FS, dir->tail_sector, NF2FS_dir_begin(NF2FS), dir->tail_off);
+    if (err)
+        goto cleanup;
+
     // Add dir to dir list.
     dir->next_dir = NF2FS->dir_list;
     NF2FS->dir_list = dir;
@@ -1082,6 +2500,8 @@ int NF2FS_create_dir(NF2FS_t* NF2FS, NF2FS_dir_ram_t* father_dir, NF2FS_dir_ram_
                               dir->id, father_dir->id, &dir->tail_sector, NULL);
     if (err)
         goto cleanup;
+    dir->oldest_sector= dir->tail_sector;
+    dir->sectors= 1;
 
     // Allocate memory for in-flash dir name structure.
     size = sizeof(NF2FS_dir_name_flash_t) + namelen;
@@ -1111,12 +2531,18 @@ int NF2FS_create_dir(NF2FS_t* NF2FS, NF2FS_dir_ram_t* father_dir, NF2FS_dir_ram_
     dir->pos_sector = NF2FS_NULL;
     dir->pos_off = NF2FS_NULL;
     dir->pos_presector= NF2FS_NULL;
+    dir->cursor= NULL;
 
     dir->name_sector = father_dir->tail_sector;
-    dir->name_off= father_dir->tail_off - size;
+    dir->name_off= father_dir->prog_off;
     dir->namelen= namelen;
-
-    dir->tail_off= sizeof(NF2FS_dir_sector_flash_t);
+#if NF2FS_DIR_FILTER_BITS > 0
+    NF2FS_filter_add(&father_dir->filter, NF2FS_name_hash(name, namelen));
+    NF2FS_filter_reset(&dir->filter, true);
+#endif
+    NF2FS_dir_tail_init(NF2FS, dir);
+    dir->stamp= NF2FS->dir_clock;
+    dir->busy= false;
 
     // Add dir to dir list.
     dir->next_dir = NF2FS->dir_list;
@@ -11,19 +11,63 @@ extern "C" {
 #endif
 
 // Free specific dir in dir list.
-int NF2FS_dir_free(NF2FS_dir_ram_t* list, NF2FS_dir_ram_t* dir);
+int NF2FS_dir_free(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
 
-// Find the needed name address in the dir.
-int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name, NF2FS_size_t namelen, int file_type, NF2FS_tree_entry_ram_t* entry);
+// The 16 bits hash of name, it's kept in name footers and used by the name filter.
+uint16_t NF2FS_name_hash(char* name, NF2FS_size_t namelen);
 
-// find file's data or index in the dir
-int NF2FS_dtraverse_data(NF2FS_t* NF2FS, NF2FS_file_ram_t* file);
+#if NF2FS_DIR_FILTER_BITS > 0
+// Reset the name filter, it's valid for a dir without names.
+void NF2FS_filter_reset(NF2FS_name_filter_ram_t* filter, bool valid);
+
+// Add a name to the name filter by its name hash.
+void NF2FS_filter_add(NF2FS_name_filter_ram_t* filter, uint16_t name_hash);
+
+// Whether or not the name with the name hash may be in the name filter.
+bool NF2FS_filter_test(NF2FS_name_filter_ram_t* filter, uint16_t name_hash);
+#endif
+
+// Find the needed name address in the dir, names passed by are added to filter if it's not NULL.
+int NF2FS_dtraverse_name(NF2FS_t* NF2FS, NF2FS_size_t begin_sector, char* name, NF2FS_size_t namelen, int file_type, NF2FS_tree_entry_ram_t* entry,
+                         NF2FS_name_filter_ram_t* filter);
+
+// Find the name in an opened dir, it's not traversed if the name filter tells the name is not there.
+int NF2FS_dir_name_find(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, char* name, NF2FS_size_t namelen,
+                        int file_type, NF2FS_tree_entry_ram_t* entry);
+
+// Where records of a dir sector begin, the data offset is behind sector head with dual_end.
+NF2FS_off_t NF2FS_dir_begin(NF2FS_t* NF2FS);
+
+// The older sector of a dir sector, NF2FS_NULL if older ones are compacted.
+NF2FS_size_t NF2FS_dir_pre(NF2FS_dir_sector_flash_t* shead);
+
+// Link the newer sector of a dir sector, next_sector is the last word of sector head.
+int NF2FS_dir_link_next(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_size_t next);
+
+// Init the tail message of dir when it gets a new tail sector.
+void NF2FS_dir_tail_init(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
+
+// find file's data or index in the dir, traverse from (begin_sector, begin_off) to older sectors
+// with dual_end, begin_off is 0 and only data of sectors is traversed.
+int NF2FS_dtraverse_data(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_file_ram_t* file,
+                         NF2FS_size_t begin_sector, NF2FS_off_t begin_off);
+
+// Get the next entry of dir with the cursor of readdir-plus, the cursor is freed at the end.
+int NF2FS_dcursor_next(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_dentry_ram_t* dentry);
+
+// Free the cursor of readdir-plus.
+void NF2FS_dcursor_free(NF2FS_dir_ram_t* dir);
+
+// clear bits of ids beginning at first that are named in the dir or its sub dirs, tail is the dir tail
+int NF2FS_dtraverse_ids(NF2FS_t* NF2FS, NF2FS_size_t tail, NF2FS_size_t first, uint32_t* bits);
 
 // delete all big files in current dir
 int NF2FS_dtraverse_bfile_delete(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
 
-// GC while traversing the dir
-int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
+// GC while traversing the dir from begin_sector to its oldest sector, moved is the size of
+// records moved to tail. A new tail sector is used if begin_sector is the tail.
+int NF2FS_dtraverse_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t begin_sector,
+                       NF2FS_size_t* moved);
 
 // prog node to the dir
 int NF2FS_dir_prog(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, void* buffer, NF2FS_size_t len);
@@ -34,6 +78,9 @@ int NF2FS_dir_old(NF2FS_t* NF2FS, NF2FS_size_t tail);
 // Update dir entry from its father dir.
 int NF2FS_dir_update(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
 
+// rename an opened dir, it's moved from father to new_father if they are different
+int NF2FS_dir_move(NF2FS_t* NF2FS, NF2FS_dir_ram_t* father, NF2FS_dir_ram_t* new_father, NF2FS_dir_ram_t* dir, char* name, NF2FS_size_t namelen);
+
 // open dir
 int NF2FS_dir_lowopen(NF2FS_t* NF2FS, NF2FS_size_t tail, NF2FS_size_t id, NF2FS_size_t father_id, NF2FS_size_t name_sector, NF2FS_size_t name_off,
                      NF2FS_dir_ram_t** dir_addr, NF2FS_cache_ram_t* cache);
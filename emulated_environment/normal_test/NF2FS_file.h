@@ -16,24 +16,51 @@ int NF2FS_file_free(NF2FS_file_ram_t** list, NF2FS_file_ram_t* file);
 // prog function for big file data
 int NF2FS_bfile_prog(NF2FS_t* NF2FS, NF2FS_size_t* sector, NF2FS_off_t* off, const void* buffer, NF2FS_size_t len);
 
+// The sector type to allocate for big file data, hot files have their own region.
+int NF2FS_bfile_sector_type(NF2FS_t* NF2FS, NF2FS_file_ram_t* file);
+
+// The sector type to allocate for a new tail of dir, hot dirs have their own region.
+int NF2FS_dir_sector_type(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
+
+// random writes of file id since mount, or rewritten records of files in dir id
+NF2FS_size_t NF2FS_file_heat(NF2FS_t* NF2FS, NF2FS_size_t id);
+
+// count times rewrites of id
+void NF2FS_file_heat_add(NF2FS_t* NF2FS, NF2FS_size_t id, NF2FS_size_t times);
+
+// forget the count of a deleted file id, the id could be reused
+void NF2FS_file_heat_drop(NF2FS_t* NF2FS, NF2FS_size_t id);
+
 // GC for parts of a very big file
 int NF2FS_bfile_part_gc(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_size_t start, NF2FS_size_t end, NF2FS_size_t len, NF2FS_size_t index_num, NF2FS_size_t sector_num);
 
 // open file with file id.
 int NF2FS_file_lowopen(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t id, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t namelen, NF2FS_file_ram_t** file_addr);
 
+// find the data or index record of a closed file in dir without a file cache, file->id is needed
+int NF2FS_file_record_find(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t tail, NF2FS_file_ram_t* file, NF2FS_size_t sector, NF2FS_off_t off);
+
+// get size of a file that is not opened, dir is NULL if it's not opened.
+int NF2FS_file_size(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_size_t tail, NF2FS_size_t id, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t* size);
+
 // Flush data in file cache to corresponding dir.
 int NF2FS_file_flush(NF2FS_t* NF2FS, NF2FS_file_ram_t* file);
 
 // create a new file
 int NF2FS_create_file(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir, NF2FS_file_ram_t** file_addr, char* name, NF2FS_size_t namelen);
 
+// rename an opened file, it's moved from father to new_father if they are different
+int NF2FS_file_move(NF2FS_t* NF2FS, NF2FS_dir_ram_t* father, NF2FS_dir_ram_t* new_father, NF2FS_file_ram_t* file, char* name, NF2FS_size_t namelen);
+
 // read data of small file
 int NF2FS_small_file_read(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer, NF2FS_size_t size);
 
 // read data of big file
 int NF2FS_big_file_read(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer, NF2FS_size_t size);
 
+// map data of big file to extents of memory mapped flash, return the number of extents
+int NF2FS_big_file_mmap(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_off_t off, NF2FS_size_t size, NF2FS_mmap_extent_t* extents, NF2FS_size_t num);
+
 // write data to small file
 int NF2FS_small_file_write(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, const void* buffer, NF2FS_size_t size);
 
@@ -46,6 +73,9 @@ void NF2FS_index_jump(NF2FS_t* NF2FS, NF2FS_bfile_index_ram_t* index, NF2FS_size
 // write data to big file
 int NF2FS_big_file_write(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, void* buffer, NF2FS_size_t size);
 
+// truncate big file to a smaller size, it's changed to small file under the threshold
+int NF2FS_big_file_truncate(NF2FS_t* NF2FS, NF2FS_file_ram_t* file, NF2FS_size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -45,10 +45,13 @@ void NF2FS_region_map_assign(NF2FS_t* NF2FS, NF2FS_region_map_ram_t* ram_region,
 // flush region map to NOR flash.
 int NF2FS_region_map_flush(NF2FS_t* NF2FS, NF2FS_region_map_ram_t* region_map);
 
-// alloc a new region to dir or file
-int NF2FS_region_alloc(NF2FS_t* NF2FS, NF2FS_region_map_ram_t* ram_region, NF2FS_region_map_flash_t* flash_region, NF2FS_size_t sector, NF2FS_size_t free_off);
+// Record the change of region map, a new map is never turned back to an in-place change.
+void NF2FS_region_map_changed(NF2FS_region_map_ram_t* region_map, uint32_t change_flag);
 
-// remove a region from origin region type, may be the region_change or no need in the future
+// alloc a new region with num sequential free sectors to dir or file, when its regions are used up
+int NF2FS_region_alloc(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int type, NF2FS_size_t num, NF2FS_size_t* region);
+
+// remove a region from origin region type
 int NF2FS_remove_region(NF2FS_t* NF2FS, NF2FS_region_map_ram_t* region_map, int type, NF2FS_size_t region);
 
 /**
@@ -63,6 +66,65 @@ int NF2FS_map_flush(NF2FS_t* NF2FS, NF2FS_map_ram_t* map, NF2FS_size_t buffer_le
 // the in-ram map change function, change to the next region.
 int NF2FS_ram_map_change(NF2FS_t* NF2FS, NF2FS_size_t region, NF2FS_size_t bits_in_buffer, NF2FS_map_ram_t* map, NF2FS_size_t map_begin, NF2FS_size_t map_off);
 
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * -----------------------------------------------------------    Free run operations    ---------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Set free runs of all regions to run.
+void NF2FS_region_run_reset(NF2FS_flash_manage_ram_t* manager, uint16_t run);
+
+// Record the longest free run of the region buffered in sector map.
+void NF2FS_region_run_update(NF2FS_flash_manage_ram_t* manager, NF2FS_map_ram_t* map);
+
+// Whether or not num sequential free sectors may be found in the region.
+bool NF2FS_region_run_fit(NF2FS_flash_manage_ram_t* manager, NF2FS_size_t region, NF2FS_size_t num);
+
+// Recalculate free runs with bits [bit, bit + bits) of the whole free map in data.
+void NF2FS_region_run_scan(NF2FS_flash_manage_ram_t* manager, const uint32_t* data,
+                           NF2FS_size_t bit, NF2FS_size_t bits, NF2FS_size_t* run);
+
+// The length of commit message, free runs of regions are behind it if they fit in a cache.
+NF2FS_size_t NF2FS_commit_len(NF2FS_t* NF2FS);
+
+// Record free runs of regions behind the commit message.
+void NF2FS_region_run_commit(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit);
+
+// Assign free runs of regions with commit message, runs not recorded are unknown.
+void NF2FS_region_run_assign(NF2FS_t* NF2FS, NF2FS_commit_flash_t* commit);
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ----------------------------------------------------------    Erase times operations    -------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Set erase times of all regions to etimes, NF2FS_NULL means unknown.
+void NF2FS_region_etimes_reset(NF2FS_flash_manage_ram_t* manager, NF2FS_size_t etimes);
+
+// Whether or not erase times of all regions are known.
+bool NF2FS_region_etimes_known(NF2FS_flash_manage_ram_t* manager);
+
+// Count an erase of the physical sector.
+void NF2FS_region_etimes_add(NF2FS_t* NF2FS, NF2FS_size_t sector);
+
+// Get erase times of all regions with sector heads, used when they are not recorded.
+int NF2FS_region_etimes_scan(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager);
+
+// The length of the record with erase times of regions from begin, it's less than a cache.
+NF2FS_size_t NF2FS_region_etimes_len(NF2FS_t* NF2FS, NF2FS_size_t begin);
+
+// Fill the record with erase times of regions from begin, return the length of it.
+NF2FS_size_t NF2FS_region_etimes_record(NF2FS_t* NF2FS, NF2FS_region_etimes_flash_t* record,
+                                        NF2FS_size_t begin);
+
+// Prog erase times of regions to superblock.
+int NF2FS_region_etimes_flush(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager);
+
+// Assign erase times of regions with a record in superblock.
+void NF2FS_region_etimes_assign(NF2FS_t* NF2FS, NF2FS_region_etimes_flash_t* record);
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * ----------------------------------------------------------    Sector map operations    --------------------------------------------------------
@@ -79,8 +141,20 @@ int NF2FS_smap_assign(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_m
 // should only used in unmount or change the in-NOR map
 int NF2FS_smap_flush(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager);
 
-// Find next region of sector map to scan.
-int NF2FS_sector_nextsmap(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int type);
+// Reload buffered sector maps after in-flash maps are merged.
+int NF2FS_smap_reload(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager);
+
+// Return the correct map according to the sector map type
+NF2FS_map_ram_t* NF2FS_smap_get(NF2FS_flash_manage_ram_t* manager, int smap_type);
+
+// Whether or not the region is buffered by a sector map other than map.
+bool NF2FS_smap_buffered(NF2FS_flash_manage_ram_t* manager, NF2FS_map_ram_t* map, NF2FS_size_t region);
+
+// Find next region of sector map to scan, the region may have num sequential free sectors.
+int NF2FS_sector_nextsmap(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int type, NF2FS_size_t num);
+
+// Allocate sequential sectors that cross regions.
+int NF2FS_sectors_find_span(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t num, int type, NF2FS_size_t* begin);
 
 // Allocate sequential sectors.
 int NF2FS_sectors_find(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t num, int type, NF2FS_size_t* begin);
@@ -98,6 +172,20 @@ int NF2FS_sector_alloc(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int se
 // Set sectors in erase map to 0 so they can reuse in the future.
 int NF2FS_emap_set(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t begin, NF2FS_size_t num);
 
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ---------------------------------------------------------    Pre-erase operations    ---------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Pre-erase sectors with bit_val in map until the pool has target sectors.
+int NF2FS_preerase_map(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_map_ram_t* map,
+                       NF2FS_preerase_ram_t* pool, NF2FS_size_t begin, bool bit_val,
+                       NF2FS_size_t target, NF2FS_size_t* budget);
+
+// Pre-erase old sectors in dir, big file and erase map, return the number of erased sectors.
+int NF2FS_preerase(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t max_ops);
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * ------------------------------------------------------------    ID map operations    ----------------------------------------------------------
@@ -113,7 +201,16 @@ int NF2FS_idmap_init(NF2FS_t* NF2FS, NF2FS_idmap_ram_t** map_addr);
 // Assign basic id map message with id addr data.
 int NF2FS_idmap_assign(NF2FS_t* NF2FS, NF2FS_idmap_ram_t* id_map, NF2FS_mapaddr_flash_t* map_addr);
 
-// Alloc an id, should flush to NOR flash immediately for consistency, maybe a new function
+// prog a lease record of ids beginning at first to superblock
+int NF2FS_id_lease_record(NF2FS_t* NF2FS, NF2FS_size_t first, uint32_t bits);
+
+// drop ids from the lease that are free or removed in flash
+int NF2FS_id_lease_check(NF2FS_t* NF2FS, NF2FS_idmap_ram_t* idmap);
+
+// Give back leased ids to the remove map and close the lease record.
+int NF2FS_idmap_sync(NF2FS_t* NF2FS, NF2FS_idmap_ram_t* idmap);
+
+// Alloc an id, ids are leased from flash a word at a time for consistency
 int NF2FS_id_alloc(NF2FS_t* NF2FS, NF2FS_size_t* id);
 
 // Free an id, should flush to NOR flash immediately for consistency
@@ -128,6 +225,32 @@ int NF2FS_id_free(NF2FS_t* NF2FS, NF2FS_idmap_ram_t* idmap, NF2FS_size_t id);
 // init the wl module
 int NF2FS_wl_init(NF2FS_t* NF2FS, NF2FS_wl_ram_t** wl_addr);
 
+// free the wl module
+void NF2FS_wl_free(NF2FS_wl_ram_t* wl);
+
+// Change to a new wl sector, the newest wl message is proged to it first
+int NF2FS_wl_sector_change(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager);
+
+// Append a record to wl sector, change to a new wl sector if it's full
+int NF2FS_wl_prog(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, void* buffer, NF2FS_size_t len);
+
+// Load candidate regions and physical regions from wl sector when mounting
+int NF2FS_wl_load(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager);
+
+// Sort the wl regions with etimes, plan migration and choose new candidate regions
+int NF2FS_wl_region_sort(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager);
+
+// Change the sector map to a candidate region, found is false if no candidate fits
+int NF2FS_wl_nextsmap(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, int smap_type,
+                      NF2FS_size_t num, bool* found);
+
+// Migrate regions in plan, at most max_sectors sectors are copied, moved is the number copied
+int NF2FS_wl_step(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t max_sectors,
+                  NF2FS_size_t* moved);
+
+// do a step of migration for an alloc, it is deferred if the alloc erased sectors
+int NF2FS_wl_pace(NF2FS_t* NF2FS, NF2FS_flash_manage_ram_t* manager, NF2FS_size_t erased);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,7 @@
 #include "NF2FS_manage.h"
 #include "NF2FS_dir.h"
 #include "NF2FS_file.h"
+#include "NF2FS_bitmap.h"
 
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
@@ -101,6 +102,697 @@ void NF2FS_cache_drop(NF2FS_t *NF2FS, NF2FS_cache_ram_t *cache)
     cache->change_flag = false;
 }
 
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * -------------------------------------------------------    Read cache pool functions    -------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Init the read cache pool.
+int NF2FS_rcache_pool_init(NF2FS_t *NF2FS, NF2FS_rcache_pool_ram_t **pool_addr)
+{
+    int err = NF2FS_ERR_OK;
+
+    // Malloc memory for the pool.
+    NF2FS_rcache_pool_ram_t *pool = NF2FS_malloc(sizeof(NF2FS_rcache_pool_ram_t));
+    if (!pool)
+        return NF2FS_ERR_NOMEM;
+
+    pool->slot_num = (NF2FS->cfg->rcache_slots) ? NF2FS->cfg->rcache_slots : NF2FS_RCACHE_SLOT_NUM;
+    pool->pin_num = 0;
+    pool->hand = 0;
+    NF2FS_ASSERT(pool->slot_num >= 2);
+    pool->slots = NF2FS_malloc(pool->slot_num * sizeof(NF2FS_rcache_slot_ram_t));
+    if (!pool->slots) {
+        err = NF2FS_ERR_NOMEM;
+        goto cleanup;
+    }
+
+    // Malloc memory for buffers of slots.
+    memset(pool->slots, 0, pool->slot_num * sizeof(NF2FS_rcache_slot_ram_t));
+    for (int i = 0; i < pool->slot_num; i++) {
+        pool->slots[i].cache.buffer = NF2FS_malloc(NF2FS->cfg->cache_size);
+        if (!pool->slots[i].cache.buffer) {
+            err = NF2FS_ERR_NOMEM;
+            goto cleanup;
+        }
+        NF2FS_cache_one(NF2FS, &pool->slots[i].cache);
+    }
+
+    *pool_addr = pool;
+    return err;
+
+cleanup:
+    NF2FS_rcache_pool_free(pool);
+    return err;
+}
+
+// Free the read cache pool.
+void NF2FS_rcache_pool_free(NF2FS_rcache_pool_ram_t *pool)
+{
+    if (!pool)
+        return;
+
+    if (pool->slots) {
+        for (int i = 0; i < pool->slot_num; i++) {
+            if (pool->slots[i].cache.buffer)
+                NF2FS_free(pool->slots[i].cache.buffer);
+        }
+        NF2FS_free(pool->slots);
+    }
+    NF2FS_free(pool);
+}
+
+// choose a slot to be evicted with CLOCK, pinned and held slots are skipped
+static NF2FS_rcache_slot_ram_t *NF2FS_rcache_victim(NF2FS_rcache_pool_ram_t *pool)
+{
+    NF2FS_rcache_slot_ram_t *slot = NULL;
+
+    // Loop at most two rounds, the first round clears reference bits.
+    for (int i = 0; i < 2 * pool->slot_num; i++) {
+        slot = &pool->slots[pool->hand];
+        pool->hand = (pool->hand + 1) % pool->slot_num;
+        if (slot->pin || slot->holds)
+            continue;
+
+        if (slot->ref) {
+            slot->ref = false;
+            continue;
+        }
+        return slot;
+    }
+
+    // other slots are held by traversals, a pinned tail is read again next time
+    for (int i = 0; i < pool->slot_num; i++) {
+        slot = &pool->slots[i];
+        if (slot->holds)
+            continue;
+
+        if (slot->pin) {
+            slot->pin = false;
+            pool->pin_num--;
+        }
+        return slot;
+    }
+    return NULL;
+}
+
+// find a slot that already has data of (sector, off, size)
+NF2FS_cache_ram_t *NF2FS_rcache_lookup(NF2FS_t *NF2FS, NF2FS_size_t sector,
+                                      NF2FS_off_t off, NF2FS_size_t size)
+{
+    NF2FS_rcache_pool_ram_t *pool = NF2FS->rcache_pool;
+    for (int i = 0; i < pool->slot_num; i++) {
+        NF2FS_cache_ram_t *cache = &pool->slots[i].cache;
+        if (cache->sector == sector && off >= cache->off &&
+            off + size <= cache->off + cache->size) {
+            pool->slots[i].ref = true;
+            return cache;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get a slot that has data of (sector, off, size), the data begins at buffer + off - cache->off.
+ *
+ * If a slot already covers the data, it's used as it is instead of reading flash again.
+ * Otherwise a victim slot is chosen by CLOCK.
+ */
+int NF2FS_rcache_fetch(NF2FS_t *NF2FS, NF2FS_cache_ram_t **cache_addr, NF2FS_size_t sector,
+                      NF2FS_off_t off, NF2FS_size_t size, bool if_pin)
+{
+    int err = NF2FS_ERR_OK;
+    NF2FS_rcache_pool_ram_t *pool = NF2FS->rcache_pool;
+    NF2FS_rcache_slot_ram_t *slot = NULL;
+
+    NF2FS_ASSERT(size <= NF2FS->cfg->cache_size);
+    NF2FS_cache_ram_t *cache = NF2FS_rcache_lookup(NF2FS, sector, off, size);
+    if (cache) {
+        // cache hit, data stays where it is
+        slot = (NF2FS_rcache_slot_ram_t *)cache;
+    } else {
+        // cache miss, read data to the victim slot
+        slot = NF2FS_rcache_victim(pool);
+        if (!slot)
+            return NF2FS_ERR_NOMEM;
+        cache = &slot->cache;
+        err = NF2FS_read_to_cache(NF2FS, cache, sector, off, size);
+        if (err) {
+            NF2FS_cache_drop(NF2FS, cache);
+            return err;
+        }
+        slot->ref = true;
+    }
+
+    // pin the slot, make sure that at least two slots can be evicted
+    if (if_pin && !slot->pin && pool->pin_num + 2 < pool->slot_num) {
+        slot->pin = true;
+        pool->pin_num++;
+    }
+
+    *cache_addr = cache;
+    return err;
+}
+
+/**
+ * Fetch like NF2FS_rcache_fetch, and hold the slot until it's released.
+ *
+ * Traversals keep pointers to the buffer while they call functions that read
+ * other data, the slot held is never evicted. The slot held in *cache_addr
+ * before is released first, so a traversal holds one slot at a time.
+ */
+int NF2FS_rcache_fetch_hold(NF2FS_t *NF2FS, NF2FS_cache_ram_t **cache_addr, NF2FS_size_t sector,
+                           NF2FS_off_t off, NF2FS_size_t size, bool if_pin)
+{
+    NF2FS_rcache_release(NF2FS, *cache_addr);
+    *cache_addr = NULL;
+
+    int err = NF2FS_rcache_fetch(NF2FS, cache_addr, sector, off, size, if_pin);
+    if (err)
+        return err;
+    ((NF2FS_rcache_slot_ram_t *)*cache_addr)->holds++;
+    return err;
+}
+
+// release a slot held by NF2FS_rcache_fetch_hold, cache could be NULL
+void NF2FS_rcache_release(NF2FS_t *NF2FS, NF2FS_cache_ram_t *cache)
+{
+    if (!cache)
+        return;
+
+    NF2FS_rcache_slot_ram_t *slot = (NF2FS_rcache_slot_ram_t *)cache;
+    NF2FS_ASSERT(slot->holds > 0);
+    slot->holds--;
+}
+
+// unpin slots that cache the sector
+void NF2FS_rcache_unpin(NF2FS_t *NF2FS, NF2FS_size_t sector)
+{
+    NF2FS_rcache_pool_ram_t *pool = NF2FS->rcache_pool;
+    for (int i = 0; i < pool->slot_num; i++) {
+        if (pool->slots[i].pin && pool->slots[i].cache.sector == sector) {
+            pool->slots[i].pin = false;
+            pool->pin_num--;
+        }
+    }
+}
+
+// sync proged data to all read caches
+void NF2FS_rcache_sync(NF2FS_t *NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size,
+                      void *buffer, int dp_type, bool if_written_flag)
+{
+    NF2FS_dprog_cache_sync(NF2FS, NF2FS->rcache, sector, off, size, buffer,
+                          dp_type, if_written_flag);
+
+    NF2FS_rcache_pool_ram_t *pool = NF2FS->rcache_pool;
+    for (int i = 0; i < pool->slot_num; i++) {
+        NF2FS_dprog_cache_sync(NF2FS, &pool->slots[i].cache, sector, off, size, buffer,
+                              dp_type, if_written_flag);
+    }
+}
+
+// drop all read caches of an erased sector
+void NF2FS_rcache_invalidate(NF2FS_t *NF2FS, NF2FS_size_t sector)
+{
+    if (NF2FS->rcache->sector == sector)
+        NF2FS_cache_drop(NF2FS, NF2FS->rcache);
+
+    NF2FS_rcache_unpin(NF2FS, sector);
+    NF2FS_rcache_pool_ram_t *pool = NF2FS->rcache_pool;
+    for (int i = 0; i < pool->slot_num; i++) {
+        if (pool->slots[i].cache.sector == sector) {
+            NF2FS_cache_drop(NF2FS, &pool->slots[i].cache);
+            pool->slots[i].ref = false;
+        }
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * -------------------------------------------------------    Prog cache pool functions    -------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Init the pool of parked prog caches.
+int NF2FS_pcache_pool_init(NF2FS_t *NF2FS, NF2FS_pcache_pool_ram_t **pool_addr)
+{
+    int err = NF2FS_ERR_OK;
+
+    // Malloc memory for the pool.
+    NF2FS_pcache_pool_ram_t *pool = NF2FS_malloc(sizeof(NF2FS_pcache_pool_ram_t));
+    if (!pool)
+        return NF2FS_ERR_NOMEM;
+    memset(pool, 0, sizeof(NF2FS_pcache_pool_ram_t));
+
+    // Init all parked caches.
+    for (int i = 0; i < NF2FS_PCACHE_POOL_NUM; i++) {
+        err = NF2FS_cache_init(NF2FS, &pool->caches[i], NF2FS->cfg->cache_size);
+        if (err)
+            goto cleanup;
+    }
+
+    *pool_addr = pool;
+    return err;
+
+cleanup:
+    NF2FS_pcache_pool_free(pool);
+    return err;
+}
+
+// Free the pool of parked prog caches.
+void NF2FS_pcache_pool_free(NF2FS_pcache_pool_ram_t *pool)
+{
+    if (!pool)
+        return;
+
+    for (int i = 0; i < NF2FS_PCACHE_POOL_NUM; i++) {
+        if (pool->caches[i]) {
+            NF2FS_free(pool->caches[i]->buffer);
+            NF2FS_free(pool->caches[i]);
+        }
+    }
+    NF2FS_free(pool);
+}
+
+// find the prog cache that has unflushed data of the sector
+NF2FS_cache_ram_t *NF2FS_pcache_find(NF2FS_t *NF2FS, NF2FS_size_t sector)
+{
+    if (NF2FS->pcache->sector == sector)
+        return NF2FS->pcache;
+
+    for (int i = 0; i < NF2FS_PCACHE_POOL_NUM; i++) {
+        if (NF2FS->pcache_pool->caches[i]->sector == sector)
+            return NF2FS->pcache_pool->caches[i];
+    }
+    return NULL;
+}
+
+/**
+ * Park the pcache and switch to the prog cache that can append (sector, off, size).
+ *
+ * If no parked cache matches, an empty one is used, or the victim is flushed.
+ * A sector only has one prog cache at a time, so a parked cache of the sector
+ * that can't be appended is flushed first.
+ */
+int NF2FS_pcache_switch(NF2FS_t *NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size)
+{
+    int err = NF2FS_ERR_OK;
+    NF2FS_pcache_pool_ram_t *pool = NF2FS->pcache_pool;
+    NF2FS_cache_ram_t *cache = NULL;
+    NF2FS_size_t index = NF2FS_NULL;
+
+    // the current pcache of the sector can not be appended
+    if (NF2FS->pcache->sector == sector) {
+        err = NF2FS_cache_flush(NF2FS, NF2FS->pcache);
+        if (err)
+            return err;
+        NF2FS_cache_one(NF2FS, NF2FS->pcache);
+    }
+
+    // find the parked cache of the sector
+    for (int i = 0; i < NF2FS_PCACHE_POOL_NUM; i++) {
+        cache = pool->caches[i];
+        if (cache->sector != sector)
+            continue;
+
+        if (off == cache->off + cache->size &&
+            off + size < cache->off + NF2FS->cfg->cache_size) {
+            index = i;
+        } else {
+            err = NF2FS_cache_flush(NF2FS, cache);
+            if (err)
+                return err;
+            NF2FS_cache_one(NF2FS, cache);
+        }
+    }
+
+    // choose an empty cache, or flush the victim one
+    for (int i = 0; i < NF2FS_PCACHE_POOL_NUM && index == NF2FS_NULL; i++) {
+        if (pool->caches[i]->sector == NF2FS_NULL)
+            index = i;
+    }
+    if (index == NF2FS_NULL) {
+        index = pool->victim;
+        pool->victim = (pool->victim + 1) % NF2FS_PCACHE_POOL_NUM;
+        err = NF2FS_cache_flush(NF2FS, pool->caches[index]);
+        if (err)
+            return err;
+        NF2FS_cache_one(NF2FS, pool->caches[index]);
+    }
+
+    // pcache without unflushed data is no need to park
+    if (!NF2FS->pcache->change_flag)
+        NF2FS_cache_one(NF2FS, NF2FS->pcache);
+
+    // swap the pcache and the chosen cache
+    cache = pool->caches[index];
+    pool->caches[index] = NF2FS->pcache;
+    NF2FS->pcache = cache;
+    return err;
+}
+
+// flush the pcache and all parked prog caches
+int NF2FS_pcache_flush_all(NF2FS_t *NF2FS)
+{
+    int err = NF2FS_ERR_OK;
+
+    for (int i = 0; i < NF2FS_PCACHE_POOL_NUM; i++) {
+        err = NF2FS_cache_flush(NF2FS, NF2FS->pcache_pool->caches[i]);
+        if (err)
+            return err;
+        NF2FS_cache_one(NF2FS, NF2FS->pcache_pool->caches[i]);
+    }
+
+    err = NF2FS_cache_flush(NF2FS, NF2FS->pcache);
+    return err;
+}
+
+// sync proged data to all prog caches
+void NF2FS_pcache_sync(NF2FS_t *NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size,
+                      void *buffer, int dp_type)
+{
+    NF2FS_dprog_cache_sync(NF2FS, NF2FS->pcache, sector, off, size, buffer, dp_type, false);
+    for (int i = 0; i < NF2FS_PCACHE_POOL_NUM; i++) {
+        NF2FS_dprog_cache_sync(NF2FS, NF2FS->pcache_pool->caches[i], sector, off, size,
+                              buffer, dp_type, false);
+    }
+}
+
+// flush the pcache and parked prog caches that have unproged data in (sector, off, size)
+int NF2FS_pcache_flush_range(NF2FS_t *NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_cache_ram_t* pcache= NF2FS->pcache;
+    if (pcache->change_flag && pcache->sector == sector && off < pcache->off + pcache->size &&
+        off + size > pcache->off) {
+        err= NF2FS_cache_flush(NF2FS, pcache);
+        if (err)
+            return err;
+    }
+
+    for (int i= 0; i < NF2FS_PCACHE_POOL_NUM; i++) {
+        NF2FS_cache_ram_t* cache= NF2FS->pcache_pool->caches[i];
+        if (cache->sector == sector && off < cache->off + cache->size &&
+            off + size > cache->off) {
+            err= NF2FS_cache_flush(NF2FS, cache);
+            if (err)
+                return err;
+            NF2FS_cache_one(NF2FS, cache);
+        }
+    }
+    return err;
+}
+
+// drop all prog caches of an erased sector
+void NF2FS_pcache_invalidate(NF2FS_t *NF2FS, NF2FS_size_t sector)
+{
+    for (int i = 0; i < NF2FS_PCACHE_POOL_NUM; i++) {
+        if (NF2FS->pcache_pool->caches[i]->sector == sector)
+            NF2FS_cache_one(NF2FS, NF2FS->pcache_pool->caches[i]);
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ------------------------------------------------------------    Device functions    ----------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Init the device state, stage is only needed when progs could be async.
+int NF2FS_dev_init(NF2FS_t *NF2FS, NF2FS_dev_ram_t **dev_addr)
+{
+    NF2FS_dev_ram_t *dev = NF2FS_malloc(sizeof(NF2FS_dev_ram_t));
+    if (!dev)
+        return NF2FS_ERR_NOMEM;
+    memset(dev, 0, sizeof(NF2FS_dev_ram_t));
+
+    if (NF2FS->cfg->prog_async && NF2FS->cfg->busy) {
+        dev->stage_size = 2 * NF2FS->cfg->cache_size;
+        dev->stage = NF2FS_malloc(dev->stage_size);
+        if (!dev->stage) {
+            NF2FS_free(dev);
+            return NF2FS_ERR_NOMEM;
+        }
+    }
+
+    *dev_addr = dev;
+    return NF2FS_ERR_OK;
+}
+
+// Free the device state.
+void NF2FS_dev_free(NF2FS_dev_ram_t *dev)
+{
+    if (!dev)
+        return;
+
+    if (dev->stage)
+        NF2FS_free(dev->stage);
+    NF2FS_free(dev);
+}
+
+/**
+ * Check whether the running async operation has finished without blocking.
+ * If so, start the next queued prog.
+ */
+int NF2FS_dev_poll(NF2FS_t *NF2FS)
+{
+    int err = NF2FS_ERR_OK;
+    NF2FS_dev_ram_t *dev = NF2FS->dev;
+
+    if (dev->busy) {
+        err = NF2FS->cfg->busy(NF2FS->cfg);
+        if (err < 0)
+            return err;
+        if (err > 0)
+            return NF2FS_ERR_OK;
+        dev->busy = false;
+    }
+
+    if (dev->next < dev->cnt) {
+        NF2FS_iovec_t *iov = &dev->queue[dev->next++];
+        err = NF2FS->cfg->prog_async(NF2FS->cfg, iov->sector, iov->off, iov->buffer, iov->size);
+        if (err)
+            return err;
+        dev->busy = true;
+        return err;
+    }
+
+    // all progs have finished, stage could be reused
+    dev->next = 0;
+    dev->cnt = 0;
+    dev->used = 0;
+    return NF2FS_ERR_OK;
+}
+
+// Wait until the running async operation and all queued progs finish.
+int NF2FS_dev_wait(NF2FS_t *NF2FS)
+{
+    int err = NF2FS_ERR_OK;
+    NF2FS_dev_ram_t *dev = NF2FS->dev;
+    while (dev->busy || dev->next < dev->cnt) {
+        err = NF2FS_dev_poll(NF2FS);
+        if (err)
+            return err;
+    }
+    return err;
+}
+
+// the physical sector of a sector, regions are migrated only when wl works
+NF2FS_size_t NF2FS_dev_sector(NF2FS_t *NF2FS, NF2FS_size_t sector)
+{
+    NF2FS_flash_manage_ram_t *manager = NF2FS->manager;
+    if (!manager || !manager->wl)
+        return sector;
+
+    // copied sectors of the moving region are in the physical region of reserve region
+    NF2FS_wl_ram_t *wl = manager->wl;
+    NF2FS_size_t region = sector / manager->region_size;
+    NF2FS_size_t off = sector % manager->region_size;
+    if (region == wl->move_region && off < wl->move_sector)
+        region = manager->region_map->reserve;
+    return wl->remap[region] * manager->region_size + off;
+}
+
+// read data from the device, it should be idle first
+int NF2FS_dev_read(NF2FS_t *NF2FS, NF2FS_size_t sector, NF2FS_off_t off, void *buffer, NF2FS_size_t size)
+{
+    int err = NF2FS_dev_wait(NF2FS);
+    if (err)
+        return err;
+
+    sector = NF2FS_dev_sector(NF2FS, sector);
+    return NF2FS->cfg->read(NF2FS->cfg, sector, off, buffer, size);
+}
+
+/**
+ * Prog data to the device.
+ *
+ * With prog_async, data is copied to stage and the prog is queued behind the
+ * running operation, so the caller goes on without waiting. Data larger than
+ * the stage is proged synchronously.
+ */
+int NF2FS_dev_prog(NF2FS_t *NF2FS, NF2FS_size_t sector, NF2FS_off_t off, void *buffer, NF2FS_size_t size)
+{
+    int err = NF2FS_ERR_OK;
+    NF2FS_dev_ram_t *dev = NF2FS->dev;
+
+    sector = NF2FS_dev_sector(NF2FS, sector);
+    if (!dev->stage || size > dev->stage_size) {
+        err = NF2FS_dev_wait(NF2FS);
+        if (err)
+            return err;
+        return NF2FS->cfg->prog(NF2FS->cfg, sector, off, buffer, size);
+    }
+
+    // make room in stage and queue
+    err = NF2FS_dev_poll(NF2FS);
+    if (err)
+        return err;
+    if (dev->used + size > dev->stage_size || dev->cnt == NF2FS_IOV_MAX) {
+        err = NF2FS_dev_wait(NF2FS);
+        if (err)
+            return err;
+    }
+
+    NF2FS_iovec_t *iov = &dev->queue[dev->cnt++];
+    iov->sector = sector;
+    iov->off = off;
+    iov->buffer = dev->stage + dev->used;
+    iov->size = size;
+    memcpy(iov->buffer, buffer, size);
+    dev->used += size;
+
+    // start it at once if the device is idle
+    if (!dev->busy)
+        err = NF2FS_dev_poll(NF2FS);
+    return err;
+}
+
+// Erase a sector, with erase_async the caller does not wait for it.
+int NF2FS_dev_erase(NF2FS_t *NF2FS, NF2FS_size_t sector)
+{
+    int err = NF2FS_dev_wait(NF2FS);
+    if (err)
+        return err;
+
+    sector = NF2FS_dev_sector(NF2FS, sector);
+    NF2FS_region_etimes_add(NF2FS, sector);
+    if (!NF2FS->cfg->erase_async || !NF2FS->cfg->busy)
+        return NF2FS->cfg->erase(NF2FS->cfg, sector);
+
+    err = NF2FS->cfg->erase_async(NF2FS->cfg, sector);
+    if (err)
+        return err;
+    NF2FS->dev->busy = true;
+    return err;
+}
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ---------------------------------------------------------    Vectored io functions    ---------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Init an empty batch of read or prog segments.
+void NF2FS_iobatch_init(NF2FS_iobatch_ram_t *batch, bool is_prog)
+{
+    batch->is_prog= is_prog;
+    batch->cnt= 0;
+}
+
+/**
+ * Send all segments in batch to the device.
+ * Use readv/progv if user provides them, otherwise fall back to read/prog.
+ */
+int NF2FS_iobatch_submit(NF2FS_t *NF2FS, NF2FS_iobatch_ram_t *batch)
+{
+    int err= NF2FS_ERR_OK;
+    if (batch->cnt == 0)
+        return err;
+
+    if (batch->is_prog && NF2FS->dev->stage) {
+        // async progs are queued one by one, nothing to wait for
+        for (int i= 0; i < batch->cnt && !err; i++) {
+            NF2FS_iovec_t* iov= &batch->iov[i];
+            err= NF2FS_dev_prog(NF2FS, iov->sector, iov->off, iov->buffer, iov->size);
+        }
+        batch->cnt= 0;
+        return err;
+    }
+
+    err= NF2FS_dev_wait(NF2FS);
+    if (err)
+        return err;
+
+    // send segments to physical sectors, queued progs above are translated in NF2FS_dev_prog
+    for (int i= 0; i < batch->cnt; i++)
+        batch->iov[i].sector= NF2FS_dev_sector(NF2FS, batch->iov[i].sector);
+
+    if (batch->is_prog && NF2FS->cfg->progv) {
+        err= NF2FS->cfg->progv(NF2FS->cfg, batch->iov, batch->cnt);
+    } else if (!batch->is_prog && NF2FS->cfg->readv) {
+        err= NF2FS->cfg->readv(NF2FS->cfg, batch->iov, batch->cnt);
+    } else {
+        for (int i= 0; i < batch->cnt; i++) {
+            NF2FS_iovec_t* iov= &batch->iov[i];
+            if (batch->is_prog)
+                err= NF2FS->cfg->prog(NF2FS->cfg, iov->sector, iov->off, iov->buffer, iov->size);
+            else
+                err= NF2FS->cfg->read(NF2FS->cfg, iov->sector, iov->off, iov->buffer, iov->size);
+            if (err)
+                break;
+        }
+    }
+
+    batch->cnt= 0;
+    return err;
+}
+
+/**
+ * Add a segment to the batch.
+ *
+ * If it follows the last segment both in flash and in ram, the two are merged.
+ * If the batch is full, it's submitted first. Buffers of segments should stay
+ * unchanged until the batch is submitted.
+ */
+int NF2FS_iobatch_add(NF2FS_t *NF2FS, NF2FS_iobatch_ram_t *batch, NF2FS_size_t sector,
+                      NF2FS_off_t off, void *buffer, NF2FS_size_t size)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_ASSERT(sector < NF2FS->cfg->sector_count && off + size <= NF2FS->cfg->sector_size);
+
+    // reads should see data still parked in prog caches
+    if (!batch->is_prog) {
+        err= NF2FS_pcache_flush_range(NF2FS, sector, off, size);
+        if (err)
+            return err;
+    }
+
+    if (batch->cnt > 0) {
+        NF2FS_iovec_t* last= &batch->iov[batch->cnt - 1];
+        if (last->sector == sector && last->off + last->size == off &&
+            (uint8_t*)last->buffer + last->size == (uint8_t*)buffer) {
+            last->size += size;
+            return err;
+        }
+    }
+
+    if (batch->cnt == NF2FS_IOV_MAX) {
+        err= NF2FS_iobatch_submit(NF2FS, batch);
+        if (err)
+            return err;
+    }
+
+    NF2FS_iovec_t* iov= &batch->iov[batch->cnt];
+    iov->sector= sector;
+    iov->off= off;
+    iov->buffer= buffer;
+    iov->size= size;
+    batch->cnt++;
+    return err;
+}
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * -------------------------------------------------------    Prog/Erase cache functions    ------------------------------------------------------
@@ -118,6 +810,10 @@ int NF2FS_cache_writen_flag(NF2FS_t *NF2FS, NF2FS_size_t off, NF2FS_size_t size,
     uint8_t *data = buffer;
     NF2FS_head_t head;
     NF2FS_size_t len;
+
+    // heads of all records in buffer are proged in one request
+    NF2FS_iobatch_ram_t batch;
+    NF2FS_iobatch_init(&batch, true);
     while (rest_size > 0) {
         head = *(NF2FS_head_t *)data;
         if (rest_size == size && off == 0) {
@@ -128,7 +824,7 @@ int NF2FS_cache_writen_flag(NF2FS_t *NF2FS, NF2FS_size_t off, NF2FS_size_t size,
                 break;
 
             case NF2FS_SECTOR_DIR:
-                len= NF2FS_min(sizeof(NF2FS_dir_sector_flash_t), rest_size);
+                len= NF2FS_min(NF2FS_dir_begin(NF2FS), rest_size);
                 break;
 
             case NF2FS_SECTOR_BFILE:
@@ -141,22 +837,21 @@ int NF2FS_cache_writen_flag(NF2FS_t *NF2FS, NF2FS_size_t off, NF2FS_size_t size,
             }
         } else if (head == NF2FS_NULL || rest_size < sizeof(NF2FS_head_t)) {
             // the data is not entirely in cache
-            return NF2FS_ERR_OK;
+            goto cleanup;
         } else {
             // the right logic
             len = NF2FS_dhead_dsize(head);
             *(NF2FS_head_t *)data &= NF2FS_DHEAD_WRITTEN_SET;
-            head &= NF2FS_DHEAD_WRITTEN_SET;
             if (if_flush) {
                 in_place_write += sizeof(NF2FS_head_t);
-                err= NF2FS->cfg->prog(NF2FS->cfg, flush_sector, off, &head, sizeof(NF2FS_head_t));
+                err= NF2FS_iobatch_add(NF2FS, &batch, flush_sector, off, data, sizeof(NF2FS_head_t));
                 if (err)
                     return err;
             }
 
             // data is not entirely in cache, indicating that the loop is over
             if (rest_size < len)
-                return NF2FS_ERR_OK;
+                goto cleanup;
         }
 
         data += len;
@@ -169,7 +864,9 @@ int NF2FS_cache_writen_flag(NF2FS_t *NF2FS, NF2FS_size_t off, NF2FS_size_t size,
         NF2FS_ERROR("err is in NF2FS_cache_writen_flag\r\n");
         return NF2FS_ERR_WRONGCAL;
     }
-    return NF2FS_ERR_OK;
+
+cleanup:
+    return NF2FS_iobatch_submit(NF2FS, &batch);
 }
 
 /**
@@ -189,18 +886,34 @@ int NF2FS_cache_flush(NF2FS_t *NF2FS, NF2FS_cache_ram_t *pcache)
         return NF2FS_ERR_OK;
     }
 
-    // Program data into nor flash.
     NF2FS_ASSERT(pcache->sector < NF2FS->cfg->sector_count);
-    err = NF2FS->cfg->prog(NF2FS->cfg, pcache->sector,
-                            pcache->off, pcache->buffer, pcache->size);
-    if (err) {
-        return err;
-    }
+    NF2FS_seal_flash_t *seal = (NF2FS_seal_flash_t *)pcache->buffer;
+    if (NF2FS->cfg->crc_seal && pcache->off != 0 &&
+        NF2FS_dhead_type(seal->head) == NF2FS_DATA_SEAL) {
+        // a sealed batch is proged once, written flags are set before
+        err = NF2FS_cache_writen_flag(NF2FS, pcache->off, pcache->size, pcache->buffer, false, NF2FS_NULL);
+        if (err)
+            return err;
+        seal->size = pcache->size - sizeof(NF2FS_seal_flash_t);
+        seal->crc = NF2FS_seal_crc(pcache->buffer + sizeof(NF2FS_seal_flash_t), seal->size);
 
-    // set the written flag in pcache to 0
-    err = NF2FS_cache_writen_flag(NF2FS, pcache->off, pcache->size, pcache->buffer, true, pcache->sector);
-    if (err)
-        return err;
+        err = NF2FS_dev_prog(NF2FS, pcache->sector,
+                             pcache->off, pcache->buffer, pcache->size);
+        if (err)
+            return err;
+    } else {
+        // Program data into nor flash.
+        err = NF2FS_dev_prog(NF2FS, pcache->sector,
+                             pcache->off, pcache->buffer, pcache->size);
+        if (err) {
+            return err;
+        }
+
+        // set the written flag in pcache to 0
+        err = NF2FS_cache_writen_flag(NF2FS, pcache->off, pcache->size, pcache->buffer, true, pcache->sector);
+        if (err)
+            return err;
+    }
 
     // // prog the written flag again
     // err = NF2FS->cfg->prog(NF2FS->cfg, pcache->sector, pcache->off,
@@ -208,9 +921,9 @@ int NF2FS_cache_flush(NF2FS_t *NF2FS, NF2FS_cache_ram_t *pcache)
     // if (err)
     //     return err;
 
-    // sync data in rcache
-    NF2FS_dprog_cache_sync(NF2FS, NF2FS->rcache, pcache->sector, pcache->off, pcache->size,
-                          pcache->buffer, NF2FS_DPROG_CACHE_DATA_PROG, false);
+    // sync data in read caches
+    NF2FS_rcache_sync(NF2FS, pcache->sector, pcache->off, pcache->size,
+                     pcache->buffer, NF2FS_DPROG_CACHE_DATA_PROG, false);
 
     NF2FS_cache_one(NF2FS, pcache);
     pcache->change_flag = false;
@@ -231,6 +944,10 @@ int NF2FS_cache_read(NF2FS_t* NF2FS, const NF2FS_cache_ram_t* pcache, NF2FS_cach
         return NF2FS_ERR_WRONGCAL;
     }
 
+    // unflushed data of the sector may be in a parked prog cache
+    if (!pcache || pcache->sector != sector)
+        pcache = NF2FS_pcache_find(NF2FS, sector);
+
     NF2FS_size_t rest_size = size;
     while (rest_size > 0)
     {
@@ -255,7 +972,7 @@ int NF2FS_cache_read(NF2FS_t* NF2FS, const NF2FS_cache_ram_t* pcache, NF2FS_cach
         }
 
         // Find data in read cache second, similar to above.
-        if (sector == rcache->sector && off < rcache->off + rcache->size) {
+        if (rcache && sector == rcache->sector && off < rcache->off + rcache->size) {
             if (off >= rcache->off){
                 diff = NF2FS_min(diff, rcache->size - (off - rcache->off));
                 memcpy(data, &rcache->buffer[off - rcache->off], diff);
@@ -269,8 +986,20 @@ int NF2FS_cache_read(NF2FS_t* NF2FS, const NF2FS_cache_ram_t* pcache, NF2FS_cach
             diff = NF2FS_min(diff, rcache->off - off);
         }
 
+        // Then find data in the read cache pool.
+        NF2FS_cache_ram_t* slot= NF2FS_rcache_lookup(NF2FS, sector, off, 1);
+        if (slot) {
+            diff = NF2FS_min(diff, slot->size - (off - slot->off));
+            memcpy(data, &slot->buffer[off - slot->off], diff);
+
+            data += diff;
+            off += diff;
+            rest_size -= diff;
+            continue;
+        }
+
         // Read data to buffer directly.
-        int err = NF2FS_direct_read(NF2FS, sector, off, diff, data);
+        err = NF2FS_direct_read(NF2FS, sector, off, diff, data);
         if (err)
         {
             return err;
@@ -306,9 +1035,9 @@ int NF2FS_cache_prog(NF2FS_t* NF2FS, NF2FS_cache_ram_t* pcache, NF2FS_cache_ram_
             NF2FS_size_t diff = NF2FS_min(NF2FS->cfg->cache_size - pcache->size,rest_size);
             memcpy(&pcache->buffer[pcache->size], data, diff);
 
-            // sync pcache data to rcache
-            NF2FS_dprog_cache_sync(NF2FS, NF2FS->rcache, sector, off, diff,
-                                  (uint8_t*)data, NF2FS_DPROG_CACHE_DATA_PROG, true);
+            // sync pcache data to read caches
+            NF2FS_rcache_sync(NF2FS, sector, off, diff, (uint8_t*)data,
+                             NF2FS_DPROG_CACHE_DATA_PROG, true);
                                   
             // update message
             data += diff;
@@ -327,14 +1056,24 @@ int NF2FS_cache_prog(NF2FS_t* NF2FS, NF2FS_cache_ram_t* pcache, NF2FS_cache_ram_
             continue;
         }
 
-        // Make sure pcache is not used by any other sectors when we use it,
-        // i.e we have flushed all data in pcache.
-        if (pcache->sector != NF2FS_NULL) {
+        if (pcache == NF2FS->pcache) {
+            // Park pcache and switch to the prog cache of the sector, so dirs
+            // written in turn do not flush partly filled pages.
+            err = NF2FS_pcache_switch(NF2FS, sector, off, size);
+            if (err) {
+                return err;
+            }
+            pcache = NF2FS->pcache;
+            if (pcache->sector != NF2FS_NULL)
+                continue;
+        } else if (pcache->sector != NF2FS_NULL) {
+            // Make sure pcache is not used by any other sectors when we use it,
+            // i.e we have flushed all data in pcache.
             err = NF2FS_cache_flush(NF2FS, pcache);
             if (err) {
                 return err;
             }
-            NF2FS_cache_one(NF2FS, NF2FS->pcache);
+            NF2FS_cache_one(NF2FS, pcache);
         }
 
         // prepare pcache for the next use.
@@ -355,36 +1094,59 @@ int NF2FS_read_to_cache(NF2FS_t* NF2FS, NF2FS_cache_ram_t* cache, NF2FS_size_t s
 {
     int err = NF2FS_ERR_OK;
 
+    // the pcache or a parked prog cache may have unflushed data of the sector
+    NF2FS_cache_ram_t* pcache= NF2FS_pcache_find(NF2FS, sector);
+
     NF2FS_ASSERT(off + size <= NF2FS->cfg->sector_size);
     if ((cache->sector == sector) && (cache->off == off) && (cache->size == size)) {
         // data are just in the cache
         return err;
-    } else if ((sector == NF2FS->pcache->sector) && (off + size > NF2FS->pcache->off)
-                && (off < NF2FS->pcache->off + NF2FS->pcache->size)) {
+    } else if (pcache && pcache != cache && (off + size > pcache->off)
+                && (off < pcache->off + pcache->size)) {
         // there has some data in pcache and they has not flush to flash
-        if (off == NF2FS->pcache->off) {
+        if (off == pcache->off) {
             // data that need is entirely in pcache
-            memcpy(cache->buffer, NF2FS->pcache->buffer, NF2FS->pcache->size);
-            memset((uint8_t *)cache->buffer + NF2FS->pcache->size, 0xff, NF2FS->cfg->cache_size - NF2FS->pcache->size);
-            err= NF2FS_cache_writen_flag(NF2FS, NF2FS->pcache->off, NF2FS->pcache->size, cache->buffer, false, NF2FS_NULL);
+            memcpy(cache->buffer, pcache->buffer, pcache->size);
+            memset((uint8_t *)cache->buffer + pcache->size, 0xff, NF2FS->cfg->cache_size - pcache->size);
+            err= NF2FS_cache_writen_flag(NF2FS, pcache->off, pcache->size, cache->buffer, false, NF2FS_NULL);
             if (err)
                 return err;
-        } else if (off < NF2FS->pcache->off && NF2FS->pcache->off - off > sizeof(NF2FS_head_t)) {
+
+            // with dual_end, data of dir may be behind the pcache
+            if (NF2FS->cfg->dual_end && size > pcache->size) {
+                err= NF2FS_direct_read(NF2FS, sector, off + pcache->size, size - pcache->size,
+                                      cache->buffer + pcache->size);
+                if (err)
+                    return err;
+            }
+        } else if (off < pcache->off) {
             // still has some data in flash, the front pcache has valid data
-            NF2FS_size_t temp_size= NF2FS->pcache->off - off;
+            NF2FS_size_t temp_size= pcache->off - off;
             err= NF2FS_direct_read(NF2FS, sector, off, temp_size, cache->buffer);
             if (err)
                 return err;
             
             // the other data are in pcache
             NF2FS_ASSERT(size - temp_size > 0);
-            memcpy(cache->buffer + temp_size, NF2FS->pcache->buffer, size - temp_size);
-            err= NF2FS_cache_writen_flag(NF2FS, NF2FS->pcache->off, size - temp_size, cache->buffer + temp_size, false, NF2FS_NULL);
+            NF2FS_size_t copy_cache_size= size - temp_size;
+            if (NF2FS->cfg->dual_end)
+                copy_cache_size= NF2FS_min(copy_cache_size, pcache->size);
+            memcpy(cache->buffer + temp_size, pcache->buffer, copy_cache_size);
+            err= NF2FS_cache_writen_flag(NF2FS, pcache->off, copy_cache_size, cache->buffer + temp_size, false, NF2FS_NULL);
             if (err)
                 return err;
+
+            // with dual_end, data of dir may be behind the pcache
+            if (temp_size + copy_cache_size < size) {
+                err= NF2FS_direct_read(NF2FS, sector, off + temp_size + copy_cache_size,
+                                      size - temp_size - copy_cache_size,
+                                      cache->buffer + temp_size + copy_cache_size);
+                if (err)
+                    return err;
+            }
         } else {
-            NF2FS_size_t temp_size= off - NF2FS->pcache->off;
-            NF2FS_size_t copy_cache_size= NF2FS->pcache->size - temp_size;
+            NF2FS_size_t temp_size= off - pcache->off;
+            NF2FS_size_t copy_cache_size= pcache->size - temp_size;
             if (copy_cache_size < sizeof(NF2FS_head_t)) {
                 // no more valid data in pcache, read directly
                 err= NF2FS_direct_read(NF2FS, sector, off, size, cache->buffer);
@@ -392,12 +1154,17 @@ int NF2FS_read_to_cache(NF2FS_t* NF2FS, NF2FS_cache_ram_t* cache, NF2FS_size_t s
                     return err;
             } else {
                 // all data are part of pcache data, if data is not in pcache, it hasn't been written
-                memcpy(cache->buffer, NF2FS->pcache->buffer + temp_size, copy_cache_size);
+                // the needed data may be shorter than the rest of pcache
+                copy_cache_size= NF2FS_min(copy_cache_size, size);
+                memcpy(cache->buffer, pcache->buffer + temp_size, copy_cache_size);
                 NF2FS_ASSERT(copy_cache_size + off <= NF2FS->cfg->sector_size);
-                err= NF2FS_direct_read(NF2FS, sector, off + copy_cache_size, size - copy_cache_size, cache->buffer + copy_cache_size);
-                if (err)
-                    return err;
-                err= NF2FS_cache_writen_flag(NF2FS, off, NF2FS->pcache->size - off + NF2FS->pcache->off, cache->buffer, false, NF2FS_NULL);
+                if (size > copy_cache_size) {
+                    err= NF2FS_direct_read(NF2FS, sector, off + copy_cache_size, size - copy_cache_size,
+                                          cache->buffer + copy_cache_size);
+                    if (err)
+                        return err;
+                }
+                err= NF2FS_cache_writen_flag(NF2FS, off, copy_cache_size, cache->buffer, false, NF2FS_NULL);
                 if (err)
                     return err;
             }
@@ -429,7 +1196,13 @@ int NF2FS_read_to_cache(NF2FS_t* NF2FS, NF2FS_cache_ram_t* cache, NF2FS_size_t s
 int NF2FS_direct_read(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size, void* buffer)
 {
     int err= NF2FS_ERR_OK;
-    err= NF2FS->cfg->read(NF2FS->cfg, sector, off, buffer, size);
+
+    // data in prog caches has not been proged, flush them first
+    err= NF2FS_pcache_flush_range(NF2FS, sector, off, size);
+    if (err)
+        return err;
+
+    err= NF2FS_dev_read(NF2FS, sector, off, buffer, size);
     return err;
 }
 
@@ -478,11 +1251,11 @@ int NF2FS_head_validate(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_size_t off, N
 {
     int err= NF2FS_ERR_OK;
     in_place_write += sizeof(NF2FS_head_t);
-    err= NF2FS->cfg->prog(NF2FS->cfg, sector, off, &head_flag, sizeof(NF2FS_head_t));
-    NF2FS_dprog_cache_sync(NF2FS, NF2FS->pcache, sector, off, sizeof(NF2FS_head_t),
-                          &head_flag, NF2FS_DPROG_CACHE_HEAD_CHANGE, false);
-    NF2FS_dprog_cache_sync(NF2FS, NF2FS->rcache, sector, off, sizeof(NF2FS_head_t),
-                          &head_flag, NF2FS_DPROG_CACHE_HEAD_CHANGE, false);
+    err= NF2FS_dev_prog(NF2FS, sector, off, &head_flag, sizeof(NF2FS_head_t));
+    NF2FS_pcache_sync(NF2FS, sector, off, sizeof(NF2FS_head_t),
+                     &head_flag, NF2FS_DPROG_CACHE_HEAD_CHANGE);
+    NF2FS_rcache_sync(NF2FS, sector, off, sizeof(NF2FS_head_t),
+                     &head_flag, NF2FS_DPROG_CACHE_HEAD_CHANGE, false);
     return err;
 }
 
@@ -497,28 +1270,219 @@ int NF2FS_direct_prog(NF2FS_t* NF2FS, NF2FS_size_t data_type, NF2FS_size_t secto
     NF2FS_ASSERT(sector < NF2FS->cfg->sector_count && off + size <= NF2FS->cfg->sector_size);
 
     // prog data first
-    err = NF2FS->cfg->prog(NF2FS->cfg, sector, off, data, size);
+    err = NF2FS_dev_prog(NF2FS, sector, off, data, size);
     NF2FS_ASSERT(err <= 0);
     if (err)
     {
         return err;
     }
 
-    // if we prog data, written flag in data head should be validated
-    if (data_type == NF2FS_DIRECT_PROG_DHEAD) {
-        in_place_write += sizeof(NF2FS_head_t);
-        NF2FS_head_t *head = (NF2FS_head_t *)buffer;
-        *head &= NF2FS_DHEAD_WRITTEN_SET;
-        err = NF2FS->cfg->prog(NF2FS->cfg, sector, off, data, size);
-        NF2FS_ASSERT(err <= 0);
+    // if we prog data, written flag in data head should be validated
+    if (data_type == NF2FS_DIRECT_PROG_DHEAD) {
+        in_place_write += sizeof(NF2FS_head_t);
+        NF2FS_head_t *head = (NF2FS_head_t *)buffer;
+        *head &= NF2FS_DHEAD_WRITTEN_SET;
+        err = NF2FS_dev_prog(NF2FS, sector, off, data, size);
+        NF2FS_ASSERT(err <= 0);
+    }
+
+    // prog data shold also sync changed in pcache and read caches
+    NF2FS_pcache_sync(NF2FS, sector, off, size, buffer,
+                     NF2FS_DPROG_CACHE_DATA_PROG);
+    NF2FS_rcache_sync(NF2FS, sector, off, size, buffer,
+                     NF2FS_DPROG_CACHE_DATA_PROG, false);
+
+    return err;
+}
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * -------------------------------------------------------------    Seal functions    ------------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// slice-by-8 tables of crc32, built when it's first used
+static uint32_t NF2FS_crc_table[8][256];
+static bool NF2FS_crc_ready= false;
+
+static void NF2FS_crc_init(void)
+{
+    for (uint32_t i= 0; i < 256; i++) {
+        uint32_t crc= i;
+        for (int j= 0; j < 8; j++)
+            crc= (crc >> 1) ^ (0xedb88320 & (0U - (crc & 1)));
+        NF2FS_crc_table[0][i]= crc;
+    }
+
+    for (int i= 0; i < 256; i++) {
+        for (int k= 1; k < 8; k++) {
+            uint32_t crc= NF2FS_crc_table[k - 1][i];
+            NF2FS_crc_table[k][i]= (crc >> 8) ^ NF2FS_crc_table[0][crc & 0xff];
+        }
+    }
+    NF2FS_crc_ready= true;
+}
+
+// update crc32 with data in buffer, 8 bytes in a step
+uint32_t NF2FS_crc32(uint32_t crc, const void* buffer, NF2FS_size_t size)
+{
+    const uint8_t* data= (const uint8_t*)buffer;
+    uint32_t (*t)[256]= NF2FS_crc_table;
+
+    if (!NF2FS_crc_ready)
+        NF2FS_crc_init();
+
+    crc= ~crc;
+    while (size >= 8) {
+        uint32_t a= crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                           (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        uint32_t b= (uint32_t)data[4] | (uint32_t)data[5] << 8 |
+                    (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+        crc= t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24] ^
+             t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+        data+= 8;
+        size-= 8;
+    }
+
+    while (size > 0) {
+        crc= (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+        size--;
+    }
+    return ~crc;
+}
+
+// cal the crc of records in buffer, data heads are masked with NF2FS_DHEAD_SEAL_MASK
+uint32_t NF2FS_seal_crc(const uint8_t* buffer, NF2FS_size_t size)
+{
+    uint32_t crc= 0;
+
+    while (size >= sizeof(NF2FS_head_t)) {
+        NF2FS_head_t head= *(NF2FS_head_t*)buffer;
+        NF2FS_size_t len= NF2FS_dhead_dsize(head);
+        if (head == NF2FS_NULL || len < sizeof(NF2FS_head_t) || len > size)
+            break;
+
+        head&= NF2FS_DHEAD_SEAL_MASK;
+        crc= NF2FS_crc32(crc, &head, sizeof(NF2FS_head_t));
+        crc= NF2FS_crc32(crc, buffer + sizeof(NF2FS_head_t), len - sizeof(NF2FS_head_t));
+        buffer+= len;
+        size-= len;
+    }
+    return crc;
+}
+
+/**
+ * Prog records of dir to (sector, off), seal_len tells the size of the new seal.
+ *
+ * Records appended to a batch that has not been flushed stay in the pcache. Otherwise
+ * a new batch begins with a seal, its size and crc are filled in NF2FS_cache_flush.
+ * Records too large for the pcache are proged with their seal directly.
+ */
+int NF2FS_seal_prog(NF2FS_t* NF2FS, NF2FS_size_t id, NF2FS_size_t sector, NF2FS_off_t off,
+                    void* buffer, NF2FS_size_t size, NF2FS_size_t* seal_len)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_cache_ram_t* cache= NF2FS_pcache_find(NF2FS, sector);
+
+    // append to the unflushed batch
+    *seal_len= 0;
+    if (cache && cache->change_flag && cache->off + cache->size == off &&
+        off + size < cache->off + NF2FS->cfg->cache_size) {
+        return NF2FS_cache_prog(NF2FS, NF2FS->pcache, NF2FS->rcache, sector, off, buffer, size);
+    }
+
+    // the flushed batch can't be changed any more
+    if (cache) {
+        err= NF2FS_cache_flush(NF2FS, cache);
+        if (err)
+            return err;
+        NF2FS_cache_one(NF2FS, cache);
+    }
+
+    NF2FS_seal_flash_t seal= {
+        .head= NF2FS_MKDHEAD(0, 1, id, NF2FS_DATA_SEAL, sizeof(NF2FS_seal_flash_t)),
+        .size= NF2FS_NULL,
+        .crc= NF2FS_NULL,
+    };
+    *seal_len= sizeof(NF2FS_seal_flash_t);
+    if (sizeof(NF2FS_seal_flash_t) + size < NF2FS->cfg->cache_size) {
+        err= NF2FS_cache_prog(NF2FS, NF2FS->pcache, NF2FS->rcache, sector, off,
+                              &seal, sizeof(NF2FS_seal_flash_t));
+        if (err)
+            return err;
+        return NF2FS_cache_prog(NF2FS, NF2FS->pcache, NF2FS->rcache, sector,
+                                off + sizeof(NF2FS_seal_flash_t), buffer, size);
+    }
+
+    // the seal and records are proged in one request
+    err= NF2FS_cache_writen_flag(NF2FS, off + sizeof(NF2FS_seal_flash_t), size, buffer, false, NF2FS_NULL);
+    if (err)
+        return err;
+    seal.head&= NF2FS_DHEAD_WRITTEN_SET;
+    seal.size= size;
+    seal.crc= NF2FS_seal_crc(buffer, size);
+
+    NF2FS_iobatch_ram_t batch;
+    NF2FS_iobatch_init(&batch, true);
+    err= NF2FS_iobatch_add(NF2FS, &batch, sector, off, &seal, sizeof(NF2FS_seal_flash_t));
+    if (err)
+        return err;
+    err= NF2FS_iobatch_add(NF2FS, &batch, sector, off + sizeof(NF2FS_seal_flash_t), buffer, size);
+    if (err)
+        return err;
+    err= NF2FS_iobatch_submit(NF2FS, &batch);
+    if (err)
+        return err;
+
+    // sync changes in pcache and read caches
+    NF2FS_pcache_sync(NF2FS, sector, off, sizeof(NF2FS_seal_flash_t), &seal,
+                      NF2FS_DPROG_CACHE_DATA_PROG);
+    NF2FS_rcache_sync(NF2FS, sector, off, sizeof(NF2FS_seal_flash_t), &seal,
+                      NF2FS_DPROG_CACHE_DATA_PROG, false);
+    NF2FS_pcache_sync(NF2FS, sector, off + sizeof(NF2FS_seal_flash_t), size, buffer,
+                      NF2FS_DPROG_CACHE_DATA_PROG);
+    NF2FS_rcache_sync(NF2FS, sector, off + sizeof(NF2FS_seal_flash_t), size, buffer,
+                      NF2FS_DPROG_CACHE_DATA_PROG, false);
+    return err;
+}
+
+// check crc of sealed batches in [begin, end) of the sector, records out of them are torn
+int NF2FS_seal_check(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t begin, NF2FS_off_t end)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_size_t size= end - begin;
+    NF2FS_size_t off= 0;
+
+    if (!NF2FS->cfg->crc_seal || end <= begin)
+        return err;
+
+    uint8_t* buffer= NF2FS_malloc(size);
+    if (!buffer)
+        return NF2FS_ERR_NOMEM;
+
+    err= NF2FS_direct_read(NF2FS, sector, begin, size, buffer);
+    if (err)
+        goto cleanup;
+
+    while (off < size) {
+        NF2FS_seal_flash_t* seal= (NF2FS_seal_flash_t*)(buffer + off);
+        if (size - off < sizeof(NF2FS_seal_flash_t) ||
+            NF2FS_dhead_check(seal->head, NF2FS_NULL, NF2FS_DATA_SEAL) ||
+            seal->size > size - off - sizeof(NF2FS_seal_flash_t)) {
+            err= NF2FS_ERR_CORRUPT;
+            goto cleanup;
+        }
+
+        off+= sizeof(NF2FS_seal_flash_t);
+        if (NF2FS_seal_crc(buffer + off, seal->size) != seal->crc) {
+            err= NF2FS_ERR_CORRUPT;
+            goto cleanup;
+        }
+        off+= seal->size;
     }
 
-    // prog data shold also sync changed in pcache and rcache
-    NF2FS_dprog_cache_sync(NF2FS, NF2FS->pcache, sector, off, size, buffer,
-                          NF2FS_DPROG_CACHE_DATA_PROG, false);
-    NF2FS_dprog_cache_sync(NF2FS, NF2FS->rcache, sector, off, size, buffer,
-                          NF2FS_DPROG_CACHE_DATA_PROG, false);
-
+cleanup:
+    NF2FS_free(buffer);
     return err;
 }
 
@@ -565,6 +1529,13 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
     if (err)
         return err;
 
+    // The new superblock should have a larger extend number than the old one.
+    NF2FS_size_t old_sector= (super->sector == NF2FS_NULL) ? 0 : super->sector;
+    NF2FS_head_t old_head;
+    err= NF2FS_direct_read(NF2FS, old_sector, 0, sizeof(NF2FS_head_t), &old_head);
+    if (err)
+        return err;
+
     // Change the using superblock to the other
     super->sector = (super->sector + 1) % 2;
     super->free_off = 0;
@@ -576,7 +1547,7 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
 
     // Prog basic sector head message.
     NF2FS_head_t new_head= NF2FS_MKSHEAD(0, NF2FS_STATE_ALLOCATING, NF2FS_SECTOR_SUPER,
-                                       (NF2FS_shead_extend(head) + 2)%0x40, NF2FS_shead_etimes(head) + 1);
+                                       (NF2FS_shead_extend(old_head) + 1) % 0x40, NF2FS_shead_etimes(head) + 1);
     err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_SHEAD, super->sector,
                           super->free_off, sizeof(NF2FS_head_t), &new_head);
     super->free_off += sizeof(NF2FS_head_t);
@@ -590,7 +1561,7 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
     pcache->size= 0;
     pcache->change_flag= true;
 
-    // 1. Prog Super message, 36B
+    // 1. Prog Super message, 40B
     NF2FS_supermessage_flash_t* prog1= (NF2FS_supermessage_flash_t*)pcache->buffer;
     NF2FS_size_t len= sizeof(NF2FS_supermessage_flash_t);
     NF2FS_ASSERT(len < NF2FS->cfg->cache_size);
@@ -602,6 +1573,8 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
     prog1->name_max= NF2FS_min(NF2FS->cfg->name_max, NF2FS_NAME_MAX);
     prog1->file_max= NF2FS_min(NF2FS->cfg->file_max, NF2FS_FILE_MAX_SIZE);
     prog1->region_cnt= NF2FS->cfg->region_cnt;
+    prog1->crc_seal= NF2FS->cfg->crc_seal;
+    prog1->dual_end= NF2FS->cfg->dual_end;
 
     super->free_off+= len;
     pcache->size+= len;
@@ -614,6 +1587,7 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
     NF2FS_ASSERT(len < NF2FS->cfg->cache_size);
     if (pcache->size + len > NF2FS->cfg->cache_size) {
         NF2FS_cache_flush(NF2FS, pcache);
+        pcache->sector= super->sector;
         pcache->off= super->free_off;
         pcache->size= 0;
         pcache->change_flag= true;
@@ -640,6 +1614,7 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
     NF2FS_ASSERT(len < NF2FS->cfg->cache_size);
     if (pcache->size + len > NF2FS->cfg->cache_size) {
         NF2FS_cache_flush(NF2FS, pcache);
+        pcache->sector= super->sector;
         pcache->size= 0;
         pcache->off= super->free_off;
         pcache->change_flag= true;
@@ -664,6 +1639,7 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
     NF2FS_ASSERT(len < NF2FS->cfg->cache_size);
     if (pcache->size + len > NF2FS->cfg->cache_size) {
         NF2FS_cache_flush(NF2FS, pcache);
+        pcache->sector= super->sector;
         pcache->size= 0;
         pcache->off= super->free_off;
         pcache->change_flag= true;
@@ -688,6 +1664,7 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
     NF2FS_ASSERT(len < NF2FS->cfg->cache_size);
     if (pcache->size + len > NF2FS->cfg->cache_size) {
         NF2FS_cache_flush(NF2FS, pcache);
+        pcache->sector= super->sector;
         pcache->size= 0;
         pcache->off= super->free_off;
         pcache->change_flag= true;
@@ -721,10 +1698,11 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
 
     // 6. prog the address of wl message
     NF2FS_wladdr_flash_t* prog6= NULL;
-    if (NF2FS->manager->scan_times >= NF2FS_WL_START) {
+    if (NF2FS->manager->wl && NF2FS->manager->wl->begin != NF2FS_NULL) {
         len= sizeof(NF2FS_wladdr_flash_t);
         if (pcache->size + len > NF2FS->cfg->cache_size) {
             NF2FS_cache_flush(NF2FS, pcache);
+            pcache->sector= super->sector;
             pcache->size= 0;
             pcache->off= super->free_off;
             pcache->change_flag= true;
@@ -734,6 +1712,8 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
         }
         prog6->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_ADDR, len);
         prog6->begin= NF2FS->manager->wl->begin;
+        prog6->off= NF2FS->manager->wl->off;
+        prog6->erase_times= NF2FS->manager->wl->etimes;
 
         super->free_off+= len;
         pcache->size= pcache->size + len;
@@ -742,33 +1722,78 @@ int NF2FS_superblock_change(NF2FS_t *NF2FS, NF2FS_superblock_ram_t *super,
         prog6= (NF2FS_wladdr_flash_t*)prog5;
     }
 
-    // 7. Commit message, 24B
+    // 7. prog erase times of regions, a record for the regions fitting in a cache
+    NF2FS_region_etimes_flash_t* prog7= (NF2FS_region_etimes_flash_t*)prog6;
+    for (NF2FS_size_t begin= 0; NF2FS_region_etimes_known(NF2FS->manager) &&
+                                begin < NF2FS->manager->region_num; ) {
+        len= NF2FS_region_etimes_len(NF2FS, begin);
+        if (pcache->size + len > NF2FS->cfg->cache_size) {
+            NF2FS_cache_flush(NF2FS, pcache);
+            pcache->sector= super->sector;
+            pcache->size= 0;
+            pcache->off= super->free_off;
+            pcache->change_flag= true;
+            prog7= (NF2FS_region_etimes_flash_t*)pcache->buffer;
+        }
+        NF2FS_region_etimes_record(NF2FS, prog7, begin);
+        begin+= (len - sizeof(NF2FS_region_etimes_flash_t)) / sizeof(NF2FS_size_t);
+
+        super->free_off+= len;
+        pcache->size= pcache->size + len;
+        prog7= (NF2FS_region_etimes_flash_t*)((uint8_t*)prog7 + len);
+    }
+    NF2FS->manager->region_etimes_changed= false;
+
+    // 8. the open lease record, leased ids are checked at mount if crash happens
+    NF2FS_idlease_flash_t* prog8= (NF2FS_idlease_flash_t*)prog7;
+    if (NF2FS->id_map->lease_begin != NF2FS_NULL) {
+        len= sizeof(NF2FS_idlease_flash_t);
+        if (pcache->size + len > NF2FS->cfg->cache_size) {
+            NF2FS_cache_flush(NF2FS, pcache);
+            pcache->sector= super->sector;
+            pcache->size= 0;
+            pcache->off= super->free_off;
+            pcache->change_flag= true;
+            prog8= (NF2FS_idlease_flash_t*)pcache->buffer;
+        }
+        prog8->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_ID_LEASE, len);
+        prog8->begin= NF2FS->id_map->lease_begin;
+        prog8->bits= NF2FS->id_map->lease;
+
+        super->free_off+= len;
+        pcache->size= pcache->size + len;
+        prog8= (NF2FS_idlease_flash_t*)((uint8_t*)prog8 + len);
+    }
+
+    // 9. Commit message, 24B
     if (if_commit) {
-        NF2FS_commit_flash_t* prog7= NULL;
-        len= sizeof(NF2FS_commit_flash_t);
+        NF2FS_commit_flash_t* prog9= NULL;
+        len= NF2FS_commit_len(NF2FS);
         NF2FS_ASSERT(len < NF2FS->cfg->cache_size);
         if (pcache->size + len > NF2FS->cfg->cache_size) {
             NF2FS_cache_flush(NF2FS, pcache);
+            pcache->sector= super->sector;
             pcache->size= 0;
             pcache->off= super->free_off;
             pcache->change_flag= true;
-            prog7 = (NF2FS_commit_flash_t*)pcache->buffer;
+            prog9 = (NF2FS_commit_flash_t*)pcache->buffer;
         } else {
-            prog7 = (NF2FS_commit_flash_t*)prog6;
+            prog9 = (NF2FS_commit_flash_t*)prog8;
         }
-        prog7->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_COMMIT, len);
-        prog7->next_id= NF2FS->id_map->free_map->index_or_changed +
+        prog9->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_COMMIT, len);
+        prog9->next_id= NF2FS->id_map->free_map->index_or_changed +
                         NF2FS->id_map->free_map->region * NF2FS->id_map->ids_in_buffer;
-        prog7->scan_times= NF2FS->manager->scan_times;
-        prog7->next_dir_sector= NF2FS->manager->dir_map->index_or_changed +
+        prog9->scan_times= NF2FS->manager->scan_times;
+        prog9->next_dir_sector= NF2FS->manager->dir_map->index_or_changed +
                                 NF2FS->manager->dir_map->region * NF2FS->manager->region_size;
-        prog7->next_bfile_sector= NF2FS->manager->bfile_map->index_or_changed +
+        prog9->next_bfile_sector= NF2FS->manager->bfile_map->index_or_changed +
                                 NF2FS->manager->bfile_map->region * NF2FS->manager->region_size;
-        prog7->reserve_region= NF2FS->manager->region_map->reserve;
+        prog9->reserve_region= NF2FS->manager->region_map->reserve;
+        NF2FS_region_run_commit(NF2FS, prog9);
 
         super->free_off+= len;
         pcache->size= pcache->size + len;
-        prog7= (NF2FS_commit_flash_t*)((uint8_t*)prog7 + len);
+        prog9= (NF2FS_commit_flash_t*)((uint8_t*)prog9 + len);
     }
 
     // All data has proged, validate the sector head
@@ -794,7 +1819,10 @@ int NF2FS_find_sectors_in_region(NF2FS_t* NF2FS, NF2FS_size_t region, uint32_t*
         off -= NF2FS->cfg->sector_size;
     }
 
-    err = NF2FS_direct_read(NF2FS, sector, off, size, buffer);
+    // the two maps are read in one request
+    NF2FS_iobatch_ram_t batch;
+    NF2FS_iobatch_init(&batch, false);
+    err = NF2FS_iobatch_add(NF2FS, &batch, sector, off, buffer, size);
     NF2FS_ASSERT(err <= 0);
     if (err)
         return err;
@@ -808,16 +1836,18 @@ int NF2FS_find_sectors_in_region(NF2FS_t* NF2FS, NF2FS_size_t region, uint32_t*
         off -= NF2FS->cfg->sector_size;
     }
 
-    err = NF2FS_direct_read(NF2FS, sector, off, size, temp_buffer);
+    err = NF2FS_iobatch_add(NF2FS, &batch, sector, off, temp_buffer, size);
+    NF2FS_ASSERT(err <= 0);
+    if (err)
+        return err;
+
+    err = NF2FS_iobatch_submit(NF2FS, &batch);
     NF2FS_ASSERT(err <= 0);
     if (err)
         return err;
 
     // Merge data in two maps.
-    size = size / 4;
-    for (int i = 0; i < size; i++) {
-        buffer[i] |= ~temp_buffer[i];
-    }
+    NF2FS_bitmap_merge(buffer, temp_buffer, size / sizeof(uint32_t));
     return err;
 }
 
@@ -825,19 +1855,8 @@ int NF2FS_find_sectors_in_region(NF2FS_t* NF2FS, NF2FS_size_t region, uint32_t*
 NF2FS_size_t NF2FS_cal_valid_bits(NF2FS_cache_ram_t* cache)
 {
     NF2FS_ASSERT(cache->size % sizeof(uint32_t) == 0);
-    uint32_t* data= (uint32_t*)cache->buffer;
-    NF2FS_size_t num = 0;
-
-    // loop times of i and j
-    NF2FS_size_t i_index= cache->size / sizeof(NF2FS_size_t);
-    NF2FS_size_t j_index= sizeof(NF2FS_size_t) * 8;
-    for (int i= 0; i < i_index; i++) {
-        for (int j= 0; j < j_index; j++) {
-            if (((data[i] >> j) & 1U) == 0)
-                num++;
-        }
-    }
-    return num;
+    NF2FS_size_t bits= cache->size * 8;
+    return bits - NF2FS_bitmap_count((uint32_t*)cache->buffer, 0, bits);
 }
 
 /**
@@ -937,6 +1956,29 @@ int NF2FS_bfile_sector_old(NF2FS_t* NF2FS, NF2FS_bfile_index_ram_t* index, NF2FS
     return err;
 }
 
+// set sectors of the big file index record in flash to old, the index is read in pieces
+int NF2FS_bfile_record_old(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t len)
+{
+    int err= NF2FS_ERR_OK;
+
+    NF2FS_bfile_index_ram_t index[8];
+    NF2FS_size_t loop= (len - sizeof(NF2FS_head_t)) / sizeof(NF2FS_bfile_index_ram_t);
+    off+= sizeof(NF2FS_head_t);
+    while (loop > 0) {
+        NF2FS_size_t num= NF2FS_min(loop, sizeof(index) / sizeof(index[0]));
+        err= NF2FS_direct_read(NF2FS, sector, off, num * sizeof(NF2FS_bfile_index_ram_t), index);
+        if (err)
+            return err;
+
+        err= NF2FS_bfile_sector_old(NF2FS, index, num);
+        if (err)
+            return err;
+        off+= num * sizeof(NF2FS_bfile_index_ram_t);
+        loop-= num;
+    }
+    return err;
+}
+
 // erase a normal sector, should return the origin head to help building a new shead
 // return true if we truly erase it.
 bool NF2FS_sector_erase(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_head_t* head)
@@ -955,19 +1997,53 @@ bool NF2FS_sector_erase(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_head_t* head)
     // Erase it if current sector has data.
     // When a id map sector has beed freed, it only records the etimes but not NF2FS_NULL
     if (NF2FS_shead_check(*head, NF2FS_STATE_FREE, NF2FS_SECTOR_NOTSURE)) {
-        err = NF2FS->cfg->erase(NF2FS->cfg, sector);
-        NF2FS_ASSERT(err == NF2FS_ERR_OK);
-        
-        // set the bit in erae map to 0
-        err= NF2FS_emap_set(NF2FS, NF2FS->manager, sector, 1);
+        err = NF2FS_dev_erase(NF2FS, sector);
         NF2FS_ASSERT(err == NF2FS_ERR_OK);
+        NF2FS_rcache_invalidate(NF2FS, sector);
+        NF2FS_pcache_invalidate(NF2FS, sector);
 
+        // the sector is being allocated, it's not old. A bit in erase map
+        // would turn it free again when maps are merged.
         return true;
     }
 
     return false;
 }
 
+// pre-erase a sector whose data is old, so a later alloc needs no erase.
+// The new sector head keeps the erase times and survives a remount.
+int NF2FS_sector_preerase(NF2FS_t* NF2FS, NF2FS_size_t sector, bool* if_erase)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_head_t head;
+
+    // Only sectors with old data are pre-erased.
+    *if_erase= false;
+    NF2FS_ASSERT(sector < NF2FS->cfg->sector_count);
+    err= NF2FS_direct_read(NF2FS, sector, 0, sizeof(NF2FS_head_t), &head);
+    if (err)
+        return err;
+    if (head == NF2FS_NULL || NF2FS_shead_check(head, NF2FS_STATE_OLD, NF2FS_NULL))
+        return err;
+
+    err= NF2FS_dev_erase(NF2FS, sector);
+    if (err)
+        return err;
+    NF2FS_rcache_invalidate(NF2FS, sector);
+    NF2FS_pcache_invalidate(NF2FS, sector);
+
+    // The same free head as map_sector_erase, NF2FS_sector_erase skips it.
+    head= NF2FS_MKSHEAD(0, NF2FS_STATE_FREE, NF2FS_SECTOR_NOTSURE, 0x3f,
+                        NF2FS_shead_etimes(head) + 1);
+    err= NF2FS_direct_prog(NF2FS, NF2FS_DIRECT_PROG_SHEAD, sector, 0,
+                          sizeof(NF2FS_head_t), &head);
+    if (err)
+        return err;
+
+    *if_erase= true;
+    return err;
+}
+
 // erase sectors belonged to id/sector map without shead
 int NF2FS_map_sector_erase(NF2FS_t* NF2FS, NF2FS_size_t begin, NF2FS_size_t num, NF2FS_size_t* etimes)
 {
@@ -976,9 +2052,11 @@ int NF2FS_map_sector_erase(NF2FS_t* NF2FS, NF2FS_size_t begin, NF2FS_size_t num,
     NF2FS_head_t head;
     for (int i = 0; i < num; i++) {
         // Erase old one directly.
-        err= NF2FS->cfg->erase(NF2FS->cfg, begin);
+        err= NF2FS_dev_erase(NF2FS, begin);
         if (err)
             return err;
+        NF2FS_rcache_invalidate(NF2FS, begin);
+        NF2FS_pcache_invalidate(NF2FS, begin);
 
         // Prog new sector head, valid flag 0 is used for NF2FS_shead_check
         // to ensure that the sector is free to use with etimes recording
@@ -999,11 +2077,124 @@ int NF2FS_map_sector_erase(NF2FS_t* NF2FS, NF2FS_size_t begin, NF2FS_size_t num,
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  */
 
-// migrate the two regions with reserve region
-int NF2FS_region_migration(NF2FS_t* NF2FS, NF2FS_size_t region_1, NF2FS_size_t region_2)
+/**
+ * Move data of a region to the physical region of reserve region, then the two swap
+ * their physical regions. buffer has cache_size bytes for copying.
+ *
+ * The old physical sectors of reserve region are erased before sector heads are proged,
+ * and heads are proged before data, so a sector without head has nothing. If crash happens
+ * before the new physical regions are recorded in wl sector, the region is not moved.
+ */
+// Copy num sectors of region from begin to the physical region of reserve region.
+int NF2FS_region_copy(NF2FS_t* NF2FS, NF2FS_size_t region, NF2FS_size_t begin, NF2FS_size_t num,
+                      uint8_t* buffer)
 {
-    // TODO in the future, currently wl is not finished
-    return NF2FS_ERR_OK;
+    int err= NF2FS_ERR_OK;
+    const struct NF2FS_config* cfg= NF2FS->cfg;
+    NF2FS_flash_manage_ram_t* manager= NF2FS->manager;
+    NF2FS_wl_ram_t* wl= manager->wl;
+    NF2FS_size_t reserve= manager->region_map->reserve;
+    NF2FS_size_t src= wl->remap[region] * manager->region_size;
+    NF2FS_size_t dst= wl->remap[reserve] * manager->region_size;
+
+    // data in prog caches should be in flash before copying
+    err= NF2FS_pcache_flush_all(NF2FS);
+    if (err)
+        return err;
+
+    // sectors are copied in physical address, so the device should be idle
+    err= NF2FS_dev_wait(NF2FS);
+    if (err)
+        return err;
+
+    for (NF2FS_size_t i= begin; i < begin + num; i++) {
+        NF2FS_head_t src_head;
+        NF2FS_head_t dst_head;
+        err= cfg->read(cfg, src + i, 0, &src_head, sizeof(NF2FS_head_t));
+        if (err)
+            return err;
+        err= cfg->read(cfg, dst + i, 0, &dst_head, sizeof(NF2FS_head_t));
+        if (err)
+            return err;
+
+        // Erase the old data in the physical sector of reserve region.
+        NF2FS_size_t etimes= 0;
+        if (dst_head != NF2FS_NULL) {
+            err= cfg->erase(cfg, dst + i);
+            if (err)
+                return err;
+            NF2FS_region_etimes_add(NF2FS, dst + i);
+            etimes= NF2FS_shead_etimes(dst_head) + 1;
+        } else if (src_head == NF2FS_NULL) {
+            continue;
+        }
+
+        // free and old sectors turn to pre-erased sectors, others keep all but etimes in head
+        bool has_data= (src_head != NF2FS_NULL &&
+                        NF2FS_shead_check(src_head, NF2FS_STATE_FREE, NF2FS_NULL) &&
+                        NF2FS_shead_check(src_head, NF2FS_STATE_OLD, NF2FS_NULL));
+        NF2FS_head_t head= has_data ? ((src_head & ~(NF2FS_head_t)0x3ffff) | etimes) :
+                                      NF2FS_MKSHEAD(0, NF2FS_STATE_FREE, NF2FS_SECTOR_NOTSURE, 0x3f, etimes);
+        err= cfg->prog(cfg, dst + i, 0, &head, sizeof(NF2FS_head_t));
+        if (err)
+            return err;
+
+        // Copy data behind the head, erased pieces need no prog.
+        for (NF2FS_off_t off= 0; has_data && off < cfg->sector_size; off+= cfg->cache_size) {
+            err= cfg->read(cfg, src + i, off, buffer, cfg->cache_size);
+            if (err)
+                return err;
+            if (off == 0)
+                memset(buffer, 0xff, sizeof(NF2FS_head_t));
+
+            NF2FS_size_t j= 0;
+            while (j < cfg->cache_size && buffer[j] == 0xff)
+                j++;
+            if (j == cfg->cache_size)
+                continue;
+
+            err= cfg->prog(cfg, dst + i, off, buffer, cfg->cache_size);
+            if (err)
+                return err;
+        }
+
+        // caches only see the new head
+        NF2FS_size_t sector= region * manager->region_size + i;
+        if (has_data) {
+            NF2FS_pcache_sync(NF2FS, sector, 0, sizeof(NF2FS_head_t), &head, NF2FS_DPROG_CACHE_DATA_PROG);
+            NF2FS_rcache_sync(NF2FS, sector, 0, sizeof(NF2FS_head_t), &head, NF2FS_DPROG_CACHE_DATA_PROG, false);
+        } else {
+            NF2FS_rcache_invalidate(NF2FS, sector);
+            NF2FS_pcache_invalidate(NF2FS, sector);
+        }
+    }
+    return err;
+}
+
+// All sectors of region are copied, region and reserve region swap their physical regions.
+int NF2FS_region_swap(NF2FS_t* NF2FS, NF2FS_size_t region)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_flash_manage_ram_t* manager= NF2FS->manager;
+    NF2FS_wl_ram_t* wl= manager->wl;
+    NF2FS_size_t reserve= manager->region_map->reserve;
+
+    // record the new physical regions of the region and reserve region
+    NF2FS_size_t record[5];
+    NF2FS_wl_remap_flash_t* remap= (NF2FS_wl_remap_flash_t*)record;
+    remap->head= NF2FS_MKDHEAD(0, 1, NF2FS_ID_SUPER, NF2FS_DATA_WL_REMAP, sizeof(record));
+    remap->remap[0]= region;
+    remap->remap[1]= wl->remap[reserve];
+    remap->remap[2]= reserve;
+    remap->remap[3]= wl->remap[region];
+    err= NF2FS_wl_prog(NF2FS, manager, remap, sizeof(record));
+    if (err)
+        return err;
+
+    NF2FS_size_t temp= wl->remap[region];
+    wl->remap[region]= wl->remap[reserve];
+    wl->remap[reserve]= temp;
+    return err;
 }
 
 // GC for a dir
@@ -1012,8 +2203,8 @@ int NF2FS_dir_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
     int err = NF2FS_ERR_OK;
     NF2FS_size_t old_tail= dir->tail_sector;
 
-    // flush data to flash first.
-    err= NF2FS_cache_flush(NF2FS, NF2FS->pcache);
+    // flush data to flash first, the tail of dir may be in a parked prog cache.
+    err= NF2FS_pcache_flush_all(NF2FS);
     if (err)
         return err;
 
@@ -1030,14 +2221,15 @@ int NF2FS_dir_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
     }
 
     // Starting gc.
-    err = NF2FS_dtraverse_gc(NF2FS, dir);
+    NF2FS_size_t moved= 0;
+    err = NF2FS_dtraverse_gc(NF2FS, dir, old_tail, &moved);
     if (err)
         return err;
 
-    // flush opened son file to flash
+    // flush opened son file to flash, except the one being flushed
     file= NF2FS->file_list;
     while (file != NULL) {
-        if (file->father_id == dir->id) {
+        if (file->father_id == dir->id && file->file_cache.sector != NF2FS_NULL) {
             // prog new data/index to flash
             NF2FS_head_t old_head = *(NF2FS_head_t *)file->file_cache.buffer;
             NF2FS_head_t *head = (NF2FS_head_t *)file->file_cache.buffer;
@@ -1048,7 +2240,7 @@ int NF2FS_dir_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
 
             // Update file cache message.
             file->file_cache.sector = dir->tail_sector;
-            file->file_cache.off = dir->tail_off - file->file_cache.size;
+            file->file_cache.off = dir->prog_off;
             file->file_cache.change_flag = false;
         }
         file= file->next_file;
@@ -1064,6 +2256,322 @@ int NF2FS_dir_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
     return err;
 }
 
+// Find the oldest sector of dir from its tail, next links lost at power loss are proged again.
+static int NF2FS_dir_oldest_find(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_dir_sector_flash_t shead;
+    NF2FS_size_t newer= NF2FS_NULL;
+
+    // sectors of the dir are counted on the way
+    NF2FS_size_t sector= dir->tail_sector;
+    dir->sectors= 0;
+    while (sector != NF2FS_NULL) {
+        err= NF2FS_direct_read(NF2FS, sector, 0, sizeof(NF2FS_dir_sector_flash_t), &shead);
+        if (err)
+            return err;
+        err= NF2FS_shead_check(shead.head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
+        if (err)
+            return err;
+
+        if (newer != NF2FS_NULL && shead.next_sector == NF2FS_NULL) {
+            err= NF2FS_dir_link_next(NF2FS, sector, newer);
+            if (err)
+                return err;
+        }
+        dir->oldest_sector= sector;
+        dir->sectors++;
+        newer= sector;
+        sector= NF2FS_dir_pre(&shead);
+    }
+    return err;
+}
+
+// Compact the oldest NF2FS_DIR_GC_SECTORS sectors of dir into its tail,
+// the whole dir is gced if it does not have more sectors.
+int NF2FS_dir_gc_step(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir)
+{
+    int err = NF2FS_ERR_OK;
+    NF2FS_size_t ring[NF2FS_DIR_GC_SECTORS + 1];
+    NF2FS_size_t num= 0;
+    NF2FS_dir_sector_flash_t shead;
+
+    // flush data to flash first, the tail of dir may be in a parked prog cache.
+    err= NF2FS_pcache_flush_all(NF2FS);
+    if (err)
+        return err;
+
+    // the dir is traversed once if its oldest sector is not known
+    bool found= dir->oldest_sector == NF2FS_NULL;
+    if (found) {
+        err= NF2FS_dir_oldest_find(NF2FS, dir);
+        if (err)
+            return err;
+    }
+
+    // find the oldest sectors and the one after them by next links, only sector heads are read
+    NF2FS_size_t sector= dir->oldest_sector;
+    while (num <= NF2FS_DIR_GC_SECTORS) {
+        err= NF2FS_direct_read(NF2FS, sector, 0, sizeof(NF2FS_dir_sector_flash_t), &shead);
+        if (err)
+            return err;
+
+        // the oldest sector in ospace record is stale if the dir is not closed after later steps,
+        // and a lost next link is proged again, both by traversing from the tail
+        bool stale= num == 0 && (NF2FS_shead_check(shead.head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR) ||
+                                 shead.id != dir->id || NF2FS_dir_pre(&shead) != NF2FS_NULL);
+        if (stale || (sector != dir->tail_sector && shead.next_sector == NF2FS_NULL)) {
+            if (found)
+                return NF2FS_ERR_WRONGHEAD;
+            found= true;
+            err= NF2FS_dir_oldest_find(NF2FS, dir);
+            if (err)
+                return err;
+            sector= dir->oldest_sector;
+            num= 0;
+            continue;
+        }
+        err= NF2FS_shead_check(shead.head, NF2FS_STATE_USING, NF2FS_SECTOR_DIR);
+        if (err)
+            return err;
+
+        ring[num++]= sector;
+        if (sector == dir->tail_sector)
+            break;
+        sector= shead.next_sector;
+    }
+    if (num <= NF2FS_DIR_GC_SECTORS)
+        return NF2FS_dir_gc(NF2FS, dir);
+    NF2FS_size_t cut= ring[NF2FS_DIR_GC_SECTORS];
+    NF2FS_size_t begin= ring[NF2FS_DIR_GC_SECTORS - 1];
+
+    // opened son files with data in the oldest sectors are proged again later
+    bool flags[NF2FS_FILE_LIST_MAX];
+    NF2FS_size_t cnt= 0;
+    NF2FS_file_ram_t* file= NF2FS->file_list;
+    while (file != NULL) {
+        flags[cnt]= false;
+        for (NF2FS_size_t i= 0; i < NF2FS_DIR_GC_SECTORS && file->father_id == dir->id; i++) {
+            if (file->file_cache.sector == ring[i])
+                flags[cnt]= true;
+        }
+
+        if (flags[cnt]) {
+            err= NF2FS_data_delete(NF2FS, dir->id, file->file_cache.sector, file->file_cache.off,
+                                  NF2FS_dhead_dsize(*(NF2FS_head_t *)file->file_cache.buffer));
+            if (err)
+                return err;
+        }
+        file= file->next_file;
+        cnt++;
+    }
+
+    // live records of the oldest sectors are moved to tail, gc does not happen while moving
+    NF2FS_size_t old_space= dir->old_space;
+    NF2FS_size_t moved= 0;
+    err = NF2FS_dtraverse_gc(NF2FS, dir, begin, &moved);
+    if (err)
+        return err;
+
+    file= NF2FS->file_list;
+    cnt= 0;
+    while (file != NULL) {
+        if (flags[cnt]) {
+            // prog new data/index to flash
+            NF2FS_head_t old_head = *(NF2FS_head_t *)file->file_cache.buffer;
+            NF2FS_head_t *head = (NF2FS_head_t *)file->file_cache.buffer;
+            *head= NF2FS_MKDHEAD(0, 1, file->id, NF2FS_dhead_type(old_head), file->file_cache.size);
+            err= NF2FS_dir_prog(NF2FS, dir, file->file_cache.buffer, file->file_cache.size);
+            if (err)
+                return err;
+
+            // Update file cache message.
+            file->file_cache.sector = dir->tail_sector;
+            file->file_cache.off = dir->prog_off;
+            file->file_cache.change_flag = false;
+        }
+        file= file->next_file;
+        cnt++;
+    }
+
+    // space not moved is reclaimed
+    NF2FS_size_t reclaimed= NF2FS_DIR_GC_SECTORS * NF2FS->cfg->sector_size - moved;
+    old_space= (old_space > reclaimed) ? old_space - reclaimed : 0;
+
+    // the new oldest sector is recorded before the cut, so a record found later is not stale
+    NF2FS_dir_ospace_flash_t record= {
+        .head= NF2FS_MKDHEAD(0, 1, dir->id, NF2FS_DATA_DIR_OSPACE, sizeof(NF2FS_dir_ospace_flash_t)),
+        .old_space= old_space,
+        .oldest_sector= cut,
+    };
+    err= NF2FS_dir_prog(NF2FS, dir, &record, sizeof(NF2FS_dir_ospace_flash_t));
+    if (err)
+        return err;
+    err= NF2FS_pcache_flush_all(NF2FS);
+    if (err)
+        return err;
+
+    // the dir ends at cut sector now, then the oldest sectors are recycled.
+    // Head of cut sector is read again, wl may have moved it while moving records.
+    err= NF2FS_direct_read(NF2FS, cut, 0, sizeof(NF2FS_head_t), &shead.head);
+    if (err)
+        return err;
+    err= NF2FS_head_validate(NF2FS, cut, 0, shead.head & NF2FS_SHEAD_CUT_SET);
+    if (err)
+        return err;
+    err = NF2FS_dir_old(NF2FS, begin);
+    if (err)
+        return err;
+
+    dir->oldest_sector= cut;
+    dir->old_space= old_space;
+    if (dir->sectors != NF2FS_NULL)
+        dir->sectors-= NF2FS_DIR_GC_SECTORS;
+    return err;
+}
+
+// Count sectors of a dir from its tail, only sector heads are read.
+static int NF2FS_dir_sectors(NF2FS_t* NF2FS, NF2FS_size_t tail, NF2FS_size_t* num)
+{
+    int err= NF2FS_ERR_OK;
+    NF2FS_dir_sector_flash_t shead;
+
+    *num= 0;
+    while (tail != NF2FS_NULL) {
+        err= NF2FS_direct_read(NF2FS, tail, 0, sizeof(NF2FS_dir_sector_flash_t), &shead);
+        if (err)
+            return err;
+        (*num)++;
+        tail= NF2FS_dir_pre(&shead);
+    }
+    return err;
+}
+
+// The cost-benefit score of reclaiming a dir, old space and the age of it are the benefit,
+// reading its sectors and moving live data are the cost.
+static uint64_t NF2FS_reclaim_score(NF2FS_t* NF2FS, NF2FS_size_t old_space, NF2FS_size_t sectors,
+                                    NF2FS_size_t stamp)
+{
+    NF2FS_size_t total= sectors * NF2FS->cfg->sector_size;
+    NF2FS_size_t live= (total > old_space) ? total - old_space : 0;
+    uint64_t age= (uint64_t)(NF2FS->dir_clock - stamp) + 1;
+    return (uint64_t)old_space * age / (total + live);
+}
+
+// Pick the dir to reclaim with the best score, dirs with less than min_space old space are skipped.
+// Closed dirs that have not been opened are opened to read their old space first, an op for each.
+static int NF2FS_reclaim_victim(NF2FS_t* NF2FS, NF2FS_size_t busy_id, NF2FS_size_t busy_father,
+                                NF2FS_size_t min_space, NF2FS_size_t max_ops, NF2FS_size_t* ops,
+                                NF2FS_size_t* victim)
+{
+    int err= NF2FS_ERR_OK;
+    uint64_t best= 0;
+
+    *victim= NF2FS_NULL;
+    for (NF2FS_size_t i= 0; i < NF2FS->ram_tree->entry_num; i++) {
+        NF2FS_tree_entry_ram_t* entry= &NF2FS->ram_tree->tree_array[i];
+        if (entry->id == NF2FS_NULL || entry->id == busy_id || entry->id == busy_father)
+            continue;
+
+        // a dir linking new tail progs to its father, both of them are not touched
+        NF2FS_dir_ram_t* dir= NULL;
+        if (!NF2FS_open_dir_find(NF2FS, entry->father_id, &dir) && dir->busy)
+            continue;
+
+        NF2FS_size_t old_space, tail, stamp= 0;
+        NF2FS_size_t* sectors= &NF2FS->ram_tree->sectors[i];
+        if (!NF2FS_open_dir_find(NF2FS, entry->id, &dir)) {
+            if (dir->busy)
+                continue;
+            old_space= dir->old_space;
+            tail= dir->tail_sector;
+            stamp= dir->stamp;
+            sectors= &dir->sectors;
+        } else {
+            if (entry->old_space == NF2FS_NULL) {
+                if (*ops >= max_ops)
+                    continue;
+
+                // old space is found in the ospace record when opening
+                err= NF2FS_dir_lowopen(NF2FS, entry->tail_sector, entry->id, entry->father_id,
+                                      entry->name_sector, entry->name_off, &dir, NF2FS->rcache);
+                if (err)
+                    return err;
+                err= NF2FS_dir_free(NF2FS, dir);
+                if (err)
+                    return err;
+                (*ops)++;
+            }
+            old_space= entry->old_space;
+            tail= entry->tail_sector;
+        }
+        if (old_space < min_space)
+            continue;
+
+        // sectors are counted once, then they are kept on sector alloc and free
+        if (*sectors == NF2FS_NULL) {
+            err= NF2FS_dir_sectors(NF2FS, tail, sectors);
+            if (err)
+                return err;
+        }
+        uint64_t score= NF2FS_reclaim_score(NF2FS, old_space, *sectors, stamp);
+        if (score > best) {
+            best= score;
+            *victim= entry->id;
+        }
+    }
+    return err;
+}
+
+// Reclaim old space of dirs that have the best cost-benefit scores, opened or closed, dirs with
+// less than min_space old space are skipped and at most max_ops sectors are copied.
+// Dirs busy_id and busy_father are in use, they are skipped too.
+int NF2FS_dir_reclaim(NF2FS_t* NF2FS, NF2FS_size_t busy_id, NF2FS_size_t busy_father,
+                      NF2FS_size_t min_space, NF2FS_size_t max_ops, NF2FS_size_t* ops)
+{
+    int err= NF2FS_ERR_OK;
+
+    // sectors allocated while reclaiming do not reclaim again
+    bool in_gc= NF2FS->in_gc;
+    NF2FS->in_gc= true;
+    while (*ops + NF2FS_DIR_GC_SECTORS <= max_ops) {
+        NF2FS_size_t id= NF2FS_NULL;
+        err= NF2FS_reclaim_victim(NF2FS, busy_id, busy_father, min_space, max_ops, ops, &id);
+        if (err || id == NF2FS_NULL)
+            break;
+        if (*ops + NF2FS_DIR_GC_SECTORS > max_ops)
+            break;
+
+        // a closed dir is opened for gc, and closed with its new old space
+        NF2FS_dir_ram_t* dir= NULL;
+        bool opened= !NF2FS_open_dir_find(NF2FS, id, &dir);
+        if (!opened) {
+            NF2FS_size_t index= NF2FS_NULL;
+            err= NF2FS_tree_entry_id_find(NF2FS->ram_tree, id, &index);
+            if (err)
+                break;
+            NF2FS_tree_entry_ram_t* entry= &NF2FS->ram_tree->tree_array[index];
+            err= NF2FS_dir_lowopen(NF2FS, entry->tail_sector, entry->id, entry->father_id,
+                                  entry->name_sector, entry->name_off, &dir, NF2FS->rcache);
+            if (err)
+                break;
+        }
+
+        err= NF2FS_dir_gc_step(NF2FS, dir);
+        if (err)
+            break;
+        *ops+= NF2FS_DIR_GC_SECTORS;
+
+        if (!opened) {
+            err= NF2FS_dir_close(NF2FS, dir);
+            if (err)
+                break;
+        }
+    }
+    NF2FS->in_gc= in_gc;
+    return err;
+}
+
 // GC for big file
 int NF2FS_bfile_gc(NF2FS_t *NF2FS, NF2FS_file_ram_t *file)
 {
@@ -1079,7 +2587,7 @@ int NF2FS_bfile_gc(NF2FS_t *NF2FS, NF2FS_file_ram_t *file)
         return err;
 
     // find candidate indexes that can be gc
-    NF2FS_size_t candidate_arr[NF2FS_FILE_INDEX_NUM] = {0};
+    NF2FS_size_t candidate_arr[NF2FS_FILE_INDEX_MAX] = {0};
     NF2FS_size_t arr_len = 0;
     for (int i = 0; i < num; i++) {
         if (bfile_index->index[i].size <= NF2FS->cfg->sector_size) {
@@ -1087,7 +2595,7 @@ int NF2FS_bfile_gc(NF2FS_t *NF2FS, NF2FS_file_ram_t *file)
             arr_len++;
         }
     }
-    NF2FS_ASSERT(arr_len <= NF2FS_FILE_INDEX_NUM);
+    NF2FS_ASSERT(arr_len < NF2FS_FILE_INDEX_MAX);
 
     NF2FS_size_t gc_size = 0;
     NF2FS_size_t min, max;
@@ -31,6 +31,114 @@ void NF2FS_cache_drop(NF2FS_t* NF2FS, NF2FS_cache_ram_t* cache);
 
 void NF2FS_cache_one(NF2FS_t* NF2FS, NF2FS_cache_ram_t* cache);
 
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * -------------------------------------------------------    Read cache pool functions    -------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Init the read cache pool.
+int NF2FS_rcache_pool_init(NF2FS_t* NF2FS, NF2FS_rcache_pool_ram_t** pool_addr);
+
+// Free the read cache pool.
+void NF2FS_rcache_pool_free(NF2FS_rcache_pool_ram_t* pool);
+
+// find a slot that already has data of (sector, off, size)
+NF2FS_cache_ram_t* NF2FS_rcache_lookup(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size);
+
+// get a slot with data of (sector, off, size) at buffer + off - cache->off, pin it if needed
+int NF2FS_rcache_fetch(NF2FS_t* NF2FS, NF2FS_cache_ram_t** cache_addr, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size, bool if_pin);
+
+// fetch and hold the slot until it's released, the slot held in *cache_addr is released first
+int NF2FS_rcache_fetch_hold(NF2FS_t* NF2FS, NF2FS_cache_ram_t** cache_addr, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size, bool if_pin);
+
+// release a slot held by NF2FS_rcache_fetch_hold, cache could be NULL
+void NF2FS_rcache_release(NF2FS_t* NF2FS, NF2FS_cache_ram_t* cache);
+
+// unpin slots that cache the sector
+void NF2FS_rcache_unpin(NF2FS_t* NF2FS, NF2FS_size_t sector);
+
+// sync proged data to all read caches
+void NF2FS_rcache_sync(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size, void* buffer, int dp_type, bool if_written_flag);
+
+// drop all read caches of an erased sector
+void NF2FS_rcache_invalidate(NF2FS_t* NF2FS, NF2FS_size_t sector);
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * -------------------------------------------------------    Prog cache pool functions    -------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Init the pool of parked prog caches.
+int NF2FS_pcache_pool_init(NF2FS_t* NF2FS, NF2FS_pcache_pool_ram_t** pool_addr);
+
+// Free the pool of parked prog caches.
+void NF2FS_pcache_pool_free(NF2FS_pcache_pool_ram_t* pool);
+
+// find the prog cache that has unflushed data of the sector
+NF2FS_cache_ram_t* NF2FS_pcache_find(NF2FS_t* NF2FS, NF2FS_size_t sector);
+
+// park the pcache and switch to the prog cache that can append (sector, off, size)
+int NF2FS_pcache_switch(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size);
+
+// flush the pcache and all parked prog caches
+int NF2FS_pcache_flush_all(NF2FS_t* NF2FS);
+
+// flush the pcache and parked prog caches that have unproged data in (sector, off, size)
+int NF2FS_pcache_flush_range(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size);
+
+// sync proged data to all prog caches
+void NF2FS_pcache_sync(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size, void* buffer, int dp_type);
+
+// drop all prog caches of an erased sector
+void NF2FS_pcache_invalidate(NF2FS_t* NF2FS, NF2FS_size_t sector);
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ------------------------------------------------------------    Device functions    ----------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Init the device state.
+int NF2FS_dev_init(NF2FS_t* NF2FS, NF2FS_dev_ram_t** dev_addr);
+
+// Free the device state.
+void NF2FS_dev_free(NF2FS_dev_ram_t* dev);
+
+// check whether the async operation has finished, start the next queued prog if so
+int NF2FS_dev_poll(NF2FS_t* NF2FS);
+
+// wait until the async operation and all queued progs finish
+int NF2FS_dev_wait(NF2FS_t* NF2FS);
+
+// the physical sector of a sector, regions may be migrated by wl
+NF2FS_size_t NF2FS_dev_sector(NF2FS_t* NF2FS, NF2FS_size_t sector);
+
+// read data from the device after it's idle
+int NF2FS_dev_read(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, void* buffer, NF2FS_size_t size);
+
+// prog data to the device, queued behind the running operation with prog_async
+int NF2FS_dev_prog(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, void* buffer, NF2FS_size_t size);
+
+// erase a sector, without waiting for it with erase_async
+int NF2FS_dev_erase(NF2FS_t* NF2FS, NF2FS_size_t sector);
+
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * ---------------------------------------------------------    Vectored io functions    ---------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// Init an empty batch of read or prog segments.
+void NF2FS_iobatch_init(NF2FS_iobatch_ram_t* batch, bool is_prog);
+
+// send all segments in batch to the device, through readv/progv if provided
+int NF2FS_iobatch_submit(NF2FS_t* NF2FS, NF2FS_iobatch_ram_t* batch);
+
+// add a segment to batch, merged with the last one if they are adjacent
+int NF2FS_iobatch_add(NF2FS_t* NF2FS, NF2FS_iobatch_ram_t* batch, NF2FS_size_t sector, NF2FS_off_t off, void* buffer, NF2FS_size_t size);
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * -------------------------------------------------------    Prog/Erase cache functions    ------------------------------------------------------
@@ -64,6 +172,24 @@ int NF2FS_head_validate(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_size_t off, N
 // should validate the written flag for dhead
 int NF2FS_direct_prog(NF2FS_t* NF2FS, NF2FS_size_t data_type, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t size, void* buffer);
 
+/**
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ * -------------------------------------------------------------    Seal functions    ------------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+// update crc32 with data in buffer, use slice-by-8 tables
+uint32_t NF2FS_crc32(uint32_t crc, const void* buffer, NF2FS_size_t size);
+
+// cal the crc of records in buffer for a seal
+uint32_t NF2FS_seal_crc(const uint8_t* buffer, NF2FS_size_t size);
+
+// prog records of dir, a new batch begins with a seal whose size is returned by seal_len
+int NF2FS_seal_prog(NF2FS_t* NF2FS, NF2FS_size_t id, NF2FS_size_t sector, NF2FS_off_t off, void* buffer, NF2FS_size_t size, NF2FS_size_t* seal_len);
+
+// check crc of sealed batches in [begin, end) of the sector
+int NF2FS_seal_check(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t begin, NF2FS_off_t end);
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * ---------------------------------------------------------    More complex operations    -------------------------------------------------------
@@ -97,9 +223,15 @@ int NF2FS_sequen_sector_old(NF2FS_t* NF2FS, NF2FS_size_t begin, NF2FS_size_t num
 // similar to NF2FS_sequen_sector_old, but should traverse indexs to sectors
 int NF2FS_bfile_sector_old(NF2FS_t* NF2FS, NF2FS_bfile_index_ram_t* index, NF2FS_size_t num);
 
+// set sectors of the big file index record in flash to old
+int NF2FS_bfile_record_old(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_off_t off, NF2FS_size_t len);
+
 // erase a normal sector, should change corresponding sector header (i.e., reprog etimes)
 bool NF2FS_sector_erase(NF2FS_t* NF2FS, NF2FS_size_t sector, NF2FS_head_t* head);
 
+// pre-erase a sector with old data and prog a free sector head with its etimes
+int NF2FS_sector_preerase(NF2FS_t* NF2FS, NF2FS_size_t sector, bool* if_erase);
+
 // erase map sector without shead
 int NF2FS_map_sector_erase(NF2FS_t* NF2FS, NF2FS_size_t begin, NF2FS_size_t num, NF2FS_size_t* etimes);
 
@@ -112,11 +244,25 @@ int NF2FS_map_sector_erase(NF2FS_t* NF2FS, NF2FS_size_t begin, NF2FS_size_t num,
 // GC for a dir
 int NF2FS_dir_gc(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
 
+// Compact the oldest NF2FS_DIR_GC_SECTORS sectors of dir into its tail,
+// the whole dir is gced if it does not have more sectors.
+int NF2FS_dir_gc_step(NF2FS_t* NF2FS, NF2FS_dir_ram_t* dir);
+
+// Reclaim old space of dirs that have the best cost-benefit scores, opened or closed, dirs with
+// less than min_space old space are skipped and at most max_ops sectors are copied.
+// Dirs busy_id and busy_father are in use, they are skipped too.
+int NF2FS_dir_reclaim(NF2FS_t* NF2FS, NF2FS_size_t busy_id, NF2FS_size_t busy_father,
+                      NF2FS_size_t min_space, NF2FS_size_t max_ops, NF2FS_size_t* ops);
+
 // GC for big file
 int NF2FS_bfile_gc(NF2FS_t* NF2FS, NF2FS_file_ram_t* file);
 
-// migrate the two regions with reserve region
-int NF2FS_region_migration(NF2FS_t* NF2FS, NF2FS_size_t region_1, NF2FS_size_t region_2);
+// copy num sectors of region from begin to the physical region of reserve region
+int NF2FS_region_copy(NF2FS_t* NF2FS, NF2FS_size_t region, NF2FS_size_t begin, NF2FS_size_t num,
+                      uint8_t* buffer);
+
+// swap physical regions of region and reserve region when all sectors are copied
+int NF2FS_region_swap(NF2FS_t* NF2FS, NF2FS_size_t region);
 
 #ifdef __cplusplus
 }
@@ -62,6 +62,16 @@ int NF2FS_tree_init(NF2FS_t* NF2FS, NF2FS_tree_ram_t** tree_addr)
     }
 
     memset(tree->tree_array, 0xff, NF2FS->cfg->cache_size);
+
+    // sectors of closed dirs are kept out of tree entries, so entries in a cache are not less
+    tree->sectors= NF2FS_malloc(tree->entry_num * sizeof(NF2FS_size_t));
+    if (!tree->sectors) {
+        NF2FS_free(tree->tree_array);
+        NF2FS_free(tree);
+        err= NF2FS_ERR_NOMEM;
+        return err;
+    }
+    memset(tree->sectors, 0xff, tree->entry_num * sizeof(NF2FS_size_t));
     *tree_addr = tree;
     return err;
 }
@@ -105,6 +115,8 @@ int NF2FS_tree_entry_add(NF2FS_tree_ram_t* tree, NF2FS_size_t father_id, NF2FS_s
     tree->tree_array[index].name_sector= name_sector;
     tree->tree_array[index].name_off= name_off;
     tree->tree_array[index].tail_sector= tail;
+    tree->tree_array[index].old_space= NF2FS_NULL;
+    tree->sectors[index]= NF2FS_NULL;
     if (namelen <= NF2FS_ENTRY_NAME_LEN) {
         memcpy(tree->tree_array[index].data.name, name, namelen);
     }else {
@@ -115,7 +127,7 @@ int NF2FS_tree_entry_add(NF2FS_tree_ram_t* tree, NF2FS_size_t father_id, NF2FS_s
 }
 
 // judge if the tree entry is valid
-bool inline NF2FS_tree_entry_isvalid(NF2FS_tree_ram_t* tree, NF2FS_size_t tree_index, NF2FS_size_t father_id)
+static bool inline NF2FS_tree_entry_isvalid(NF2FS_tree_ram_t* tree, NF2FS_size_t tree_index, NF2FS_size_t father_id)
 {
     return (tree->tree_array[tree_index].id != NF2FS_NULL &&
             tree->tree_array[tree_index].father_id == father_id);
@@ -200,6 +212,34 @@ int NF2FS_tree_entry_update(NF2FS_tree_ram_t* tree, NF2FS_size_t id, NF2FS_size_
     return err;
 }
 
+// keep old space of a dir in the tree, it's used after the dir is closed
+int NF2FS_tree_entry_ospace(NF2FS_tree_ram_t* tree, NF2FS_size_t id, NF2FS_size_t old_space)
+{
+    NF2FS_size_t err= NF2FS_ERR_OK;
+    NF2FS_size_t index= NF2FS_NULL;
+
+    // if not found, return directly
+    if (NF2FS_tree_entry_id_find(tree, id, &index))
+        return err;
+
+    tree->tree_array[index].old_space= old_space;
+    return err;
+}
+
+// keep sectors of a dir in the tree, it's used after the dir is closed
+int NF2FS_tree_entry_sectors(NF2FS_tree_ram_t* tree, NF2FS_size_t id, NF2FS_size_t sectors)
+{
+    NF2FS_size_t err= NF2FS_ERR_OK;
+    NF2FS_size_t index= NF2FS_NULL;
+
+    // if not found, return directly
+    if (NF2FS_tree_entry_id_find(tree, id, &index))
+        return err;
+
+    tree->sectors[index]= sectors;
+    return err;
+}
+
 // remove a tree entry in the tree
 int NF2FS_tree_entry_remove(NF2FS_tree_ram_t* tree, NF2FS_size_t id)
 {
@@ -262,7 +302,7 @@ int NF2FS_father_dir_flash_find(NF2FS_t* NF2FS, char* path, NF2FS_size_t begin_s
 
         // traverse the dir to find the subdir
         err= NF2FS_dtraverse_name(NF2FS, cur_sector, name, namelen,
-                                 NF2FS_DATA_DIR, temp_entry);
+                                 NF2FS_DATA_DIR, temp_entry, NULL);
         if (err)
             return err;
 
@@ -275,6 +315,7 @@ int NF2FS_father_dir_flash_find(NF2FS_t* NF2FS, char* path, NF2FS_size_t begin_s
 
         // init for the next loop.
         cur_sector = temp_entry->tail_sector;
+        name += namelen;
     }
     
     *found_entry= temp_entry;
@@ -35,6 +35,12 @@ int NF2FS_tree_entry_add(NF2FS_tree_ram_t* tree, NF2FS_size_t father_id, NF2FS_s
 // update a tree entry into the tree
 int NF2FS_tree_entry_update(NF2FS_tree_ram_t* tree, NF2FS_size_t id, NF2FS_size_t name_sector, NF2FS_size_t name_off, NF2FS_size_t tail);
 
+// keep old space of a dir in the tree, it's used after the dir is closed
+int NF2FS_tree_entry_ospace(NF2FS_tree_ram_t* tree, NF2FS_size_t id, NF2FS_size_t old_space);
+
+// keep sectors of a dir in the tree, it's used after the dir is closed
+int NF2FS_tree_entry_sectors(NF2FS_tree_ram_t* tree, NF2FS_size_t id, NF2FS_size_t sectors);
+
 // remove a tree entry in the tree
 int NF2FS_tree_entry_remove(NF2FS_tree_ram_t* tree, NF2FS_size_t id);
 
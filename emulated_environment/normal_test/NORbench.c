@@ -13,6 +13,9 @@
 // #include <sys/types.h>
 #include "NF2FS_manage.h"
 
+// the NF2FS instance mounted by the bridge
+extern NF2FS_t NF2FS;
+
 uint32_t random_data[60] = {499888, 8651, 1342281, 55400, 437511, 
                             152389, 1776584,  2051967,  1667859,  569284, 
                             462956, 1263403,  564154,   966241,   514405,
@@ -95,6 +98,32 @@ void raw_read(struct nfvfs *fs, int fd, int size)
   return;
 }
 
+// read data through mmap, and compare with what nfvfs_read gets
+void raw_mmap_read(struct nfvfs *fs, int fd, int off, int size)
+{
+  char test_buffer[size > 4096 ? 4096 : size];
+
+  while (size > 0) {
+    void *addr = NULL;
+    int min = (size > 4096) ? 4096 : size;
+    int ret = nfvfs_mmap(fs, fd, &addr, min, off);
+    if (ret <= 0) {
+      printf("mmap file failed: %d\r\n", ret);
+      assert(-1 > 0);
+    }
+
+    raw_lseek(fs, fd, off);
+    nfvfs_read(fs, fd, test_buffer, ret);
+    if (memcmp(addr, test_buffer, ret) != 0) {
+      printf("mmap data is different from read data\r\n");
+      assert(-1 > 0);
+    }
+    off += ret;
+    size -= ret;
+  }
+  return;
+}
+
 void raw_close(struct nfvfs *fs, int fd)
 {
   int err = nfvfs_close(fs, fd);
@@ -589,6 +618,8 @@ void fs_io_test(const char *fsname)
   int fd= raw_open(fs, path, O_RDWR | O_CREAT, S_ISREG);
   raw_write(fs, fd, size);
   printf("-----------------big file random read test-----------------\r\n\r\n");
+  Cmd_Times_Reset();
+  Busy_Time_Reset();
   int test_size = 20 * 1024;
   while (test_size > 0) {
     int min = (test_size > 1024) ? 1024 : test_size;
@@ -596,6 +627,16 @@ void fs_io_test(const char *fsname)
     raw_read(fs, fd, min);
     test_size -= min;
   }
+  Cmd_Times_Print();
+  Busy_Time_Print();
+
+  printf("-----------------big file mmap read test-----------------\r\n\r\n");
+  test_size = 20 * 1024;
+  while (test_size > 0) {
+    int min = (test_size > 1024) ? 1024 : test_size;
+    raw_mmap_read(fs, fd, random_data[random_index++], min);
+    test_size -= min;
+  }
 
   // test big file random io 
   printf("-----------------big file random write test-----------------\r\n\r\n");
@@ -715,6 +756,170 @@ void wl_test(const char *fsname)
   printf("-----------------wl test end-----------------\r\n\r\n");
 }
 
+// append 4KB to log files and fsync, print the average and worst device time of a single append
+// a full log file is deleted and a new one is created, path is changed for it
+// if until_moved, appends go on until the wl migration of NF2FS is done
+long long append_latency_test(struct nfvfs *fs, char *path, int file_size, int append_times, bool until_moved)
+{
+  int tail = strlen(path);
+  long long total = 0;
+  long long worst = 0;
+  int cnt = 0;
+  int fd = raw_open(fs, path, O_RDWR | O_CREAT, S_ISREG);
+  while (cnt < append_times || (until_moved && NF2FS.manager->wl->move_region != NF2FS_NULL)) {
+    long long begin = Busy_Time_Get();
+    raw_write(fs, fd, 4096);
+    nfvfs_fsync(fs, fd);
+    cnt++;
+    if (cnt % (file_size / 4096) == 0) {
+      raw_delete(fs, fd, path, S_ISREG);
+      path[tail - 1]++;
+      fd = raw_open(fs, path, O_RDWR | O_CREAT, S_ISREG);
+    }
+
+    long long cost = Busy_Time_Get() - begin;
+    total += cost;
+    if (cost > worst)
+      worst = cost;
+  }
+  raw_close(fs, fd);
+
+  printf("%d appends, average device time is %lld us, the worst is %lld us\r\n\r\n",
+         cnt, total / cnt, worst);
+  return worst;
+}
+
+// test the latency of single operations while regions are migrated by wl
+void wl_epoch_test(const char *fsname, int file_size, int loop, int append_times)
+{
+  W25QXX_init();
+
+  // Get and mount file system
+  printf("-----------------wl epoch test begin-----------------\r\n\r\n");
+  struct nfvfs *dst_fs;
+  dst_fs = get_nfvfs(fsname);
+  if (!dst_fs) {
+    printf("\r\nFailed to get %s, making sure you have register it\r\n", fsname);
+    return;
+  }
+  raw_mount(dst_fs);
+
+  // init file path
+  char path[64];
+  memset(path, 0, 64);
+  strcpy(path, "/test1.?");
+  int tail = strlen(path);
+  char my_cnt1 = 'A';
+
+  // static data stays in its regions, so erase times of them fall behind
+  path[tail - 1] = my_cnt1++;
+  int fd = raw_open(dst_fs, path, O_RDWR | O_CREAT, S_ISREG);
+  raw_write(dst_fs, fd, file_size);
+  raw_close(dst_fs, fd);
+
+  // other regions are erased again and again by short-lived files
+  printf("-----------------age flash-----------------\r\n\r\n");
+  for (int i = 0; i < loop; i++) {
+    path[tail - 1] = my_cnt1++;
+    fd = raw_open(dst_fs, path, O_RDWR | O_CREAT, S_ISREG);
+    raw_write(dst_fs, fd, file_size);
+    nfvfs_fsync(dst_fs, fd);
+    raw_delete(dst_fs, fd, path, S_ISREG);
+  }
+
+  printf("-----------------appends before wl-----------------\r\n\r\n");
+  path[tail - 1] = my_cnt1;
+  append_latency_test(dst_fs, path, file_size, append_times, false);
+
+  // start a wl epoch at once, instead of scanning flash NF2FS_WL_START times
+  NF2FS.manager->scan_times = NF2FS_WL_START;
+  int err = NF2FS_wl_region_sort(&NF2FS, NF2FS.manager);
+  if (err < 0) {
+    printf("wl sort error, error is %d\r\n", err);
+    assert(-1 > 0);
+  }
+  printf("-----------------appends in wl epoch-----------------\r\n\r\n");
+  printf("%d pairs of regions to migrate\r\n", NF2FS.manager->wl->plan_num);
+  path[tail - 1]++;
+  append_latency_test(dst_fs, path, file_size, append_times, true);
+
+  raw_unmount(dst_fs);
+  printf("-----------------wl epoch test end-----------------\r\n\r\n");
+}
+
+// ids that can be allocated, i.e. free, removed or leased ids
+static int id_free_count(void)
+{
+  int num = NF2FS_popc(NF2FS.id_map->lease);
+  for (int i = 0; i < NF2FS_ID_MAX / 32; i++) {
+    uint32_t free_word, remove_word;
+    NF2FS_direct_read(&NF2FS, NF2FS.id_map->begin, NF2FS.id_map->off + i * sizeof(uint32_t),
+                      sizeof(uint32_t), &free_word);
+    NF2FS_direct_read(&NF2FS, NF2FS.id_map->begin,
+                      NF2FS.id_map->off + NF2FS_ID_MAX / 8 + i * sizeof(uint32_t),
+                      sizeof(uint32_t), &remove_word);
+    num += NF2FS_popc(free_word | ~remove_word);
+  }
+  return num;
+}
+
+// test that leased ids without names are given back at mount after a crash
+void id_lease_test(const char *fsname, int file_num)
+{
+  W25QXX_init();
+
+  // Get and mount file system
+  printf("-----------------id lease test begin-----------------\r\n\r\n");
+  struct nfvfs *dst_fs;
+  dst_fs = get_nfvfs(fsname);
+  if (!dst_fs) {
+    printf("\r\nFailed to get %s, making sure you have register it\r\n", fsname);
+    return;
+  }
+  raw_mount(dst_fs);
+
+  // init file path
+  char path[64];
+  memset(path, 0, 64);
+  strcpy(path, "/lease0.?");
+  int tail = strlen(path);
+
+  // each round leases a new word of id map, half of the files are deleted
+  for (int round = 0; round < 4; round++) {
+    int before = id_free_count();
+    for (int i = 0; i < file_num; i++) {
+      path[tail - 1] = 'A' + i;
+      int fd = raw_open(dst_fs, path, O_RDWR | O_CREAT, S_ISREG);
+      raw_write(dst_fs, fd, 64);
+      if (i % 2) {
+        raw_delete(dst_fs, fd, path, S_ISREG);
+      } else {
+        raw_close(dst_fs, fd);
+      }
+    }
+    int expect = before - (file_num + 1) / 2;
+
+    // mount needs the commit of unmount, so the crash only loses the lease in ram
+    NF2FS.id_map->lease = 0;
+    NF2FS.id_map->lease_begin = NF2FS_NULL;
+    raw_unmount(dst_fs);
+    raw_mount(dst_fs);
+
+    int after = id_free_count();
+    printf("round %d, free ids %d -> %d, expect %d\r\n", round, before, after, expect);
+    if (after != expect) {
+      printf("leased ids are not given back\r\n");
+      assert(-1 > 0);
+    }
+
+    // keep the names of files unique in next rounds
+    path[tail - 3] = '1' + round;
+  }
+
+  raw_unmount(dst_fs);
+  printf("-----------------id lease test end-----------------\r\n\r\n");
+}
+
 // test the gc performance of NF2FS
 void gc_test(const char *fsname, int sfile_num, int rwrite_times)
 {
@@ -740,6 +945,8 @@ void gc_test(const char *fsname, int sfile_num, int rwrite_times)
 
   // small file gc
   in_place_size_reset();
+  Cmd_Times_Reset();
+  Busy_Time_Reset();
   printf("-----------------dir gc-----------------\r\n\r\n");
   for (int i = 0; i < sfile_num; i++) {
     // create new small files
@@ -765,12 +972,20 @@ void gc_test(const char *fsname, int sfile_num, int rwrite_times)
     }
   }
   in_place_size_print();
+  Cmd_Times_Print();
+  Busy_Time_Print();
 
   // // NEXT
   // assert(-1 > 0);
 
+  // pre-erase old sectors left by dir gc while idle
+  printf("-----------------idle pre-erase-----------------\r\n\r\n");
+  printf("pre-erased sectors: %d\r\n\r\n", nfvfs_gc(dst_fs, 64));
+
   // big file gc begin
   in_place_size_reset();
+  Cmd_Times_Reset();
+  Busy_Time_Reset();
   printf("-----------------big file gc-----------------\r\n\r\n");
   for (int i = 0; i < 1; i++) {
     // create a big file
@@ -795,6 +1010,8 @@ void gc_test(const char *fsname, int sfile_num, int rwrite_times)
     raw_close(dst_fs, fd);
   }
   in_place_size_print();
+  Cmd_Times_Print();
+  Busy_Time_Print();
 
   raw_unmount(dst_fs);
   printf("-----------------gc test end-----------------\r\n\r\n");
@@ -39,6 +39,12 @@ void Busybox_test(const char *fsname);
 // test the lifespan of nor flash
 void wl_test(const char *fsname);
 
+// test the latency of single operations while regions are migrated by wl
+void wl_epoch_test(const char *fsname, int file_size, int loop, int append_times);
+
+// test that leased ids without names are given back at mount after a crash
+void id_lease_test(const char *fsname, int file_num);
+
 // test the gc performance of NF2FS
 void gc_test(const char *fsname, int sfile_num, int rwrite_times);
 
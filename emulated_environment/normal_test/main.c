@@ -30,6 +30,12 @@ void fs_task()
 
 	// 7. Overhead breakdown of the multi-layer I/O stack
 	IO_stack_test("NF2FS", 500, 20);
+
+	// 8. Latency of appends while wl migrates regions
+	wl_epoch_test("NF2FS", 2 * 1024 * 1024, 40, 200);
+
+	// 9. Ids leased before a crash are given back at mount
+	id_lease_test("NF2FS", 20);
 }
 
 extern struct nfvfs_operations lfs_ops;
@@ -167,11 +167,67 @@ int nfvfs_lseek(struct nfvfs *nfvfs, int fd, int offset, int whence)
     return ret;
 }
 
+int nfvfs_mmap(struct nfvfs *nfvfs, int fd, void **addr, int len, int offset)
+{
+    int ret = 0;
+    int fentry = translate_fd_fentry(fd);
+
+    if (fentry < 0 || !ftable[fentry].used || !nfvfs->super.op.mmap)
+        return -1;
+
+    ret = nfvfs->super.op.mmap(addr, len, 0, 0, fentry, offset);
+    if (ret < 0)
+        return ret;
+
+    return ret;
+}
+
 int nfvfs_unlink(struct nfvfs *nfvfs, const char *path)
 {
     return nfvfs->super.op.unlink(path);
 }
 
+int nfvfs_rename(struct nfvfs *nfvfs, const char *oldpath, const char *newpath)
+{
+    if (!nfvfs->super.op.rename)
+        return -1;
+    return nfvfs->super.op.rename(oldpath, newpath);
+}
+
+int nfvfs_stat(struct nfvfs *nfvfs, const char *path, struct nfvfs_stat *buf)
+{
+    if (!nfvfs->super.op.stat)
+        return -1;
+    return nfvfs->super.op.stat(path, buf);
+}
+
+int nfvfs_fstat(struct nfvfs *nfvfs, int fd, struct nfvfs_stat *buf)
+{
+    int fentry = translate_fd_fentry(fd);
+
+    if (fentry < 0 || !ftable[fentry].used || !nfvfs->super.op.fstat)
+        return -1;
+
+    return nfvfs->super.op.fstat(fentry, buf);
+}
+
+int nfvfs_truncate(struct nfvfs *nfvfs, const char *path, int length)
+{
+    if (!nfvfs->super.op.truncate)
+        return -1;
+    return nfvfs->super.op.truncate(path, length);
+}
+
+int nfvfs_ftruncate(struct nfvfs *nfvfs, int fd, int length)
+{
+    int fentry = translate_fd_fentry(fd);
+
+    if (fentry < 0 || !ftable[fentry].used || !nfvfs->super.op.ftruncate)
+        return -1;
+
+    return nfvfs->super.op.ftruncate(fentry, length);
+}
+
 int nfvfs_readdir(struct nfvfs *nfvfs, int fd, struct nfvfs_dentry *buf)
 {
     int fentry = translate_fd_fentry(fd);
@@ -181,9 +237,18 @@ int nfvfs_readdir(struct nfvfs *nfvfs, int fd, struct nfvfs_dentry *buf)
 int nfvfs_list(struct nfvfs *nfvfs, int fd, int (*action)(const char *name, void *data), void *data)
 {
     int fentry = translate_fd_fentry(fd);
+    if (fentry < 0 || !ftable[fentry].used)
+        return -1;
+
+    // names are not copied if the fs lists entries itself
+    if (nfvfs->super.op.list)
+        return nfvfs->super.op.list(fentry, action, data);
+
+    char name[256];
     struct nfvfs_dentry dentry;
     int ret = 0;
-    while (nfvfs_readdir(nfvfs, fentry, &dentry) == 0) {
+    dentry.name = name;
+    while (nfvfs->super.op.readdir(fentry, &dentry) == 0 && dentry.type != NFVFS_TYPE_END) {
         ret = action(dentry.name, data);
         if (ret != 0) {
             break;
@@ -75,6 +75,11 @@ struct nfvfs_dentry {
   char *name;
 };
 
+struct nfvfs_stat {
+  uint8_t type;
+  uint32_t size;
+};
+
 struct nfvfs_context {
   void *in_data;
   void *out_data;
@@ -114,6 +119,7 @@ struct nfvfs_operations {
   int (*ioctl)(int fd, int request, void *argp);
   int (*mmap)(void *addr, int len, int prot, int flags, int fd, int offset);
   int (*gc)(int size);
+  int (*list)(int fd, int (*action)(const char *name, void *data), void *data);
 };
 
 struct nfvfs {
@@ -139,7 +145,13 @@ int nfvfs_close(struct nfvfs *, int fd);
 int nfvfs_read(struct nfvfs *, int fd, void *buf, int size);
 int nfvfs_write(struct nfvfs *, int fd, void *buf, int size);
 int nfvfs_lseek(struct nfvfs *, int fd, int offset, int whence);
+int nfvfs_mmap(struct nfvfs *, int fd, void **addr, int len, int offset);
 int nfvfs_unlink(struct nfvfs *, const char *path);
+int nfvfs_rename(struct nfvfs *, const char *oldpath, const char *newpath);
+int nfvfs_stat(struct nfvfs *, const char *path, struct nfvfs_stat *buf);
+int nfvfs_fstat(struct nfvfs *, int fd, struct nfvfs_stat *buf);
+int nfvfs_truncate(struct nfvfs *, const char *path, int length);
+int nfvfs_ftruncate(struct nfvfs *, int fd, int length);
 int nfvfs_readdir(struct nfvfs *, int fd, struct nfvfs_dentry *buf);
 int nfvfs_list(struct nfvfs *nfvfs, int fd,
                int (*action)(const char *name, void *data), void *data);
@@ -2,12 +2,26 @@
  * Simulatiton module, used to debug the NF2FS.
  */
 
+#define _POSIX_C_SOURCE 199309L
 #include "nor_flash_simulate.h"
 #include <stdio.h>
+#include <time.h>
 
 char *sflash = NULL;
 int erase_times[8192] = {0};
 
+// number of read/prog commands sent to the simulater
+int read_cmds = 0;
+int prog_cmds = 0;
+
+// busy time of the simulater and the time cpu waits for it, in us of the real chip
+long long busy_us = 0;
+long long stall_us = 0;
+
+// end of the running async operation and the last busy poll, in ns of the host
+long long busy_until = 0;
+long long last_poll = -1;
+
 // Init simulater
 int W25QXX_init()
 {
@@ -31,25 +45,57 @@ int W25QXX_free()
     return -1;
 }
 
+// program data to simulater, bits can only turn from 1 to 0
+static void W25QXX_Program(void *buffer, int address, int size)
+{
+    char *data = sflash + address;
+    char *src = (char *)buffer;
+    while (size > 0) {
+        *data &= *src;
+        data++;
+        src++;
+        size--;
+    }
+}
+
+// us the chip is busy for programming size bytes
+static int W25QXX_Prog_Time(int size)
+{
+    return W25Q256_PROG_BASE_US + size * 5 / 2;
+}
+
+// current time of the host in ns
+static long long W25QXX_Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// start an async operation, it ends after us of the real chip
+static void W25QXX_Start(int us)
+{
+    busy_us += us;
+    busy_until = W25QXX_Now() + (long long)us * 1000 / W25Q256_TIME_SCALE;
+    last_poll = -1;
+}
+
 // read data from simulater
 int W25QXX_Read(void *buffer, int address, int size)
 {
     char *data = sflash + address;
     memcpy(buffer, data, size);
+    read_cmds++;
     return 0;
 }
 
 // write data to simulater
 int W25QXX_Write_NoCheck(void *buffer, int address, int size)
 {
-    char *data = sflash + address;
-    char *src = (char *)buffer;
-    while (size > 0) {
-        *data &= *src;
-        data++;
-        src++;
-        size--;
-    }
+    W25QXX_Program(buffer, address, size);
+    prog_cmds++;
+    busy_us += W25QXX_Prog_Time(size);
+    stall_us += W25QXX_Prog_Time(size);
     return 0;
 }
 
@@ -65,9 +111,109 @@ int W25QXX_Erase_Sector(int sector)
 
     char *data = sflash + sector * 4096;
     memset(data, -1, 4096);
+    busy_us += W25Q256_ERASE_US;
+    stall_us += W25Q256_ERASE_US;
+    return 0;
+}
+
+// read segments in one chained transfer, the command is set up only once
+int W25QXX_Read_Chain(W25QXX_seg_t *segs, int num)
+{
+    for (int i = 0; i < num; i++) {
+        memcpy(segs[i].buffer, sflash + segs[i].address, segs[i].size);
+    }
+    read_cmds++;
     return 0;
 }
 
+// write segments in one chained transfer, the command is set up only once
+int W25QXX_Write_Chain(W25QXX_seg_t *segs, int num)
+{
+    for (int i = 0; i < num; i++) {
+        W25QXX_Program(segs[i].buffer, segs[i].address, segs[i].size);
+        busy_us += W25QXX_Prog_Time(segs[i].size);
+        stall_us += W25QXX_Prog_Time(segs[i].size);
+    }
+    prog_cmds++;
+    return 0;
+}
+
+// reset command times
+void Cmd_Times_Reset(void)
+{
+    read_cmds = 0;
+    prog_cmds = 0;
+}
+
+// print command times and their setup cost
+void Cmd_Times_Print(void)
+{
+    printf("The number of read/prog commands is %d/%d, setup cost is %d us\r\n",
+           read_cmds, prog_cmds, (read_cmds + prog_cmds) * W25Q256_CMD_SETUP_US);
+}
+
+// start erasing a sector, data changes at once but the chip stays busy
+int W25QXX_Erase_Sector_Async(int sector)
+{
+    if (sector >= 0 && sector < 8192) {
+        erase_times[sector] += 1;
+    } else {
+        printf("erase sector is wrong!, %d\n", sector);
+        return -1;
+    }
+
+    char *data = sflash + sector * 4096;
+    memset(data, -1, 4096);
+    W25QXX_Start(W25Q256_ERASE_US);
+    return 0;
+}
+
+// start programming, data changes at once but the chip stays busy
+int W25QXX_Write_Async(void *buffer, int address, int size)
+{
+    W25QXX_Program(buffer, address, size);
+    prog_cmds++;
+    W25QXX_Start(W25QXX_Prog_Time(size));
+    return 0;
+}
+
+// return 1 if an async operation is running
+// time between busy polls is taken as waiting, so the stall is an upper bound
+int W25QXX_Busy(void)
+{
+    long long now = W25QXX_Now();
+    if (now < busy_until) {
+        if (last_poll >= 0)
+            stall_us += (now - last_poll) * W25Q256_TIME_SCALE / 1000;
+        last_poll = now;
+        return 1;
+    }
+
+    if (last_poll >= 0 && last_poll < busy_until)
+        stall_us += (busy_until - last_poll) * W25Q256_TIME_SCALE / 1000;
+    last_poll = -1;
+    return 0;
+}
+
+// reset busy and stall time
+void Busy_Time_Reset(void)
+{
+    busy_us = 0;
+    stall_us = 0;
+}
+
+// busy time of the chip since the last reset
+long long Busy_Time_Get(void)
+{
+    return busy_us;
+}
+
+// print busy time of the chip and the time cpu waits for it
+void Busy_Time_Print(void)
+{
+    printf("The device is busy for %lld us, cpu waits %lld us\r\n", busy_us, stall_us);
+}
+
 // reset erase times
 void Erase_Times_Reset(void)
 {
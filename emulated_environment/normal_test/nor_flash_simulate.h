@@ -23,6 +23,24 @@ extern "C" {
 #define W25Q256_ERASE_GRAN 4096
 #define W25Q256_NUM_GRAN 8192
 
+// fixed setup cost of a QSPI command in us
+#define W25Q256_CMD_SETUP_US 1
+
+// typical busy time of sector erase and program in us
+#define W25Q256_ERASE_US 45000
+#define W25Q256_PROG_BASE_US 30
+
+// the simulated chip runs faster than the real one, so async tests do not take too long
+#define W25Q256_TIME_SCALE 100
+
+// one segment of a chained transfer
+typedef struct W25QXX_seg
+{
+    void *buffer;
+    int address;
+    int size;
+} W25QXX_seg_t;
+
 /**
  * -----------------------------------------------------------------------------------------------------------------------------------------------
  * -----------------------------------------------------------    Initialize function    ---------------------------------------------------------
@@ -45,6 +63,26 @@ int W25QXX_Write_NoCheck(void* buffer, int address, int size);
 
 int W25QXX_Erase_Sector(int sector);
 
+int W25QXX_Read_Chain(W25QXX_seg_t *segs, int num);
+
+int W25QXX_Write_Chain(W25QXX_seg_t *segs, int num);
+
+void Cmd_Times_Reset(void);
+
+void Cmd_Times_Print(void);
+
+int W25QXX_Erase_Sector_Async(int sector);
+
+int W25QXX_Write_Async(void *buffer, int address, int size);
+
+int W25QXX_Busy(void);
+
+void Busy_Time_Reset(void);
+
+void Busy_Time_Print(void);
+
+long long Busy_Time_Get(void);
+
 void Erase_Times_Reset(void);
 
 void Erase_Times_Print(char* name);